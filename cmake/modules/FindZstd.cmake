@@ -0,0 +1,24 @@
+# Find the Zstd headers and libraries
+#
+#  ZSTD_INCLUDE_DIRS - The Zstd include directory (directory where zstd.h was found)
+#  ZSTD_LIBRARIES    - The libraries needed to use Zstd
+#  ZSTD_FOUND        - True if Zstd found in system
+ 
+ 
+FIND_PATH(ZSTD_INCLUDE_DIR NAMES zstd.h)
+ 
+FIND_LIBRARY(ZSTD_LIBRARY NAMES 
+    zstd
+    libzstd
+)
+
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(Zstd DEFAULT_MSG ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+ 
+IF(ZSTD_FOUND)
+  SET(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+  SET(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+ENDIF(ZSTD_FOUND)
+
+MARK_AS_ADVANCED(CLEAR ZSTD_INCLUDE_DIR)
+MARK_AS_ADVANCED(CLEAR ZSTD_LIBRARY)
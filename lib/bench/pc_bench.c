@@ -0,0 +1,600 @@
+/***********************************************************************
+* pc_bench.c
+*
+*  Micro-benchmarks of the codecs and patch operations of libpc, run
+*  on patches generated for the schemas of lib/cunit/data, and of
+*  sigbits decoding for each word size and count of unique bits. Each
+*  case prints one JSON line of its latency and throughput, so runs of
+*  two builds can be compared.
+*
+*    pc_bench [-n npoints,...] [-t seconds] [-d datadir] [schema.xml ...]
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*
+***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h> /* for strcasecmp */
+#include <math.h>
+#include <time.h>
+#include "pc_api_internal.h"
+
+#ifndef PROJECT_SOURCE_DIR
+#define PROJECT_SOURCE_DIR "."
+#endif
+
+#define BENCH_MAX_REPS 100000
+#define BENCH_MAX_SIZES 16
+#define BENCH_PIECES 16
+
+/* What one case of a run works on, and what its last call produced */
+typedef struct
+{
+	PCSCHEMA *schema;
+	PCPATCH_UNCOMPRESSED *pu;
+	PCPATCH_DIMENSIONAL *pdl;     /* Dimensions of pu, not encoded */
+	PCPATCH *pa;                  /* Input patch of the case */
+	PCPATCH *pieces[BENCH_PIECES];
+	PCBYTES *ebytes;              /* Dimensions of pu encoded with codec */
+	PCBYTES words;                /* Sigbits encoded words, for the word cases */
+	int codec;
+	uint32_t npoints;             /* Points of one call */
+	uint8_t *wkb;
+	size_t wkbsize;
+	size_t piecessize;            /* WKB bytes of the pieces */
+	/* Output of the last call, freed out of the timed section */
+	PCPATCH *out;
+	PCBYTES *obytes;
+	uint8_t *owkb;
+	/* Bytes read and written by one call */
+	size_t bytesin;
+	size_t bytesout;
+} BENCHCASE;
+
+typedef void (*bench_fn)(BENCHCASE *bc);
+
+static double bench_mintime = 0.2;
+static uint64_t bench_reps[BENCH_MAX_REPS];
+
+static uint64_t
+bench_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + ts.tv_nsec;
+}
+
+static void
+bench_free_output(BENCHCASE *bc)
+{
+	/* One dimension for the word cases, which have no schema */
+	uint32_t i, ndims = bc->schema ? bc->schema->ndims : 1;
+
+	if ( bc->out && bc->out != bc->pa && bc->out != (PCPATCH*)bc->pu )
+		pc_patch_free(bc->out);
+	bc->out = NULL;
+
+	if ( bc->obytes )
+	{
+		for ( i = 0; i < ndims; i++ )
+			pc_bytes_free(bc->obytes[i]);
+		pcfree(bc->obytes);
+		bc->obytes = NULL;
+	}
+
+	if ( bc->owkb )
+		pcfree(bc->owkb);
+	bc->owkb = NULL;
+}
+
+static int
+bench_cmp(const void *a, const void *b)
+{
+	uint64_t ua = *(const uint64_t*)a, ub = *(const uint64_t*)b;
+	return ua < ub ? -1 : ua > ub;
+}
+
+/**
+* Call fn until bench_mintime has passed and at least five times,
+* after one call to warm up, and print the spread of the call times.
+*/
+static void
+bench_run(const char *schemaname, const char *op, const char *variant, BENCHCASE *bc, bench_fn fn)
+{
+	uint64_t start, t, total = 0;
+	uint32_t npoints = bc->npoints;
+	double median;
+	int n = 0;
+
+	fn(bc);
+	bench_free_output(bc);
+
+	start = bench_clock();
+	while ( n < BENCH_MAX_REPS && ( n < 5 || bench_clock() - start < bench_mintime * 1e9 ) )
+	{
+		t = bench_clock();
+		fn(bc);
+		t = bench_clock() - t;
+		bench_free_output(bc);
+		bench_reps[n++] = t;
+		total += t;
+	}
+
+	qsort(bench_reps, n, sizeof(uint64_t), bench_cmp);
+	median = n % 2 ? bench_reps[n / 2] : ( bench_reps[n / 2 - 1] + bench_reps[n / 2] ) / 2.0;
+
+	printf("{\"schema\":\"%s\",\"op\":\"%s\",\"variant\":\"%s\",\"npoints\":%u,\"reps\":%d,"
+	       "\"min_ns\":%llu,\"median_ns\":%.0f,\"mean_ns\":%.0f,\"max_ns\":%llu,"
+	       "\"points_per_s\":%.0f,\"bytes_in\":%zu,\"bytes_out\":%zu,\"mb_per_s\":%.2f,"
+	       "\"out_mb_per_s\":%.2f}\n",
+	       schemaname, op, variant, npoints, n,
+	       (unsigned long long)bench_reps[0], median, (double)total / n,
+	       (unsigned long long)bench_reps[n - 1],
+	       npoints / (median / 1e9), bc->bytesin, bc->bytesout,
+	       bc->bytesin / (median / 1e9) / (1024 * 1024),
+	       bc->bytesout / (median / 1e9) / (1024 * 1024));
+	fflush(stdout);
+}
+
+/* BENCHMARKED CALLS **************************************************/
+
+static void
+bench_bytes_encode(BENCHCASE *bc)
+{
+	uint32_t i;
+	bc->obytes = pcalloc(bc->schema->ndims * sizeof(PCBYTES));
+	bc->bytesin = bc->bytesout = 0;
+	for ( i = 0; i < bc->schema->ndims; i++ )
+	{
+		bc->obytes[i] = pc_bytes_encode(bc->pdl->bytes[i], bc->codec);
+		bc->bytesin += bc->pdl->bytes[i].size;
+		bc->bytesout += bc->obytes[i].size;
+	}
+}
+
+static void
+bench_bytes_decode(BENCHCASE *bc)
+{
+	uint32_t i;
+	bc->obytes = pcalloc(bc->schema->ndims * sizeof(PCBYTES));
+	bc->bytesin = bc->bytesout = 0;
+	for ( i = 0; i < bc->schema->ndims; i++ )
+	{
+		bc->obytes[i] = pc_bytes_decode(bc->ebytes[i]);
+		bc->bytesin += bc->ebytes[i].size;
+		bc->bytesout += bc->obytes[i].size;
+	}
+}
+
+static void
+bench_sigbits_decode(BENCHCASE *bc)
+{
+	bc->obytes = pcalloc(sizeof(PCBYTES));
+	bc->obytes[0] = pc_bytes_sigbits_decode(bc->words);
+	bc->bytesin = bc->words.size;
+	bc->bytesout = bc->obytes[0].size;
+}
+
+static void
+bench_patch_compress(BENCHCASE *bc)
+{
+	bc->out = pc_patch_compress((PCPATCH*)bc->pu, NULL);
+	bc->bytesin = bc->pu->datasize;
+	bc->bytesout = bc->wkbsize;
+}
+
+static void
+bench_patch_uncompress(BENCHCASE *bc)
+{
+	bc->out = pc_patch_uncompress(bc->pa);
+	bc->bytesin = bc->wkbsize;
+	bc->bytesout = bc->pu->datasize;
+}
+
+static void
+bench_patch_filter(BENCHCASE *bc)
+{
+	const PCSTATS *stats = bc->pa->stats;
+	uint32_t z = bc->schema->zdim->position;
+	double zmin, zmax;
+
+	pc_point_get_double(&(stats->min), bc->schema->zdim, &zmin);
+	pc_point_get_double(&(stats->max), bc->schema->zdim, &zmax);
+	/* The lower half of the heights */
+	bc->out = pc_patch_filter(bc->pa, z, PC_BETWEEN, zmin - 1, (zmin + zmax) / 2);
+	bc->bytesin = bc->pu->datasize;
+	bc->bytesout = bc->out ? bc->out->npoints * bc->schema->size : 0;
+}
+
+static void
+bench_patch_sort_z(BENCHCASE *bc)
+{
+	const char *name[] = { bc->schema->zdim->name };
+	bc->out = pc_patch_sort(bc->pa, name, 1);
+	bc->bytesin = bc->bytesout = bc->pu->datasize;
+}
+
+static void
+bench_patch_sort_hilbert(BENCHCASE *bc)
+{
+	const char *name[] = { "hilbert" };
+	bc->out = pc_patch_sort(bc->pa, name, 1);
+	bc->bytesin = bc->bytesout = bc->pu->datasize;
+}
+
+static void
+bench_patch_from_patchlist(BENCHCASE *bc)
+{
+	bc->out = pc_patch_from_patchlist(bc->pieces, BENCH_PIECES);
+	bc->bytesin = bc->piecessize;
+	bc->bytesout = bc->pu->datasize;
+}
+
+static void
+bench_wkb_out(BENCHCASE *bc)
+{
+	bc->owkb = pc_patch_to_wkb(bc->pa, &(bc->bytesout));
+	bc->bytesin = bc->wkbsize;
+}
+
+static void
+bench_wkb_in(BENCHCASE *bc)
+{
+	bc->out = pc_patch_from_wkb(bc->schema, bc->wkb, bc->wkbsize);
+	bc->bytesin = bc->bytesout = bc->wkbsize;
+}
+
+/* DATA ***************************************************************/
+
+/* Deterministic noise in [0, 1) */
+static double
+bench_noise(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	z ^= z >> 31;
+	return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+* Words of the interpretation sharing all but their nbits lowest bits,
+* which are noise, as sigbits finds them in a dimension.
+*/
+static PCBYTES
+bench_words_make(uint32_t interpretation, uint32_t npoints, int nbits)
+{
+	PCBYTES pcb;
+	size_t size = pc_interpretation_size(interpretation);
+	uint64_t common = UINT64_C(0xA5A5A5A5A5A5A5A5);
+	uint64_t mask = nbits >= 64 ? ~UINT64_C(0) : ( UINT64_C(1) << nbits ) - 1;
+	uint64_t state = npoints;
+	uint32_t i;
+
+	pcb.size = size * npoints;
+	pcb.bytes = pcalloc(pcb.size);
+	pcb.npoints = npoints;
+	pcb.interpretation = interpretation;
+	pcb.compression = PC_DIM_NONE;
+	pcb.readonly = PC_FALSE;
+	pcb.indexsize = 0;
+	for ( i = 0; i < npoints; i++ )
+	{
+		uint64_t noise = (uint64_t)(bench_noise(&state) * 4294967296.0) << 32 |
+		                 (uint64_t)(bench_noise(&state) * 4294967296.0);
+		uint64_t val = ( common & ~mask ) | ( noise & mask );
+		/* The low bytes of the value, on little and big endian alike */
+		uint8_t v8 = val;
+		uint16_t v16 = val;
+		uint32_t v32 = val;
+		const void *ptr = size == 1 ? (void*)&v8 : size == 2 ? (void*)&v16 : size == 4 ? (void*)&v32 : (void*)&val;
+		memcpy(pcb.bytes + i * size, ptr, size);
+	}
+	return pcb;
+}
+
+/**
+* Points of an airborne scan: lines of 500 points of X and Y walking
+* across the terrain, Z over rolling hills, a rising time, intensity
+* and colours with some noise, and small attributes in runs.
+*/
+static PCPATCH_UNCOMPRESSED *
+bench_patch_make(const PCSCHEMA *schema, uint32_t npoints)
+{
+	PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_make(schema, npoints);
+	uint64_t state = npoints;
+	PCPOINT pt;
+	uint32_t i, j;
+
+	pt.schema = schema;
+	pt.readonly = PC_TRUE;
+	for ( i = 0; i < npoints; i++ )
+	{
+		/* In metres, from the south west corner */
+		double x = (i % 500) * 0.5 + bench_noise(&state) * 0.2;
+		double y = (i / 500) * 0.7 + bench_noise(&state) * 0.2;
+		double z = 100 + 10 * sin(x / 50) + 5 * cos(y / 30) + bench_noise(&state) * 0.3;
+
+		pt.data = pu->data + (size_t)i * schema->size;
+		for ( j = 0; j < schema->ndims; j++ )
+		{
+			const PCDIMENSION *dim = schema->dims[j];
+			double val;
+
+			/* A metre is a hundred steps of the coordinate, whatever its scale */
+			if ( dim == schema->xdim )
+				val = dim->offset + (1000 + x) * dim->scale * 100;
+			else if ( dim == schema->ydim )
+				val = dim->offset + (2000 + y) * dim->scale * 100;
+			else if ( dim == schema->zdim )
+				val = z;
+			else if ( ! strcasecmp(dim->name, "time") || ! strcasecmp(dim->name, "gpstime") )
+				val = 100000 + i * 0.00001;
+			else if ( ! strcasecmp(dim->name, "intensity") )
+				val = 200 + (int)(bench_noise(&state) * 300);
+			else if ( ! strcasecmp(dim->name, "red") || ! strcasecmp(dim->name, "green") || ! strcasecmp(dim->name, "blue") )
+				val = 128 * 256 + (int)(z * 100) % 4096;
+			else if ( ! strcasecmp(dim->name, "pointid") )
+				val = i;
+			else
+				val = (i >> (6 + j % 4)) % 4;
+
+			pc_point_set_double(&pt, dim, val);
+		}
+	}
+	pu->npoints = npoints;
+	pc_patch_uncompressed_compute_extent(pu);
+	pc_patch_uncompressed_compute_stats(pu);
+	return pu;
+}
+
+static char *
+bench_read_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	char *str;
+	long sz;
+
+	if ( ! f )
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	sz = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	str = pcalloc(sz + 1);
+	if ( fread(str, 1, sz, f) != (size_t)sz )
+	{
+		pcfree(str);
+		str = NULL;
+	}
+	fclose(f);
+	return str;
+}
+
+/* CASES **************************************************************/
+
+static void
+bench_patch_cases(const char *name, BENCHCASE *bc)
+{
+	static const int compressions[] = { PC_NONE, PC_DIMENSIONAL,
+#ifdef HAVE_LAZPERF
+	                                    PC_LAZPERF,
+#endif
+#ifdef HAVE_LIBGHT
+	                                    PC_GHT,
+#endif
+	                                  };
+	uint32_t ncomp = sizeof(compressions) / sizeof(int);
+	uint32_t c, i, k;
+
+	for ( c = 0; c < ncomp; c++ )
+	{
+		const char *cname = pc_compression_name(compressions[c]);
+		uint32_t npoints = bc->pu->npoints;
+
+		bc->schema->compression = compressions[c];
+		bc->pa = pc_patch_compress((PCPATCH*)bc->pu, NULL);
+		bc->wkb = pc_patch_to_wkb(bc->pa, &(bc->wkbsize));
+
+		/* Uncompressed patches are their own compression */
+		if ( compressions[c] != PC_NONE )
+		{
+			bench_run(name, "patch_compress", cname, bc, bench_patch_compress);
+			bench_run(name, "patch_uncompress", cname, bc, bench_patch_uncompress);
+		}
+		bench_run(name, "wkb_out", cname, bc, bench_wkb_out);
+		bench_run(name, "wkb_in", cname, bc, bench_wkb_in);
+		bench_run(name, "patch_filter", cname, bc, bench_patch_filter);
+		bench_run(name, "patch_sort_z", cname, bc, bench_patch_sort_z);
+		bench_run(name, "patch_sort_hilbert", cname, bc, bench_patch_sort_hilbert);
+
+		/* The patch in pieces, to be put back together */
+		bc->piecessize = 0;
+		for ( i = 0, k = 0; i < BENCH_PIECES; i++ )
+		{
+			uint32_t n = npoints / BENCH_PIECES + ( i < npoints % BENCH_PIECES );
+			PCPATCH *range = pc_patch_range((PCPATCH*)bc->pu, k + 1, n);
+			size_t wkbsize;
+			bc->pieces[i] = pc_patch_compress(range, NULL);
+			if ( bc->pieces[i] != range && range != (PCPATCH*)bc->pu )
+				pc_patch_free(range);
+			pcfree(pc_patch_to_wkb(bc->pieces[i], &wkbsize));
+			bc->piecessize += wkbsize;
+			k += n;
+		}
+		bench_run(name, "patch_from_patchlist", cname, bc, bench_patch_from_patchlist);
+		for ( i = 0; i < BENCH_PIECES; i++ )
+		{
+			if ( bc->pieces[i] != (PCPATCH*)bc->pu )
+				pc_patch_free(bc->pieces[i]);
+			bc->pieces[i] = NULL;
+		}
+
+		pcfree(bc->wkb);
+		bc->wkb = NULL;
+		if ( bc->pa != (PCPATCH*)bc->pu )
+			pc_patch_free(bc->pa);
+		bc->pa = NULL;
+	}
+	bc->schema->compression = PC_NONE;
+}
+
+/**
+* Sigbits decoding of 8, 16, 32 and 64 bit words, with one unique bit,
+* a quarter, half and all but one of them unique.
+*/
+static void
+bench_sigbits(const uint32_t *sizes, int nsizes)
+{
+	static const uint32_t interps[] = { PC_UINT8, PC_UINT16, PC_UINT32, PC_UINT64 };
+	BENCHCASE bc;
+	int s, i, k;
+
+	memset(&bc, 0, sizeof(bc));
+	for ( s = 0; s < nsizes; s++ )
+	{
+		bc.npoints = sizes[s];
+		for ( i = 0; i < 4; i++ )
+		{
+			int width = 8 * pc_interpretation_size(interps[i]);
+			int nbits[] = { 1, width / 4, width / 2, width - 1 };
+			for ( k = 0; k < 4; k++ )
+			{
+				PCBYTES pcb = bench_words_make(interps[i], sizes[s], nbits[k]);
+				char variant[32];
+
+				bc.words = pc_bytes_sigbits_encode(pcb);
+				snprintf(variant, sizeof(variant), "uint%d_%dbits", width, nbits[k]);
+				bench_run("words", "sigbits_decode", variant, &bc, bench_sigbits_decode);
+				pc_bytes_free(bc.words);
+				pc_bytes_free(pcb);
+			}
+		}
+	}
+}
+
+static void
+bench_schema(const char *path, const char *name, const uint32_t *sizes, int nsizes)
+{
+	char *xml = bench_read_file(path);
+	BENCHCASE bc;
+	int s, c;
+	uint32_t i;
+
+	if ( ! xml )
+	{
+		fprintf(stderr, "pc_bench: cannot read %s\n", path);
+		exit(1);
+	}
+
+	memset(&bc, 0, sizeof(bc));
+	bc.schema = pc_schema_from_xml(xml);
+	pcfree(xml);
+	if ( ! bc.schema || ! ( bc.schema->xdim && bc.schema->ydim && bc.schema->zdim ) )
+	{
+		fprintf(stderr, "pc_bench: %s has no X, Y and Z dimensions\n", path);
+		exit(1);
+	}
+	/* The points are generated in scan order */
+	bc.schema->spatialsort = PC_CURVE_NONE;
+
+	for ( s = 0; s < nsizes; s++ )
+	{
+		bc.pu = bench_patch_make(bc.schema, sizes[s]);
+		bc.npoints = sizes[s];
+		bc.pdl = pc_patch_dimensional_from_uncompressed(bc.pu);
+
+		for ( c = 0; c < PC_DIM_NUM_COMPRESSIONS; c++ )
+		{
+			if ( ! pc_bytes_compression_available(c) )
+				continue;
+			bc.codec = c;
+			bench_run(name, "bytes_encode", pc_dim_compression_name(c), &bc, bench_bytes_encode);
+
+			bc.ebytes = pcalloc(bc.schema->ndims * sizeof(PCBYTES));
+			for ( i = 0; i < bc.schema->ndims; i++ )
+				bc.ebytes[i] = pc_bytes_encode(bc.pdl->bytes[i], c);
+			bench_run(name, "bytes_decode", pc_dim_compression_name(c), &bc, bench_bytes_decode);
+			for ( i = 0; i < bc.schema->ndims; i++ )
+				pc_bytes_free(bc.ebytes[i]);
+			pcfree(bc.ebytes);
+			bc.ebytes = NULL;
+		}
+
+		bench_patch_cases(name, &bc);
+
+		pc_patch_free((PCPATCH*)bc.pdl);
+		pc_patch_free((PCPATCH*)bc.pu);
+	}
+
+	pc_schema_free(bc.schema);
+}
+
+static void
+bench_usage(void)
+{
+	fprintf(stderr, "usage: pc_bench [-n npoints,...] [-t seconds] [-d datadir] [schema.xml ...]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *datadir = PROJECT_SOURCE_DIR "/lib/cunit/data";
+	static const char *defschemas[] = { "simple-schema.xml", "las-schema.xml" };
+	uint32_t sizes[BENCH_MAX_SIZES] = { 1000, 10000, 100000 };
+	int nsizes = 3;
+	int i;
+
+	for ( i = 1; i < argc && argv[i][0] == '-'; i++ )
+	{
+		if ( i + 1 >= argc )
+			bench_usage();
+		if ( ! strcmp(argv[i], "-n") )
+		{
+			char *tok, *str = argv[++i];
+			nsizes = 0;
+			for ( tok = strtok(str, ","); tok && nsizes < BENCH_MAX_SIZES; tok = strtok(NULL, ",") )
+			{
+				long n = atol(tok);
+				if ( n <= 0 )
+					bench_usage();
+				sizes[nsizes++] = n;
+			}
+		}
+		else if ( ! strcmp(argv[i], "-t") )
+			bench_mintime = atof(argv[++i]);
+		else if ( ! strcmp(argv[i], "-d") )
+			datadir = argv[++i];
+		else
+			bench_usage();
+	}
+
+	pc_install_default_handlers();
+
+	if ( i == argc )
+	{
+		for ( i = 0; i < 2; i++ )
+		{
+			char path[1024];
+			snprintf(path, sizeof(path), "%s/%s", datadir, defschemas[i]);
+			bench_schema(path, defschemas[i], sizes, nsizes);
+		}
+		bench_sigbits(sizes, nsizes);
+		return 0;
+	}
+
+	for ( ; i < argc; i++ )
+	{
+		char path[1024];
+		const char *base = strrchr(argv[i], '/');
+		if ( strchr(argv[i], '/') )
+			snprintf(path, sizeof(path), "%s", argv[i]);
+		else
+			snprintf(path, sizeof(path), "%s/%s", datadir, argv[i]);
+		bench_schema(path, base ? base + 1 : argv[i], sizes, nsizes);
+	}
+	return 0;
+}
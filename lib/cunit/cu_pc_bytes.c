@@ -7,6 +7,8 @@
 *
 ***********************************************************************/
 
+#include <float.h>
+#include <math.h>
 #include "CUnit/Basic.h"
 #include "cu_tester.h"
 
@@ -47,6 +49,7 @@ static PCBYTES initbytes(uint8_t *bytes, size_t size, uint32_t interp)
 	pcb.npoints = pcb.size / pc_interpretation_size(pcb.interpretation);
 	pcb.compression = PC_DIM_NONE;
 	pcb.readonly = PC_TRUE;
+	pcb.indexsize = 0;
 	return pcb;
 }
 
@@ -388,7 +391,7 @@ test_zlib_encoding()
 	*/
 	bytes = (uint8_t *)"abcaabcaabcbabcc";
 	pcb = initbytes(bytes, strlen((char *)bytes), PC_INT8);
-	epcb = pc_bytes_zlib_encode(pcb);
+	epcb = pc_bytes_zlib_encode(pcb, PC_FALSE);
 	pcb2 = pc_bytes_zlib_decode(epcb);
 
 	CU_ASSERT_EQUAL(pcb.compression, PC_DIM_NONE);
@@ -425,9 +428,9 @@ test_rle_filter()
 	epcb = pc_bytes_run_length_encode(pcb);
 	CU_ASSERT_EQUAL(epcb.bytes[0], 4);
 
-	map1 = pc_bytes_bitmap(&epcb, PC_GT, 'b', 'b');
+	map1 = pc_bytes_bitmap(&epcb, PC_GT, 'b', 'b', NULL);
 	CU_ASSERT_EQUAL(map1->nset, 4);
-	map2 = pc_bytes_bitmap(&epcb, PC_GT, 'a', 'a');
+	map2 = pc_bytes_bitmap(&epcb, PC_GT, 'a', 'a', NULL);
 	CU_ASSERT_EQUAL(map2->nset, 8);
 
 	fpcb = pc_bytes_filter(&epcb, map1, NULL);
@@ -454,7 +457,7 @@ test_rle_filter()
 	bytes = (char *)((uint32_t[]){ 10, 10, 10, 20, 20, 30, 20, 20 });
 	pcb = initbytes((uint8_t *)bytes, 8*4, PC_UINT32);
 	epcb = pc_bytes_run_length_encode(pcb);
-	map1 = pc_bytes_bitmap(&epcb, PC_LT, 25, 25); /* strip out the 30 */
+	map1 = pc_bytes_bitmap(&epcb, PC_LT, 25, 25, NULL); /* strip out the 30 */
 	CU_ASSERT_EQUAL(map1->nset, 7);
 	fpcb = pc_bytes_filter(&epcb, map1, NULL);
 	CU_ASSERT_EQUAL(fpcb.size, 15); /* three runs (2x10, 2x20, 2x20), of 5 bytes eachh */
@@ -465,7 +468,7 @@ test_rle_filter()
 
 	bytes = (char *)((uint16_t[]){ 1, 2, 3, 4, 5, 6, 7, 8 });
 	pcb = initbytes((uint8_t *)bytes, 8*2, PC_UINT16);
-	map1 = pc_bytes_bitmap(&pcb, PC_BETWEEN, 2.5, 4.5); /* everything except entries 3 and 4 */
+	map1 = pc_bytes_bitmap(&pcb, PC_BETWEEN, 2.5, 4.5, NULL); /* everything except entries 3 and 4 */
 	CU_ASSERT_EQUAL(map1->nset, 2);
 	fpcb = pc_bytes_filter(&epcb, map1, NULL); /* Should have only two entry, 10, 20 */
 	CU_ASSERT_EQUAL(fpcb.size, 10); /* two runs (1x10, 1x20), of 5 bytes eachh */
@@ -508,7 +511,7 @@ test_uncompressed_filter()
 	CU_ASSERT_EQUAL(pcb.bytes[0], 'a');
 	CU_ASSERT_EQUAL(pcb.npoints, 12);
 
-	map1 = pc_bytes_bitmap(&pcb, PC_GT, 'b', 'b');
+	map1 = pc_bytes_bitmap(&pcb, PC_GT, 'b', 'b', NULL);
 	CU_ASSERT_EQUAL(map1->nset, 4);
 
 	fpcb = pc_bytes_filter(&pcb, map1, NULL);
@@ -520,7 +523,720 @@ test_uncompressed_filter()
 //    pc_bytes_free(epcb);
 
 }
+static void
+test_bitmap_ops()
+{
+	PCBITMAP *map1, *map2;
+	uint32_t i, n;
+
+	/* Ranges across word boundaries, with a partial last word */
+	map1 = pc_bitmap_new(150);
+	pc_bitmap_set_range(map1, 60, 10);
+	pc_bitmap_set_range(map1, 64, 70);
+	CU_ASSERT_EQUAL(map1->nset, 74);
+	CU_ASSERT_EQUAL(pc_bitmap_get(map1, 59), 0);
+	CU_ASSERT_EQUAL(pc_bitmap_get(map1, 60), 1);
+	CU_ASSERT_EQUAL(pc_bitmap_get(map1, 133), 1);
+	CU_ASSERT_EQUAL(pc_bitmap_get(map1, 134), 0);
+	CU_ASSERT_EQUAL(pc_bitmap_count_range(map1, 0, 64), 4);
+	CU_ASSERT_EQUAL(pc_bitmap_count_range(map1, 100, 50), 34);
+	CU_ASSERT_EQUAL(pc_bitmap_count_range(map1, 0, 150), 74);
+
+	/* Inversion keeps the bits past npoints clear */
+	pc_bitmap_not(map1);
+	CU_ASSERT_EQUAL(map1->nset, 76);
+	CU_ASSERT_EQUAL(map1->map[2] >> (150 - 128), 0);
+	pc_bitmap_update_nset(map1);
+	CU_ASSERT_EQUAL(map1->nset, 76);
+
+	map2 = pc_bitmap_new(150);
+	pc_bitmap_set_range(map2, 0, 100);
+	pc_bitmap_and(map2, map1);
+	CU_ASSERT_EQUAL(map2->nset, 60);
+	pc_bitmap_set_range(map2, 140, 10);
+	pc_bitmap_or(map2, map1);
+	CU_ASSERT_EQUAL(map2->nset, 76);
+
+	/* Iterating over the set bits visits them in order */
+	n = 0;
+	for ( i = 0; i < PC_BITMAP_NWORDS(map2->npoints); i++ )
+	{
+		uint64_t bits = map2->map[i];
+		while ( bits )
+		{
+			uint32_t j = i * 64 + pc_bitmap_ctz(bits);
+			CU_ASSERT(j < 60 || j >= 134);
+			bits &= bits - 1;
+			n++;
+		}
+	}
+	CU_ASSERT_EQUAL(n, 76);
+
+	pc_bitmap_free(map1);
+	pc_bitmap_free(map2);
+}
+
+/*
+* The range kernels must agree with a plain comparison
+* for every interpretation, filter and layout.
+*/
+static void
+test_bitmap_filter_values()
+{
+	uint32_t interps[] = { PC_UINT8, PC_UINT16, PC_UINT32, PC_UINT64, PC_INT8, PC_INT16, PC_INT32, PC_INT64, PC_FLOAT, PC_DOUBLE };
+	PC_FILTERTYPE filters[] = { PC_GT, PC_LT, PC_EQUAL, PC_BETWEEN };
+	double vals[][2] = { {10, 50}, {-3.5, 7}, {0, 0}, {99, 1e30}, {-INFINITY, INFINITY}, {INFINITY, INFINITY} };
+	uint32_t npoints = 201, stride = 12, i, k, f, v;
+	double scale = 0.5, offset = -20;
+	uint8_t *bytes = pcalloc(npoints * stride);
+
+	for ( k = 0; k < sizeof(interps)/sizeof(uint32_t); k++ )
+	{
+		uint32_t interp = interps[k];
+		size_t sz = pc_interpretation_size(interp);
+		int s;
+
+		for ( i = 0; i < npoints; i++ )
+			pc_double_to_ptr(bytes + i * stride, interp, (double)((i * 37) % 101));
+
+		/* Once packed, once strided and scaled like a point */
+		for ( s = 0; s < 2; s++ )
+		{
+			size_t st = s ? stride : sz;
+			double sc = s ? scale : 1;
+			double of = s ? offset : 0;
+
+			if ( ! s )
+				for ( i = 0; i < npoints; i++ )
+					memmove(bytes + i * sz, bytes + i * stride, sz);
+
+			for ( f = 0; f < 4; f++ )
+			{
+				for ( v = 0; v < sizeof(vals)/sizeof(vals[0]); v++ )
+				{
+					PCBITMAP *map = pc_bitmap_new(npoints);
+					uint32_t nset = 0, nbad = 0;
+					pc_bitmap_filter_values(map, filters[f], vals[v][0], vals[v][1], bytes, st, interp, sc, of);
+					for ( i = 0; i < npoints; i++ )
+					{
+						double d = pc_double_from_ptr(bytes + i * st, interp) * sc + of;
+						int pass = 0;
+						switch ( filters[f] )
+						{
+						case PC_GT: pass = d > vals[v][0]; break;
+						case PC_LT: pass = d < vals[v][0]; break;
+						case PC_EQUAL: pass = d == vals[v][0]; break;
+						case PC_BETWEEN: pass = d > vals[v][0] && d < vals[v][1]; break;
+						}
+						nset += pass;
+						nbad += ( pass != pc_bitmap_get(map, i) );
+					}
+					CU_ASSERT_EQUAL(nbad, 0);
+					CU_ASSERT_EQUAL(map->nset, nset);
+					pc_bitmap_free(map);
+				}
+			}
+
+			/* Restore the strided layout for the next pass */
+			if ( ! s )
+				for ( i = npoints; i-- > 0; )
+					memmove(bytes + i * stride, bytes + i * sz, sz);
+		}
+	}
+	pcfree(bytes);
+}
+
+/*
+* The batch conversions must give the same values as the
+* per value functions, packed and strided, for every
+* interpretation and scale/offset case.
+*/
+static void
+test_values_conversion()
+{
+	uint32_t interps[] = { PC_UINT8, PC_UINT16, PC_UINT32, PC_UINT64, PC_INT8, PC_INT16, PC_INT32, PC_INT64, PC_FLOAT, PC_DOUBLE };
+	double scaleoffsets[][2] = { {1, 0}, {0.01, 0}, {1, -20}, {0.5, 100.25} };
+	uint32_t npoints = 300, stride = 12, i, k, c, nbad;
+	uint8_t *bytes = pcalloc(npoints * stride);
+	uint8_t *out = pcalloc(npoints * stride);
+	double *vals = pcalloc(npoints * sizeof(double));
+
+	for ( k = 0; k < sizeof(interps)/sizeof(uint32_t); k++ )
+	{
+		uint32_t interp = interps[k];
+		size_t sz = pc_interpretation_size(interp);
+		int s;
+
+		for ( i = 0; i < npoints; i++ )
+			pc_double_to_ptr(bytes + i * stride, interp, (double)((i * 37) % 101));
+
+		for ( c = 0; c < 4; c++ )
+		{
+			PCDIMENSION dim;
+			memset(&dim, 0, sizeof(PCDIMENSION));
+			dim.interpretation = interp;
+			dim.scale = scaleoffsets[c][0];
+			dim.offset = scaleoffsets[c][1];
+
+			for ( s = 0; s < 2; s++ )
+			{
+				size_t st = s ? stride : sz;
+				const uint8_t *in = s ? bytes : out;
+				if ( ! s )
+					for ( i = 0; i < npoints; i++ )
+						memcpy(out + i * sz, bytes + i * stride, sz);
+
+				CU_ASSERT_EQUAL(pc_values_to_double(in, st, interp, dim.scale, dim.offset, npoints, vals), PC_SUCCESS);
+				nbad = 0;
+				for ( i = 0; i < npoints; i++ )
+					nbad += ( vals[i] != pc_value_scale_offset(pc_double_from_ptr(in + i * st, interp), &dim) );
+				CU_ASSERT_EQUAL(nbad, 0);
+			}
+
+			/* And back again, strided into a fresh buffer */
+			memset(out, 0, npoints * stride);
+			CU_ASSERT_EQUAL(pc_values_from_double(vals, npoints, interp, dim.scale, dim.offset, out, stride), PC_SUCCESS);
+			nbad = 0;
+			for ( i = 0; i < npoints; i++ )
+			{
+				uint8_t v[8];
+				pc_double_to_ptr(v, interp, pc_value_unscale_unoffset(vals[i], &dim));
+				nbad += ( memcmp(out + i * stride, v, sz) != 0 );
+			}
+			CU_ASSERT_EQUAL(nbad, 0);
+		}
+	}
+	pcfree(vals);
+	pcfree(out);
+	pcfree(bytes);
+}
+
+/*
+* Sigbits bitmaps and filters must agree with the ones
+* computed on the decoded values.
+*/
+static void
+test_sigbits_filter()
+{
+	char *bytes;
+	PCBYTES pcb, epcb, fpcb, dfpcb, rfpcb;
+	PCBITMAP *map1, *map2;
+	PCDOUBLESTAT stats;
+	double vals[][2] = { {-1, 10}, {3, 6}, {5, 5}, {7, 100}, {100, 200} };
+	PC_FILTERTYPE filters[] = { PC_GT, PC_LT, PC_EQUAL, PC_BETWEEN };
+	int f, v;
+
+	bytes = (char *)((int16_t[]){ -7, -3, -2, -8, -1, -5, -6, -4, -8 });
+	pcb = initbytes((uint8_t *)bytes, 9*2, PC_INT16);
+	epcb = pc_bytes_sigbits_encode(pcb);
+
+	/* Decided from the header alone */
+	map1 = pc_bytes_bitmap(&epcb, PC_LT, 0, 0, NULL);
+	CU_ASSERT_EQUAL(map1->nset, 9);
+	pc_bitmap_free(map1);
+	map1 = pc_bytes_bitmap(&epcb, PC_GT, 0, 0, NULL);
+	CU_ASSERT_EQUAL(map1->nset, 0);
+	pc_bitmap_free(map1);
+
+	/* Per value, on signed words with a common sign bit */
+	map1 = pc_bytes_bitmap(&epcb, PC_BETWEEN, -7.5, -2.5, NULL);
+	CU_ASSERT_EQUAL(map1->nset, 5);
+	stats.min = FLT_MAX;
+	stats.max = -1*FLT_MAX;
+	stats.sum = 0;
+	fpcb = pc_bytes_filter(&epcb, map1, &stats);
+	CU_ASSERT_EQUAL(fpcb.compression, PC_DIM_SIGBITS);
+	CU_ASSERT_EQUAL(fpcb.npoints, 5);
+	CU_ASSERT_DOUBLE_EQUAL(stats.min, -7, 0.0001);
+	CU_ASSERT_DOUBLE_EQUAL(stats.max, -3, 0.0001);
+	CU_ASSERT_DOUBLE_EQUAL(stats.sum, -25, 0.0001);
+	dfpcb = pc_bytes_decode(fpcb);
+	CU_ASSERT_EQUAL(((int16_t*)dfpcb.bytes)[0], -7);
+	CU_ASSERT_EQUAL(((int16_t*)dfpcb.bytes)[4], -4);
+	pc_bytes_free(dfpcb);
+	pc_bytes_free(fpcb);
+	pc_bitmap_free(map1);
+	pc_bytes_free(epcb);
+
+	/* Every filter against the decoded reference */
+	bytes = (char *)((uint32_t[]){ 3, 5, 5, 6, 4, 7, 3, 5, 6, 5, 4, 7, 7, 3 });
+	pcb = initbytes((uint8_t *)bytes, 14*4, PC_UINT32);
+	epcb = pc_bytes_sigbits_encode(pcb);
+	for ( f = 0; f < 4; f++ )
+	{
+		for ( v = 0; v < 5; v++ )
+		{
+			map1 = pc_bytes_bitmap(&pcb, filters[f], vals[v][0], vals[v][1], NULL);
+			map2 = pc_bytes_bitmap(&epcb, filters[f], vals[v][0], vals[v][1], NULL);
+			CU_ASSERT_EQUAL(map1->nset, map2->nset);
+			CU_ASSERT_EQUAL(memcmp(map1->map, map2->map, PC_BITMAP_NWORDS(pcb.npoints) * sizeof(uint64_t)), 0);
+
+			fpcb = pc_bytes_filter(&epcb, map2, NULL);
+			CU_ASSERT_EQUAL(fpcb.npoints, map1->nset);
+			dfpcb = pc_bytes_decode(fpcb);
+			rfpcb = pc_bytes_filter(&pcb, map1, NULL);
+			CU_ASSERT_EQUAL(dfpcb.size, rfpcb.size);
+			/* An empty filter output may have no buffer at all */
+			if ( rfpcb.size )
+				CU_ASSERT_EQUAL(memcmp(dfpcb.bytes, rfpcb.bytes, rfpcb.size), 0);
+			pc_bytes_free(rfpcb);
+			pc_bytes_free(dfpcb);
+			pc_bytes_free(fpcb);
+			pc_bitmap_free(map1);
+			pc_bitmap_free(map2);
+		}
+	}
+	pc_bytes_free(epcb);
+}
+
+/*
+* Fill a buffer of npoints words of the interpretation size with a
+* common prefix and nbits of pseudo random unique bits.
+*/
+static uint8_t *
+sigbits_make_words(uint32_t interp, uint32_t npoints, int nbits)
+{
+	int i;
+	size_t size = pc_interpretation_size(interp);
+	uint8_t *bytes = pcalloc(size * npoints);
+	uint64_t prefix = 0xA5A5A5A5A5A5A5A5ULL;
+	uint64_t mask = (nbits >= 64) ? 0xFFFFFFFFFFFFFFFFULL : ((1ULL << nbits) - 1);
+	uint64_t seed = 12345;
+
+	for ( i = 0; i < npoints; i++ )
+	{
+		uint64_t val;
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		val = (prefix & ~mask) | ((seed >> 11) & mask);
+		switch ( size )
+		{
+		case 1: { uint8_t v = val; memcpy(bytes + i, &v, 1); break; }
+		case 2: { uint16_t v = val; memcpy(bytes + 2*i, &v, 2); break; }
+		case 4: { uint32_t v = val; memcpy(bytes + 4*i, &v, 4); break; }
+		case 8: { memcpy(bytes + 8*i, &val, 8); break; }
+		}
+	}
+	return bytes;
+}
+
+/*
+* Round trip every word size and unique bit count through the
+* sigbits codec, with point counts that don't fill whole words
+* or whole vector steps.
+*/
+static void
+test_sigbits_decoding_all_widths()
+{
+	uint32_t interps[] = { PC_UINT8, PC_UINT16, PC_UINT32, PC_UINT64 };
+	uint32_t npoints[] = { 1, 7, 8, 9, 31, 100, 1001 };
+	int i, j, nbits;
+
+	for ( i = 0; i < 4; i++ )
+	{
+		int width = 8 * pc_interpretation_size(interps[i]);
+		for ( nbits = 0; nbits <= width; nbits++ )
+		{
+			for ( j = 0; j < 7; j++ )
+			{
+				uint8_t *bytes = sigbits_make_words(interps[i], npoints[j], nbits);
+				PCBYTES pcb = initbytes(bytes, npoints[j] * width / 8, interps[i]);
+				PCBYTES epcb = pc_bytes_sigbits_encode(pcb);
+				PCBYTES dpcb = pc_bytes_sigbits_decode(epcb);
+				CU_ASSERT_EQUAL(dpcb.npoints, pcb.npoints);
+				CU_ASSERT_EQUAL(dpcb.size, pcb.size);
+				CU_ASSERT_EQUAL(memcmp(dpcb.bytes, pcb.bytes, pcb.size), 0);
+				pc_bytes_free(epcb);
+				pc_bytes_free(dpcb);
+				pcfree(bytes);
+			}
+		}
+	}
+}
+
+/*
+* Delta encode values of every interpretation, including jumps
+* that wrap around, and check the round trip and the sizes.
+*/
+static void
+test_delta_encoding()
+{
+	uint32_t interps[] = { PC_INT8, PC_UINT8, PC_INT16, PC_UINT16, PC_INT32, PC_UINT32, PC_INT64, PC_UINT64, PC_FLOAT, PC_DOUBLE };
+	int npoints = 1000;
+	int i, j, order;
 
+	for ( i = 0; i < 10; i++ )
+	{
+		size_t sz = pc_interpretation_size(interps[i]);
+		uint8_t *bytes = pcalloc(npoints * sz);
+		PCBYTES pcb;
+
+		/* A slow ramp, then far apart bit patterns */
+		for ( j = 0; j < npoints - 4; j++ )
+			pc_double_to_ptr(bytes + j * sz, interps[i], 3 * j % 200);
+		for ( ; j < npoints; j++ )
+			memset(bytes + j * sz, j % 2 ? 0x80 : 0x7F, sz);
+		pcb = initbytes(bytes, npoints * sz, interps[i]);
+
+		for ( order = 1; order <= 2; order++ )
+		{
+			PCBYTES epcb = pc_bytes_encode(pcb, order == 2 ? PC_DIM_DELTA2 : PC_DIM_DELTA);
+			PCBYTES dpcb = pc_bytes_decode(epcb);
+			uint8_t val[8];
+			double mn, mx, avg, dmn, dmx, davg;
+
+			CU_ASSERT_EQUAL(epcb.compression, order == 2 ? PC_DIM_DELTA2 : PC_DIM_DELTA);
+			CU_ASSERT_EQUAL(epcb.size, pc_bytes_delta_count(&pcb, order));
+			CU_ASSERT_EQUAL(dpcb.compression, PC_DIM_NONE);
+			CU_ASSERT_EQUAL(dpcb.size, pcb.size);
+			CU_ASSERT_EQUAL(memcmp(dpcb.bytes, pcb.bytes, pcb.size), 0);
+
+			pc_bytes_to_ptr(val, epcb, npoints - 3);
+			CU_ASSERT_EQUAL(memcmp(val, pcb.bytes + (npoints - 3) * sz, sz), 0);
+
+			pc_bytes_minmax(&pcb, &mn, &mx, &avg);
+			pc_bytes_minmax(&epcb, &dmn, &dmx, &davg);
+			CU_ASSERT_DOUBLE_EQUAL(dmn, mn, 0.0);
+			CU_ASSERT_DOUBLE_EQUAL(dmx, mx, 0.0);
+
+			pc_bytes_free(epcb);
+			pc_bytes_free(dpcb);
+		}
+		pcfree(bytes);
+	}
+
+	/* A constant step takes a byte a point, mostly for delta-of-delta */
+	{
+		uint64_t steps[1000];
+		PCBYTES pcb, epcb;
+		for ( j = 0; j < npoints; j++ )
+			steps[j] = 1000000000000ULL + 12345 * j;
+		pcb = initbytes((uint8_t*)steps, sizeof(steps), PC_UINT64);
+
+		epcb = pc_bytes_delta_encode(pcb, 1);
+		CU_ASSERT(epcb.size < 3 * npoints + 16);
+		pc_bytes_free(epcb);
+
+		epcb = pc_bytes_delta_encode(pcb, 2);
+		CU_ASSERT(epcb.size < npoints + 16);
+		pc_bytes_free(epcb);
+	}
+}
+
+static void
+test_zstd_encoding()
+{
+	uint8_t bytes[4000];
+	PCBYTES pcb, epcb, pcb2;
+	int i;
+
+	if ( ! pc_bytes_compression_available(PC_DIM_ZSTD) )
+		return;
+
+	for ( i = 0; i < 4000; i++ )
+		bytes[i] = i % 13 + i / 400;
+	pcb = initbytes(bytes, 4000, PC_UINT32);
+	epcb = pc_bytes_encode(pcb, PC_DIM_ZSTD);
+	pcb2 = pc_bytes_decode(epcb);
+
+	CU_ASSERT_EQUAL(epcb.compression, PC_DIM_ZSTD);
+	CU_ASSERT_EQUAL(pcb2.compression, PC_DIM_NONE);
+	CU_ASSERT_EQUAL(pcb2.size, pcb.size);
+	CU_ASSERT_EQUAL(memcmp(pcb.bytes, pcb2.bytes, pcb.size), 0);
+	pc_bytes_free(epcb);
+	pc_bytes_free(pcb2);
+}
+
+static void
+test_lz4_encoding()
+{
+	uint8_t bytes[4000];
+	PCBYTES pcb, epcb, pcb2;
+	int i;
+
+	if ( ! pc_bytes_compression_available(PC_DIM_LZ4) )
+		return;
+
+	for ( i = 0; i < 4000; i++ )
+		bytes[i] = i % 13 + i / 400;
+	pcb = initbytes(bytes, 4000, PC_UINT32);
+	epcb = pc_bytes_encode(pcb, PC_DIM_LZ4);
+	pcb2 = pc_bytes_decode(epcb);
+
+	CU_ASSERT_EQUAL(epcb.compression, PC_DIM_LZ4);
+	CU_ASSERT(epcb.size < pcb.size);
+	CU_ASSERT_EQUAL(pcb2.compression, PC_DIM_NONE);
+	CU_ASSERT_EQUAL(pcb2.size, pcb.size);
+	CU_ASSERT_EQUAL(memcmp(pcb.bytes, pcb2.bytes, pcb.size), 0);
+	pc_bytes_free(epcb);
+	pc_bytes_free(pcb2);
+}
+
+/*
+* Merged arrays must decode to the concatenation of their parts,
+* whatever the mix of encodings.
+*/
+static void
+test_bytes_merge()
+{
+	uint32_t interps[] = { PC_UINT8, PC_UINT16, PC_UINT32, PC_UINT64 };
+	uint32_t nparts[] = { 13, 7, 29 };
+	int nbitss[] = { 0, 3, 5 };
+	const PCBYTES *parts[3];
+	PCBYTES pcb, epcb[3], mpcb, dpcb;
+	char *bytes;
+	int i, j, k;
+
+	/* Runs of the same value are joined across the boundary */
+	bytes = "aaaabbbbcc";
+	pcb = initbytes((uint8_t *)bytes, 6, PC_UINT8);
+	epcb[0] = pc_bytes_run_length_encode(pcb);
+	pcb = initbytes((uint8_t *)bytes + 6, 4, PC_UINT8);
+	epcb[1] = pc_bytes_run_length_encode(pcb);
+	parts[0] = &(epcb[0]);
+	parts[1] = &(epcb[1]);
+	mpcb = pc_bytes_merge(parts, 2);
+	CU_ASSERT_EQUAL(mpcb.compression, PC_DIM_RLE);
+	CU_ASSERT_EQUAL(mpcb.npoints, 10);
+	CU_ASSERT_EQUAL(mpcb.size, 6);
+	CU_ASSERT_EQUAL(mpcb.bytes[2], 4);
+	dpcb = pc_bytes_decode(mpcb);
+	CU_ASSERT_EQUAL(memcmp(dpcb.bytes, bytes, 10), 0);
+	pc_bytes_free(dpcb);
+	pc_bytes_free(mpcb);
+	pc_bytes_free(epcb[0]);
+	pc_bytes_free(epcb[1]);
+
+	/* Sigbits streams of every width, appended at odd bit offsets */
+	for ( i = 0; i < 4; i++ )
+	{
+		size_t sz = pc_interpretation_size(interps[i]);
+		for ( k = 0; k < 3; k++ )
+		{
+			size_t offset = 0;
+			uint8_t *words = sigbits_make_words(interps[i], 49, nbitss[k]);
+			for ( j = 0; j < 3; j++ )
+			{
+				pcb = initbytes(words + offset, nparts[j] * sz, interps[i]);
+				epcb[j] = pc_bytes_sigbits_encode(pcb);
+				parts[j] = &(epcb[j]);
+				offset += nparts[j] * sz;
+			}
+			mpcb = pc_bytes_merge(parts, 3);
+			CU_ASSERT_EQUAL(mpcb.compression, PC_DIM_SIGBITS);
+			CU_ASSERT_EQUAL(mpcb.npoints, 49);
+			dpcb = pc_bytes_decode(mpcb);
+			CU_ASSERT_EQUAL(dpcb.size, 49 * sz);
+			CU_ASSERT_EQUAL(memcmp(dpcb.bytes, words, 49 * sz), 0);
+			pc_bytes_free(dpcb);
+			pc_bytes_free(mpcb);
+			for ( j = 0; j < 3; j++ )
+				pc_bytes_free(epcb[j]);
+			pcfree(words);
+		}
+	}
+
+	/* Mixed encodings and sigbits prefixes are re-packed */
+	bytes = (char *)((uint32_t[]){ 10, 10, 10, 20, 20, 7, 7, 1000000, 4, 4, 4, 4, 4 });
+	pcb = initbytes((uint8_t *)bytes, 5*4, PC_UINT32);
+	epcb[0] = pc_bytes_sigbits_encode(pcb);
+	pcb = initbytes((uint8_t *)bytes + 5*4, 3*4, PC_UINT32);
+	epcb[1] = pc_bytes_sigbits_encode(pcb);
+	pcb = initbytes((uint8_t *)bytes + 8*4, 5*4, PC_UINT32);
+	epcb[2] = pc_bytes_run_length_encode(pcb);
+	for ( j = 0; j < 3; j++ )
+		parts[j] = &(epcb[j]);
+	mpcb = pc_bytes_merge(parts, 3);
+	CU_ASSERT_EQUAL(mpcb.compression, PC_DIM_SIGBITS);
+	CU_ASSERT_EQUAL(mpcb.npoints, 13);
+	dpcb = pc_bytes_decode(mpcb);
+	CU_ASSERT_EQUAL(memcmp(dpcb.bytes, bytes, 13*4), 0);
+	pc_bytes_free(dpcb);
+	pc_bytes_free(mpcb);
+	for ( j = 0; j < 3; j++ )
+		pc_bytes_free(epcb[j]);
+}
+
+/*
+* Stats read off sigbits and zlib bytes must match those of the
+* decoded values, signed interpretations and indexed blocks included.
+*/
+static void
+test_bytes_minmax()
+{
+	uint32_t interps[] = { PC_INT8, PC_UINT8, PC_INT16, PC_UINT16, PC_INT32, PC_UINT32, PC_INT64, PC_UINT64 };
+	uint32_t npoints[] = { 1, 100, 3000 };
+	int nbitss[] = { 0, 5, 13 };
+	int i, j, k, c;
+
+	for ( i = 0; i < 8; i++ )
+	{
+		size_t sz = pc_interpretation_size(interps[i]);
+		for ( j = 0; j < 3; j++ )
+		{
+			for ( k = 0; k < 3; k++ )
+			{
+				uint8_t *bytes = sigbits_make_words(interps[i], npoints[j], nbitss[k]);
+				PCBYTES pcb = initbytes(bytes, npoints[j] * sz, interps[i]);
+				double mn, mx, avg;
+				pc_bytes_minmax(&pcb, &mn, &mx, &avg);
+				for ( c = PC_DIM_SIGBITS; c <= PC_DIM_ZLIB; c++ )
+				{
+					PCBYTES epcb = pc_bytes_encode(pcb, c);
+					double emn, emx, eavg;
+					CU_ASSERT_EQUAL(pc_bytes_minmax(&epcb, &emn, &emx, &eavg), PC_SUCCESS);
+					CU_ASSERT_DOUBLE_EQUAL(emn, mn, 0.0);
+					CU_ASSERT_DOUBLE_EQUAL(emx, mx, 0.0);
+					CU_ASSERT_DOUBLE_EQUAL(eavg, avg, fabs(avg) * 1e-12);
+					pc_bytes_free(epcb);
+				}
+				pcfree(bytes);
+			}
+		}
+	}
+}
+
+/*
+* RLE and zlib bytes of many values carry a block index, which
+* must find every value, survive serialization and be rebuilt by
+* filters and merges.
+*/
+static void
+test_bytes_block_index()
+{
+	uint32_t npoints = 5000;
+	uint32_t compressions[] = { PC_DIM_RLE, PC_DIM_ZLIB | PC_DIM_INDEXED };
+	uint16_t *vals = pcalloc(npoints * sizeof(uint16_t));
+	PCDIMENSION dim;
+	PCBITMAP *map;
+	PCBYTES pcb;
+	uint32_t i, c;
+
+	memset(&dim, 0, sizeof(dim));
+	dim.interpretation = PC_UINT16;
+	/* Short runs of slowly growing values */
+	for ( i = 0; i < npoints; i++ )
+		vals[i] = i / 3 + (i % 7 == 0);
+	pcb = initbytes((uint8_t*)vals, npoints * sizeof(uint16_t), PC_UINT16);
+
+	map = pc_bitmap_new(npoints);
+	for ( i = 0; i < npoints; i++ )
+		if ( i % 5 != 0 ) pc_bitmap_set_range(map, i, 1);
+
+	for ( c = 0; c < 2; c++ )
+	{
+		PCBYTES epcb = pc_bytes_encode(pcb, compressions[c]);
+		PCBYTES dpcb, rpcb, wpcb, fpcb, mpcb;
+		const PCBYTES *parts[2];
+		uint8_t *buf;
+		size_t size;
+		uint16_t val;
+		int ok = PC_TRUE;
+
+		/* Found the same with or without the index */
+		CU_ASSERT(epcb.indexsize > 0);
+		for ( i = 0; i < npoints; i++ )
+		{
+			pc_bytes_to_ptr((uint8_t*)&val, epcb, i);
+			if ( val != vals[i] ) ok = PC_FALSE;
+		}
+		CU_ASSERT(ok);
+		dpcb = pc_bytes_decode(epcb);
+		CU_ASSERT_EQUAL(dpcb.indexsize, 0);
+		CU_ASSERT_EQUAL(memcmp(dpcb.bytes, vals, pcb.size), 0);
+		pc_bytes_free(dpcb);
+
+		/* Serialized with the index, read back in place or copied */
+		buf = pcalloc(pc_bytes_serialized_size(&epcb));
+		pc_bytes_serialize(&epcb, buf, &size);
+		CU_ASSERT_EQUAL(size, pc_bytes_serialized_size(&epcb));
+		CU_ASSERT_EQUAL(buf[0], compressions[c] | PC_DIM_INDEXED);
+		rpcb.npoints = wpcb.npoints = npoints;
+		pc_bytes_deserialize(buf, &dim, &rpcb, PC_TRUE, PC_FALSE);
+		pc_bytes_deserialize(buf, &dim, &wpcb, PC_FALSE, PC_FALSE);
+		CU_ASSERT_EQUAL(rpcb.compression, compressions[c] & ~PC_DIM_INDEXED);
+		CU_ASSERT_EQUAL(rpcb.size, epcb.size);
+		CU_ASSERT_EQUAL(rpcb.indexsize, epcb.indexsize);
+		CU_ASSERT_EQUAL(wpcb.size, epcb.size);
+		CU_ASSERT_EQUAL(wpcb.indexsize, epcb.indexsize);
+		pc_bytes_to_ptr((uint8_t*)&val, rpcb, npoints - 1);
+		CU_ASSERT_EQUAL(val, vals[npoints - 1]);
+		pc_bytes_to_ptr((uint8_t*)&val, wpcb, 2345);
+		CU_ASSERT_EQUAL(val, vals[2345]);
+		pc_bytes_free(wpcb);
+		pcfree(buf);
+
+		/* Filtered and merged bytes get a fresh index */
+		fpcb = pc_bytes_filter(&epcb, map, NULL);
+		parts[0] = &epcb;
+		parts[1] = &fpcb;
+		mpcb = pc_bytes_merge(parts, 2);
+		CU_ASSERT_EQUAL(mpcb.npoints, npoints + fpcb.npoints);
+		ok = PC_TRUE;
+		for ( i = 0; i < mpcb.npoints; i++ )
+		{
+			uint32_t j = i < npoints ? i : (i - npoints) / 4 * 5 + (i - npoints) % 4 + 1;
+			pc_bytes_to_ptr((uint8_t*)&val, mpcb, i);
+			if ( val != vals[j] ) ok = PC_FALSE;
+		}
+		CU_ASSERT(ok);
+		pc_bytes_free(mpcb);
+		pc_bytes_free(fpcb);
+		pc_bytes_free(epcb);
+	}
+
+	/* Zlib only splits its blocks when asked to */
+	{
+		PCBYTES epcb = pc_bytes_encode(pcb, PC_DIM_ZLIB);
+		CU_ASSERT_EQUAL(epcb.indexsize, 0);
+		pc_bytes_free(epcb);
+	}
+
+	/* Broken indexes are refused: block length zero, entries out */
+	/* of order or past the bytes, blocks short of the points */
+	{
+		PCBYTES epcb = pc_bytes_encode(pcb, PC_DIM_ZLIB | PC_DIM_INDEXED);
+		uint32_t nblocks = epcb.indexsize / 4 - 2;
+		uint8_t *buf = pcalloc(pc_bytes_serialized_size(&epcb));
+		uint8_t *index = buf + 5 + epcb.size;
+		uint32_t word;
+		PCBYTES rpcb;
+		size_t size;
+
+		for ( i = 0; i < 4; i++ )
+		{
+			pc_bytes_serialize(&epcb, buf, &size);
+			rpcb.npoints = npoints;
+			CU_ASSERT_EQUAL(pc_bytes_deserialize(buf, &dim, &rpcb, PC_TRUE, PC_FALSE), PC_SUCCESS);
+			if ( i == 0 )
+				word = 0;
+			else if ( i == 1 )
+				word = epcb.size;
+			else if ( i == 2 )
+				word = epcb.size + 1;
+			else
+				word = 1;
+			memcpy(index + 4 * (i == 1 ? 0 : i == 2 ? nblocks - 1 : nblocks), &word, 4);
+			rpcb.npoints = npoints;
+			CU_ASSERT_EQUAL(pc_bytes_deserialize(buf, &dim, &rpcb, PC_TRUE, PC_FALSE), PC_FAILURE);
+			CU_ASSERT_EQUAL(rpcb.indexsize, 0);
+		}
+		pcfree(buf);
+		pc_bytes_free(epcb);
+	}
+
+	/* Few runs or values stay unindexed */
+	pcb.npoints = pcb.size = PC_INDEX_RUNS;
+	pcb.interpretation = PC_UINT8;
+	for ( c = 0; c < 2; c++ )
+	{
+		PCBYTES epcb = pc_bytes_encode(pcb, compressions[c]);
+		CU_ASSERT_EQUAL(epcb.indexsize, 0);
+		pc_bytes_free(epcb);
+	}
+
+	pc_bitmap_free(map);
+	pcfree(vals);
+}
 
 /* REGISTER ***********************************************************/
 
@@ -528,8 +1244,19 @@ CU_TestInfo bytes_tests[] = {
 	PC_TEST(test_run_length_encoding),
 	PC_TEST(test_sigbits_encoding),
 	PC_TEST(test_zlib_encoding),
+	PC_TEST(test_zstd_encoding),
+	PC_TEST(test_lz4_encoding),
 	PC_TEST(test_rle_filter),
 	PC_TEST(test_uncompressed_filter),
+	PC_TEST(test_bitmap_ops),
+	PC_TEST(test_bitmap_filter_values),
+	PC_TEST(test_values_conversion),
+	PC_TEST(test_sigbits_filter),
+	PC_TEST(test_sigbits_decoding_all_widths),
+	PC_TEST(test_bytes_merge),
+	PC_TEST(test_bytes_block_index),
+	PC_TEST(test_bytes_minmax),
+	PC_TEST(test_delta_encoding),
 	CU_TEST_INFO_NULL
 };
 
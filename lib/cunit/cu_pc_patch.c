@@ -454,6 +454,318 @@ test_patch_union()
 }
 
 
+static void
+test_patch_union_dimensional()
+{
+	int i;
+	int npts = 30;
+	PCPOINTLIST *pl;
+	PCPATCH *palist[3];
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *pu, *pref;
+	char *str1, *str2;
+	double d;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i / 10);
+		pc_point_set_double_by_name(pt, "Z", i * 0.25);
+		pc_point_set_double_by_name(pt, "intensity", 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	/* A compressed, an uncompressed and another compressed dimensional */
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	palist[0] = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+	palist[1] = (PCPATCH*)pdl;
+	palist[2] = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+
+	pu = pc_patch_from_patchlist(palist, 3);
+	CU_ASSERT_EQUAL(pu->type, PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(pu->npoints, 3*npts);
+	CU_ASSERT_EQUAL(pu->bounds.xmin, 0);
+	CU_ASSERT_EQUAL(pu->bounds.xmax, npts-1);
+	pc_point_get_double_by_name(&(pu->stats->max), "y", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 2, 0.000001);
+	pc_point_get_double_by_name(&(pu->stats->avg), "x", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 14.5, 0.000001);
+
+	/* Same points as the merge of uncompressed copies */
+	palist[1] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pref = pc_patch_from_patchlist(palist, 3);
+	CU_ASSERT_EQUAL(pref->type, PC_NONE);
+	str1 = pc_patch_to_string(pu);
+	str2 = pc_patch_to_string(pref);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pref);
+	pc_patch_free(pu);
+	pc_patch_free(palist[0]);
+	pc_patch_free(palist[1]);
+	pc_patch_free(palist[2]);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_union_streaming()
+{
+	int i;
+	int npts = 30;
+	PCPOINTLIST *pl;
+	PCPATCH *palist[4];
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH_UNION *pcu;
+	PCSCHEMA *otherschema;
+	PCPATCH *pa, *pref;
+	char *str1, *str2;
+	double d;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i / 10);
+		pc_point_set_double_by_name(pt, "Z", i * 0.25);
+		pc_point_set_double_by_name(pt, "intensity", 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	palist[0] = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+	palist[1] = (PCPATCH*)pdl;
+	palist[2] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	palist[3] = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+
+	/* Dimensional inputs only, decoded into columns, compressed again at the end */
+	pcu = pc_patch_union_new(simpleschema);
+	CU_ASSERT_EQUAL(pc_patch_union_add(pcu, palist[0]), PC_SUCCESS);
+	CU_ASSERT_EQUAL(pc_patch_union_add(pcu, palist[1]), PC_SUCCESS);
+	CU_ASSERT_PTR_NOT_NULL(pcu->pdl);
+	CU_ASSERT_EQUAL(pcu->pdl->bytes[0].compression, PC_DIM_NONE);
+	CU_ASSERT_EQUAL(pcu->pdl->bytes[0].size, 2*npts*4);
+	pa = pc_patch_union_result(pcu);
+	CU_ASSERT_EQUAL(pa->type, PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(pa->npoints, 2*npts);
+	CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)pa)->bytes[3].compression, PC_DIM_RLE);
+	CU_ASSERT_EQUAL(pa->bounds.xmax, npts-1);
+	pc_point_get_double_by_name(&(pa->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, (npts-1) * 0.25, 0.000001);
+	pc_patch_free(pa);
+
+	/* An uncompressed input moves everything to the point buffer */
+	CU_ASSERT_EQUAL(pc_patch_union_add(pcu, palist[2]), PC_SUCCESS);
+	CU_ASSERT_EQUAL(pc_patch_union_add(pcu, palist[3]), PC_SUCCESS);
+	CU_ASSERT_PTR_NULL(pcu->pdl);
+	pa = pc_patch_union_result(pcu);
+	CU_ASSERT_EQUAL(pa->type, PC_NONE);
+	CU_ASSERT_EQUAL(pa->npoints, 4*npts);
+	CU_ASSERT_EQUAL(pa->bounds.xmin, 0);
+	CU_ASSERT_EQUAL(pa->bounds.xmax, npts-1);
+	pc_point_get_double_by_name(&(pa->stats->max), "y", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 2, 0.000001);
+	pc_point_get_double_by_name(&(pa->stats->avg), "x", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 14.5, 0.000001);
+
+	/* Same points as the all-at-once union */
+	pref = pc_patch_from_patchlist(palist, 4);
+	str1 = pc_patch_to_string(pa);
+	str2 = pc_patch_to_string(pref);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pref);
+	pc_patch_free(pa);
+
+	/* Mismatched schema is refused */
+	otherschema = pc_schema_clone(simpleschema);
+	otherschema->pcid = simpleschema->pcid + 1;
+	pa = (PCPATCH*)pc_patch_uncompressed_make(otherschema, 0);
+	CU_ASSERT_EQUAL(pc_patch_union_add(pcu, pa), PC_FAILURE);
+	pc_patch_free(pa);
+	pc_schema_free(otherschema);
+
+	pc_patch_union_free(pcu);
+	for ( i = 0; i < 4; i++ )
+		pc_patch_free(palist[i]);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_union_merge()
+{
+	int i;
+	int npts = 25;
+	PCPOINTLIST *pl;
+	PCPATCH *palist[3];
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH_UNION *pcu1, *pcu2, *pcu;
+	PCPATCH *pa, *pref;
+	char *str1, *str2;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", -i);
+		pc_point_set_double_by_name(pt, "Z", i * 0.5);
+		pc_point_set_double_by_name(pt, "intensity", i % 3);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	palist[0] = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+	palist[1] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	palist[2] = (PCPATCH*)pdl;
+
+	/* One partial union still dimensional, one already uncompressed */
+	pcu1 = pc_patch_union_new(simpleschema);
+	pc_patch_union_add(pcu1, palist[0]);
+	pcu2 = pc_patch_union_new(simpleschema);
+	pc_patch_union_add(pcu2, palist[1]);
+	pc_patch_union_add(pcu2, palist[2]);
+
+	pcu = pc_patch_union_new(simpleschema);
+	CU_ASSERT_EQUAL(pc_patch_union_merge(pcu, pcu1), PC_SUCCESS);
+	CU_ASSERT_PTR_NOT_NULL(pcu->pdl);
+	CU_ASSERT_EQUAL(pc_patch_union_merge(pcu, pcu2), PC_SUCCESS);
+	CU_ASSERT_EQUAL(pcu->npoints, 3*npts);
+
+	/* Nothing of the merged states is referenced afterwards */
+	pc_patch_union_free(pcu1);
+	pc_patch_union_free(pcu2);
+	pa = pc_patch_union_result(pcu);
+	pref = pc_patch_from_patchlist(palist, 3);
+	str1 = pc_patch_to_string(pa);
+	str2 = pc_patch_to_string(pref);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	CU_ASSERT_EQUAL(pa->bounds.ymin, pref->bounds.ymin);
+
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pref);
+	pc_patch_free(pa);
+	pc_patch_union_free(pcu);
+	for ( i = 0; i < 3; i++ )
+		pc_patch_free(palist[i]);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_union_avg()
+{
+	int i;
+	PCPOINTLIST *pl1, *pl2;
+	PCPATCH *palist[2];
+	PCPATCH *pa;
+	PCPATCH_UNION *pcu;
+	double d;
+
+	/* Intensities 1 and 2, stored average 2, then a single 1 */
+	pl1 = pc_pointlist_make(2);
+	pl2 = pc_pointlist_make(1);
+	for ( i = 0; i < 3; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i);
+		pc_point_set_double_by_name(pt, "Z", i);
+		pc_point_set_double_by_name(pt, "intensity", i == 1 ? 2 : 1);
+		pc_pointlist_add_point(i < 2 ? pl1 : pl2, pt);
+	}
+
+	/* The average of 1, 2 and 1 rounds to 1, not to (2*2 + 1)/3 */
+	palist[0] = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl1);
+	palist[1] = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl2);
+	pa = pc_patch_from_patchlist(palist, 2);
+	CU_ASSERT_EQUAL(pa->type, PC_DIMENSIONAL);
+	pc_point_get_double_by_name(&(pa->stats->avg), "intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 1, 0.000001);
+	pc_patch_free(pa);
+	pc_patch_free(palist[0]);
+	pc_patch_free(palist[1]);
+
+	palist[0] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl1);
+	palist[1] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl2);
+	pcu = pc_patch_union_new(simpleschema);
+	CU_ASSERT_EQUAL(pc_patch_union_add(pcu, palist[0]), PC_SUCCESS);
+	CU_ASSERT_EQUAL(pc_patch_union_add(pcu, palist[1]), PC_SUCCESS);
+	pa = pc_patch_union_result(pcu);
+	CU_ASSERT_EQUAL(pa->type, PC_NONE);
+	pc_point_get_double_by_name(&(pa->stats->avg), "intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 1, 0.000001);
+
+	pc_patch_free(pa);
+	pc_patch_union_free(pcu);
+	pc_patch_free(palist[0]);
+	pc_patch_free(palist[1]);
+	pc_pointlist_free(pl1);
+	pc_pointlist_free(pl2);
+}
+
+static void
+test_patch_dstats_merge()
+{
+	int i;
+	PCPOINTLIST *pl1, *pl2;
+	PCPATCH *palist[2];
+	PCDOUBLESTATS *d1, *d2;
+	PCSTATS *stats;
+	double d;
+
+	pl1 = pc_pointlist_make(10);
+	pl2 = pc_pointlist_make(20);
+	for ( i = 0; i < 30; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", 100 - i);
+		pc_point_set_double_by_name(pt, "Z", 1);
+		pc_point_set_double_by_name(pt, "intensity", i < 10 ? 3 : 6);
+		pc_pointlist_add_point(i < 10 ? pl1 : pl2, pt);
+	}
+	palist[0] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl1);
+	palist[1] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl2);
+
+	/* Partial accumulators, as two parallel workers would build them */
+	d1 = pc_dstats_new(simpleschema->ndims);
+	d2 = pc_dstats_new(simpleschema->ndims);
+	pc_dstats_add_stats(d1, palist[0]->stats, palist[0]->npoints);
+	pc_dstats_add_stats(d2, palist[1]->stats, palist[1]->npoints);
+	pc_dstats_merge(d1, d2, simpleschema->ndims);
+	CU_ASSERT_EQUAL(d1->npoints, 30);
+
+	stats = pc_stats_new_from_dstats(simpleschema, d1);
+	pc_point_get_double_by_name(&(stats->min), "y", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 71, 0.000001);
+	pc_point_get_double_by_name(&(stats->max), "x", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 29, 0.000001);
+	pc_point_get_double_by_name(&(stats->avg), "intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 5, 0.000001);
+
+	/* Merging an empty accumulator is a no-op */
+	pc_dstats_free(d2);
+	d2 = pc_dstats_new(simpleschema->ndims);
+	pc_dstats_merge(d1, d2, simpleschema->ndims);
+	CU_ASSERT_EQUAL(d1->npoints, 30);
+	CU_ASSERT_DOUBLE_EQUAL(d1->dims[0].min, 0, 0.000001);
+
+	pc_stats_free(stats);
+	pc_dstats_free(d1);
+	pc_dstats_free(d2);
+	pc_patch_free(palist[0]);
+	pc_patch_free(palist[1]);
+	pc_pointlist_free(pl1);
+	pc_pointlist_free(pl2);
+}
+
 static void
 test_patch_wkb()
 {
@@ -465,113 +777,1384 @@ test_patch_wkb()
 	size_t z1, z2;
 	uint8_t *wkb1, *wkb2;
 
-	pl1 = pc_pointlist_make(npts);
+	pl1 = pc_pointlist_make(npts);
+
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i*2.123);
+		pc_point_set_double_by_name(pt, "y", i*2.9);
+		pc_point_set_double_by_name(pt, "Z", i*0.3099);
+		pc_point_set_double_by_name(pt, "intensity", 13);
+		pc_pointlist_add_point(pl1, pt);
+	}
+
+	pa1 = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl1);
+	wkb1 = pc_patch_to_wkb(pa1, &z1);
+	// str = pc_hexbytes_from_bytes(wkb1, z1);
+	// printf("str\n%s\n",str);
+	pa2 = pc_patch_from_wkb(simpleschema, wkb1, z1);
+
+	// printf("pa2\n%s\n",pc_patch_to_string(pa2));
+
+	pa3 = pc_patch_compress(pa2, NULL);
+
+	// printf("pa3\n%s\n",pc_patch_to_string(pa3));
+
+	wkb2 = pc_patch_to_wkb(pa3, &z2);
+	pa4 = pc_patch_from_wkb(simpleschema, wkb2, z2);
+	pcfree(wkb2);
+
+	// printf("pa4\n%s\n",pc_patch_to_string(pa4));
+
+	pu1 = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompressed_from_dimensional((PCPATCH_DIMENSIONAL*)pa1);
+	pu2 = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompressed_from_dimensional((PCPATCH_DIMENSIONAL*)pa4);
+
+	// printf("pu1\n%s\n", pc_patch_to_string((PCPATCH*)pu1));
+	// printf("pu2\n%s\n", pc_patch_to_string((PCPATCH*)pu2));
+
+	CU_ASSERT_EQUAL(pu1->datasize, pu2->datasize);
+	CU_ASSERT_EQUAL(pu1->npoints, pu2->npoints);
+	CU_ASSERT(memcmp(pu1->data, pu2->data, pu1->datasize) == 0);
+
+
+	pc_pointlist_free(pl1);
+	pc_patch_free(pa1);
+	pc_patch_free(pa2);
+	pc_patch_free(pa3);
+	pc_patch_free(pa4);
+	pc_patch_free((PCPATCH*)pu1);
+	pc_patch_free((PCPATCH*)pu2);
+	pcfree(wkb1);
+}
+
+
+static void
+test_patch_filter()
+{
+	int i;
+	int npts = 20;
+	PCPOINTLIST *pl1, *pl2;
+	PCPATCH *pa1, *pa2, *pa3, *pa4;
+	char *str1, *str2;
+
+	pl1 = pc_pointlist_make(npts);
+	pl2 = pc_pointlist_make(npts);
+
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt1 = pc_point_make(simpleschema);
+		PCPOINT *pt2 = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt1, "x", i);
+		pc_point_set_double_by_name(pt1, "y", i);
+		pc_point_set_double_by_name(pt1, "Z", i*0.1);
+		pc_point_set_double_by_name(pt1, "intensity", 100-i);
+		pc_pointlist_add_point(pl1, pt1);
+		pc_point_set_double_by_name(pt2, "x", i);
+		pc_point_set_double_by_name(pt2, "y", i);
+		pc_point_set_double_by_name(pt2, "Z", i*0.1);
+		pc_point_set_double_by_name(pt2, "intensity", 100-i);
+		pc_pointlist_add_point(pl2, pt2);
+	}
+
+	// PCPATCH* pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2);
+
+	pa1 = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl1);
+	// printf("pa1\n%s\n", pc_patch_to_string(pa1));
+	pa2 = pc_patch_filter(pa1, 0, PC_GT, 17, 20);
+	str1 = pc_patch_to_string(pa2);
+	// printf("pa2\n%s\n", str1);
+	CU_ASSERT_STRING_EQUAL(str1, "{\"pcid\":0,\"pts\":[[18,18,1.8,82],[19,19,1.9,81]]}");
+
+	pa3 = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl2);
+	// printf("\npa3\n%s\n", pc_patch_to_string(pa3));
+	pa4 = pc_patch_filter(pa3, 0, PC_GT, 17, 20);
+	str2 = pc_patch_to_string(pa4);
+	// printf("\npa4\n%s\n", str2);
+	CU_ASSERT_STRING_EQUAL(str2, "{\"pcid\":0,\"pts\":[[18,18,1.8,82],[19,19,1.9,81]]}");
+
+	pcfree(str1);
+	pcfree(str2);
+
+	pc_pointlist_free(pl1);
+	pc_pointlist_free(pl2);
+	pc_patch_free(pa1);
+	pc_patch_free(pa3);
+	pc_patch_free(pa4);
+	pc_patch_free(pa2);
+
+	return;
+}
+
+static void
+test_patch_filter_expression()
+{
+	int i;
+	int npts = 20;
+	PCPOINTLIST *pl;
+	PCPATCH *pa[3];
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *pf;
+	char *str;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i % 4);
+		pc_point_set_double_by_name(pt, "Z", i*0.1);
+		pc_point_set_double_by_name(pt, "intensity", 100-i);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	/* Uncompressed, plain dimensional and compressed dimensional */
+	pa[0] = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	pa[1] = (PCPATCH*)pdl;
+	pa[2] = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+
+	for ( i = 0; i < 3; i++ )
+	{
+		pf = pc_patch_filter_by_expression(pa[i], "x > 5 AND intensity > 90");
+		CU_ASSERT(pf != NULL);
+		str = pc_patch_to_string(pf);
+		CU_ASSERT_STRING_EQUAL(str, "{\"pcid\":0,\"pts\":[[6,2,0.6,94],[7,3,0.7,93],[8,0,0.8,92],[9,1,0.9,91]]}");
+		pcfree(str);
+		pc_patch_free(pf);
+
+		/* AND binds tighter than OR, BETWEEN is exclusive */
+		pf = pc_patch_filter_by_expression(pa[i], "x < 2 OR y = 3 and Z between 1.5 and 1.95 OR (X BETWEEN 17 AND 15)");
+		CU_ASSERT(pf != NULL);
+		str = pc_patch_to_string(pf);
+		CU_ASSERT_STRING_EQUAL(str, "{\"pcid\":0,\"pts\":[[0,0,0,100],[1,1,0.1,99],[16,0,1.6,84],[19,3,1.9,81]]}");
+		pcfree(str);
+		pc_patch_free(pf);
+
+		/* Settled by the stats */
+		pf = pc_patch_filter_by_expression(pa[i], "y > 1 AND x > 100");
+		CU_ASSERT_EQUAL(pf->npoints, 0);
+		pc_patch_free(pf);
+		pf = pc_patch_filter_by_expression(pa[i], "(x > -1 OR y = 2) AND intensity < 101");
+		CU_ASSERT_EQUAL(pf->npoints, npts);
+		CU_ASSERT_EQUAL(pf->type, pa[i]->type);
+		CU_ASSERT_DOUBLE_EQUAL(pf->bounds.xmax, 19, 0.000001);
+		pc_patch_free(pf);
+
+		/* Settled by the bitmaps */
+		pf = pc_patch_filter_by_expression(pa[i], "y = 1 AND y = 2");
+		CU_ASSERT_EQUAL(pf->npoints, 0);
+		pc_patch_free(pf);
+
+		/* Negations */
+		pf = pc_patch_filter_by_expression(pa[i], "NOT (x > 1 AND NOT y = 3)");
+		CU_ASSERT(pf != NULL);
+		str = pc_patch_to_string(pf);
+		CU_ASSERT_STRING_EQUAL(str, "{\"pcid\":0,\"pts\":[[0,0,0,100],[1,1,0.1,99],[3,3,0.3,97],[7,3,0.7,93],[11,3,1.1,89],[15,3,1.5,85],[19,3,1.9,81]]}");
+		pcfree(str);
+		pc_patch_free(pf);
+		pf = pc_patch_filter_by_expression(pa[i], "not x < 100");
+		CU_ASSERT_EQUAL(pf->npoints, 0);
+		pc_patch_free(pf);
+	}
+
+	/* Syntax errors and unknown dimensions */
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], "x >= 3"), NULL);
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], "x > 3 AND"), NULL);
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], "(x > 3"), NULL);
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], "x > 3 y < 2"), NULL);
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], "x BETWEEN 1 2"), NULL);
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], "nosuch > 1"), NULL);
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], ""), NULL);
+	CU_ASSERT_EQUAL(pc_patch_filter_by_expression(pa[0], "NOT"), NULL);
+
+	for ( i = 0; i < 3; i++ )
+		pc_patch_free(pa[i]);
+	pc_pointlist_free(pl);
+}
+
+/* Points of the patch inside the polygon, one at a time */
+static uint32_t
+test_polygon_count(const PCPATCH *pa, const PCPOLYGON *poly)
+{
+	uint32_t i, n = 0;
+	for ( i = 1; i <= pa->npoints; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(pa, i);
+		double x, y;
+		pc_point_get_x(pt, &x);
+		pc_point_get_y(pt, &y);
+		n += pc_polygon_contains(poly, x, y);
+		pc_point_free(pt);
+	}
+	return n;
+}
+
+static void
+test_patch_filter_polygon()
+{
+	/* EWKB square from 9.5 to 60.5 in srid 4326, with a hole from 19.5 to 29.5 */
+	const char *hexsquare = "0103000020E61000000200000005000000000000000000234000000000000023400000000000404E4000000000000023400000000000404E400000000000404E4000000000000023400000000000404E400000000000002340000000000000234005000000000000000080334000000000008033400000000000803D4000000000008033400000000000803D400000000000803D4000000000008033400000000000803D4000000000008033400000000000803340";
+	/* Triangle of (-0.5,-0.5), (120,-0.5), (-0.5,120) */
+	const char *hextriangle = "01030000000100000004000000000000000000E0BF000000000000E0BF0000000000005E40000000000000E0BF000000000000E0BF0000000000005E40000000000000E0BF000000000000E0BF";
+	/* Squares from 70.5 to 80.5 and from -10 to 5.5 */
+	const char *hexmulti = "010600000002000000010300000001000000050000000000000000A051400000000000A0514000000000002054400000000000A05140000000000020544000000000002054400000000000A0514000000000002054400000000000A051400000000000A051400103000000010000000500000000000000000024C000000000000024C0000000000000164000000000000024C00000000000001640000000000000164000000000000024C0000000000000164000000000000024C000000000000024C0";
+	/* Square of (10,10), (20,10), (20,20), (10,20) */
+	const char *hexedges = "010300000001000000050000000000000000002440000000000000244000000000000034400000000000002440000000000000344000000000000034400000000000002440000000000000344000000000000024400000000000002440";
+	/* POINT(1 2) */
+	const char *hexpoint = "0101000000000000000000F03F0000000000000040";
+	const char *hexs[3];
+	uint32_t expected[3];
+	int i, j, k;
+	int npts = 100 * 100;
+	PCPOINTLIST *pl;
+	PCPATCH_UNCOMPRESSED *pau;
+	PCPATCH_DIMENSIONAL *pdl, *pdlu;
+	PCPOLYGON *poly;
+	PCPATCH *pa;
+	uint8_t *wkb;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < 100; i++ )
+	{
+		for ( j = 0; j < 100; j++ )
+		{
+			PCPOINT *pt = pc_point_make(simpleschema);
+			pc_point_set_double_by_name(pt, "x", i);
+			pc_point_set_double_by_name(pt, "y", j);
+			pc_point_set_double_by_name(pt, "Z", i * j);
+			pc_point_set_double_by_name(pt, "intensity", i);
+			pc_pointlist_add_point(pl, pt);
+		}
+	}
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+	pdlu = pc_patch_dimensional_from_pointlist(pl);
+	pdl = pc_patch_dimensional_compress(pdlu, NULL);
+	pc_patch_free((PCPATCH*)pdlu);
+
+	wkb = pc_bytes_from_hexbytes(hexsquare, strlen(hexsquare));
+	poly = pc_polygon_from_wkb(wkb, strlen(hexsquare)/2);
+	pcfree(wkb);
+	CU_ASSERT_EQUAL(poly->srid, 4326);
+	CU_ASSERT_EQUAL(poly->nrings, 2);
+	CU_ASSERT_EQUAL(poly->npoints, 10);
+	CU_ASSERT_DOUBLE_EQUAL(poly->bounds.xmax, 60.5, 0.000001);
+	CU_ASSERT(pc_polygon_contains(poly, 10, 10));
+	CU_ASSERT(! pc_polygon_contains(poly, 25, 25));
+	CU_ASSERT(! pc_polygon_contains(poly, 61, 30));
+	pc_polygon_free(poly);
+
+	hexs[0] = hexsquare;
+	expected[0] = 51 * 51 - 10 * 10;
+	hexs[1] = hextriangle;
+	expected[1] = 0;
+	hexs[2] = hexmulti;
+	expected[2] = 10 * 10 + 6 * 6;
+	for ( k = 0; k < 3; k++ )
+	{
+		wkb = pc_bytes_from_hexbytes(hexs[k], strlen(hexs[k]));
+		poly = pc_polygon_from_wkb(wkb, strlen(hexs[k])/2);
+		pcfree(wkb);
+		CU_ASSERT(poly != NULL);
+
+		/* The grid and the exact tests agree with testing every point */
+		if ( ! expected[k] )
+			expected[k] = test_polygon_count((PCPATCH*)pau, poly);
+		CU_ASSERT(expected[k] > 0);
+
+		pa = pc_patch_filter_polygon((PCPATCH*)pau, poly);
+		CU_ASSERT_EQUAL(pa->npoints, expected[k]);
+		CU_ASSERT_EQUAL(test_polygon_count(pa, poly), expected[k]);
+		pc_patch_free(pa);
+
+		pa = pc_patch_filter_polygon((PCPATCH*)pdl, poly);
+		CU_ASSERT_EQUAL(pa->type, PC_DIMENSIONAL);
+		CU_ASSERT_EQUAL(pa->npoints, expected[k]);
+		CU_ASSERT_EQUAL(test_polygon_count(pa, poly), expected[k]);
+		pc_patch_free(pa);
+
+		pc_polygon_free(poly);
+	}
+
+	/* Points with x + y over 119 are out of the triangle */
+	wkb = pc_bytes_from_hexbytes(hextriangle, strlen(hextriangle));
+	poly = pc_polygon_from_wkb(wkb, strlen(hextriangle)/2);
+	pcfree(wkb);
+	pa = pc_patch_filter_polygon((PCPATCH*)pau, poly);
+	CU_ASSERT_EQUAL(pa->npoints, npts - 79 * 80 / 2);
+	pc_patch_free(pa);
+
+	/* A polygon around the whole patch keeps it all */
+	poly->xy[2] = poly->xy[5] = 1000;
+	poly->bounds.xmax = poly->bounds.ymax = 1000;
+	pa = pc_patch_filter_polygon((PCPATCH*)pdl, poly);
+	CU_ASSERT_EQUAL(pa->npoints, npts);
+	pc_patch_free(pa);
+
+	/* And one away from it keeps nothing */
+	for ( i = 0; i < poly->npoints * 2; i++ )
+		poly->xy[i] += 2000;
+	poly->bounds.xmin += 2000;
+	poly->bounds.ymin += 2000;
+	poly->bounds.xmax += 2000;
+	poly->bounds.ymax += 2000;
+	pa = pc_patch_filter_polygon((PCPATCH*)pdl, poly);
+	CU_ASSERT_EQUAL(pa->npoints, 0);
+	pc_patch_free(pa);
+	pc_polygon_free(poly);
+
+	/* Points on the edges and vertices are in, on every side */
+	wkb = pc_bytes_from_hexbytes(hexedges, strlen(hexedges));
+	poly = pc_polygon_from_wkb(wkb, strlen(hexedges)/2);
+	pcfree(wkb);
+	CU_ASSERT(pc_polygon_contains(poly, 10, 15));
+	CU_ASSERT(pc_polygon_contains(poly, 20, 15));
+	CU_ASSERT(pc_polygon_contains(poly, 15, 10));
+	CU_ASSERT(pc_polygon_contains(poly, 15, 20));
+	CU_ASSERT(pc_polygon_contains(poly, 10, 10));
+	CU_ASSERT(pc_polygon_contains(poly, 20, 20));
+	CU_ASSERT(! pc_polygon_contains(poly, 20.001, 15));
+	CU_ASSERT(! pc_polygon_contains(poly, 15, 9.999));
+	pa = pc_patch_filter_polygon((PCPATCH*)pau, poly);
+	CU_ASSERT_EQUAL(pa->npoints, 11 * 11);
+	pc_patch_free(pa);
+	pa = pc_patch_filter_polygon((PCPATCH*)pdl, poly);
+	CU_ASSERT_EQUAL(pa->npoints, 11 * 11);
+	pc_patch_free(pa);
+
+	/* A diagonal edge, the triangle of (10,10), (20,10), (10,20) */
+	poly->xy[4] = 10;
+	poly->npoints = 4;
+	poly->rings[1] = 4;
+	memcpy(poly->xy + 6, poly->xy, 2 * sizeof(double));
+	CU_ASSERT(pc_polygon_contains(poly, 15, 15));
+	CU_ASSERT(! pc_polygon_contains(poly, 15, 15.001));
+	pa = pc_patch_filter_polygon((PCPATCH*)pdl, poly);
+	CU_ASSERT_EQUAL(pa->npoints, 11 * 12 / 2);
+	pc_patch_free(pa);
+
+	/* Edges along the bounds of the patch, (0,0), (99,0), (0,99) */
+	poly->xy[0] = poly->xy[1] = poly->xy[3] = poly->xy[4] = 0;
+	poly->xy[2] = poly->xy[5] = 99;
+	memcpy(poly->xy + 6, poly->xy, 2 * sizeof(double));
+	poly->bounds.xmin = poly->bounds.ymin = 0;
+	poly->bounds.xmax = poly->bounds.ymax = 99;
+	pa = pc_patch_filter_polygon((PCPATCH*)pdl, poly);
+	CU_ASSERT_EQUAL(pa->npoints, npts / 2 + 50);
+	pc_patch_free(pa);
+	pc_polygon_free(poly);
+
+	/* Other geometries are refused */
+	wkb = pc_bytes_from_hexbytes(hexpoint, strlen(hexpoint));
+	CU_ASSERT(pc_polygon_from_wkb(wkb, strlen(hexpoint)/2) == NULL);
+	CU_ASSERT(pc_polygon_from_wkb(wkb, 3) == NULL);
+	pcfree(wkb);
+
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pau);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_grid()
+{
+	int i, j, r, c;
+	int npts = 100 * 100;
+	PCPOINTLIST *pl;
+	PCPATCH_UNCOMPRESSED *pau;
+	PCPATCH_DIMENSIONAL *pdl, *pdlu;
+	PCDIMENSION *z = pc_schema_get_dimension_by_name(simpleschema, "Z");
+	PCDIMENSION *intensity = pc_schema_get_dimension_by_name(simpleschema, "intensity");
+	PCGRID *grid, *grid2;
+	PCPATCH *pa;
+	PCBOUNDS bounds;
+	double vals[120];
+	uint8_t isnull[120];
+	uint8_t *wkb;
+	size_t wkbsize;
+	uint16_t u16;
+	double d;
+
+	/* Points in the middle of unit squares, 100 to a cell of 10 */
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < 100; i++ )
+	{
+		for ( j = 0; j < 100; j++ )
+		{
+			PCPOINT *pt = pc_point_make(simpleschema);
+			pc_point_set_double_by_name(pt, "x", i + 0.5);
+			pc_point_set_double_by_name(pt, "y", j + 0.5);
+			pc_point_set_double_by_name(pt, "Z", i * j);
+			pc_point_set_double_by_name(pt, "intensity", i);
+			pc_pointlist_add_point(pl, pt);
+		}
+	}
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+	pdlu = pc_patch_dimensional_from_pointlist(pl);
+	pdl = pc_patch_dimensional_compress(pdlu, NULL);
+	pc_patch_free((PCPATCH*)pdlu);
+
+	CU_ASSERT_EQUAL(pc_grid_agg_number("AVG"), PC_GRID_AVG);
+	CU_ASSERT_EQUAL(pc_grid_agg_number("median"), -1);
+	CU_ASSERT_STRING_EQUAL(pc_grid_agg_name(PC_GRID_MAX), "max");
+	CU_ASSERT(pc_grid_new(0) == NULL);
+
+	grid = pc_grid_from_patch((PCPATCH*)pau, 10, z);
+	CU_ASSERT_EQUAL(grid->ix, 0);
+	CU_ASSERT_EQUAL(grid->iy, 0);
+	CU_ASSERT_EQUAL(grid->nx, 10);
+	CU_ASSERT_EQUAL(grid->ny, 10);
+
+	/* Rows come from the north */
+	CU_ASSERT_EQUAL(pc_grid_get_values(grid, PC_GRID_MAX, vals, isnull), PC_SUCCESS);
+	for ( r = 0; r < 10; r++ )
+	{
+		for ( c = 0; c < 10; c++ )
+		{
+			CU_ASSERT_EQUAL(isnull[r * 10 + c], 0);
+			CU_ASSERT_DOUBLE_EQUAL(vals[r * 10 + c], (10 * c + 9) * (10 * (9 - r) + 9), 0.000001);
+		}
+	}
+	pc_grid_get_values(grid, PC_GRID_MIN, vals, NULL);
+	CU_ASSERT_DOUBLE_EQUAL(vals[0], 0, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(vals[9], 8100, 0.000001);
+	pc_grid_get_values(grid, PC_GRID_COUNT, vals, NULL);
+	CU_ASSERT_DOUBLE_EQUAL(vals[42], 100, 0.000001);
+	CU_ASSERT_EQUAL(pc_grid_get_values(grid, PC_GRID_NUM_AGGS, vals, NULL), PC_FAILURE);
+
+	/* A grid of the column decoded patch is the same */
+	grid2 = pc_grid_from_patch((PCPATCH*)pdl, 10, z);
+	CU_ASSERT_EQUAL(grid2->nx, 10);
+	CU_ASSERT_EQUAL(memcmp(grid->count, grid2->count, 100 * sizeof(uint32_t)), 0);
+	CU_ASSERT_EQUAL(memcmp(grid->sum, grid2->sum, 100 * sizeof(double)), 0);
+	CU_ASSERT_EQUAL(memcmp(grid->max, grid2->max, 100 * sizeof(double)), 0);
+	pc_grid_free(grid2);
+	pc_grid_free(grid);
+
+	/* Halves of the patch binned apart and merged */
+	grid = pc_grid_new(10);
+	pa = pc_patch_range((PCPATCH*)pdl, 5001, 5000);
+	CU_ASSERT_EQUAL(pc_grid_extend(grid, &(pa->bounds)), PC_SUCCESS);
+	CU_ASSERT_EQUAL(pc_grid_add_patch(grid, pa, intensity), PC_SUCCESS);
+	CU_ASSERT_EQUAL(grid->ix, 5);
+	CU_ASSERT_EQUAL(grid->nx, 5);
+	pc_patch_free(pa);
+	pa = pc_patch_range((PCPATCH*)pdl, 1, 5000);
+	grid2 = pc_grid_from_patch(pa, 10, intensity);
+	CU_ASSERT_EQUAL(pc_grid_merge(grid, grid2), PC_SUCCESS);
+	CU_ASSERT_EQUAL(grid->ix, 0);
+	CU_ASSERT_EQUAL(grid->nx, 10);
+	pc_grid_free(grid2);
+	pc_patch_free(pa);
+	pc_grid_get_values(grid, PC_GRID_AVG, vals, isnull);
+	for ( c = 0; c < 10; c++ )
+		CU_ASSERT_DOUBLE_EQUAL(vals[50 + c], 10 * c + 4.5, 0.000001);
+
+	/* Cells of other sizes do not merge */
+	grid2 = pc_grid_new(5);
+	CU_ASSERT_EQUAL(pc_grid_merge(grid, grid2), PC_FAILURE);
+	pc_grid_free(grid2);
+
+	/* The grid grows south west, with empty cells there */
+	bounds.xmin = -15;
+	bounds.xmax = -15;
+	bounds.ymin = 5;
+	bounds.ymax = 5;
+	CU_ASSERT_EQUAL(pc_grid_extend(grid, &bounds), PC_SUCCESS);
+	CU_ASSERT_EQUAL(grid->ix, -2);
+	CU_ASSERT_EQUAL(grid->nx, 12);
+	CU_ASSERT_EQUAL(grid->ny, 10);
+	pc_grid_get_values(grid, PC_GRID_SUM, vals, isnull);
+	CU_ASSERT_EQUAL(isnull[0], 1);
+	CU_ASSERT_EQUAL(isnull[2], 0);
+	CU_ASSERT_DOUBLE_EQUAL(vals[2], 450, 0.000001);
+
+	/* The raster of the grid, upper left corner at -20,100 */
+	wkb = pc_grid_to_raster_wkb(grid, PC_GRID_AVG, 4326, &wkbsize);
+	CU_ASSERT_EQUAL(wkbsize, 61 + 1 + 8 + 120 * 8);
+	memcpy(&u16, wkb + 3, 2);
+	CU_ASSERT_EQUAL(u16, 1);
+	memcpy(&d, wkb + 5 + 8, 8);
+	CU_ASSERT_DOUBLE_EQUAL(d, -10, 0.000001);
+	memcpy(&d, wkb + 5 + 16, 8);
+	CU_ASSERT_DOUBLE_EQUAL(d, -20, 0.000001);
+	memcpy(&d, wkb + 5 + 24, 8);
+	CU_ASSERT_DOUBLE_EQUAL(d, 100, 0.000001);
+	memcpy(&u16, wkb + 57, 2);
+	CU_ASSERT_EQUAL(u16, 12);
+	CU_ASSERT_EQUAL(wkb[61], 11 | 64);
+	memcpy(&d, wkb + 62 + 8 + 2 * 8, 8);
+	CU_ASSERT_DOUBLE_EQUAL(d, 4.5, 0.000001);
+	pcfree(wkb);
+	pc_grid_free(grid);
+
+	/* A fixed grid leaves out the points outside of it */
+	grid = pc_grid_new(10);
+	bounds.xmin = bounds.ymin = 0;
+	bounds.xmax = bounds.ymax = 15;
+	pc_grid_extend(grid, &bounds);
+	pc_grid_add_patch(grid, (PCPATCH*)pau, NULL);
+	pc_grid_get_values(grid, PC_GRID_COUNT, vals, NULL);
+	CU_ASSERT_DOUBLE_EQUAL(vals[0] + vals[1] + vals[2] + vals[3], 400, 0.000001);
+	pc_grid_free(grid);
+
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pau);
+	pc_pointlist_free(pl);
+}
+
+static int
+test_double_cmp(const void *a, const void *b)
+{
+	double da = *(const double*)a, db = *(const double*)b;
+	return da < db ? -1 : ( da > db );
+}
+
+/* Distance of the kth point nearest to x, y, z, testing every point */
+static double
+test_knn_distance(const PCPATCH *pa, double x, double y, double z, int usez, uint32_t k)
+{
+	double *d = pcalloc(pa->npoints * sizeof(double));
+	double px, py, pz, dk;
+	uint32_t i;
+	for ( i = 1; i <= pa->npoints; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(pa, i);
+		pc_point_get_x(pt, &px);
+		pc_point_get_y(pt, &py);
+		pc_point_get_z(pt, &pz);
+		d[i - 1] = (px - x) * (px - x) + (py - y) * (py - y) + ( usez ? (pz - z) * (pz - z) : 0 );
+		pc_point_free(pt);
+	}
+	qsort(d, pa->npoints, sizeof(double), test_double_cmp);
+	dk = sqrt(d[k - 1]);
+	pcfree(d);
+	return dk;
+}
+
+static void
+test_patch_knn()
+{
+	int i, j;
+	int npts = 100 * 100;
+	PCPOINTLIST *pl;
+	PCPATCH_UNCOMPRESSED *pau;
+	PCPATCH_DIMENSIONAL *pdl, *pdlu;
+	PCPATCH *pa, *pa1, *pa2;
+	PCPOINT *pt;
+	PCKNN *knn;
+	double x, y, d;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < 100; i++ )
+	{
+		for ( j = 0; j < 100; j++ )
+		{
+			pt = pc_point_make(simpleschema);
+			pc_point_set_double_by_name(pt, "x", i);
+			pc_point_set_double_by_name(pt, "y", j);
+			pc_point_set_double_by_name(pt, "Z", (i * j) % 97);
+			pc_point_set_double_by_name(pt, "intensity", i);
+			pc_pointlist_add_point(pl, pt);
+		}
+	}
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+	pdlu = pc_patch_dimensional_from_pointlist(pl);
+	pdl = pc_patch_dimensional_compress(pdlu, NULL);
+	pc_patch_free((PCPATCH*)pdlu);
+
+	CU_ASSERT(pc_patch_knn((PCPATCH*)pau, 0, 0, 0, 0, 0) == NULL);
+	CU_ASSERT_DOUBLE_EQUAL(pc_bounds_distance(&(pau->bounds), 102, 103), 5, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pc_bounds_distance(&(pau->bounds), 50, 50), 0, 0.000001);
+
+	pa = pc_patch_knn((PCPATCH*)pau, 10.2, 20.1, 0, 0, 1);
+	CU_ASSERT_EQUAL(pa->npoints, 1);
+	pt = pc_patch_pointn(pa, 1);
+	pc_point_get_x(pt, &x);
+	pc_point_get_y(pt, &y);
+	CU_ASSERT_DOUBLE_EQUAL(x, 10, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(y, 20, 0.000001);
+	pc_point_free(pt);
+	pc_patch_free(pa);
+
+	/* The nearest comes first, then the four at 1 */
+	pa1 = pc_patch_knn((PCPATCH*)pau, 50, 50, 0, 0, 5);
+	pa2 = pc_patch_knn((PCPATCH*)pdl, 50, 50, 0, 0, 5);
+	CU_ASSERT_EQUAL(pa1->npoints, 5);
+	CU_ASSERT_EQUAL(pa2->npoints, 5);
+	CU_ASSERT_EQUAL(memcmp(((PCPATCH_UNCOMPRESSED*)pa1)->data, ((PCPATCH_UNCOMPRESSED*)pa2)->data, 5 * simpleschema->size), 0);
+	pt = pc_patch_pointn(pa1, 1);
+	pc_point_get_x(pt, &x);
+	pc_point_get_y(pt, &y);
+	CU_ASSERT_DOUBLE_EQUAL(x, 50, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(y, 50, 0.000001);
+	pc_point_free(pt);
+	CU_ASSERT_DOUBLE_EQUAL(pa1->bounds.xmax - pa1->bounds.xmin, 2, 0.000001);
+	pc_patch_free(pa1);
+	pc_patch_free(pa2);
+
+	/* Same distances as testing every point, in 2d and 3d */
+	knn = pc_knn_new(simpleschema, 33.3, 66.6, 40, 1, 7);
+	CU_ASSERT(isinf(pc_knn_max_distance(knn)));
+	pc_knn_add_patch(knn, (PCPATCH*)pdl);
+	d = test_knn_distance((PCPATCH*)pau, 33.3, 66.6, 40, 1, 7);
+	CU_ASSERT_DOUBLE_EQUAL(pc_knn_max_distance(knn), d, 0.000001);
+	CU_ASSERT(d > test_knn_distance((PCPATCH*)pau, 33.3, 66.6, 40, 0, 7));
+	pc_knn_free(knn);
+
+	/* Across halves of the patch, the far one passed over by its bounds */
+	pa1 = pc_patch_range((PCPATCH*)pdl, 1, 5000);
+	pa2 = pc_patch_range((PCPATCH*)pdl, 5001, 5000);
+	knn = pc_knn_new(simpleschema, 80.3, 10.4, 0, 0, 9);
+	CU_ASSERT_SUCCESS(pc_knn_add_patch(knn, pa2));
+	d = pc_knn_max_distance(knn);
+	CU_ASSERT_SUCCESS(pc_knn_add_patch(knn, pa1));
+	CU_ASSERT_DOUBLE_EQUAL(pc_knn_max_distance(knn), d, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(d, test_knn_distance((PCPATCH*)pau, 80.3, 10.4, 0, 0, 9), 0.000001);
+	pc_knn_free(knn);
+
+	/* And the near one found whatever the order */
+	knn = pc_knn_new(simpleschema, 30.3, 10.4, 0, 0, 9);
+	CU_ASSERT_SUCCESS(pc_knn_add_patch(knn, pa2));
+	CU_ASSERT_SUCCESS(pc_knn_add_patch(knn, pa1));
+	CU_ASSERT_DOUBLE_EQUAL(pc_knn_max_distance(knn), test_knn_distance((PCPATCH*)pau, 30.3, 10.4, 0, 0, 9), 0.000001);
+	pa = (PCPATCH*)pc_knn_get_patch(knn);
+	CU_ASSERT_EQUAL(pa->npoints, 9);
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.xmax, 31, 0.000001);
+	pc_patch_free(pa);
+	pc_knn_free(knn);
+	pc_patch_free(pa1);
+	pc_patch_free(pa2);
+
+	/* Fewer points than asked for */
+	pa1 = pc_patch_range((PCPATCH*)pau, 1, 3);
+	pa = pc_patch_knn(pa1, 0, 0, 0, 0, 10);
+	CU_ASSERT_EQUAL(pa->npoints, 3);
+	pc_patch_free(pa);
+	pc_patch_free(pa1);
+
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pau);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_decimate()
+{
+	int i, npts = 1000;
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH_UNCOMPRESSED *pau;
+	PCPATCH_DIMENSIONAL *pdl, *pdlu;
+	PCPATCH *pa, *pa2;
+	char *str1, *str2;
+	double z, zlast, cellsize;
+	uint8_t cells[40 * 25];
+
+	/* A 40 by 25 grid, z counting the points */
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i % 40);
+		pc_point_set_double_by_name(pt, "y", i / 40);
+		pc_point_set_double_by_name(pt, "Z", i);
+		pc_point_set_double_by_name(pt, "intensity", i % 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+	pdlu = pc_patch_dimensional_from_pointlist(pl);
+	pdl = pc_patch_dimensional_compress(pdlu, NULL);
+	pc_patch_free((PCPATCH*)pdlu);
+
+	CU_ASSERT_EQUAL(pc_decimation_number("Random"), PC_DECIMATE_RANDOM);
+	CU_ASSERT_EQUAL(pc_decimation_number("nope"), -1);
+	CU_ASSERT_STRING_EQUAL(pc_decimation_name(PC_DECIMATE_GRID), "grid");
+	CU_ASSERT(pc_patch_decimate((PCPATCH*)pau, npts, PC_DECIMATE_STRIDE) == NULL);
+	CU_ASSERT(pc_patch_decimate((PCPATCH*)pau, PC_DECIMATE_STRIDE, npts) == (PCPATCH*)pau);
+	pa = pc_patch_decimate((PCPATCH*)pau, PC_DECIMATE_STRIDE, 0);
+	CU_ASSERT_EQUAL(pa->npoints, 0);
+	pc_patch_free(pa);
+
+	/* Every tenth point, the same from both patches */
+	pa = pc_patch_decimate((PCPATCH*)pau, PC_DECIMATE_STRIDE, 100);
+	pa2 = pc_patch_decimate((PCPATCH*)pdl, PC_DECIMATE_STRIDE, 100);
+	CU_ASSERT_EQUAL(pa->npoints, 100);
+	CU_ASSERT_EQUAL(pa2->type, PC_DIMENSIONAL);
+	for ( i = 0; i < 100; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(pa, i + 1);
+		pc_point_get_double_by_name(pt, "Z", &z);
+		CU_ASSERT_DOUBLE_EQUAL(z, 10 * i, 0.000001);
+		pc_point_free(pt);
+	}
+	str1 = pc_patch_to_string(pa);
+	str2 = pc_patch_to_string(pa2);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	CU_ASSERT_DOUBLE_EQUAL(pa2->bounds.ymax, 24, 0.000001);
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pa);
+	pc_patch_free(pa2);
+
+	/* Random draws keep the order of the points and repeat themselves */
+	pa = pc_patch_decimate((PCPATCH*)pau, PC_DECIMATE_RANDOM, 100);
+	pa2 = pc_patch_decimate((PCPATCH*)pdl, PC_DECIMATE_RANDOM, 100);
+	CU_ASSERT_EQUAL(pa->npoints, 100);
+	zlast = -1;
+	for ( i = 0; i < 100; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(pa, i + 1);
+		pc_point_get_double_by_name(pt, "Z", &z);
+		CU_ASSERT(z > zlast);
+		zlast = z;
+		pc_point_free(pt);
+	}
+	str1 = pc_patch_to_string(pa);
+	str2 = pc_patch_to_string(pa2);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pa);
+	pc_patch_free(pa2);
+
+	/* At most one point per cell, over the whole patch */
+	cellsize = sqrt(39 * 24 / 100.0);
+	pa = pc_patch_decimate((PCPATCH*)pdl, PC_DECIMATE_GRID, 100);
+	CU_ASSERT_EQUAL(pa->type, PC_DIMENSIONAL);
+	CU_ASSERT(pa->npoints > 50);
+	CU_ASSERT(pa->npoints <= 300);
+	memset(cells, 0, sizeof(cells));
+	for ( i = 0; i < (int)pa->npoints; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(pa, i + 1);
+		double x, y;
+		int c;
+		pc_point_get_x(pt, &x);
+		pc_point_get_y(pt, &y);
+		c = (int)(y / cellsize) * 40 + (int)(x / cellsize);
+		CU_ASSERT_EQUAL(cells[c], 0);
+		cells[c] = 1;
+		pc_point_free(pt);
+	}
+	CU_ASSERT(pa->bounds.xmax > 35);
+	CU_ASSERT(pa->bounds.ymax > 20);
+	pc_patch_free(pa);
+
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pau);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_counters()
+{
+	int i, op, npts = 1000;
+	uint64_t encodes = 0;
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH_UNCOMPRESSED *pau;
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *pa;
+	PCCOUNTER c;
+	const char *name[] = { "Z" };
+
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i % 40);
+		pc_point_set_double_by_name(pt, "y", i / 40);
+		pc_point_set_double_by_name(pt, "Z", npts - i);
+		pc_point_set_double_by_name(pt, "intensity", i % 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+
+	CU_ASSERT_STRING_EQUAL(pc_counter_name(PC_OP_DIM_DECODE + PC_DIM_ZLIB), "decode zlib");
+	CU_ASSERT_STRING_EQUAL(pc_counter_name(PC_OP_DESERIALIZE), "deserialize");
+	CU_ASSERT_STRING_EQUAL(pc_counter_name(PC_NUM_OPS), "UNKNOWN");
+	CU_ASSERT_EQUAL(pc_counter_get(PC_NUM_OPS, &c), PC_FAILURE);
+
+	pc_counters_reset();
+	pc_counters_enable(PC_TRUE);
+
+	pa = pc_patch_filter_between_by_name((PCPATCH*)pau, "x", 9.5, 19.5);
+	pc_counter_get(PC_OP_FILTER, &c);
+	CU_ASSERT_EQUAL(c.calls, 1);
+	CU_ASSERT_EQUAL(c.points, npts);
+	CU_ASSERT_EQUAL(c.bytesin, pau->datasize);
+	CU_ASSERT_EQUAL(c.bytesout, pa->npoints * simpleschema->size);
+	CU_ASSERT_EQUAL(pa->npoints, 250);
+	pc_patch_free(pa);
+
+	pa = pc_patch_sort((PCPATCH*)pau, name, 1);
+	pc_counter_get(PC_OP_SORT, &c);
+	CU_ASSERT_EQUAL(c.calls, 1);
+	CU_ASSERT_EQUAL(c.points, npts);
+	pc_patch_free(pa);
+
+	/* Every dimension gets encoded at least once */
+	pdl = pc_patch_dimensional_from_uncompressed(pau);
+	pa = (PCPATCH*)pc_patch_dimensional_compress(pdl, NULL);
+	for ( op = PC_OP_DIM_ENCODE; op < PC_OP_DIM_ENCODE + PC_DIM_NUM_COMPRESSIONS; op++ )
+	{
+		pc_counter_get(op, &c);
+		encodes += c.calls;
+		CU_ASSERT_EQUAL(c.points, c.calls * npts);
+	}
+	CU_ASSERT(encodes >= simpleschema->ndims);
+	pc_counter_get(PC_OP_ALLOC, &c);
+	CU_ASSERT(c.calls > 0);
+	CU_ASSERT(c.bytesout >= pau->datasize);
+	pc_patch_free((PCPATCH*)pdl);
+
+	/* Nothing is counted once counting is off */
+	pc_counters_enable(PC_FALSE);
+	pc_patch_free(pa);
+	pa = pc_patch_filter_between_by_name((PCPATCH*)pau, "x", 9.5, 19.5);
+	pc_counter_get(PC_OP_FILTER, &c);
+	CU_ASSERT_EQUAL(c.calls, 1);
+	pc_patch_free(pa);
+
+	pc_counters_reset();
+	for ( op = 0; op < PC_NUM_OPS; op++ )
+	{
+		pc_counter_get(op, &c);
+		CU_ASSERT_EQUAL(c.calls + c.points + c.bytesin + c.bytesout + c.nanos, 0);
+	}
+
+	pc_patch_free((PCPATCH*)pau);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_readonly_no_copy()
+{
+	int i, j;
+	int npts = 50;
+	PCPOINTLIST *pl;
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH_UNCOMPRESSED *pu;
+	PCPATCH *pa;
+	double d1, d2;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i % 5);
+		pc_point_set_double_by_name(pt, "Z", i * 0.1);
+		pc_point_set_double_by_name(pt, "intensity", 100 - i);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = pc_patch_uncompressed_from_pointlist(pl);
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	pc_bytes_copied = 0;
+
+	/* Stats read off the dimensions match the uncompressed ones */
+	CU_ASSERT_EQUAL(pc_patch_compute_stats((PCPATCH*)pu), PC_SUCCESS);
+	CU_ASSERT_EQUAL(pc_patch_compute_stats((PCPATCH*)pdl), PC_SUCCESS);
+	for ( j = 0; j < simpleschema->ndims; j++ )
+	{
+		pc_point_get_double_by_index(&(pdl->stats->min), j, &d1);
+		pc_point_get_double_by_index(&(pu->stats->min), j, &d2);
+		CU_ASSERT_DOUBLE_EQUAL(d1, d2, 0.000001);
+		pc_point_get_double_by_index(&(pdl->stats->max), j, &d1);
+		pc_point_get_double_by_index(&(pu->stats->max), j, &d2);
+		CU_ASSERT_DOUBLE_EQUAL(d1, d2, 0.000001);
+		pc_point_get_double_by_index(&(pdl->stats->avg), j, &d1);
+		pc_point_get_double_by_index(&(pu->stats->avg), j, &d2);
+		CU_ASSERT_DOUBLE_EQUAL(d1, d2, 0.000001);
+	}
+
+	/* A range of uncompressed points is a view on them */
+	pa = pc_patch_range((PCPATCH*)pu, 11, 20);
+	CU_ASSERT_EQUAL(pa->npoints, 20);
+	CU_ASSERT(((PCPATCH_UNCOMPRESSED*)pa)->data == pu->data + 10 * simpleschema->size);
+	pc_point_get_double_by_name(&(pa->stats->min), "x", &d1);
+	CU_ASSERT_DOUBLE_EQUAL(d1, 10, 0.000001);
+	pc_patch_free(pa);
+
+	/* Filters only write out the survivors */
+	pa = pc_patch_filter((PCPATCH*)pdl, 0, PC_GT, 10, 0);
+	CU_ASSERT_EQUAL(pa->npoints, 39);
+	pc_patch_free(pa);
+	CU_ASSERT(pc_patch_filter_keeps_all((PCPATCH*)pu, 0, PC_GT, -1, 0));
+	CU_ASSERT(! pc_patch_filter_keeps_all((PCPATCH*)pu, 0, PC_GT, 10, 0));
+
+	/* Uncompressed dimensions are transposed without a copy first */
+	pa = (PCPATCH*)pc_patch_uncompressed_from_dimensional(pdl);
+	CU_ASSERT_EQUAL(memcmp(((PCPATCH_UNCOMPRESSED*)pa)->data, pu->data, pu->datasize), 0);
+	pc_patch_free(pa);
+
+	CU_ASSERT_EQUAL(pc_bytes_copied, 0);
+
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pu);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_pointlist_rows()
+{
+	int i;
+	int npts = 50;
+	PCPOINTLIST *pl, *pl2;
+	PCPATCH *pa, *pa2;
+	PCPOINT *pt;
+	uint8_t *data;
+	double d;
+
+	/* Starts small, so adding rows moves them */
+	pl = pc_pointlist_make_rows(simpleschema, 4);
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i);
+		pc_point_set_double_by_name(pt, "y", i % 5);
+		pc_point_set_double_by_name(pt, "Z", i * 0.1);
+		pc_point_set_double_by_name(pt, "intensity", 100 - i);
+		if ( i % 2 )
+			pc_pointlist_add_point(pl, pt);
+		else
+		{
+			pc_pointlist_add_row(pl, pt->data);
+			pc_point_free(pt);
+		}
+	}
+	CU_ASSERT_EQUAL(pl->npoints, npts);
+
+	/* The points are views into the rows, back to back */
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_pointlist_get_point(pl, i);
+		CU_ASSERT(pt->readonly);
+		CU_ASSERT(pt->data == pl->data + i * simpleschema->size);
+		pc_point_get_double_by_name(pt, "x", &d);
+		CU_ASSERT_DOUBLE_EQUAL(d, i, 0.000001);
+	}
+
+	/* Copying gives the same patch as taking over the rows */
+	pa2 = pc_patch_from_pointlist(pl);
+	data = pl->data;
+	pa = pc_patch_from_pointlist_take(pl);
+	CU_ASSERT_EQUAL(pl->npoints, 0);
+	CU_ASSERT(pl->data == NULL);
+	CU_ASSERT(((PCPATCH_UNCOMPRESSED*)pa)->data == data);
+	CU_ASSERT_EQUAL(pa->npoints, npts);
+	CU_ASSERT_EQUAL(memcmp(((PCPATCH_UNCOMPRESSED*)pa)->data, ((PCPATCH_UNCOMPRESSED*)pa2)->data, npts * simpleschema->size), 0);
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.xmax, npts - 1, 0.000001);
+	pc_point_get_double_by_name(&(pa->stats->max), "intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 100, 0.000001);
+	pc_pointlist_free(pl);
+	pc_patch_free(pa2);
+
+	/* Points of an uncompressed patch are views into its data */
+	pl = pc_pointlist_from_patch(pa);
+	CU_ASSERT(pc_pointlist_get_point(pl, 7)->data == ((PCPATCH_UNCOMPRESSED*)pa)->data + 7 * simpleschema->size);
+
+	/* Rows of a list that does not own them are copied */
+	pa2 = pc_patch_from_pointlist_take(pl);
+	CU_ASSERT(((PCPATCH_UNCOMPRESSED*)pa2)->data != ((PCPATCH_UNCOMPRESSED*)pa)->data);
+	CU_ASSERT_EQUAL(pl->npoints, npts);
+	pc_patch_free(pa2);
+
+	/* Decoding a dimensional patch hands its rows over to the list */
+	pa2 = pc_patch_compress(pa, NULL);
+	CU_ASSERT_EQUAL(pa2->type, PC_DIMENSIONAL);
+	pl2 = pc_pointlist_from_patch(pa2);
+	CU_ASSERT(pl2->data == pl2->mem);
+	pc_point_get_double_by_name(pc_pointlist_get_point(pl2, 49), "intensity", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 51, 0.000001);
+
+	pc_pointlist_free(pl2);
+	pc_pointlist_free(pl);
+	pc_patch_free(pa2);
+	pc_patch_free(pa);
+}
+
+static void
+test_patch_get_values()
+{
+	int i, c;
+	int npts = 100;
+	PCPOINTLIST *pl;
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *pa;
+	PCDIMSTATS *stats;
+	PCDIMENSION *zdim = pc_schema_get_dimension_by_name(simpleschema, "Z");
+	PCDIMENSION *idim = pc_schema_get_dimension_by_name(simpleschema, "Intensity");
+	double vals[120];
+	int comps[] = { PC_DIM_NONE, PC_DIM_RLE, PC_DIM_SIGBITS, PC_DIM_ZLIB };
 
+	pl = pc_pointlist_make(npts);
 	for ( i = 0; i < npts; i++ )
 	{
 		PCPOINT *pt = pc_point_make(simpleschema);
-		pc_point_set_double_by_name(pt, "x", i*2.123);
-		pc_point_set_double_by_name(pt, "y", i*2.9);
-		pc_point_set_double_by_name(pt, "Z", i*0.3099);
-		pc_point_set_double_by_name(pt, "intensity", 13);
-		pc_pointlist_add_point(pl1, pt);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i);
+		pc_point_set_double_by_name(pt, "Z", i * 0.1);
+		pc_point_set_double_by_name(pt, "Intensity", i / 10);
+		pc_pointlist_add_point(pl, pt);
 	}
 
-	pa1 = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl1);
-	wkb1 = pc_patch_to_wkb(pa1, &z1);
-	// str = pc_hexbytes_from_bytes(wkb1, z1);
-	// printf("str\n%s\n",str);
-	pa2 = pc_patch_from_wkb(simpleschema, wkb1, z1);
+	pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	CU_ASSERT_EQUAL(pc_patch_get_values(pa, zdim, vals), PC_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(vals[0], 0, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(vals[99], 9.9, 0.000001);
+	pc_patch_free(pa);
 
-	// printf("pa2\n%s\n",pc_patch_to_string(pa2));
+	/* Dimensional patches decode only the requested dimension */
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	stats = pc_dimstats_make(simpleschema);
+	pc_dimstats_update(stats, pdl);
+	stats->total_points = PCDIMSTATS_MIN_SAMPLE + 1;
+	for ( c = 0; c < 4; c++ )
+	{
+		for ( i = 0; i < simpleschema->ndims; i++ )
+			stats->stats[i].recommended_compression = comps[c];
+		pa = (PCPATCH*)pc_patch_dimensional_compress(pdl, stats);
+
+		memset(vals, 0, sizeof(vals));
+		CU_ASSERT_EQUAL(pc_patch_get_values(pa, zdim, vals), PC_SUCCESS);
+		for ( i = 0; i < npts; i++ )
+			CU_ASSERT_DOUBLE_EQUAL(vals[i], i * 0.1, 0.000001);
+		CU_ASSERT_EQUAL(pc_patch_get_values(pa, idim, vals), PC_SUCCESS);
+		CU_ASSERT_DOUBLE_EQUAL(vals[42], 4, 0.000001);
+		CU_ASSERT_DOUBLE_EQUAL(vals[99], 9, 0.000001);
+		pc_patch_free(pa);
+	}
 
-	pa3 = pc_patch_compress(pa2, NULL);
+	/* Several dimensions at once, one after the other */
+	pa = (PCPATCH*)pc_patch_dimensional_compress(pdl, stats);
+	for ( c = 0; c < 2; c++ )
+	{
+		PCDIMENSION *dims[2];
+		double mvals[200];
+		dims[0] = idim;
+		dims[1] = zdim;
+		CU_ASSERT_EQUAL(pc_patch_get_values_multi(pa, dims, 2, mvals), PC_SUCCESS);
+		CU_ASSERT_DOUBLE_EQUAL(mvals[42], 4, 0.000001);
+		CU_ASSERT_DOUBLE_EQUAL(mvals[100], 0, 0.000001);
+		CU_ASSERT_DOUBLE_EQUAL(mvals[199], 9.9, 0.000001);
+		pc_patch_free(pa);
+		pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	}
+	pc_patch_free(pa);
 
-	// printf("pa3\n%s\n",pc_patch_to_string(pa3));
+	pc_dimstats_free(stats);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_pointlist_free(pl);
+}
 
-	wkb2 = pc_patch_to_wkb(pa3, &z2);
-	pa4 = pc_patch_from_wkb(simpleschema, wkb2, z2);
-	pcfree(wkb2);
+static void
+test_patch_cursor()
+{
+	int i, c;
+	int npts = 2500;
+	PCPOINTLIST *pl;
+	PCPATCH_UNCOMPRESSED *pu;
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *patches[3];
+	int npatches = 0;
+	PCDIMSTATS *stats;
 
-	// printf("pa4\n%s\n",pc_patch_to_string(pa4));
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i % 7);
+		pc_point_set_double_by_name(pt, "Z", i * 0.1);
+		pc_point_set_double_by_name(pt, "Intensity", i / 10);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = pc_patch_uncompressed_from_pointlist(pl);
 
-	pu1 = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompressed_from_dimensional((PCPATCH_DIMENSIONAL*)pa1);
-	pu2 = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompressed_from_dimensional((PCPATCH_DIMENSIONAL*)pa4);
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	stats = pc_dimstats_make(simpleschema);
+	pc_dimstats_update(stats, pdl);
+	stats->total_points = PCDIMSTATS_MIN_SAMPLE + 1;
+	for ( i = 0; i < simpleschema->ndims; i++ )
+		stats->stats[i].recommended_compression = (i % 2) ? PC_DIM_RLE : PC_DIM_SIGBITS;
 
-	// printf("pu1\n%s\n", pc_patch_to_string((PCPATCH*)pu1));
-	// printf("pu2\n%s\n", pc_patch_to_string((PCPATCH*)pu2));
+	patches[npatches++] = (PCPATCH*)pu;
+	patches[npatches++] = (PCPATCH*)pc_patch_dimensional_compress(pdl, stats);
+#ifdef HAVE_LAZPERF
+	patches[npatches++] = (PCPATCH*)pc_patch_lazperf_from_uncompressed(pu);
+#endif
 
-	CU_ASSERT_EQUAL(pu1->datasize, pu2->datasize);
-	CU_ASSERT_EQUAL(pu1->npoints, pu2->npoints);
-	CU_ASSERT(memcmp(pu1->data, pu2->data, pu1->datasize) == 0);
+	/* Every patch type reads back the uncompressed points, in batches */
+	for ( c = 0; c < npatches; c++ )
+	{
+		PCPATCH_CURSOR *cur = pc_patch_cursor_new(patches[c], 1024);
+		const uint8_t *points;
+		uint32_t n, total = 0, nbatches = 0;
+
+		while ( (n = pc_patch_cursor_next(cur, &points)) )
+		{
+			CU_ASSERT(n <= 1024);
+			CU_ASSERT_EQUAL(memcmp(points, pu->data + (size_t)total * simpleschema->size, n * simpleschema->size), 0);
+			total += n;
+			nbatches++;
+		}
+		CU_ASSERT_EQUAL(total, npts);
+		CU_ASSERT_EQUAL(nbatches, 3);
+		/* Uncompressed points are read in place */
+		if ( patches[c]->type == PC_NONE )
+		{
+			pc_patch_cursor_free(cur);
+			cur = pc_patch_cursor_new(patches[c], 1024);
+			pc_patch_cursor_next(cur, &points);
+			CU_ASSERT(points == pu->data);
+		}
+		pc_patch_cursor_free(cur);
+	}
 
+	for ( c = 1; c < npatches; c++ )
+		pc_patch_free(patches[c]);
+	pc_dimstats_free(stats);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pu);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_dimensional_directory()
+{
+	int i;
+	int npts = 100;
+	PCPOINTLIST *pl;
+	PCPATCH_DIMENSIONAL *pdl, *pdl2;
+	PCPATCH_UNCOMPRESSED *pu1, *pu2;
+	PCDIMENTRY dir[4], olddir[4];
+	uint8_t *buf, *wkb, *wkb2;
+	size_t size, wkbsize;
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i % 7);
+		pc_point_set_double_by_name(pt, "Z", i * 0.1);
+		pc_point_set_double_by_name(pt, "Intensity", 13);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	pdl2 = pc_patch_dimensional_compress(pdl, NULL);
+
+	/* The directory locates every dimension */
+	size = pc_patch_dimensional_directory_serialized_size(pdl2);
+	CU_ASSERT_EQUAL(size, pc_patch_dimensional_serialized_size(pdl2) + 1 + 4 * simpleschema->ndims);
+	buf = pcalloc(size);
+	CU_ASSERT_EQUAL(pc_patch_dimensional_directory_serialize(pdl2, buf), PC_SUCCESS);
+	CU_ASSERT_EQUAL(buf[0], PC_DIMENSIONAL_DIRECTORY);
+	CU_ASSERT_EQUAL(pc_patch_dimensional_directory_read(buf, size, simpleschema->ndims, PC_FALSE, dir), PC_SUCCESS);
+	for ( i = 0; i < simpleschema->ndims; i++ )
+	{
+		CU_ASSERT_EQUAL(dir[i].size, pdl2->bytes[i].size);
+		CU_ASSERT_EQUAL(dir[i].compression, pdl2->bytes[i].compression);
+		CU_ASSERT_EQUAL(memcmp(buf + dir[i].offset, pdl2->bytes[i].bytes, dir[i].size), 0);
+	}
+	CU_ASSERT_EQUAL(dir[3].offset + dir[3].size, size);
+
+	/* The older layout is still readable */
+	wkb = pc_patch_to_wkb((PCPATCH*)pdl2, &wkbsize);
+	CU_ASSERT_EQUAL(pc_patch_dimensional_directory_read(wkb + 13, wkbsize - 13, simpleschema->ndims, PC_FALSE, olddir), PC_SUCCESS);
+	for ( i = 0; i < simpleschema->ndims; i++ )
+	{
+		CU_ASSERT_EQUAL(olddir[i].size, dir[i].size);
+		CU_ASSERT_EQUAL(olddir[i].compression, dir[i].compression);
+		CU_ASSERT_EQUAL(memcmp(wkb + 13 + olddir[i].offset, buf + dir[i].offset, dir[i].size), 0);
+	}
+
+	/* And so is wkb carrying a directory */
+	wkb2 = pcalloc(13 + size);
+	memcpy(wkb2, wkb, 13);
+	memcpy(wkb2 + 13, buf, size);
+	pc_patch_free((PCPATCH*)pdl);
+	pdl = (PCPATCH_DIMENSIONAL*)pc_patch_dimensional_from_wkb(simpleschema, wkb2, 13 + size);
+	pu1 = pc_patch_uncompressed_from_dimensional(pdl);
+	pu2 = pc_patch_uncompressed_from_dimensional(pdl2);
+	CU_ASSERT_EQUAL(pu1->datasize, pu2->datasize);
+	CU_ASSERT_EQUAL(memcmp(pu1->data, pu2->data, pu1->datasize), 0);
 
-	pc_pointlist_free(pl1);
-	pc_patch_free(pa1);
-	pc_patch_free(pa2);
-	pc_patch_free(pa3);
-	pc_patch_free(pa4);
 	pc_patch_free((PCPATCH*)pu1);
 	pc_patch_free((PCPATCH*)pu2);
-	pcfree(wkb1);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pdl2);
+	pcfree(wkb);
+	pcfree(wkb2);
+	pcfree(buf);
+	pc_pointlist_free(pl);
 }
 
-
 static void
-test_patch_filter()
+test_patch_dimstats_reuse()
 {
 	int i;
-	int npts = 20;
-	PCPOINTLIST *pl1, *pl2;
-	PCPATCH *pa1, *pa2, *pa3, *pa4;
-	char *str1, *str2;
+	int npts = PCDIMSTATS_MIN_SAMPLE;
+	PCPOINTLIST *pl;
+	PCPATCH *pa, *pa2;
+	PCDIMSTATS *pds = pc_dimstats_make(simpleschema);
 
-	pl1 = pc_pointlist_make(npts);
-	pl2 = pc_pointlist_make(npts);
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i % 7);
+		pc_point_set_double_by_name(pt, "Z", i * 0.1);
+		pc_point_set_double_by_name(pt, "Intensity", 13);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pa = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl);
+	CU_ASSERT_EQUAL(pc_patch_compute_stats(pa), PC_SUCCESS);
+
+	/* The first patch fills the sample */
+	pa2 = pc_patch_compress(pa, pds);
+	pc_patch_free(pa2);
+	CU_ASSERT_EQUAL(pds->total_points, npts);
+	CU_ASSERT_EQUAL(pds->total_patches, 1);
+	CU_ASSERT_EQUAL(pds->stats[3].recommended_compression, PC_DIM_RLE);
+
+	/* Later ones reuse its recommendations */
+	pa2 = pc_patch_compress(pa, pds);
+	CU_ASSERT_EQUAL(pds->total_patches, 1);
+	CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL*)pa2)->bytes[3].compression, PC_DIM_RLE);
+	pc_patch_free(pa2);
+
+	pc_patch_free(pa);
+	pc_dimstats_free(pds);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_patch_dimstats_trial()
+{
+	int i, j, c;
+	int npts = 1000;
+	PCPOINTLIST *pl;
+	PCPATCH_DIMENSIONAL *pdl;
+	PCDIMSTATS *pds;
+	char *str;
 
+	pl = pc_pointlist_make(npts);
 	for ( i = 0; i < npts; i++ )
 	{
-		PCPOINT *pt1 = pc_point_make(simpleschema);
-		PCPOINT *pt2 = pc_point_make(simpleschema);
-		pc_point_set_double_by_name(pt1, "x", i);
-		pc_point_set_double_by_name(pt1, "y", i);
-		pc_point_set_double_by_name(pt1, "Z", i*0.1);
-		pc_point_set_double_by_name(pt1, "intensity", 100-i);
-		pc_pointlist_add_point(pl1, pt1);
-		pc_point_set_double_by_name(pt2, "x", i);
-		pc_point_set_double_by_name(pt2, "y", i);
-		pc_point_set_double_by_name(pt2, "Z", i*0.1);
-		pc_point_set_double_by_name(pt2, "intensity", 100-i);
-		pc_pointlist_add_point(pl2, pt2);
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i % 7);
+		pc_point_set_double_by_name(pt, "Z", i * 0.1);
+		pc_point_set_double_by_name(pt, "Intensity", 13);
+		pc_pointlist_add_point(pl, pt);
 	}
+	pdl = pc_patch_dimensional_from_pointlist(pl);
 
-	// PCPATCH* pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2);
+	/* Smallest trial wins, and the trials are the real sizes */
+	pds = pc_dimstats_make(simpleschema);
+	pds->objective = PC_TRIAL_SIZE;
+	CU_ASSERT_EQUAL(pc_dimstats_update(pds, pdl), PC_SUCCESS);
+	for ( j = 0; j < simpleschema->ndims; j++ )
+	{
+		const PCDIMSTAT *stat = &(pds->stats[j]);
+		for ( c = 0; c < PC_DIM_NUM_COMPRESSIONS; c++ )
+		{
+			PCBYTES epcb;
+			if ( ! pc_bytes_compression_available(c) )
+				continue;
+			epcb = pc_bytes_encode(pdl->bytes[j], c);
+			CU_ASSERT_EQUAL(stat->trials[c].size, epcb.size + epcb.indexsize);
+			CU_ASSERT(stat->trials[stat->recommended_compression].size <= epcb.size + epcb.indexsize);
+			pc_bytes_free(epcb);
+		}
+	}
+	/* Runs cap at 255 points, so a constant takes fewer bytes with sigbits */
+	CU_ASSERT_EQUAL(pds->stats[3].recommended_compression, PC_DIM_SIGBITS);
+	str = pc_dimstats_to_string(pds);
+	CU_ASSERT(strstr(str, "\"trials\":[{\"size\":") != NULL);
+	pcfree(str);
+	pc_dimstats_free(pds);
 
-	pa1 = (PCPATCH*)pc_patch_dimensional_from_pointlist(pl1);
-	// printf("pa1\n%s\n", pc_patch_to_string(pa1));
-	pa2 = pc_patch_filter(pa1, 0, PC_GT, 17, 20);
-	str1 = pc_patch_to_string(pa2);
-	// printf("pa2\n%s\n", str1);
-	CU_ASSERT_STRING_EQUAL(str1, "{\"pcid\":0,\"pts\":[[18,18,1.8,82],[19,19,1.9,81]]}");
+	/* Fastest still has to compress */
+	pds = pc_dimstats_make(simpleschema);
+	pds->objective = PC_TRIAL_SPEED;
+	CU_ASSERT_EQUAL(pc_dimstats_update(pds, pdl), PC_SUCCESS);
+	for ( j = 0; j < simpleschema->ndims; j++ )
+	{
+		const PCDIMSTAT *stat = &(pds->stats[j]);
+		CU_ASSERT(stat->recommended_compression != PC_DIM_NONE);
+		CU_ASSERT(stat->trials[stat->recommended_compression].size < stat->trials[PC_DIM_NONE].size);
+	}
+	pc_dimstats_free(pds);
 
-	pa3 = (PCPATCH*)pc_patch_uncompressed_from_pointlist(pl2);
-	// printf("\npa3\n%s\n", pc_patch_to_string(pa3));
-	pa4 = pc_patch_filter(pa3, 0, PC_GT, 17, 20);
-	str2 = pc_patch_to_string(pa4);
-	// printf("\npa4\n%s\n", str2);
-	CU_ASSERT_STRING_EQUAL(str2, "{\"pcid\":0,\"pts\":[[18,18,1.8,82],[19,19,1.9,81]]}");
+	pc_patch_free((PCPATCH*)pdl);
+	pc_pointlist_free(pl);
+}
 
-	pcfree(str1);
-	pcfree(str2);
+static void
+test_patch_dimensional_threads()
+{
+	int i, j, t;
+	int npts = PC_POOL_MIN_POINTS * 2;
+	int nthreads = pc_get_num_threads();
+	int threads[] = { 1, 2, 4 };
+	int comps[] = { PC_DIM_ZLIB, PC_DIM_RLE, PC_DIM_SIGBITS, PC_DIM_ZLIB };
+	PCPOINTLIST *pl;
+	PCPATCH_DIMENSIONAL *pdl, *pdl_serial = NULL;
+	PCPATCH_DIMENSIONAL *pdl2, *pdl3;
+	PCDIMSTATS *pds;
 
-	pc_pointlist_free(pl1);
-	pc_pointlist_free(pl2);
-	pc_patch_free(pa1);
-	pc_patch_free(pa3);
-	pc_patch_free(pa4);
-	pc_patch_free(pa2);
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i * 0.01);
+		pc_point_set_double_by_name(pt, "Y", i % 97);
+		pc_point_set_double_by_name(pt, "Z", i / 100);
+		pc_point_set_double_by_name(pt, "Intensity", i % 3);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	pds = pc_dimstats_make(simpleschema);
+	pc_dimstats_update(pds, pdl);
+	for ( j = 0; j < simpleschema->ndims; j++ )
+		pds->stats[j].recommended_compression = comps[j];
 
-	return;
+	/* Any number of threads writes out the same bytes */
+	for ( t = 0; t < 3; t++ )
+	{
+		pc_set_num_threads(threads[t]);
+#ifdef HAVE_PTHREAD
+		CU_ASSERT_EQUAL(pc_get_num_threads(), threads[t]);
+#else
+		CU_ASSERT_EQUAL(pc_get_num_threads(), 1);
+#endif
+		pdl2 = pc_patch_dimensional_compress(pdl, pds);
+		pdl3 = pc_patch_dimensional_decompress(pdl2);
+		for ( j = 0; j < simpleschema->ndims; j++ )
+		{
+			CU_ASSERT_EQUAL(pdl2->bytes[j].compression, comps[j]);
+			CU_ASSERT_EQUAL(pdl3->bytes[j].size, pdl->bytes[j].size);
+			CU_ASSERT_EQUAL(memcmp(pdl3->bytes[j].bytes, pdl->bytes[j].bytes, pdl->bytes[j].size), 0);
+			if ( pdl_serial )
+			{
+				CU_ASSERT_EQUAL(pdl2->bytes[j].size, pdl_serial->bytes[j].size);
+				CU_ASSERT_EQUAL(memcmp(pdl2->bytes[j].bytes, pdl_serial->bytes[j].bytes, pdl2->bytes[j].size), 0);
+			}
+		}
+		/* Shares its stats with pdl2 */
+		pc_patch_dimensional_free(pdl3);
+		if ( pdl_serial )
+			pc_patch_free((PCPATCH*)pdl2);
+		else
+			pdl_serial = pdl2;
+	}
+
+	pc_set_num_threads(nthreads);
+	pc_patch_free((PCPATCH*)pdl_serial);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_dimstats_free(pds);
+	pc_pointlist_free(pl);
 }
 
 #if defined(HAVE_LIBGHT) && defined(HAVE_LAZPERF)
@@ -1384,6 +2967,109 @@ test_patch_transform_compression_none()
 	pc_pointlist_free(pl);
 }
 
+static void
+test_patch_remap()
+{
+	PCPATCH_UNCOMPRESSED *pau;
+	PCPATCH_DIMENSIONAL *pdl, *pdlz;
+	PCPATCH_DIMENSIONAL *pdo;
+	PCPATCH *pa, *pa2;
+	PCSCHEMA *nschema;
+	PCPOINTLIST *pl;
+	PCDIMSTATS *pds;
+	PCREMAP *remap;
+	PCPOINT *pt;
+	char *str, *str2;
+	double d;
+	int i;
+	int npts = PCDIMSTATS_MIN_SAMPLE+1; // force to keep custom compression
+
+	pl = pc_pointlist_make(npts);
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "X", i * 0.1);
+		pc_point_set_double_by_name(pt, "Y", i * 0.2);
+		pc_point_set_double_by_name(pt, "Z", i * 0.3);
+		pc_point_set_double_by_name(pt, "Intensity", 10);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+	pdl = pc_patch_dimensional_from_uncompressed(pau);
+	pds = pc_dimstats_make(simpleschema);
+	pc_dimstats_update(pds, pdl);
+	for ( i = 0; i < simpleschema->ndims; i++ )
+		pds->stats[i].recommended_compression = PC_DIM_ZLIB;
+	pdlz = pc_patch_dimensional_compress(pdl, pds);
+
+	/* A subset is one segment copied */
+	remap = pc_remap_new(simpleschema, simpleschema_nointensity, 0.0, PC_FALSE);
+	CU_ASSERT_EQUAL(remap->ncopy, 3);
+	CU_ASSERT_EQUAL(remap->nsegments, 1);
+	CU_ASSERT_EQUAL(remap->segments[0].size, simpleschema_nointensity->size);
+	CU_ASSERT_EQUAL(remap->ndefault, 0);
+	pc_remap_free(remap);
+
+	/* Missing dimensions take the default */
+	remap = pc_remap_new(simpleschema_nointensity, simpleschema, 7.0, PC_FALSE);
+	CU_ASSERT_EQUAL(remap->ncopy, 3);
+	CU_ASSERT_EQUAL(remap->ndefault, 1);
+	CU_ASSERT_EQUAL(remap->dims[3].op, PC_REMAP_DEFAULT);
+	pc_remap_free(remap);
+
+	/* Only the dimension of another scale is converted */
+	nschema = pc_schema_clone(simpleschema);
+	nschema->zdim->scale = 0.02;
+	remap = pc_remap_new(simpleschema, nschema, 0.0, PC_TRUE);
+	CU_ASSERT_EQUAL(remap->ncopy, 3);
+	CU_ASSERT_EQUAL(remap->nrescale, 1);
+	CU_ASSERT_EQUAL(remap->dims[2].op, PC_REMAP_RESCALE);
+	CU_ASSERT_EQUAL(remap->nsegments, 2);
+
+	/* Dimensional patches keep the compressed bytes of copied dimensions */
+	pa = pc_remap_patch(remap, (PCPATCH*)pdlz);
+	CU_ASSERT_EQUAL(pa->type, PC_DIMENSIONAL);
+	pdo = (PCPATCH_DIMENSIONAL*)pa;
+	CU_ASSERT_EQUAL(pdo->bytes[0].compression, PC_DIM_ZLIB);
+	CU_ASSERT_EQUAL(pdo->bytes[0].size, pdlz->bytes[0].size);
+	CU_ASSERT_EQUAL(memcmp(pdo->bytes[0].bytes, pdlz->bytes[0].bytes, pdlz->bytes[0].size), 0);
+	CU_ASSERT_EQUAL(pdo->bytes[2].compression, PC_DIM_ZLIB);
+
+	/* And come out the same as uncompressed ones */
+	pa2 = pc_remap_patch(remap, (PCPATCH*)pau);
+	CU_ASSERT_EQUAL(pa2->type, PC_NONE);
+	str = pc_patch_to_string(pa);
+	str2 = pc_patch_to_string(pa2);
+	CU_ASSERT_STRING_EQUAL(str, str2);
+	pcfree(str);
+	pcfree(str2);
+	pc_point_get_double_by_name(&(pa->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, (npts - 1) * 0.3, 0.02);
+	pc_point_get_double_by_name(&(pa2->stats->max), "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, (npts - 1) * 0.3, 0.02);
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.xmax, pa2->bounds.xmax, 0.000001);
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.ymax, pa2->bounds.ymax, 0.000001);
+	pt = pc_patch_pointn(pa, 101);
+	pc_point_get_double_by_name(pt, "Z", &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 30, 0.000001);
+	pc_point_free(pt);
+	pc_patch_free(pa);
+	pc_patch_free(pa2);
+	pc_remap_free(remap);
+
+	/* A different srid cannot be transformed */
+	nschema->srid = 4326;
+	remap = pc_remap_new(simpleschema, nschema, 0.0, PC_TRUE);
+	CU_ASSERT(remap == NULL);
+
+	pc_dimstats_free(pds);
+	pc_schema_free(nschema);
+	pc_patch_free((PCPATCH*)pdlz);
+	pc_patch_free((PCPATCH*)pdl);
+	pc_patch_free((PCPATCH*)pau);
+	pc_pointlist_free(pl);
+}
+
 
 /* REGISTER ***********************************************************/
 
@@ -1396,8 +3082,27 @@ CU_TestInfo patch_tests[] = {
 	PC_TEST(test_patch_dimensional_compression),
 	PC_TEST(test_patch_dimensional_extent),
 	PC_TEST(test_patch_union),
+	PC_TEST(test_patch_union_dimensional),
+	PC_TEST(test_patch_union_streaming),
+	PC_TEST(test_patch_union_merge),
+	PC_TEST(test_patch_union_avg),
+	PC_TEST(test_patch_dstats_merge),
 	PC_TEST(test_patch_wkb),
 	PC_TEST(test_patch_filter),
+	PC_TEST(test_patch_filter_expression),
+	PC_TEST(test_patch_filter_polygon),
+	PC_TEST(test_patch_grid),
+	PC_TEST(test_patch_knn),
+	PC_TEST(test_patch_decimate),
+	PC_TEST(test_patch_counters),
+	PC_TEST(test_patch_readonly_no_copy),
+	PC_TEST(test_pointlist_rows),
+	PC_TEST(test_patch_get_values),
+	PC_TEST(test_patch_cursor),
+	PC_TEST(test_patch_dimensional_directory),
+	PC_TEST(test_patch_dimensional_threads),
+	PC_TEST(test_patch_dimstats_reuse),
+	PC_TEST(test_patch_dimstats_trial),
 #if defined(HAVE_LIBGHT) && defined(HAVE_LAZPERF)
 	PC_TEST(test_patch_compress_from_ght_to_lazperf),
 #endif
@@ -1436,6 +3141,7 @@ CU_TestInfo patch_tests[] = {
 	PC_TEST(test_patch_set_schema_compression_lazperf),
 #endif
 	PC_TEST(test_patch_transform_compression_none),
+	PC_TEST(test_patch_remap),
 	CU_TEST_INFO_NULL
 };
 
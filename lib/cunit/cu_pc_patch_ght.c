@@ -131,6 +131,57 @@ test_patch_ght_filtering()
 	pc_patch_ght_free(pag);
 }
 
+static void
+test_patch_ght_from_patchlist()
+{
+	PCPOINT *pt;
+	int i, j;
+	static int npts = 100;
+	PCPOINTLIST *pl;
+	PCPATCH_GHT *pags[2];
+	PCPATCH *pa, *pa_filtered;
+	double d;
+
+	for ( j = 0; j < 2; j++ )
+	{
+		pl = pc_pointlist_make(npts);
+		for ( i = 0; i < npts; i++ )
+		{
+			pt = pc_point_make(simpleschema);
+			pc_point_set_double_by_name(pt, "x", 45 + j*0.001 + i*0.000004);
+			pc_point_set_double_by_name(pt, "y", 45 + i*0.000001666);
+			pc_point_set_double_by_name(pt, "Z", 10 + i*0.34);
+			pc_point_set_double_by_name(pt, "intensity", 10);
+			pc_pointlist_add_point(pl, pt);
+		}
+		pags[j] = pc_patch_ght_from_pointlist(pl);
+		pc_pointlist_free(pl);
+	}
+
+	pa = pc_patch_from_patchlist((PCPATCH**)pags, 2);
+	CU_ASSERT_EQUAL(pa->type, PC_GHT);
+	CU_ASSERT_EQUAL(pa->npoints, 2*npts);
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.xmin, 45.0, 0.0001);
+	CU_ASSERT_DOUBLE_EQUAL(pa->bounds.xmax, 45.0014, 0.0001);
+
+	/* Stats are merged from those of the inputs */
+	CU_ASSERT_EQUAL(pc_point_get_double_by_name(&(pa->stats->min), "Z", &d), PC_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(d, 10, 0.001);
+	CU_ASSERT_EQUAL(pc_point_get_double_by_name(&(pa->stats->max), "Z", &d), PC_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(d, 10 + (npts-1)*0.34, 0.001);
+	CU_ASSERT_EQUAL(pc_point_get_double_by_name(&(pa->stats->avg), "Z", &d), PC_SUCCESS);
+	CU_ASSERT_DOUBLE_EQUAL(d, 10 + (npts-1)*0.17, 0.01);
+
+	/* A filter every point passes copies the tree as it is */
+	pa_filtered = pc_patch_filter(pa, 2, PC_GT, 0, 0);
+	CU_ASSERT_EQUAL(pa_filtered->type, PC_GHT);
+	CU_ASSERT_EQUAL(pa_filtered->npoints, 2*npts);
+	pc_patch_free(pa_filtered);
+
+	pc_patch_free(pa);
+	pc_patch_ght_free(pags[0]);
+	pc_patch_ght_free(pags[1]);
+}
 
 #endif /* HAVE_LIBGHT */
 
@@ -140,6 +191,7 @@ CU_TestInfo ght_tests[] = {
 #ifdef HAVE_LIBGHT
 	PC_TEST(test_patch_ght),
 	PC_TEST(test_patch_ght_filtering),
+	PC_TEST(test_patch_ght_from_patchlist),
 #endif
 	CU_TEST_INFO_NULL
 };
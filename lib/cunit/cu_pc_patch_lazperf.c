@@ -246,6 +246,12 @@ test_wkb_lazperf()
 	// compare wkb
 	CU_ASSERT_STRING_EQUAL(wkb1, wkb2);
 
+	// stats and extent streamed out of the decoder match the points
+	CU_ASSERT_EQUAL(pc_patch_compute_stats((PCPATCH*) pal2), PC_SUCCESS);
+	CU_ASSERT_EQUAL(memcmp(pal2->stats->data, pau->stats->data, pc_stats_size(simpleschema)), 0);
+	CU_ASSERT_DOUBLE_EQUAL(pal2->bounds.xmin, pau->bounds.xmin, 0.0);
+	CU_ASSERT_DOUBLE_EQUAL(pal2->bounds.ymax, pau->bounds.ymax, 0.0);
+
 	// free
 	pc_patch_free((PCPATCH*) pal1);
 	pc_patch_free((PCPATCH*) pal2);
@@ -330,6 +336,97 @@ test_patch_compression_with_multiple_dimension()
 	pcfree(str1);
 	pcfree(str2);
 }
+
+static void
+test_patch_lazperf_partial_decoding()
+{
+	PCPOINT *pt, *pt1, *pt2;
+	int i;
+	int npts = 400;
+	PCPOINTLIST *pl;
+	PCPATCH_LAZPERF *pal;
+	PCPATCH_UNCOMPRESSED *pau;
+	PCPATCH *par1, *par2;
+	LAZPERF_DECODER *dec;
+	PCGRID *grid1, *grid2;
+	char *str1, *str2;
+	double val;
+
+	// build a list of points
+	pl = pc_pointlist_make(npts);
+
+	for ( i = 0; i < npts; i++ )
+	{
+		pt = pc_point_make(simpleschema);
+		pc_point_set_double_by_name(pt, "x", i*2.0);
+		pc_point_set_double_by_name(pt, "y", i*1.9);
+		pc_point_set_double_by_name(pt, "Z", i*0.34);
+		pc_point_set_double_by_name(pt, "intensity", 10);
+		pc_pointlist_add_point(pl, pt);
+	}
+
+	pal = pc_patch_lazperf_from_pointlist(pl);
+	pau = pc_patch_uncompressed_from_pointlist(pl);
+
+	// pointn
+	pt1 = pc_patch_pointn((PCPATCH*) pal, 1);
+	pt2 = pc_patch_pointn((PCPATCH*) pau, 1);
+	CU_ASSERT_EQUAL(memcmp(pt1->data, pt2->data, simpleschema->size), 0);
+	pc_point_free(pt1);
+	pc_point_free(pt2);
+
+	pt1 = pc_patch_pointn((PCPATCH*) pal, -1);
+	pc_point_get_double_by_name(pt1, "x", &val);
+	CU_ASSERT_DOUBLE_EQUAL(val, (npts-1)*2.0, 0.0001);
+	pc_point_free(pt1);
+
+	// range
+	par1 = pc_patch_range((PCPATCH*) pal, 11, 10);
+	par2 = pc_patch_range((PCPATCH*) pau, 11, 10);
+	CU_ASSERT_EQUAL(par1->npoints, 10);
+	str1 = pc_patch_to_string(par1);
+	str2 = pc_patch_to_string(par2);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	CU_ASSERT_DOUBLE_EQUAL(par1->bounds.xmin, par2->bounds.xmin, 0.0001);
+	CU_ASSERT_DOUBLE_EQUAL(par1->bounds.xmax, par2->bounds.xmax, 0.0001);
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(par1);
+	pc_patch_free(par2);
+
+	// streaming decoder, stopped early
+	dec = pc_patch_lazperf_decoder_new(pal);
+	pt1 = pc_point_make(simpleschema);
+	for ( i = 0; i < 3; i++ )
+	{
+		CU_ASSERT_SUCCESS(pc_patch_lazperf_decoder_next(dec, pt1));
+		pt2 = pc_pointlist_get_point(pl, i);
+		CU_ASSERT_EQUAL(memcmp(pt1->data, pt2->data, simpleschema->size), 0);
+	}
+	pc_patch_lazperf_decoder_free(dec);
+
+	// streaming decoder, run to exhaustion
+	dec = pc_patch_lazperf_decoder_new(pal);
+	for ( i = 0; i < npts; i++ )
+		CU_ASSERT_SUCCESS(pc_patch_lazperf_decoder_next(dec, pt1));
+	CU_ASSERT_FAILURE(pc_patch_lazperf_decoder_next(dec, pt1));
+	pc_patch_lazperf_decoder_free(dec);
+	pc_point_free(pt1);
+
+	// binning, streamed out of the decoder
+	grid1 = pc_grid_from_patch((PCPATCH*) pal, 50, pc_schema_get_dimension_by_name(simpleschema, "Z"));
+	grid2 = pc_grid_from_patch((PCPATCH*) pau, 50, pc_schema_get_dimension_by_name(simpleschema, "Z"));
+	CU_ASSERT_EQUAL(grid1->nx, grid2->nx);
+	CU_ASSERT_EQUAL(grid1->ny, grid2->ny);
+	CU_ASSERT_EQUAL(memcmp(grid1->count, grid2->count, grid1->nx * grid1->ny * sizeof(uint32_t)), 0);
+	CU_ASSERT_EQUAL(memcmp(grid1->sum, grid2->sum, grid1->nx * grid1->ny * sizeof(double)), 0);
+	pc_grid_free(grid1);
+	pc_grid_free(grid2);
+
+	pc_patch_free((PCPATCH*) pal);
+	pc_patch_free((PCPATCH*) pau);
+	pc_pointlist_free(pl);
+}
 #endif
 
 /* REGISTER ***********************************************************/
@@ -343,6 +440,7 @@ CU_TestInfo lazperf_tests[] = {
 	PC_TEST(test_wkb_lazperf),
 	PC_TEST(test_patch_filter_lazperf_zero_point),
 	PC_TEST(test_patch_compression_with_multiple_dimension),
+	PC_TEST(test_patch_lazperf_partial_decoding),
 #endif
 	CU_TEST_INFO_NULL
 };
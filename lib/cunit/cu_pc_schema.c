@@ -191,6 +191,41 @@ test_schema_compression(void)
 	CU_ASSERT_EQUAL(compression, PC_DIMENSIONAL);
 }
 
+static void
+test_schema_dimension_compression(void)
+{
+	const char *xmlstr =
+		"<pc:PointCloudSchema xmlns:pc='x'>"
+		"<pc:dimension><pc:position>1</pc:position><pc:name>X</pc:name>"
+		"<pc:interpretation>int32_t</pc:interpretation><pc:compression>delta2</pc:compression></pc:dimension>"
+		"<pc:dimension><pc:position>2</pc:position><pc:name>Y</pc:name>"
+		"<pc:interpretation>int32_t</pc:interpretation></pc:dimension>"
+		"<pc:metadata><Metadata name=\"spatialsort\">hilbert</Metadata></pc:metadata>"
+		"</pc:PointCloudSchema>";
+	PCSCHEMA *myschema = pc_schema_from_xml(xmlstr);
+	PCSCHEMA *clone;
+	char *json;
+
+	CU_ASSERT_PTR_NOT_NULL(myschema);
+	CU_ASSERT_EQUAL(myschema->dims[0]->compression, PC_DIM_DELTA2);
+	CU_ASSERT_EQUAL(myschema->dims[1]->compression, PC_DIM_AUTO);
+	CU_ASSERT_EQUAL(schema->dims[0]->compression, PC_DIM_AUTO);
+	CU_ASSERT_STRING_EQUAL(pc_dim_compression_name(PC_DIM_ZSTD), "zstd");
+	CU_ASSERT_STRING_EQUAL(pc_dim_compression_name(PC_DIM_LZ4), "lz4");
+
+	clone = pc_schema_clone(myschema);
+	CU_ASSERT_EQUAL(clone->dims[0]->compression, PC_DIM_DELTA2);
+	CU_ASSERT_EQUAL(clone->spatialsort, PC_CURVE_HILBERT);
+	CU_ASSERT_EQUAL(schema->spatialsort, PC_CURVE_NONE);
+	json = pc_schema_to_json(clone);
+	CU_ASSERT(strstr(json, "\"compression\" : \"delta2\"") != NULL);
+	CU_ASSERT(strstr(json, "\"spatialsort\" : \"hilbert\"") != NULL);
+
+	pcfree(json);
+	pc_schema_free(clone);
+	pc_schema_free(myschema);
+}
+
 static void
 test_schema_clone(void)
 {
@@ -449,6 +484,7 @@ CU_TestInfo schema_tests[] = {
 	PC_TEST(test_schema_empty),
 	PC_TEST(test_schema_clone),
 	PC_TEST(test_schema_clone_empty_description),
+	PC_TEST(test_schema_dimension_compression),
 	PC_TEST(test_schema_clone_no_name),
 	PC_TEST(test_schema_clone_empty_name),
 	PC_TEST(test_schema_same_dimensions),
@@ -371,6 +371,475 @@ test_sort_patch_ndims()
 	pc_patch_free(pa);
 }
 
+/*
+* Signed values, several dimensions and ties: the order must be the
+* lexicographic one, ties must keep their input order, and dimensional
+* patches must sort like uncompressed ones.
+*/
+static void
+test_sort_radix()
+{
+	int i, npts = 3000, nbad = 0;
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH_DIMENSIONAL *pdl, *pdlc;
+	PCPATCH *pu, *pusort, *pdlsort, *pdlsort_u;
+	PCDIMSTATS *stats;
+	const char *Y_X[] = {"Y", "X"};
+	char *str1, *str2;
+
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "X", ((i * 7919) % 201 - 100) * 0.01);
+		pc_point_set_double_by_name(pt, "Y", i % 5);
+		pc_point_set_double_by_name(pt, "Z", i);
+		pc_point_set_double_by_name(pt, "Intensity", (i * 31) % 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = (PCPATCH *) pc_patch_uncompressed_from_pointlist(pl);
+	pusort = pc_patch_sort(pu, Y_X, 2);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pusort, Y_X, 2, PC_TRUE), PC_TRUE);
+
+	/* Ties keep their input order */
+	for ( i = 1; i < npts; i++ )
+	{
+		PCPOINT *p0 = pc_patch_pointn(pusort, i);
+		PCPOINT *p1 = pc_patch_pointn(pusort, i + 1);
+		double x0, x1, y0, y1, z0, z1;
+		pc_point_get_x(p0, &x0); pc_point_get_x(p1, &x1);
+		pc_point_get_y(p0, &y0); pc_point_get_y(p1, &y1);
+		pc_point_get_z(p0, &z0); pc_point_get_z(p1, &z1);
+		if ( x0 == x1 && y0 == y1 && z0 >= z1 )
+			nbad++;
+		pc_point_free(p0);
+		pc_point_free(p1);
+	}
+	CU_ASSERT_EQUAL(nbad, 0);
+
+	/* Compressed dimensional patches sort without going through rows */
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	stats = pc_dimstats_make(schema);
+	pc_dimstats_update(stats, pdl);
+	for ( i = 0; i < schema->ndims; i++ )
+		stats->stats[i].recommended_compression = PC_DIM_SIGBITS;
+	pdlc = pc_patch_dimensional_compress(pdl, stats);
+	pdlsort = pc_patch_sort((PCPATCH *) pdlc, Y_X, 2);
+	CU_ASSERT_EQUAL(pdlsort->type, PC_DIMENSIONAL);
+	pdlsort_u = pc_patch_uncompress(pdlsort);
+	str1 = pc_patch_to_string(pusort);
+	str2 = pc_patch_to_string(pdlsort_u);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pdlsort_u);
+	pc_patch_free(pdlsort);
+	pc_patch_free((PCPATCH *) pdlc);
+	pc_patch_free((PCPATCH *) pdl);
+	pc_dimstats_free(stats);
+	pc_patch_free(pusort);
+	pc_patch_free(pu);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_sort_int64_exact()
+{
+	int i, npts = 300;
+	char *xmlstr =
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+		"<pc:PointCloudSchema xmlns:pc=\"http://pointcloud.org/schemas/PC/1.1\">"
+		"<pc:dimension><pc:position>1</pc:position><pc:size>8</pc:size>"
+		"<pc:name>X</pc:name><pc:interpretation>int64_t</pc:interpretation></pc:dimension>"
+		"<pc:dimension><pc:position>2</pc:position><pc:size>8</pc:size>"
+		"<pc:name>Y</pc:name><pc:interpretation>uint64_t</pc:interpretation></pc:dimension>"
+		"<pc:dimension><pc:position>3</pc:position><pc:size>4</pc:size>"
+		"<pc:name>C</pc:name><pc:interpretation>int32_t</pc:interpretation></pc:dimension>"
+		"</pc:PointCloudSchema>";
+	PCSCHEMA *s64 = pc_schema_from_xml(xmlstr);
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH_DIMENSIONAL *pdl;
+	PCPATCH *pu, *pusort, *pdlsort;
+	const char *X_C[] = {"X", "C"}, *Y_C[] = {"Y", "C"};
+
+	CU_ASSERT_PTR_NOT_NULL(s64);
+
+	/* Values 2^53 apart by one, which doubles cannot tell apart */
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(s64);
+		int64_t x = (INT64_C(1) << 53) + (i * 7) % 5;
+		uint64_t y = UINT64_MAX - (i * 11) % 7;
+		memcpy(pt->data, &x, sizeof(int64_t));
+		memcpy(pt->data + 8, &y, sizeof(uint64_t));
+		pc_point_set_double_by_name(pt, "C", i % 3);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = (PCPATCH *) pc_patch_uncompressed_from_pointlist(pl);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pu, X_C, 2, PC_TRUE), PC_FALSE);
+
+	pusort = pc_patch_sort(pu, X_C, 2);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pusort, X_C, 2, PC_TRUE), PC_TRUE);
+	for ( i = 1; i < npts; i++ )
+	{
+		int64_t x0, x1;
+		uint8_t *data = ((PCPATCH_UNCOMPRESSED *) pusort)->data;
+		memcpy(&x0, data + (size_t)(i - 1) * s64->size, sizeof(int64_t));
+		memcpy(&x1, data + (size_t)i * s64->size, sizeof(int64_t));
+		CU_ASSERT(x0 <= x1);
+	}
+	pc_patch_free(pusort);
+
+	pusort = pc_patch_sort(pu, Y_C, 2);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pusort, Y_C, 2, PC_TRUE), PC_TRUE);
+
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	pdlsort = pc_patch_sort((PCPATCH *) pdl, Y_C, 2);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pdlsort, Y_C, 2, PC_TRUE), PC_TRUE);
+
+	pc_patch_free(pdlsort);
+	pc_patch_free((PCPATCH *) pdl);
+	pc_patch_free(pusort);
+	pc_patch_free(pu);
+	pc_pointlist_free(pl);
+	pc_schema_free(s64);
+}
+
+/* Sum of the grid steps between consecutive points of a patch */
+static double
+sort_curve_path_length(const PCPATCH *pa)
+{
+	uint32_t i;
+	double len = 0.0, x0 = 0.0, y0 = 0.0;
+	for ( i = 1; i <= pa->npoints; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(pa, i);
+		double x, y;
+		pc_point_get_x(pt, &x);
+		pc_point_get_y(pt, &y);
+		if ( i > 1 )
+			len += fabs(x - x0) + fabs(y - y0);
+		x0 = x;
+		y0 = y;
+		pc_point_free(pt);
+	}
+	return len;
+}
+
+static void
+test_sort_curve()
+{
+	int i, npts = 4096;
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH *pu, *pmorton, *philbert, *pbyname, *pcomp, *pcomp_u;
+	PCSCHEMA *sschema;
+	const char *MORTON[] = {"morton"}, *Z[] = {"Z"};
+	double len_in, len_morton, len_hilbert;
+	char *str1, *str2;
+
+	CU_ASSERT_EQUAL(pc_curve_number("Hilbert"), PC_CURVE_HILBERT);
+	CU_ASSERT_EQUAL(pc_curve_number("nope"), PC_CURVE_NONE);
+	CU_ASSERT_STRING_EQUAL(pc_curve_name(PC_CURVE_MORTON), "morton");
+
+	/* A 64x64 grid visited in scattered order */
+	for ( i = 0; i < npts; i++ )
+	{
+		int j = (i * 2741) % npts;
+		PCPOINT *pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "X", j % 64);
+		pc_point_set_double_by_name(pt, "Y", j / 64);
+		pc_point_set_double_by_name(pt, "Z", j);
+		pc_point_set_double_by_name(pt, "Intensity", i % 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = (PCPATCH *) pc_patch_uncompressed_from_pointlist(pl);
+	pmorton = pc_patch_sort_curve(pu, PC_CURVE_MORTON);
+	philbert = pc_patch_sort_curve(pu, PC_CURVE_HILBERT);
+	CU_ASSERT_PTR_NOT_NULL(pmorton);
+	CU_ASSERT_PTR_NOT_NULL(philbert);
+	CU_ASSERT_EQUAL(pmorton->npoints, npts);
+	CU_ASSERT_EQUAL(philbert->npoints, npts);
+
+	/* Same points, once each, along a much shorter path */
+	pbyname = pc_patch_sort(philbert, Z, 1);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(pbyname, Z, 1, PC_FALSE), PC_TRUE);
+	pc_patch_free(pbyname);
+	len_in = sort_curve_path_length(pu);
+	len_morton = sort_curve_path_length(pmorton);
+	len_hilbert = sort_curve_path_length(philbert);
+	CU_ASSERT(len_morton < len_in / 10);
+	CU_ASSERT(len_hilbert < len_morton);
+
+	/* A lone curve name is accepted by pc_patch_sort */
+	pbyname = pc_patch_sort(pu, MORTON, 1);
+	str1 = pc_patch_to_string(pmorton);
+	str2 = pc_patch_to_string(pbyname);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pcfree(str2);
+
+	/* Schemas with a spatialsort order new patches as they compress */
+	sschema = pc_schema_clone(schema);
+	sschema->spatialsort = PC_CURVE_MORTON;
+	sschema->compression = PC_DIMENSIONAL;
+	pu->schema = sschema;
+	pcomp = pc_patch_compress(pu, NULL);
+	CU_ASSERT_EQUAL(pcomp->type, PC_DIMENSIONAL);
+	pcomp_u = pc_patch_uncompress(pcomp);
+	str2 = pc_patch_to_string(pcomp_u);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+	pu->schema = schema;
+
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pcomp_u);
+	pc_patch_free(pcomp);
+	pc_schema_free(sschema);
+	pc_patch_free(pbyname);
+	pc_patch_free(philbert);
+	pc_patch_free(pmorton);
+	pc_patch_free(pu);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_sort_curve_progressive()
+{
+	int i, npts = 4096;
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH *pu, *pprog, *prange, *pa1, *pa2;
+	const char *PROGRESSIVE[] = {"progressive"}, *Z[] = {"Z"};
+	uint8_t blocks[16];
+	char *str1, *str2;
+
+	CU_ASSERT_EQUAL(pc_curve_number("Progressive"), PC_CURVE_PROGRESSIVE);
+	CU_ASSERT_STRING_EQUAL(pc_curve_name(PC_CURVE_PROGRESSIVE), "progressive");
+
+	/* A 64x64 grid visited row by row */
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "X", i % 64);
+		pc_point_set_double_by_name(pt, "Y", i / 64);
+		pc_point_set_double_by_name(pt, "Z", i);
+		pc_point_set_double_by_name(pt, "Intensity", i % 7);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = (PCPATCH *) pc_patch_uncompressed_from_pointlist(pl);
+	pprog = pc_patch_sort(pu, PROGRESSIVE, 1);
+	CU_ASSERT_PTR_NOT_NULL(pprog);
+	CU_ASSERT_EQUAL(pprog->npoints, npts);
+
+	/* The first 16 points fall in each of the 16 blocks of 16x16 */
+	memset(blocks, 0, sizeof(blocks));
+	prange = pc_patch_range(pprog, 1, 16);
+	for ( i = 1; i <= 16; i++ )
+	{
+		PCPOINT *pt = pc_patch_pointn(prange, i);
+		double x, y;
+		int b;
+		pc_point_get_x(pt, &x);
+		pc_point_get_y(pt, &y);
+		b = 4 * ((int)y / 16) + (int)x / 16;
+		CU_ASSERT_EQUAL(blocks[b], 0);
+		blocks[b] = 1;
+		pc_point_free(pt);
+	}
+	pc_patch_free(prange);
+
+	/* Every point once */
+	pa1 = pc_patch_sort(pu, Z, 1);
+	pa2 = pc_patch_sort(pprog, Z, 1);
+	str1 = pc_patch_to_string(pa1);
+	str2 = pc_patch_to_string(pa2);
+	CU_ASSERT_STRING_EQUAL(str1, str2);
+
+	pcfree(str1);
+	pcfree(str2);
+	pc_patch_free(pa1);
+	pc_patch_free(pa2);
+	pc_patch_free(pprog);
+	pc_patch_free(pu);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_sort_filter_sorted()
+{
+	int i, j, k, npts = 500;
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH_DIMENSIONAL *pdl, *pdlc;
+	PCPATCH *pu, *patches[3];
+	PCDIMSTATS *stats;
+	PCSCHEMA *sschema;
+	const char *Z_X[] = {"Z", "X"}, *Z[] = {"Z"};
+	const int zdim = 2;
+	const PC_FILTERTYPE filters[] = {PC_GT, PC_LT, PC_EQUAL, PC_BETWEEN, PC_BETWEEN};
+	const double vals[][2] = {{0.5, 0}, {0.5, 0}, {0.5, 0}, {0.25, 0.75}, {0.75, 0.25}};
+
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(schema);
+		pc_point_set_double_by_name(pt, "X", i);
+		pc_point_set_double_by_name(pt, "Y", i % 3);
+		pc_point_set_double_by_name(pt, "Z", ((i * 37) % 101) * 0.01);
+		pc_point_set_double_by_name(pt, "Intensity", i % 11);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pu = (PCPATCH *) pc_patch_uncompressed_from_pointlist(pl);
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	stats = pc_dimstats_make(schema);
+	pc_dimstats_update(stats, pdl);
+	for ( i = 0; i < schema->ndims; i++ )
+		stats->stats[i].recommended_compression = PC_DIM_SIGBITS;
+	pdlc = pc_patch_dimensional_compress(pdl, stats);
+
+	/* Sorting records the leading dimension, compression keeps it */
+	patches[0] = pc_patch_sort(pu, Z_X, 2);
+	patches[1] = pc_patch_sort((PCPATCH *) pdlc, Z_X, 2);
+	sschema = pc_schema_clone(schema);
+	sschema->compression = PC_DIMENSIONAL;
+	patches[0]->schema = sschema;
+	patches[2] = pc_patch_compress(patches[0], NULL);
+	patches[0]->schema = patches[2]->schema = schema;
+	CU_ASSERT_EQUAL(patches[2]->type, PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(pu->sortdim, 0);
+	CU_ASSERT_EQUAL(patches[0]->sortdim, zdim + 1);
+	CU_ASSERT_EQUAL(patches[1]->sortdim, zdim + 1);
+	CU_ASSERT_EQUAL(patches[2]->sortdim, zdim + 1);
+	CU_ASSERT_EQUAL(pc_patch_is_sorted(patches[1], Z, 1, PC_TRUE), PC_TRUE);
+
+	/* Binary searched runs match the scans of unsorted patches */
+	for ( i = 0; i < 3; i++ )
+	{
+		for ( j = 0; j < 5; j++ )
+		{
+			PCPATCH *f1 = pc_patch_filter(patches[i], zdim, filters[j], vals[j][0], vals[j][1]);
+			PCPATCH *f2;
+			patches[i]->sortdim = 0;
+			f2 = pc_patch_filter(patches[i], zdim, filters[j], vals[j][0], vals[j][1]);
+			patches[i]->sortdim = zdim + 1;
+			PCPATCH *f1u = pc_patch_uncompress(f1);
+			PCPATCH *f2u = pc_patch_uncompress(f2);
+			CU_ASSERT_EQUAL(f1->type, f2->type);
+			CU_ASSERT_EQUAL(f1->npoints, f2->npoints);
+			if ( f1->npoints )
+			{
+				char *str1 = pc_patch_to_string(f1u);
+				char *str2 = pc_patch_to_string(f2u);
+				double d1, d2;
+				CU_ASSERT_STRING_EQUAL(str1, str2);
+				CU_ASSERT_EQUAL(f1->sortdim, zdim + 1);
+				for ( k = 0; k < schema->ndims; k++ )
+				{
+					pc_point_get_double_by_index(&(f1->stats->min), k, &d1);
+					pc_point_get_double_by_index(&(f2->stats->min), k, &d2);
+					CU_ASSERT_DOUBLE_EQUAL(d1, d2, precision);
+					pc_point_get_double_by_index(&(f1->stats->max), k, &d1);
+					pc_point_get_double_by_index(&(f2->stats->max), k, &d2);
+					CU_ASSERT_DOUBLE_EQUAL(d1, d2, precision);
+				}
+				CU_ASSERT_DOUBLE_EQUAL(f1->bounds.xmin, f2->bounds.xmin, precision);
+				CU_ASSERT_DOUBLE_EQUAL(f1->bounds.xmax, f2->bounds.xmax, precision);
+				pcfree(str1);
+				pcfree(str2);
+			}
+			if ( f1u != f1 ) pc_patch_free(f1u);
+			if ( f2u != f2 ) pc_patch_free(f2u);
+			pc_patch_free(f1);
+			pc_patch_free(f2);
+		}
+	}
+
+	/* New points lose the order */
+	CU_ASSERT_EQUAL(pc_patch_uncompressed_add_point((PCPATCH_UNCOMPRESSED *) patches[0], pl->points[0]), PC_SUCCESS);
+	CU_ASSERT_EQUAL(patches[0]->sortdim, 0);
+
+	for ( i = 0; i < 3; i++ )
+		pc_patch_free(patches[i]);
+	pc_schema_free(sschema);
+	pc_patch_free((PCPATCH *) pdlc);
+	pc_patch_free((PCPATCH *) pdl);
+	pc_dimstats_free(stats);
+	pc_patch_free(pu);
+	pc_pointlist_free(pl);
+}
+
+/* Sorted filter on a sigbits dimension of small words, against a scan of the values */
+static void
+test_sort_filter_sorted_sigbits_dim(const PCSCHEMA *s, const char *dimname, int npts, int base, int range)
+{
+	int i, j, k;
+	PCPOINTLIST *pl = pc_pointlist_make(npts);
+	PCPATCH_DIMENSIONAL *pdl, *pdlc;
+	PCPATCH *psort;
+	PCDIMSTATS *stats;
+	PCDIMENSION *dim = pc_schema_get_dimension_by_name(s, dimname);
+	const char *names[] = {dimname};
+	const PC_FILTERTYPE filters[] = {PC_GT, PC_LT, PC_EQUAL, PC_BETWEEN};
+	const double vals[][2] = {
+		{base + range / 2, 0}, {base + 2, 0},
+		{base + range / 3, 0}, {base + 1, base + range - 2}
+	};
+
+	CU_ASSERT_PTR_NOT_NULL(dim);
+	for ( i = 0; i < npts; i++ )
+	{
+		PCPOINT *pt = pc_point_make(s);
+		pc_point_set_double_by_name(pt, dimname, base + (i * 37) % range);
+		pc_pointlist_add_point(pl, pt);
+	}
+	pdl = pc_patch_dimensional_from_pointlist(pl);
+	stats = pc_dimstats_make(s);
+	pc_dimstats_update(stats, pdl);
+	for ( i = 0; i < s->ndims; i++ )
+		stats->stats[i].recommended_compression = PC_DIM_SIGBITS;
+	pdlc = pc_patch_dimensional_compress(pdl, stats);
+	psort = pc_patch_sort((PCPATCH *) pdlc, names, 1);
+	CU_ASSERT_EQUAL(psort->type, PC_DIMENSIONAL);
+	CU_ASSERT_EQUAL(psort->sortdim, dim->position + 1);
+	CU_ASSERT_EQUAL(((PCPATCH_DIMENSIONAL *) psort)->bytes[dim->position].compression, PC_DIM_SIGBITS);
+
+	for ( j = 0; j < 4; j++ )
+	{
+		PCPATCH *f = pc_patch_filter(psort, dim->position, filters[j], vals[j][0], vals[j][1]);
+		uint32_t npass = 0;
+		for ( k = 0; k < npts; k++ )
+		{
+			double v = base + (k * 37) % range;
+			switch ( filters[j] )
+			{
+				case PC_GT: npass += v > vals[j][0]; break;
+				case PC_LT: npass += v < vals[j][0]; break;
+				case PC_EQUAL: npass += v == vals[j][0]; break;
+				case PC_BETWEEN: npass += v > vals[j][0] && v < vals[j][1]; break;
+			}
+		}
+		CU_ASSERT_EQUAL(f->npoints, npass);
+		pc_patch_free(f);
+	}
+
+	pc_patch_free(psort);
+	pc_patch_free((PCPATCH *) pdlc);
+	pc_patch_free((PCPATCH *) pdl);
+	pc_dimstats_free(stats);
+	pc_pointlist_free(pl);
+}
+
+static void
+test_sort_filter_sorted_sigbits_small()
+{
+	char *xmlstr = file_to_str("data/las-schema.xml");
+	PCSCHEMA *las = pc_schema_from_xml(xmlstr);
+	pcfree(xmlstr);
+	CU_ASSERT_PTR_NOT_NULL(las);
+
+	/* bit offsets past 255 and 65535 read keys at the far end of the column */
+	test_sort_filter_sorted_sigbits_dim(las, "Classification", 10000, 8, 13);
+	test_sort_filter_sorted_sigbits_dim(schema, "Intensity", 20000, 1000, 200);
+
+	pc_schema_free(las);
+}
+
 /* REGISTER ***********************************************************/
 
 CU_TestInfo sort_tests[] = {
@@ -384,6 +853,12 @@ CU_TestInfo sort_tests[] = {
 	PC_TEST(test_sort_patch_is_sorted_compression_dimensional_sigbits),
 	PC_TEST(test_sort_patch_is_sorted_compression_dimensional_rle),
 	PC_TEST(test_sort_patch_ndims),
+	PC_TEST(test_sort_radix),
+	PC_TEST(test_sort_int64_exact),
+	PC_TEST(test_sort_curve),
+	PC_TEST(test_sort_curve_progressive),
+	PC_TEST(test_sort_filter_sorted),
+	PC_TEST(test_sort_filter_sorted_sigbits_small),
 	CU_TEST_INFO_NULL
 };
 
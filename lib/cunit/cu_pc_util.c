@@ -9,6 +9,7 @@
 
 #include "CUnit/Basic.h"
 #include "cu_tester.h"
+#include <float.h>
 
 
 /* GLOBALS ************************************************************/
@@ -93,11 +94,96 @@ test_bounding_diagonal_wkb_from_stats()
 	pcfree(wkbhex);
 }
 
+static void
+test_stats_layout()
+{
+	PCSTATS *stats, *clone, *view;
+	double d;
+
+	/* Values back to back in one block, copied and viewed as one */
+	stats = pc_stats_new(schema);
+	CU_ASSERT(stats->min.data == stats->data);
+	CU_ASSERT(stats->max.data == stats->data + schema->size);
+	CU_ASSERT(stats->avg.data == stats->data + 2 * schema->size);
+	pc_point_set_x(&stats->min, -10);
+	pc_point_set_x(&stats->max, 10);
+	pc_point_set_x(&stats->avg, 2);
+
+	clone = pc_stats_clone(stats);
+	CU_ASSERT(clone->data != stats->data);
+	CU_ASSERT_EQUAL(memcmp(clone->data, stats->data, pc_stats_size(schema)), 0);
+	pc_point_get_x(&clone->max, &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 10, 0.000001);
+
+	view = pc_stats_new_from_data(schema, clone->data);
+	CU_ASSERT(view->data == clone->data);
+	CU_ASSERT_EQUAL(view->avg.readonly, PC_TRUE);
+	pc_point_get_x(&view->avg, &d);
+	CU_ASSERT_DOUBLE_EQUAL(d, 2, 0.000001);
+
+	pc_stats_free(view);
+	pc_stats_free(clone);
+	pc_stats_free(stats);
+}
+
+static void
+test_arena()
+{
+	PCARENA arena;
+	uint8_t *a, *b, *big;
+	PCBITMAP *map;
+	PCDOUBLESTATS *dstats;
+	int i, zero = 1;
+
+	pc_arena_begin(&arena);
+	CU_ASSERT(pc_arena_alloc(&arena, 0) == NULL);
+
+	/* Small allocations come out of the arena itself, aligned */
+	a = pc_arena_alloc(&arena, 3);
+	b = pc_arena_alloc(&arena, 8);
+	CU_ASSERT(a == (uint8_t*)arena.initial);
+	CU_ASSERT(b == a + 8);
+	CU_ASSERT(arena.blocks == NULL);
+
+	/* Past the initial bytes, blocks are taken and zeroed */
+	for ( i = 0; i < 4; i++ )
+	{
+		a = pc_arena_alloc(&arena, PC_ARENA_INITIAL);
+		memset(a, 0xFF, PC_ARENA_INITIAL);
+	}
+	CU_ASSERT(arena.blocks != NULL);
+	big = pc_arena_alloc(&arena, 3 * PC_ARENA_BLOCKSIZE);
+	for ( i = 0; i < 3 * PC_ARENA_BLOCKSIZE; i++ )
+		zero &= big[i] == 0;
+	CU_ASSERT(zero);
+	memset(big, 0xFF, 3 * PC_ARENA_BLOCKSIZE);
+
+	/* A big block leaves the current one in use */
+	b = pc_arena_alloc(&arena, 8);
+	CU_ASSERT(b == a + PC_ARENA_INITIAL);
+
+	/* Bitmaps and accumulators of an arena are left to it */
+	map = pc_bitmap_new_in(&arena, 100);
+	pc_bitmap_set_range(map, 10, 20);
+	CU_ASSERT_EQUAL(map->nset, 20);
+	pc_bitmap_free(map);
+	dstats = pc_dstats_new_in(&arena, schema->ndims);
+	CU_ASSERT_DOUBLE_EQUAL(dstats->dims[0].min, DBL_MAX, 0);
+	pc_dstats_free(dstats);
+
+	pc_arena_end(&arena);
+	CU_ASSERT(arena.blocks == NULL);
+	CU_ASSERT(pc_arena_alloc(&arena, 8) == (uint8_t*)arena.initial);
+	pc_arena_end(&arena);
+}
+
 /* REGISTER ***********************************************************/
 
 CU_TestInfo util_tests[] = {
 	PC_TEST(test_bounding_diagonal_wkb_from_bounds),
 	PC_TEST(test_bounding_diagonal_wkb_from_stats),
+	PC_TEST(test_stats_layout),
+	PC_TEST(test_arena),
 	CU_TEST_INFO_NULL
 };
 
@@ -17,16 +17,17 @@
 size_t
 lazperf_compress_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa, uint8_t **compressed)
 {
-	size_t size = 1;
+	size_t size = -1;
 
 	LazPerfBuf buf;
+	// laz usually shrinks a patch well below a quarter of its raw size
+	buf.reserve(pa->datasize / 4 + 64);
 	LazPerfCompressor engine(pa->schema, buf);
 
 	if (engine.compress(pa->data, pa->datasize) == pa->npoints)
 	{
-		size = buf.buf.size();
-		*compressed = (uint8_t*) malloc(size);
-		*compressed = (uint8_t*) memcpy(*compressed, buf.data(), size);
+		size = buf.size;
+		*compressed = buf.release();
 	}
 
 	// log
@@ -37,27 +38,70 @@ lazperf_compress_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa, uint8_t **com
 }
 
 size_t
-lazperf_uncompress_from_compressed(const PCPATCH_LAZPERF *pa, uint8_t **decompressed)
+lazperf_uncompress_from_compressed(const PCPATCH_LAZPERF *pa, uint8_t *decompressed)
 {
 	size_t size = -1;
 	size_t datasize = pa->schema->size * pa->npoints;
 
-	LazPerfBuf buf;
-	buf.putBytes(pa->lazperf, pa->lazperfsize);
+	LazPerfBuf buf(pa->lazperf, pa->lazperfsize);
 	LazPerfDecompressor engine(pa->schema, buf);
 
-	*decompressed = (uint8_t*) malloc(datasize);
-
-	if (engine.decompress(*decompressed, datasize) == pa->npoints)
-		size = buf.buf.size();
+	if (engine.decompress(decompressed, datasize) == pa->npoints)
+		size = datasize;
 
 	// log
 	// lazperf_dump(pa);
-	// lazperf_dump(*decompressed, datasize);
+	// lazperf_dump(decompressed, datasize);
 
 	return size;
 }
 
+size_t
+lazperf_uncompress_range(const PCPATCH_LAZPERF *pa, size_t first, size_t count, uint8_t *decompressed)
+{
+	if (first >= pa->npoints)
+		return 0;
+
+	if (count > pa->npoints - first)
+		count = pa->npoints - first;
+
+	LazPerfBuf buf(pa->lazperf, pa->lazperfsize);
+	LazPerfDecompressor engine(pa->schema, buf);
+
+	// laz is sequential, the leading points have to be decoded anyway
+	if (engine.skip(first) != first)
+		return 0;
+
+	return engine.decompress(decompressed, count * pa->schema->size);
+}
+
+LAZPERF_DECODER*
+lazperf_decoder_new(const PCPATCH_LAZPERF *pa)
+{
+	return new LAZPERF_DECODER(pa);
+}
+
+size_t
+lazperf_decoder_read(LAZPERF_DECODER *dec, uint8_t *decompressed, size_t npoints)
+{
+	if (npoints > dec->npoints - dec->nread)
+		npoints = dec->npoints - dec->nread;
+
+	if (npoints == 0)
+		return 0;
+
+	size_t size = dec->engine.decompress(decompressed, npoints * dec->engine.pointsize());
+	dec->nread += size;
+
+	return size;
+}
+
+void
+lazperf_decoder_free(LAZPERF_DECODER *dec)
+{
+	delete dec;
+}
+
 /**********************************************************************
 * INTERNAL CPP
 */
@@ -106,6 +150,102 @@ lazperf_dump(const PCPATCH_LAZPERF* p)
 	std::cout << std::endl;
 }
 
+// Field layouts
+#define LAZPERF_LAYOUT_CACHE_SIZE 16
+
+static LazPerfLayout lazperf_layout_cache[LAZPERF_LAYOUT_CACHE_SIZE];
+static int lazperf_layout_cache_next = 0;
+
+static bool
+lazperf_layout_matches(const LazPerfLayout &layout, const PCSCHEMA *pcschema)
+{
+	if (layout.pcid != pcschema->pcid ||
+		layout.interpretations.size() != pcschema->ndims)
+		return false;
+
+	for (int i = 0; i < pcschema->ndims; i++)
+	{
+		if (layout.interpretations[i] != pcschema->dims[i]->interpretation)
+			return false;
+	}
+
+	return true;
+}
+
+static void
+lazperf_layout_build(LazPerfLayout &layout, const PCSCHEMA *pcschema)
+{
+	layout.pcid = pcschema->pcid;
+	layout.pointsize = 0;
+	layout.interpretations.clear();
+	layout.fields.clear();
+
+	for (int i = 0; i < pcschema->ndims; i++)
+	{
+		const PCDIMENSION *dim = pcschema->dims[i];
+		bool known = true;
+
+		layout.interpretations.push_back(dim->interpretation);
+
+		switch(dim->interpretation)
+		{
+			case PC_INT8:
+				layout.fields.push_back(LAZPERF_I8);
+				break;
+			case PC_UINT8:
+				layout.fields.push_back(LAZPERF_U8);
+				break;
+			case PC_INT16:
+				layout.fields.push_back(LAZPERF_I16);
+				break;
+			case PC_UINT16:
+				layout.fields.push_back(LAZPERF_U16);
+				break;
+			case PC_INT32:
+			case PC_FLOAT:
+				layout.fields.push_back(LAZPERF_I32);
+				break;
+			case PC_UINT32:
+				layout.fields.push_back(LAZPERF_U32);
+				break;
+			case PC_INT64:
+				layout.fields.push_back(LAZPERF_I32);
+				layout.fields.push_back(LAZPERF_I32);
+				break;
+			case PC_UINT64:
+			case PC_DOUBLE:
+				layout.fields.push_back(LAZPERF_U32);
+				layout.fields.push_back(LAZPERF_U32);
+				break;
+			case PC_UNKNOWN:
+			default:
+				known = false;
+		}
+
+		if (known)
+			layout.pointsize += dim->size;
+	}
+}
+
+// Return the field layout of the schema, from the cache when an entry with
+// the same pcid and dimension types is available. Entries live for the whole
+// backend, so they are std allocated rather than pcalloc'd.
+const LazPerfLayout&
+lazperf_layout(const PCSCHEMA *pcschema)
+{
+	for (int i = 0; i < LAZPERF_LAYOUT_CACHE_SIZE; i++)
+	{
+		if (lazperf_layout_matches(lazperf_layout_cache[i], pcschema))
+			return lazperf_layout_cache[i];
+	}
+
+	LazPerfLayout &layout = lazperf_layout_cache[lazperf_layout_cache_next];
+	lazperf_layout_cache_next = (lazperf_layout_cache_next + 1) % LAZPERF_LAYOUT_CACHE_SIZE;
+	lazperf_layout_build(layout, pcschema);
+
+	return layout;
+}
+
 // LazPerf class
 template<typename LazPerfEngine, typename LazPerfCoder>
 LazPerf<LazPerfEngine, LazPerfCoder>::LazPerf(const PCSCHEMA *pcschema, LazPerfBuf &buf)
@@ -124,80 +264,39 @@ template<typename LazPerfEngine, typename LazPerfCoder>
 void
 LazPerf<LazPerfEngine, LazPerfCoder>::initSchema()
 {
-	for (int i = 0; i < _pcschema->ndims; i++)
-		addField(_pcschema->dims[i]);
+	const LazPerfLayout &layout = lazperf_layout(_pcschema);
+
+	for (size_t i = 0; i < layout.fields.size(); i++)
+		addField(layout.fields[i]);
+
+	_pointsize = layout.pointsize;
 }
 
 template<typename LazPerfEngine, typename LazPerfCoder>
-bool
-LazPerf<LazPerfEngine, LazPerfCoder>::addField(const PCDIMENSION *dim)
+void
+LazPerf<LazPerfEngine, LazPerfCoder>::addField(LazPerfFieldType field)
 {
-	bool rc = true;
-
-	switch(dim->interpretation)
+	switch(field)
 	{
-		case PC_INT8:
-		{
+		case LAZPERF_I8:
 			_engine->template add_field<I8>();
 			break;
-		}
-		case PC_UINT8:
-		{
+		case LAZPERF_U8:
 			_engine->template add_field<U8>();
 			break;
-		}
-		case PC_INT16:
-		{
+		case LAZPERF_I16:
 			_engine->template add_field<I16>();
 			break;
-		}
-		case PC_UINT16:
-		{
+		case LAZPERF_U16:
 			_engine->template add_field<U16>();
 			break;
-		}
-		case PC_INT32:
-		{
-			_engine->template add_field<I32>();
-			break;
-		}
-		case PC_UINT32:
-		{
-			_engine->template add_field<U32>();
-			break;
-		}
-		case PC_INT64:
-		{
-			_engine->template add_field<I32>();
+		case LAZPERF_I32:
 			_engine->template add_field<I32>();
 			break;
-		}
-		case PC_UINT64:
-		{
-			_engine->template add_field<U32>();
+		case LAZPERF_U32:
 			_engine->template add_field<U32>();
 			break;
-		}
-		case PC_DOUBLE:
-		{
-			_engine->template add_field<U32>();
-			_engine->template add_field<U32>();
-			break;
-		}
-		case PC_FLOAT:
-		{
-			_engine->template add_field<I32>();
-			break;
-		}
-		case PC_UNKNOWN:
-		default:
-			rc = false;
 	}
-
-	if (rc)
-		_pointsize += dim->size;
-
-	return rc;
 }
 
 // LazPerf Compressor
@@ -260,4 +359,24 @@ LazPerfDecompressor::decompress(uint8_t *output, const size_t outputsize)
 	return size;
 }
 
+size_t
+LazPerfDecompressor::skip(const size_t npoints)
+{
+	_scratch.resize(_pointsize);
+
+	for (size_t i = 0; i < npoints; i++)
+		_engine->decompress(&_scratch[0]);
+
+	return npoints;
+}
+
+// Streaming decoder
+LAZPERF_DECODER::LAZPERF_DECODER(const PCPATCH_LAZPERF *pa)
+	: buf(pa->lazperf, pa->lazperfsize)
+	, engine(pa->schema, buf)
+	, npoints(pa->npoints)
+	, nread(0)
+{
+}
+
 #endif // HAVE_LAZPERF
@@ -16,8 +16,17 @@
 #ifdef __cplusplus
 extern "C" {
 #endif
+/** Compress an uncompressed patch, *compressed is pcalloc'd. Returns the compressed size or -1 on failure */
 size_t lazperf_compress_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa, uint8_t **compressed);
-size_t lazperf_uncompress_from_compressed(const PCPATCH_LAZPERF *pa, uint8_t **decompressed);
+/** Decompress a lazperf patch into a caller supplied buffer of schema->size * npoints bytes. Returns the decompressed size or -1 on failure */
+size_t lazperf_uncompress_from_compressed(const PCPATCH_LAZPERF *pa, uint8_t *decompressed);
+/** Decompress count points starting at (0-based) first, decoding stops after the last one. Returns the number of points written */
+size_t lazperf_uncompress_range(const PCPATCH_LAZPERF *pa, size_t first, size_t count, uint8_t *decompressed);
+/** Streaming decoder reading the patch buffer in place, the patch must outlive it */
+LAZPERF_DECODER* lazperf_decoder_new(const PCPATCH_LAZPERF *pa);
+/** Decompress up to npoints following points. Returns the number of points written, 0 once the patch is exhausted */
+size_t lazperf_decoder_read(LAZPERF_DECODER *dec, uint8_t *decompressed, size_t npoints);
+void lazperf_decoder_free(LAZPERF_DECODER *dec);
 #ifdef __cplusplus
 }
 #endif
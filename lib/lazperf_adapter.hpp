@@ -9,7 +9,10 @@
 
 #pragma once
 
+// the memory handlers (pcalloc and friends) have C linkage
+extern "C" {
 #include "pc_api_internal.h"
+}
 
 #ifdef HAVE_LAZPERF
 #include <laz-perf/common/common.hpp>
@@ -20,6 +23,9 @@
 #include <laz-perf/formats.hpp>
 #include <laz-perf/las.hpp>
 
+#include <algorithm>
+#include <vector>
+
 /**********************************************************************
 * C API
 */
@@ -33,26 +39,53 @@ void lazperf_dump( uint8_t* data, const size_t size );
 void lazperf_dump( const PCPATCH_UNCOMPRESSED *p );
 void lazperf_dump( const PCPATCH_LAZPERF *p );
 
-// struct which capture data coming from the compressor
+// Stream used by the laz-perf coders. In read mode the compressed bytes are
+// consumed in place (typically straight from the detoasted datum), in write
+// mode the encoder output goes into a pcalloc'd buffer which is handed over
+// to the caller with release(), so no staging copy is needed either way.
 struct LazPerfBuf {
-	LazPerfBuf() : buf(), idx(0) {}
+	// write mode
+	LazPerfBuf() : buf(NULL), size(0), capacity(0), idx(0), owned(true) {}
+
+	// read mode, input is not copied and must outlive the buffer
+	LazPerfBuf(const uint8_t *input, size_t inputsize)
+		: buf(const_cast<uint8_t*>(input)), size(inputsize), capacity(inputsize)
+		, idx(0), owned(false) {}
+
+	~LazPerfBuf() {
+		if (owned && buf)
+			pcfree(buf);
+	}
 
 	const uint8_t*	data() {
-		return reinterpret_cast<const uint8_t*>(buf.data());
+		return buf;
+	}
+
+	void reserve(size_t len) {
+		if (len <= capacity)
+			return;
+
+		if (buf)
+			buf = (uint8_t*) pcrealloc(buf, len);
+		else
+			buf = (uint8_t*) pcalloc(len);
+		capacity = len;
 	}
 
 	void putBytes(const unsigned char* b, size_t len) {
-		while(len --) {
-			buf.push_back(*b++);
-		}
+		if (size + len > capacity)
+			reserve(std::max(size + len, 2 * capacity));
+		memcpy(buf + size, b, len);
+		size += len;
 	}
 
 	void putByte(const unsigned char b) {
-		buf.push_back(b);
+		putBytes(&b, 1);
 	}
 
 	unsigned char getByte() {
-		return buf[idx++];
+		// the arithmetic decoder may look ahead past the end of the stream
+		return idx < size ? buf[idx++] : 0;
 	}
 
 	void getBytes(unsigned char *b, int len) {
@@ -61,10 +94,49 @@ struct LazPerfBuf {
 		}
 	}
 
-	std::vector<unsigned char> buf;
+	// give the written bytes away, the caller is in charge of pcfree
+	uint8_t* release() {
+		uint8_t *b = buf;
+		buf = NULL;
+		size = capacity = 0;
+		return b;
+	}
+
+	uint8_t *buf;
+	size_t size;
+	size_t capacity;
 	size_t idx;
+	bool owned;
+
+	private:
+		LazPerfBuf(const LazPerfBuf&);
+		LazPerfBuf& operator=(const LazPerfBuf&);
 };
 
+// laz-perf field types used to encode a pcpoint
+enum LazPerfFieldType {
+	LAZPERF_I8,
+	LAZPERF_U8,
+	LAZPERF_I16,
+	LAZPERF_U16,
+	LAZPERF_I32,
+	LAZPERF_U32
+};
+
+// Field layout of a schema, computed once per pcid and kept in a small
+// backend-wide cache so that engines don't re-walk the schema dimensions
+// for every patch.
+struct LazPerfLayout {
+	LazPerfLayout() : pcid(0), pointsize(0) {}
+
+	uint32_t pcid;
+	size_t pointsize;
+	std::vector<uint32_t> interpretations;
+	std::vector<LazPerfFieldType> fields;
+};
+
+const LazPerfLayout& lazperf_layout( const PCSCHEMA *pcschema );
+
 // some typedef
 typedef laszip::encoders::arithmetic<LazPerfBuf> Encoder;
 typedef laszip::decoders::arithmetic<LazPerfBuf> Decoder;
@@ -84,7 +156,7 @@ class LazPerf {
 
 	protected:
 		void initSchema();
-		bool addField(const PCDIMENSION *dim);
+		void addField(LazPerfFieldType field);
 
 		const PCSCHEMA *_pcschema;
 		LazPerfCoder _coder;
@@ -110,5 +182,19 @@ class LazPerfDecompressor : public LazPerf<Decompressor, Decoder> {
 		~LazPerfDecompressor();
 
 		size_t decompress( uint8_t *data, const size_t datasize );
+		size_t skip( const size_t npoints );
+
+	private:
+		std::vector<char> _scratch;
+};
+
+// streaming decoder handed to C code, points are decoded on demand
+struct LAZPERF_DECODER {
+	LAZPERF_DECODER( const PCPATCH_LAZPERF *pa );
+
+	LazPerfBuf buf;
+	LazPerfDecompressor engine;
+	size_t npoints;
+	size_t nread;
 };
 #endif // HAVE_LAZPERF
@@ -62,6 +62,28 @@ typedef enum
 	PC_BETWEEN
 } PC_FILTERTYPE;
 
+/**
+* Space-filling curves points can be ordered along,
+* within the X/Y bounds of their patch.
+*/
+enum CURVES
+{
+	PC_CURVE_NONE = 0,
+	PC_CURVE_MORTON = 1,
+	PC_CURVE_HILBERT = 2,
+	/* Morton order, read in bit-reversed rank so any prefix is spread over the patch */
+	PC_CURVE_PROGRESSIVE = 3
+};
+
+/** Ways of picking the points kept by pc_patch_decimate */
+enum DECIMATIONS
+{
+	PC_DECIMATE_STRIDE = 0,
+	PC_DECIMATE_RANDOM = 1,
+	PC_DECIMATE_GRID = 2,
+	PC_DECIMATE_NUM_METHODS
+};
+
 
 
 /**
@@ -79,6 +101,7 @@ typedef struct
 	double scale;
 	double offset;
 	uint8_t active;
+	int32_t compression;  /* Dimensional compression to use, or PC_DIM_AUTO */
 } PCDIMENSION;
 
 typedef struct
@@ -93,15 +116,41 @@ typedef struct
 	PCDIMENSION *zdim;    /* pointer to the z dimension within dims */
 	PCDIMENSION *mdim;    /* pointer to the m dimension within dims */
 	uint32_t compression; /* Compression type applied to the data */
+	uint32_t spatialsort; /* Curve to order points along before compression, see CURVES */
 	hashtable *namehash;  /* Look-up from dimension name to pointer */
 } PCSCHEMA;
 
+/* How many dimensional compressions there are, see DIMCOMPRESSIONS */
+#define PC_DIM_NUM_COMPRESSIONS 8
+
+/* No dimensional compression set by the schema, the stats pick one */
+#define PC_DIM_AUTO -1
+
+/* What trial encoding picks the compression of a dimension for */
+typedef enum
+{
+	PC_TRIAL_NONE = 0,  /* no trial, estimate from runs and common bits */
+	PC_TRIAL_SIZE = 1,  /* smallest encoding */
+	PC_TRIAL_SPEED = 2  /* fastest decoding of those that compress */
+} PC_TRIAL_OBJECTIVE;
+
+/* Totals of trial encodings of a dimension with one compression */
+typedef struct
+{
+	uint64_t size;       /* encoded bytes */
+	double encode_time;  /* seconds spent encoding */
+	double decode_time;  /* seconds spent decoding */
+} PCDIMTRIAL;
+
 /* Used for dimensional patch statistics */
 typedef struct
 {
 	uint32_t total_runs;
 	uint32_t total_commonbits;
+	uint32_t total_deltabytes;
+	uint32_t total_delta2bytes;
 	uint32_t recommended_compression;
+	PCDIMTRIAL trials[PC_DIM_NUM_COMPRESSIONS];
 } PCDIMSTAT;
 
 typedef struct
@@ -109,6 +158,7 @@ typedef struct
 	int32_t ndims;
 	uint32_t total_points;
 	uint32_t total_patches;
+	PC_TRIAL_OBJECTIVE objective;
 	PCDIMSTAT *stats;
 } PCDIMSTATS;
 
@@ -126,12 +176,20 @@ typedef struct
 	uint8_t *data; /* A serialized version of the data */
 } PCPOINT;
 
+/**
+* A list of separately allocated points, or a list of rows where
+* the points are views into the rows of one buffer, back to back
+* in the schema layout. Lists of rows have a schema.
+*/
 typedef struct
 {
 	void *mem; /* An opaque memory buffer to be freed on destruction if not NULL */
 	uint32_t npoints;
 	uint32_t maxpoints;
 	PCPOINT **points;
+	const PCSCHEMA *schema; /* Of the rows, NULL for a list of separate points */
+	uint8_t *data; /* The rows, owned by the list when it is also mem */
+	PCPOINT *views; /* The points of the rows, in one array */
 } PCPOINTLIST;
 
 typedef struct
@@ -141,9 +199,41 @@ typedef struct
 	uint32_t interpretation;
 	uint32_t compression;
 	uint32_t readonly;
+	uint32_t indexsize; /* Bytes of block index after the size bytes, or 0 */
 	uint8_t *bytes;
 } PCBYTES;
 
+/**
+* RLE and zlib bytes of many values carry a block index, so one
+* value is found without decoding those before it: the point count
+* at the end of every PC_INDEX_RUNS runs for RLE, the end offset of
+* each independently deflated block of PC_INDEX_VALUES values for
+* zlib. Zlib bytes only get one when encoded with
+* PC_DIM_ZLIB | PC_DIM_INDEXED, as the blocks compress less well. It follows the encoded values as uint32 entries, then the
+* block length and the entry count. Serialized bytes that have one
+* flag their compression byte with PC_DIM_INDEXED.
+*/
+#define PC_DIM_INDEXED 0x40
+#define PC_INDEX_RUNS 64
+#define PC_INDEX_VALUES 1024
+
+/**
+* Serialized dimensional data may open with a directory locating
+* each dimension, so one can be reached without reading those
+* before it. The directory is flagged by a marker byte where the
+* older layout has the compression of its first dimension, and
+* holds one PC_DIMENTRY_SIZE entry per dimension.
+*/
+#define PC_DIMENSIONAL_DIRECTORY 0x81
+#define PC_DIMENTRY_SIZE 9
+
+typedef struct
+{
+	uint32_t offset; /* From the start of the dimensional data */
+	uint32_t size;
+	uint8_t compression;
+} PCDIMENTRY;
+
 typedef struct
 {
 	double xmin;
@@ -152,12 +242,17 @@ typedef struct
 	double ymax;
 } PCBOUNDS;
 
-/* Used for generic patch statistics */
+/*
+* Used for generic patch statistics. The min, max and avg values lie
+* back to back from data, in the same allocation as the stats or in
+* the serialized patch they were read from.
+*/
 typedef struct
 {
 	PCPOINT min;
 	PCPOINT max;
 	PCPOINT avg;
+	uint8_t *data;
 }
 PCSTATS;
 
@@ -167,6 +262,9 @@ PCSTATS;
 * one of these by pointing the data element at the
 * PgSQL memory and setting the capacity to 0
 * to indicate it is read-only.
+*
+* The sortdim of a patch is 1 + the position of the dimension
+* its points are known to be sorted by, ascending, or 0.
 */
 
 #define PCPATCH_COMMON \
@@ -174,6 +272,7 @@ PCSTATS;
 	int8_t readonly; \
 	const PCSCHEMA *schema; \
 	uint32_t npoints;  \
+	uint32_t sortdim; \
 	PCBOUNDS bounds; \
 	PCSTATS *stats;
 
@@ -210,6 +309,140 @@ typedef struct
 	uint8_t *lazperf;
 } PCPATCH_LAZPERF;
 
+/* How a dimension of the new schema of a PCREMAP gets its values */
+enum REMAPOPS
+{
+	PC_REMAP_COPY = 0,    /* bytes of the old dimension as they are */
+	PC_REMAP_RESCALE = 1, /* values of the old dimension converted */
+	PC_REMAP_DEFAULT = 2  /* no old dimension, the default value */
+};
+
+typedef struct
+{
+	uint32_t op;
+	const PCDIMENSION *odim; /* NULL for PC_REMAP_DEFAULT */
+	const PCDIMENSION *ndim;
+} PCREMAPDIM;
+
+typedef struct
+{
+	uint32_t ooffset;
+	uint32_t noffset;
+	uint32_t size;
+} PCREMAPSEGMENT;
+
+/**
+* Plan to move patches from an old schema to a new one, worked out
+* once per pair of schemas. Dimensions copied next to each other on
+* both sides are merged in segments copied in one go.
+*/
+typedef struct
+{
+	const PCSCHEMA *oschema;
+	const PCSCHEMA *nschema;
+	double def;
+	int rescale;
+	uint32_t ncopy;
+	uint32_t nrescale;
+	uint32_t ndefault;
+	PCREMAPDIM *dims; /* One per dimension of nschema */
+	uint32_t nsegments;
+	PCREMAPSEGMENT *segments;
+	uint8_t *defrow; /* A point of nschema holding the defaults */
+} PCREMAP;
+
+/* Values gathered per cell of a PCGRID */
+enum GRIDAGGS
+{
+	PC_GRID_COUNT = 0,
+	PC_GRID_MIN = 1,
+	PC_GRID_MAX = 2,
+	PC_GRID_SUM = 3,
+	PC_GRID_AVG = 4,
+	PC_GRID_NUM_AGGS
+};
+
+/* No grid grows over this many cells */
+#define PC_GRID_MAX_CELLS (1 << 24)
+
+/**
+* Square cells binning points, the cells laid out row by row from the
+* south west one. Columns and rows are counted from 0,0 in steps of
+* the cell size, so grids of a cell size line up whatever their extent.
+*/
+typedef struct
+{
+	double cellsize;
+	double invcellsize;
+	int64_t ix; /* Column of the western cells */
+	int64_t iy; /* Row of the southern cells */
+	uint32_t nx;
+	uint32_t ny;
+	uint32_t *count;
+	double *sum;
+	double *min;
+	double *max;
+} PCGRID;
+
+/* A point held by a PCKNN */
+typedef struct
+{
+	double dist;    /* Squared distance to the location */
+	uint32_t idx;   /* Row of the point in rows, or in the patch being scanned if fresh */
+	uint32_t fresh;
+} PCKNNHIT;
+
+/**
+* Search for the k points nearest to a location over patches of a
+* schema. The hits are a max-heap, so the farthest point held is
+* the first to give way.
+*/
+typedef struct
+{
+	const PCSCHEMA *schema;
+	double x;
+	double y;
+	double z;
+	int usez;
+	uint32_t k;
+	uint32_t nhits;
+	PCKNNHIT *hits;
+	uint8_t *rows;    /* k rows of the points held */
+	uint8_t *scratch; /* k rows, swapped with rows */
+} PCKNN;
+
+/**
+* Operations counted while pc_counters_enable is on, the dimensional
+* encodings and decodings one per DIMCOMPRESSIONS from PC_OP_DIM_ENCODE
+* and PC_OP_DIM_DECODE.
+*/
+enum PCCOUNTEROPS
+{
+	PC_OP_DIM_ENCODE = 0,
+	PC_OP_DIM_DECODE = PC_OP_DIM_ENCODE + PC_DIM_NUM_COMPRESSIONS,
+	PC_OP_LAZPERF_ENCODE = PC_OP_DIM_DECODE + PC_DIM_NUM_COMPRESSIONS,
+	PC_OP_LAZPERF_DECODE,
+	PC_OP_GHT_ENCODE,
+	PC_OP_GHT_DECODE,
+	PC_OP_FILTER,
+	PC_OP_SORT,
+	PC_OP_STATS,
+	PC_OP_SERIALIZE,
+	PC_OP_DESERIALIZE,
+	PC_OP_ALLOC,
+	PC_NUM_OPS
+};
+
+/* Running totals of an operation since the last pc_counters_reset */
+typedef struct
+{
+	uint64_t calls;
+	uint64_t points;
+	uint64_t bytesin;
+	uint64_t bytesout;
+	uint64_t nanos;
+} PCCOUNTER;
+
 
 /* Global function signatures for memory/logging handlers. */
 typedef void* (*pc_allocator)(size_t size);
@@ -247,6 +480,39 @@ void pc_set_handlers(
 /** Set program to use system memory allocators and messaging */
 void pc_install_default_handlers(void);
 
+/** Set how many threads may encode and decode the dimensions of a patch, 0 for one per processor, 1 to stay serial */
+void pc_set_num_threads(int nthreads);
+
+/** How many threads may encode and decode the dimensions of a patch */
+int pc_get_num_threads(void);
+
+/* Bytes of the first allocations of an arena, held in the arena itself */
+#define PC_ARENA_INITIAL 2048
+/* Smallest block an arena takes from the allocator once the first bytes are used */
+#define PC_ARENA_BLOCKSIZE 16384
+
+/**
+* Bump allocator for the temporary memory of one operation. Memory
+* handed out is zeroed, like pcalloc's, and is only released by
+* pc_arena_end, all at once. The first few allocations come out of
+* the arena itself, so one declared on the stack makes small
+* operations allocation free. An arena must not be copied while in use.
+*/
+typedef struct
+{
+	struct PCARENABLOCK_t *blocks;
+	uint8_t *ptr;
+	size_t avail;
+	uint64_t initial[PC_ARENA_INITIAL / sizeof(uint64_t)];
+} PCARENA;
+
+/** Start using an arena */
+void pc_arena_begin(PCARENA *arena);
+/** Zeroed memory from the arena, aligned for any value, NULL for a zero size */
+void* pc_arena_alloc(PCARENA *arena, size_t size);
+/** Release all the memory handed out by the arena */
+void pc_arena_end(PCARENA *arena);
+
 
 /**********************************************************************
 * UTILITY
@@ -260,9 +526,16 @@ char* pc_hexbytes_from_bytes(const uint8_t *bytebuf, size_t bytesize);
 uint32_t pc_wkb_get_pcid(const uint8_t *wkb);
 /** Build an empty #PCDIMSTATS based on the schema */
 PCDIMSTATS* pc_dimstats_make(const PCSCHEMA *schema);
+/** Free the PCDIMSTATS memory */
+void pc_dimstats_free(PCDIMSTATS *pds);
+/** Returns a JSON summary of the #PCDIMSTATS */
+char* pc_dimstats_to_string(const PCDIMSTATS *pds);
 /** Get compression name from enum */
 const char* pc_compression_name(int num);
 
+/** Returns the name of a dimensional compression */
+const char* pc_dim_compression_name(int num);
+
 
 
 /**********************************************************************
@@ -302,10 +575,16 @@ uint32_t pc_schema_same_interpretations(const PCSCHEMA *s1, const PCSCHEMA *s2);
 /** Allocate a pointlist */
 PCPOINTLIST* pc_pointlist_make(uint32_t npoints);
 
+/** Allocate a list of rows of a schema, with room for npoints */
+PCPOINTLIST* pc_pointlist_make_rows(const PCSCHEMA *schema, uint32_t npoints);
+
+/** Copy the data of a point as a new row, growing the buffer as necessary, which moves the views */
+void pc_pointlist_add_row(PCPOINTLIST *pl, const uint8_t *data);
+
 /** Free a pointlist, including the points contained therein */
 void pc_pointlist_free(PCPOINTLIST *pl);
 
-/** Add a point to the list, expanding buffer as necessary */
+/** Add a point to the list, expanding buffer as necessary, lists of rows copy and free it */
 void pc_pointlist_add_point(PCPOINTLIST *pl, PCPOINT *pt);
 
 /** Get a point from the list */
@@ -396,7 +675,10 @@ uint8_t* pc_point_to_geometry_wkb(const PCPOINT *pt, size_t *wkbsize);
 /** Create new PCPATCH from a PCPOINT set. Copies data, doesn't take ownership of points */
 PCPATCH* pc_patch_from_pointlist(const PCPOINTLIST *ptl);
 
-/** Returns a list of points extracted from patch */
+/** Create new PCPATCH from a PCPOINT set, taking over the rows of a list of rows, which is left empty */
+PCPATCH* pc_patch_from_pointlist_take(PCPOINTLIST *ptl);
+
+/** Returns a list of points extracted from patch, views into the rows of an uncompressed patch */
 PCPOINTLIST* pc_pointlist_from_patch(const PCPATCH *patch);
 
 /** Merge a set of patches into a single patch */
@@ -423,6 +705,15 @@ char* pc_patch_to_string(const PCPATCH *patch);
 /** Return byte buffer size of serialization */
 size_t pc_patch_dimensional_serialized_size(const PCPATCH_DIMENSIONAL *patch);
 
+/** Return byte buffer size of serialization behind a dimension directory */
+size_t pc_patch_dimensional_directory_serialized_size(const PCPATCH_DIMENSIONAL *patch);
+
+/** Write the dimensions down to a buffer behind a dimension directory */
+int pc_patch_dimensional_directory_serialize(const PCPATCH_DIMENSIONAL *patch, uint8_t *buf);
+
+/** Locate the ndims dimensions of serialized dimensional data, with or without a directory */
+int pc_patch_dimensional_directory_read(const uint8_t *buf, size_t bufsize, uint32_t ndims, int flip_endian, PCDIMENTRY *dir);
+
 /** How big will the serialization be? */
 size_t pc_bytes_serialized_size(const PCBYTES *pcb);
 
@@ -432,8 +723,14 @@ int pc_bytes_serialize(const PCBYTES *pcb, uint8_t *buf, size_t *size);
 /** Read a buffer up into a bytes structure */
 int pc_bytes_deserialize(const uint8_t *buf, const PCDIMENSION *dim, PCBYTES *pcb, int readonly, int flip_endian);
 
+/** Read the bytes of a dimension directory entry up into a bytes structure */
+int pc_bytes_from_dimentry(const uint8_t *buf, const PCDIMENTRY *entry, const PCDIMENSION *dim, uint32_t npoints, PCBYTES *pcb, int readonly, int flip_endian);
+
+/** Take the block index flagged on serialized bytes out of their size into their indexsize */
+int pc_bytes_index_split(PCBYTES *pcb, int flip_endian);
+
 /** Wrap serialized stats in a new stats objects */
-PCSTATS* pc_stats_new_from_data(const PCSCHEMA *schema, const uint8_t *mindata, const uint8_t *maxdata, const uint8_t *avgdata);
+PCSTATS* pc_stats_new_from_data(const PCSCHEMA *schema, const uint8_t *data);
 
 /** Allocate a stats object */
 PCSTATS* pc_stats_new(const PCSCHEMA *schema);
@@ -453,6 +750,9 @@ int pc_patch_compute_extent(PCPATCH *patch);
 /** True/false if bounds intersect */
 int pc_bounds_intersects(const PCBOUNDS *b1, const PCBOUNDS *b2);
 
+/** X/Y distance from a location to the bounds, 0 inside of them */
+double pc_bounds_distance(const PCBOUNDS *b, double x, double y);
+
 /** Returns OGC WKB of the bounding diagonal of XY bounds */
 uint8_t* pc_bounding_diagonal_wkb_from_bounds(const PCBOUNDS *bounds, const PCSCHEMA *schema, size_t *wkbsize);
 
@@ -471,22 +771,143 @@ PCPATCH* pc_patch_filter_equal_by_name(const PCPATCH *pa, const char *name, doub
 /** Subset batch based on range condition on dimension */
 PCPATCH* pc_patch_filter_between_by_name(const PCPATCH *pa, const char *name, double val1, double val2);
 
+/**
+* Subset patch based on an expression of dimension conditions, like
+* "classification = 2 AND z BETWEEN 10 AND 50 AND intensity > 100".
+* Conditions use <, >, = and (exclusive) BETWEEN and are combined with
+* AND, OR, NOT and parentheses. Returns NULL if the expression does not parse.
+*/
+PCPATCH* pc_patch_filter_by_expression(const PCPATCH *pa, const char *expr);
+
 /** get point n */
 PCPOINT *pc_patch_pointn(const PCPATCH *patch, int n);
 
-/** Sorted patch after reordering points on dimensions */
+/**
+* Write the npoints values of one dimension into vals. Dimensional
+* patches only decode the bytes of that dimension.
+*/
+int pc_patch_get_values(const PCPATCH *patch, const PCDIMENSION *dim, double *vals);
+
+/**
+* Write the values of ndims dimensions into vals, npoints values for
+* each dimension one after the other. Other patches than dimensional
+* ones are decoded only once for all the dimensions.
+*/
+int pc_patch_get_values_multi(const PCPATCH *patch, PCDIMENSION **dims, uint32_t ndims, double *vals);
+
+/**
+* Sorted patch after reordering points on dimensions. A single name
+* of "morton" or "hilbert" that is not a dimension of the schema
+* orders the points along that curve instead.
+*/
 PCPATCH *pc_patch_sort(const PCPATCH *pa, const char **name, int ndims);
 
+/** Patch with its points ordered along a space-filling curve over their X/Y bounds */
+PCPATCH *pc_patch_sort_curve(const PCPATCH *pa, int curve);
+
+/** Curve number of a curve name, PC_CURVE_NONE for other names */
+int pc_curve_number(const char *str);
+
+/** Name of a curve number */
+const char *pc_curve_name(int num);
+
 /** True/false if the patch is sorted on dimension */
 uint32_t pc_patch_is_sorted(const PCPATCH *pa, const char **name, int ndims, char strict);
 
-/** Subset batch based on index */
+/**
+* Subset batch based on index. Returns pa itself when the range
+* covers it, and a readonly view on the points of an uncompressed
+* pa, which must then outlive the result.
+*/
 PCPATCH* pc_patch_range(const PCPATCH *pa, int first, int count);
 
+/**
+* About n points of the patch kept in their order, every npoints/n-th
+* one, a random draw that is the same for the same patch, or the first
+* point of each cell of a grid of about n cells. Returns pa itself when
+* n covers it, dimensional patches stay dimensional.
+*/
+PCPATCH* pc_patch_decimate(const PCPATCH *pa, int method, uint32_t n);
+
+/** Decimation method number of a name such as "stride", -1 for other names */
+int pc_decimation_number(const char *str);
+
+/** Name of a decimation method number */
+const char *pc_decimation_name(int method);
+
 /** assign a schema to the patch */
 PCPATCH *pc_patch_set_schema(PCPATCH *patch, const PCSCHEMA *schema, double def);
 
 /** transform the patch based on the passed schema */
 PCPATCH *pc_patch_transform(const PCPATCH *patch, const PCSCHEMA *schema, double def);
 
+/** Plan to move patches to nschema, converting values that differ in scale or interpretation if rescale is set */
+PCREMAP *pc_remap_new(const PCSCHEMA *oschema, const PCSCHEMA *nschema, double def, int rescale);
+
+/** Free a remap plan */
+void pc_remap_free(PCREMAP *remap);
+
+/** Move a patch of the old schema of the plan to its new one, dimensional patches stay dimensional */
+PCPATCH *pc_remap_patch(const PCREMAP *remap, const PCPATCH *pa);
+
+/** Grid aggregate number of a name such as "avg", -1 for other names */
+int pc_grid_agg_number(const char *str);
+
+/** Name of a grid aggregate number */
+const char *pc_grid_agg_name(int agg);
+
+/** Empty grid of square cells of cellsize */
+PCGRID *pc_grid_new(double cellsize);
+
+/** Free a grid */
+void pc_grid_free(PCGRID *grid);
+
+/** Grow the grid to cover the bounds too */
+int pc_grid_extend(PCGRID *grid, const PCBOUNDS *bounds);
+
+/** Bin the points of the patch, leaving out those outside the grid. A NULL dim only counts them */
+int pc_grid_add_patch(PCGRID *grid, const PCPATCH *pa, const PCDIMENSION *dim);
+
+/** Grid over the bounds of a patch, with its points binned */
+PCGRID *pc_grid_from_patch(const PCPATCH *pa, double cellsize, const PCDIMENSION *dim);
+
+/** Fold the cells of other into grid, both of the same cell size */
+int pc_grid_merge(PCGRID *grid, const PCGRID *other);
+
+/** Write the agg value of the nx * ny cells to vals, northern row first, flagging cells without points in isnull */
+int pc_grid_get_values(const PCGRID *grid, int agg, double *vals, uint8_t *isnull);
+
+/** One band PostGIS raster WKB of the agg values of the grid */
+uint8_t *pc_grid_to_raster_wkb(const PCGRID *grid, int agg, int32_t srid, size_t *wkbsize);
+
+/** Search for the k points nearest to x, y, and z if usez is set and the schema has a Z dimension */
+PCKNN *pc_knn_new(const PCSCHEMA *schema, double x, double y, double z, int usez, uint32_t k);
+
+/** Free a search */
+void pc_knn_free(PCKNN *knn);
+
+/** Offer the points of a patch, passing over patches with bounds farther than the k points held */
+int pc_knn_add_patch(PCKNN *knn, const PCPATCH *pa);
+
+/** Distance to the farthest of the k points held, infinity until k are held */
+double pc_knn_max_distance(const PCKNN *knn);
+
+/** Uncompressed patch of the points held, nearest first */
+PCPATCH_UNCOMPRESSED *pc_knn_get_patch(const PCKNN *knn);
+
+/** The k points of the patch nearest to x, y (and z), nearest first */
+PCPATCH *pc_patch_knn(const PCPATCH *pa, double x, double y, double z, int usez, uint32_t k);
+
+/** Start or stop counting calls, points, bytes and time of the operations of PCCOUNTEROPS */
+void pc_counters_enable(int on);
+
+/** Zero the counters */
+void pc_counters_reset(void);
+
+/** Totals of an operation since the last reset */
+int pc_counter_get(int op, PCCOUNTER *counter);
+
+/** Name of an operation of PCCOUNTEROPS, such as "decode zlib" */
+const char *pc_counter_name(int op);
+
 #endif /* _PC_API_H */
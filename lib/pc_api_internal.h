@@ -61,7 +61,11 @@ enum DIMCOMPRESSIONS
 	PC_DIM_NONE = 0,
 	PC_DIM_RLE = 1,
 	PC_DIM_SIGBITS = 2,
-	PC_DIM_ZLIB = 3
+	PC_DIM_ZLIB = 3,
+	PC_DIM_DELTA = 4,
+	PC_DIM_DELTA2 = 5,
+	PC_DIM_ZSTD = 6,
+	PC_DIM_LZ4 = 7
 };
 
 /* PCDOUBLESTAT are members of PCDOUBLESTATS */
@@ -76,17 +80,106 @@ typedef struct
 typedef struct
 {
 	uint32_t npoints;
+	/* Taken from a PCARENA, pc_dstats_free leaves it to the arena */
+	int inarena;
 	PCDOUBLESTAT *dims;
 } PCDOUBLESTATS;
 
+/**
+* Streaming union of patches, built up one input patch at a time
+* so the memory held stays close to the size of the final patch.
+* While every input is dimensional each one is decoded into growing
+* per-dimension columns and let go, once any other input arrives all
+* points move to one uncompressed buffer that grows geometrically and
+* keeps running stats.
+*/
+typedef struct
+{
+	const PCSCHEMA *schema;
+	uint32_t npoints;
+	PCBOUNDS bounds;
+	/* Uncompressed columns of the points, while every input is dimensional */
+	PCPATCH_DIMENSIONAL *pdl;
+	uint32_t maxpoints;
+	/* Points of all inputs, NULL while every input is dimensional */
+	PCPATCH_UNCOMPRESSED *pu;
+	PCDOUBLESTATS *dstats;
+} PCPATCH_UNION;
+
+/**
+* Reads the points of a patch in order, a batch at a time, in the
+* uncompressed point layout. Uncompressed patches are read in place,
+* dimensional ones have their dimensions decoded once and are then
+* interleaved batch by batch into one reused buffer, lazperf ones
+* are decoded only as far as the caller reads.
+*/
+typedef struct
+{
+	const PCPATCH *patch;
+	uint32_t next;
+	uint32_t batchsize;
+	uint8_t *buf;
+	/* What the points are read from, depending on the patch type */
+	const PCPATCH_UNCOMPRESSED *pu;
+	PCPATCH_UNCOMPRESSED *pu_owned;
+	PCPATCH_DIMENSIONAL *pdl;
+	struct LAZPERF_DECODER *decoder;
+} PCPATCH_CURSOR;
 
+
+/**
+* One bit per point, packed into 64-bit words with point i at
+* bit (i % 64) of word (i / 64). Bits past npoints are always zero.
+* The words follow the struct in the same allocation.
+*/
 typedef struct
 {
 	uint32_t nset;
 	uint32_t npoints;
-	uint8_t *map;
+	uint64_t *map;
+	/* Taken from a PCARENA, pc_bitmap_free leaves it to the arena */
+	int inarena;
 } PCBITMAP;
 
+typedef enum
+{
+	PC_FILTEREXPR_CLAUSE,
+	PC_FILTEREXPR_AND,
+	PC_FILTEREXPR_OR,
+	PC_FILTEREXPR_NOT
+} PC_FILTEREXPR_TYPE;
+
+/**
+* Parsed filter expression. Clause nodes test one dimension
+* against one or two values, AND / OR nodes combine their
+* arguments and NOT nodes invert their single argument.
+*/
+typedef struct PCFILTEREXPR
+{
+	PC_FILTEREXPR_TYPE type;
+	uint32_t dimnum;
+	PC_FILTERTYPE filter;
+	double val1;
+	double val2;
+	uint32_t nargs;
+	struct PCFILTEREXPR **args;
+} PCFILTEREXPR;
+
+/**
+* Polygon or multipolygon read from WKB. All the rings are tested
+* together by the even-odd rule, which takes care of holes and of
+* the parts of a multipolygon alike.
+*/
+typedef struct
+{
+	uint32_t srid;     /* 0 when the WKB carries none */
+	uint32_t nrings;
+	uint32_t *rings;   /* nrings+1 offsets into the vertices */
+	uint32_t npoints;
+	double *xy;        /* npoints x/y pairs */
+	PCBOUNDS bounds;
+} PCPOLYGON;
+
 
 /** What is the endianness of this system? */
 char machine_endian(void);
@@ -130,6 +223,19 @@ double pc_double_from_ptr(const uint8_t *ptr, uint32_t interpretation);
 /** Write value to buffer in the interpretation type */
 int pc_double_to_ptr(uint8_t *ptr, uint32_t interpretation, double val);
 
+/** Values converted at a time by the batch conversions, a stack buffer of doubles worth */
+#define PC_VALUES_CHUNK 256
+
+/**
+* Read n values of an interpretation type, stride bytes apart, and
+* write them scaled and offset to vals. A stride of the type size
+* reads a dimensional column, the schema size reads point rows.
+*/
+int pc_values_to_double(const uint8_t *ptr, size_t stride, uint32_t interpretation, double scale, double offset, uint32_t n, double *vals);
+
+/** Unscale, unoffset and write n values in the interpretation type to ptr, stride bytes apart */
+int pc_values_from_double(const double *vals, uint32_t n, uint32_t interpretation, double scale, double offset, uint8_t *ptr, size_t stride);
+
 /** Return number of bytes in a given interpretation */
 size_t pc_interpretation_size(uint32_t interp);
 
@@ -139,6 +245,37 @@ const char * pc_interpretation_string(uint32_t interp);
 /** Copy a string within the global memory management context */
 char* pcstrdup(const char *str);
 
+/**
+* Debug counter of the bytes of point data copied verbatim out of
+* an existing patch, for the paths meant to read readonly patches
+* in place. Reset it before a call and read it after.
+*/
+extern size_t pc_bytes_copied;
+#define PC_COUNT_COPY(size) __sync_fetch_and_add(&pc_bytes_copied, (size))
+
+/**
+* Counting of the operations of PCCOUNTEROPS. When counting is off
+* an operation costs one test of pc_counting on entry and one on exit.
+*/
+extern volatile int pc_counting;
+uint64_t pc_counter_clock(void);
+void pc_counter_add(int op, uint64_t start, uint64_t npoints, uint64_t bytesin, uint64_t bytesout);
+#define PC_COUNTER_START(t) uint64_t t = pc_counting ? pc_counter_clock() : 0
+#define PC_COUNTER_STOP(op, t, npoints, bytesin, bytesout) \
+	do { if ( t ) pc_counter_add((op), (t), (npoints), (bytesin), (bytesout)); } while (0)
+
+/**
+* Patches with fewer points than this are encoded and decoded
+* serially, it is not worth waking the pool for them.
+*/
+#define PC_POOL_MIN_POINTS 8192
+
+/** A task run by pc_pool_run, n is the number of the task */
+typedef void (*pc_pool_task)(void *arg, int n);
+
+/** Run ntasks tasks, in the order given, on the thread pool or serially */
+void pc_pool_run(pc_pool_task task, void *arg, const int *order, int ntasks);
+
 /** Scales/offsets double, casts to appropriate dimension type, and writes into point */
 int pc_point_set_double_by_index(PCPOINT *pt, uint32_t idx, double val);
 
@@ -155,30 +292,85 @@ int pc_point_set_double(PCPOINT *pt, const PCDIMENSION *dim, double val);
 
 /** Analyze the bytes in the #PCPATCH_DIMENSIONAL and update the #PCDIMSTATS */
 int pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl);
-/** Free the PCDIMSTATS memory */
-void pc_dimstats_free(PCDIMSTATS *pds);
-char* pc_dimstats_to_string(const PCDIMSTATS *pds);
 
 
 /****************************************************************************
 * PATCHES
 */
 
+/** Start an empty streaming union of patches of the given schema */
+PCPATCH_UNION* pc_patch_union_new(const PCSCHEMA *schema);
+
+/** Append the points of a patch to the union, the patch is not referenced afterwards */
+int pc_patch_union_add(PCPATCH_UNION *pcu, const PCPATCH *pa);
+
+/** Append every point of another union, as used to combine partial aggregates */
+int pc_patch_union_merge(PCPATCH_UNION *pcu, const PCPATCH_UNION *other);
+
+/** Returns newly allocated patch holding every point added so far, the union is left untouched */
+PCPATCH* pc_patch_union_result(const PCPATCH_UNION *pcu);
+
+/** Free the union and everything it holds */
+void pc_patch_union_free(PCPATCH_UNION *pcu);
+
+/** Start reading the points of a patch, batchsize points at a time, the patch must outlive the cursor */
+PCPATCH_CURSOR* pc_patch_cursor_new(const PCPATCH *pa, uint32_t batchsize);
+
+/** Point *points at the next batch of points, returns how many there are, 0 once the patch is exhausted */
+uint32_t pc_patch_cursor_next(PCPATCH_CURSOR *cur, const uint8_t **points);
+
+/** Free the cursor and the decoded data it holds */
+void pc_patch_cursor_free(PCPATCH_CURSOR *cur);
+
+/** Like pc_patch_sort_curve, but the columns of dimensional patches are left uncompressed for the encoder */
+PCPATCH* pc_patch_order_curve(const PCPATCH *pa, int curve);
+
 /** Returns newly allocated patch that only contains the points fitting the filter condition */
 PCPATCH* pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2);
 
+/** Returns newly allocated patch that only contains the points matching the expression */
+PCPATCH* pc_patch_filter_expr(const PCPATCH *pa, const PCFILTEREXPR *expr);
+
+/** Parse a filter expression against a schema, returns NULL on syntax errors or unknown dimensions */
+PCFILTEREXPR* pc_filterexpr_parse(const PCSCHEMA *schema, const char *str);
+
+/** Free a filter expression and all its arguments */
+void pc_filterexpr_free(PCFILTEREXPR *expr);
+
+/** True if the patch stats show every point passes the expression */
+int pc_patch_filter_expr_keeps_all(const PCPATCH *pa, const PCFILTEREXPR *expr);
+
+/** True if the patch stats show every point passes the dimension filter */
+int pc_patch_filter_keeps_all(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2);
+
+/** Read a Polygon or MultiPolygon from WKB or EWKB, returns NULL on other geometries */
+PCPOLYGON* pc_polygon_from_wkb(const uint8_t *wkb, size_t wkbsize);
+
+/** Free a polygon */
+void pc_polygon_free(PCPOLYGON *poly);
+
+/** True if the point is inside the polygon */
+int pc_polygon_contains(const PCPOLYGON *poly, double x, double y);
+
+/** Returns newly allocated patch that only contains the points inside the polygon */
+PCPATCH* pc_patch_filter_polygon(const PCPATCH *pa, const PCPOLYGON *poly);
+
 /* DIMENSIONAL PATCHES */
 char* pc_patch_dimensional_to_string(const PCPATCH_DIMENSIONAL *pa);
 PCPATCH_DIMENSIONAL* pc_patch_dimensional_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa);
+/** Scratch dimensional copy in the arena, released with it and never with pc_patch_free */
+PCPATCH_DIMENSIONAL* pc_patch_dimensional_from_uncompressed_in(PCARENA *arena, const PCPATCH_UNCOMPRESSED *pa);
 PCPATCH_DIMENSIONAL* pc_patch_dimensional_compress(const PCPATCH_DIMENSIONAL *pdl, PCDIMSTATS *pds);
 PCPATCH_DIMENSIONAL* pc_patch_dimensional_decompress(const PCPATCH_DIMENSIONAL *pdl);
 void pc_patch_dimensional_free(PCPATCH_DIMENSIONAL *pdl);
 int pc_patch_dimensional_compute_extent(PCPATCH_DIMENSIONAL *pdl);
+int pc_patch_dimensional_compute_stats(PCPATCH_DIMENSIONAL *pdl);
 uint8_t* pc_patch_dimensional_to_wkb(const PCPATCH_DIMENSIONAL *patch, size_t *wkbsize);
 PCPATCH* pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize);
 PCPATCH_DIMENSIONAL* pc_patch_dimensional_from_pointlist(const PCPOINTLIST *pdl);
 PCPOINTLIST* pc_pointlist_from_dimensional(const PCPATCH_DIMENSIONAL *pdl);
 PCPATCH_DIMENSIONAL* pc_patch_dimensional_clone(const PCPATCH_DIMENSIONAL *patch);
+PCPATCH_DIMENSIONAL* pc_patch_dimensional_from_patchlist(PCPATCH_DIMENSIONAL **palist, int numpatches);
 PCPOINT *pc_patch_dimensional_pointn(const PCPATCH_DIMENSIONAL *pdl, int n);
 
 /* UNCOMPRESSED PATCHES */
@@ -191,6 +383,8 @@ int pc_patch_uncompressed_compute_stats(PCPATCH_UNCOMPRESSED *patch);
 void pc_patch_uncompressed_free(PCPATCH_UNCOMPRESSED *patch);
 uint8_t *pc_patch_uncompressed_readonly(PCPATCH_UNCOMPRESSED *patch);
 PCPOINTLIST* pc_pointlist_from_uncompressed(const PCPATCH_UNCOMPRESSED *patch);
+/** List of views into npoints rows, freeing mem with itself */
+PCPOINTLIST* pc_pointlist_from_rows(const PCSCHEMA *schema, uint8_t *data, uint32_t npoints, void *mem);
 PCPATCH_UNCOMPRESSED* pc_patch_uncompressed_from_pointlist(const PCPOINTLIST *pl);
 PCPATCH_UNCOMPRESSED* pc_patch_uncompressed_from_dimensional(const PCPATCH_DIMENSIONAL *pdl);
 int pc_patch_uncompressed_add_point(PCPATCH_UNCOMPRESSED *c, const PCPOINT *p);
@@ -208,6 +402,8 @@ PCPATCH* pc_patch_ght_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_
 PCPOINTLIST* pc_pointlist_from_ght(const PCPATCH_GHT *pag);
 PCPATCH_GHT* pc_patch_ght_filter(const PCPATCH_GHT *patch, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2);
 PCPOINT *pc_patch_ght_pointn(const PCPATCH_GHT *patch, int n);
+PCPATCH_GHT* pc_patch_ght_clone(const PCPATCH_GHT *patch);
+PCPATCH_GHT* pc_patch_ght_from_patchlist(PCPATCH_GHT **palist, int numpatches);
 
 /* LAZPERF PATCHES */
 PCPATCH_LAZPERF* pc_patch_lazperf_from_pointlist(const PCPOINTLIST *pl);
@@ -215,11 +411,22 @@ PCPATCH_LAZPERF* pc_patch_lazperf_from_uncompressed(const PCPATCH_UNCOMPRESSED *
 PCPOINTLIST* pc_pointlist_from_lazperf(const PCPATCH_LAZPERF *palaz);
 PCPATCH_UNCOMPRESSED* pc_patch_uncompressed_from_lazperf(const PCPATCH_LAZPERF *palaz);
 int pc_patch_lazperf_compute_extent(PCPATCH_LAZPERF *patch);
+int pc_patch_lazperf_compute_stats(PCPATCH_LAZPERF *patch);
 char* pc_patch_lazperf_to_string(const PCPATCH_LAZPERF *pa);
 void pc_patch_lazperf_free(PCPATCH_LAZPERF *palaz);
 uint8_t* pc_patch_lazperf_to_wkb(const PCPATCH_LAZPERF *patch, size_t *wkbsize);
 PCPATCH* pc_patch_lazperf_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkbsize);
 PCPOINT *pc_patch_lazperf_pointn(const PCPATCH_LAZPERF *patch, int n);
+PCPATCH_UNCOMPRESSED *pc_patch_lazperf_range(const PCPATCH_LAZPERF *patch, int first, int count);
+
+/** Streaming lazperf decoder, decoding stops when the caller does */
+typedef struct LAZPERF_DECODER LAZPERF_DECODER;
+LAZPERF_DECODER* pc_patch_lazperf_decoder_new(const PCPATCH_LAZPERF *patch);
+/** Decode the next point into pt data, returns PC_FAILURE once the patch is exhausted */
+int pc_patch_lazperf_decoder_next(LAZPERF_DECODER *dec, PCPOINT *pt);
+/** Decode up to npoints next points into buf, returns how many were decoded */
+uint32_t pc_patch_lazperf_decoder_read(LAZPERF_DECODER *dec, uint8_t *buf, uint32_t npoints);
+void pc_patch_lazperf_decoder_free(LAZPERF_DECODER *dec);
 
 /****************************************************************************
 * BYTES
@@ -229,8 +436,12 @@ PCPOINT *pc_patch_lazperf_pointn(const PCPATCH_LAZPERF *patch, int n);
 PCBYTES pc_bytes_make(const PCDIMENSION *dim, uint32_t npoints);
 /** Empty the byte array (free the byte buffer) */
 void pc_bytes_free(PCBYTES bytes);
+/** Deep copy of the bytes, the copy is always read/write */
+PCBYTES pc_bytes_clone(PCBYTES pcb);
 /** Apply the compresstion to the byte array in place, freeing the original byte buffer */
 PCBYTES pc_bytes_encode(PCBYTES pcb, int compression);
+/** The compression to re-encode bytes like these with, PC_DIM_INDEXED if they have a block index */
+int pc_bytes_encoding(const PCBYTES *pcb);
 /** Convert the bytes in #PCBYTES to PC_DIM_NONE compression */
 PCBYTES pc_bytes_decode(PCBYTES epcb);
 
@@ -242,10 +453,24 @@ PCBYTES pc_bytes_run_length_decode(const PCBYTES pcb);
 PCBYTES pc_bytes_sigbits_encode(const PCBYTES pcb);
 /** Convert bit packed bytes to value bytes */
 PCBYTES pc_bytes_sigbits_decode(const PCBYTES pcb);
-/** Compress bytes using zlib */
-PCBYTES pc_bytes_zlib_encode(const PCBYTES pcb);
+/** Compress bytes using zlib, in indexed blocks if asked for */
+PCBYTES pc_bytes_zlib_encode(const PCBYTES pcb, int indexed);
 /** De-compress bytes using zlib */
 PCBYTES pc_bytes_zlib_decode(const PCBYTES pcb);
+/** Convert value bytes to varints of their deltas (order 1) or delta-of-deltas (order 2) */
+PCBYTES pc_bytes_delta_encode(const PCBYTES pcb, int order);
+/** Convert delta bytes to value bytes */
+PCBYTES pc_bytes_delta_decode(const PCBYTES pcb);
+/** Compress bytes using zstd, when built with it */
+PCBYTES pc_bytes_zstd_encode(const PCBYTES pcb);
+/** De-compress bytes using zstd, when built with it */
+PCBYTES pc_bytes_zstd_decode(const PCBYTES pcb);
+/** Compress bytes using lz4, when built with it */
+PCBYTES pc_bytes_lz4_encode(const PCBYTES pcb);
+/** De-compress bytes using lz4, when built with it */
+PCBYTES pc_bytes_lz4_decode(const PCBYTES pcb);
+/** Can bytes be encoded and decoded with this compression in this build? */
+int pc_bytes_compression_available(int compression);
 
 /** How many runs are there in a value array? */
 uint32_t pc_bytes_run_count(const PCBYTES *pcb);
@@ -259,12 +484,19 @@ uint16_t pc_bytes_sigbits_count_16(const PCBYTES *pcb, uint32_t *nsigbits);
 uint32_t pc_bytes_sigbits_count_32(const PCBYTES *pcb, uint32_t *nsigbits);
 /** Using an 64-bit word, what is the common word and number of bits in common? */
 uint64_t pc_bytes_sigbits_count_64(const PCBYTES *pcb, uint32_t *nsigbits);
+/** How many bytes would delta encoding of this order take? */
+uint32_t pc_bytes_delta_count(const PCBYTES *pcb, int order);
 
 /* NOTE: stats are gathered without applying scale and offset */
 PCBYTES pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats);
 
-PCBITMAP* pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2);
+/** Bitmap of the values that pass the filter, taken from the arena unless it is NULL */
+PCBITMAP* pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2, PCARENA *arena);
+/** Concatenate byte arrays of the same interpretation, keeping their encoding where possible */
+PCBYTES pc_bytes_merge(const PCBYTES **pcbs, int npcbs);
 int pc_bytes_minmax(const PCBYTES *pcb, double *min, double *max, double *avg);
+/** Write the scaled values of a dimension's bytes into vals, decoding them if needed */
+int pc_bytes_get_values(const PCBYTES *pcb, const PCDIMENSION *dim, double *vals);
 
 /** getting the n-th point out of a PCBYTE into a buffer */
 void pc_bytes_uncompressed_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
@@ -272,6 +504,9 @@ void pc_bytes_run_length_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
 void pc_bytes_sigbits_to_ptr_32(uint8_t *buf, PCBYTES pcb, int n);
 void pc_bytes_sigbits_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
 void pc_bytes_zlib_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
+void pc_bytes_delta_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
+void pc_bytes_zstd_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
+void pc_bytes_lz4_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
 void pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
 
 /****************************************************************************
@@ -282,6 +517,20 @@ void pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n);
 void pc_bounds_init(PCBOUNDS *b);
 /** Copy a bounds */
 PCSTATS* pc_stats_clone(const PCSTATS *stats);
+/** Running min/max/sum accumulators, see pc_stats_new_from_dstats */
+PCDOUBLESTATS* pc_dstats_new(int ndims);
+/** Accumulators in the arena, or allocated when it is NULL */
+PCDOUBLESTATS* pc_dstats_new_in(PCARENA *arena, int ndims);
+void pc_dstats_free(PCDOUBLESTATS *dstats);
+/** Fold existing stats of npoints points into the accumulators */
+void pc_dstats_add_stats(PCDOUBLESTATS *dstats, const PCSTATS *stats, uint32_t npoints);
+/** Fold the accumulators of another set of points with ndims dimensions into dstats */
+void pc_dstats_merge(PCDOUBLESTATS *dstats, const PCDOUBLESTATS *other, int ndims);
+/** Fold npoints uncompressed points into the accumulators */
+void pc_dstats_add_points(PCDOUBLESTATS *dstats, const PCSCHEMA *schema, const uint8_t *data, uint32_t npoints);
+PCSTATS* pc_stats_new_from_dstats(const PCSCHEMA *schema, const PCDOUBLESTATS *dstats);
+/** Replace the stats of a patch with dstats, and its bounds with their x and y ranges */
+void pc_patch_set_dstats(PCPATCH *pa, const PCDOUBLESTATS *dstats);
 /** Expand extents of b1 to encompass b2 */
 void pc_bounds_merge(PCBOUNDS *b1, const PCBOUNDS *b2);
 
@@ -289,15 +538,61 @@ void pc_bounds_merge(PCBOUNDS *b1, const PCBOUNDS *b2);
 * BITMAPS
 */
 
+/** Number of 64-bit words holding npoints bits */
+#define PC_BITMAP_NWORDS(npoints) (((npoints) + 63) / 64)
+
 /** Allocate new unset bitmap */
 PCBITMAP* pc_bitmap_new(uint32_t npoints);
-/** Deallocate bitmap */
+/** New unset bitmap in the arena, or allocated when it is NULL */
+PCBITMAP* pc_bitmap_new_in(PCARENA *arena, uint32_t npoints);
+/** Deallocate bitmap, bitmaps of an arena go with the arena */
 void pc_bitmap_free(PCBITMAP *map);
-/** Set indicated bit on bitmap if filter and value are consistent */
-void pc_bitmap_filter(PCBITMAP *map, PC_FILTERTYPE filter, int i, double d, double val1, double val2);
+/** Set the bits of the values that pass the filter, in npoints values of an interpretation stride bytes apart */
+void pc_bitmap_filter_values(PCBITMAP *map, PC_FILTERTYPE filter, double val1, double val2, const uint8_t *bytes, size_t stride, uint32_t interpretation, double scale, double offset);
+/** Express a filter as an inclusive range [lo, hi], returns PC_FALSE if nothing can pass */
+int pc_filter_range(PC_FILTERTYPE filter, double val1, double val2, double *lo, double *hi);
+/** Set count bits starting at first */
+void pc_bitmap_set_range(PCBITMAP *map, uint32_t first, uint32_t count);
+/** Count the set bits among count bits starting at first */
+uint32_t pc_bitmap_count_range(const PCBITMAP *map, uint32_t first, uint32_t count);
+/** Recompute nset from the words */
+void pc_bitmap_update_nset(PCBITMAP *map);
+/** Keep only the bits that are also set in other */
+void pc_bitmap_and(PCBITMAP *map, const PCBITMAP *other);
+/** Add the bits that are set in other */
+void pc_bitmap_or(PCBITMAP *map, const PCBITMAP *other);
+/** Invert every bit */
+void pc_bitmap_not(PCBITMAP *map);
 
 /** Read indicated bit of bitmap */
-#define pc_bitmap_get(map, i) ((map)->map[(i)])
+#define pc_bitmap_get(bm, i) (((bm)->map[(i) >> 6] >> ((i) & 63)) & 1)
+
+/** Number of set bits in a word */
+static inline uint32_t
+pc_bitmap_popcount(uint64_t w)
+{
+#if defined(__GNUC__)
+	return __builtin_popcountll(w);
+#else
+	w = w - ((w >> 1) & 0x5555555555555555ULL);
+	w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+	w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (uint32_t)((w * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/** Index of the lowest set bit of a non-zero word */
+static inline uint32_t
+pc_bitmap_ctz(uint64_t w)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(w);
+#else
+	uint32_t n = 0;
+	while ( ! (w & 1) ) { w >>= 1; n++; }
+	return n;
+#endif
+}
 
 
 
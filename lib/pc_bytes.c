@@ -10,7 +10,8 @@
 *
 *  - run-length encoding
 *  - significant-bit removal
-*  - deflate
+*  - deflate, or zstd or lz4 when built with them
+*  - delta and delta-of-delta varints
 *
 *  PgSQL Pointcloud is free and open source software provided
 *  by the Government of Canada
@@ -22,7 +23,17 @@
 #include <assert.h>
 #include <float.h>
 #include "pc_api_internal.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "zlib.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
 
 void
 pc_bytes_free(PCBYTES pcb)
@@ -46,26 +57,157 @@ pc_bytes_make(const PCDIMENSION *dim, uint32_t npoints)
 	pcb.interpretation = dim->interpretation;
 	pcb.compression = PC_DIM_NONE;
 	pcb.readonly = PC_FALSE;
+	pcb.indexsize = 0;
 	return pcb;
 }
 
-static PCBYTES
+PCBYTES
 pc_bytes_clone(PCBYTES pcb)
 {
 	PCBYTES pcbnew = pcb;
 	if ( ! pc_bytes_empty(&pcb) )
 	{
-		pcbnew.bytes = pcalloc(pcb.size);
-		memcpy(pcbnew.bytes, pcb.bytes, pcb.size);
+		pcbnew.bytes = pcalloc(pcb.size + pcb.indexsize);
+		memcpy(pcbnew.bytes, pcb.bytes, pcb.size + pcb.indexsize);
+		PC_COUNT_COPY(pcb.size + pcb.indexsize);
 	}
 	pcbnew.readonly = PC_FALSE;
 	return pcbnew;
 }
 
+/* Number of entries in the block index of the bytes */
+static inline uint32_t
+pc_bytes_index_count(const PCBYTES *pcb)
+{
+	return pcb->indexsize ? pcb->indexsize / 4 - 2 : 0;
+}
+
+/* Entry j of the block index, the block length after the last one */
+static inline uint32_t
+pc_bytes_index_get(const PCBYTES *pcb, uint32_t j)
+{
+	uint32_t v;
+	memcpy(&v, pcb->bytes + pcb->size + 4 * (size_t)j, 4);
+	return v;
+}
+
+/* Write the entries, block length and entry count of an index at ptr */
+static size_t
+pc_bytes_index_write(uint8_t *ptr, const uint32_t *entries, uint32_t n, uint32_t blocklen)
+{
+	memcpy(ptr, entries, 4 * (size_t)n);
+	memcpy(ptr + 4 * (size_t)n, &blocklen, 4);
+	memcpy(ptr + 4 * (size_t)n + 4, &n, 4);
+	return 4 * ((size_t)n + 2);
+}
+
+/**
+* Serialized bytes flagged with PC_DIM_INDEXED end with their block
+* index, read its length off the trailing entry count and take it out
+* of the size. The npoints and interpretation of the bytes must be set,
+* the index is checked against them before anything trusts it.
+*/
+int
+pc_bytes_index_split(PCBYTES *pcb, int flip_endian)
+{
+	uint32_t n, j, blocklen, entry, last = 0;
+	uint64_t limit, covered;
+	size_t sz = pc_interpretation_size(pcb->interpretation);
+
+	if ( ! (pcb->compression & PC_DIM_INDEXED) )
+	{
+		pcb->indexsize = 0;
+		return PC_SUCCESS;
+	}
+	pcb->compression &= ~PC_DIM_INDEXED;
+	pcb->indexsize = 0;
+
+	if ( pcb->size < 8 )
+	{
+		pcerror("%s: block index overruns the bytes", __func__);
+		return PC_FAILURE;
+	}
+	n = wkb_get_int32(pcb->bytes + pcb->size - 4, flip_endian);
+	if ( n > (pcb->size - 8) / 4 )
+	{
+		pcerror("%s: block index overruns the bytes", __func__);
+		return PC_FAILURE;
+	}
+	pcb->indexsize = 4 * (n + 2);
+	pcb->size -= pcb->indexsize;
+
+	/* Entries count points for RLE, compressed bytes for zlib */
+	blocklen = wkb_get_int32(pcb->bytes + pcb->size + 4 * (size_t)n, flip_endian);
+	if ( pcb->compression == PC_DIM_RLE )
+	{
+		/* Every indexed block of runs is a whole one */
+		limit = pcb->npoints;
+		covered = (uint64_t)n * blocklen * (1 + sz) <= pcb->size;
+	}
+	else if ( pcb->compression == PC_DIM_ZLIB )
+	{
+		limit = pcb->size;
+		covered = (uint64_t)n * blocklen >= pcb->npoints;
+	}
+	else
+	{
+		pcerror("%s: unexpected block index on %s bytes", __func__, pc_dim_compression_name(pcb->compression));
+		goto fail;
+	}
+	if ( blocklen == 0 || ! covered )
+	{
+		pcerror("%s: block index does not cover the %u points", __func__, pcb->npoints);
+		goto fail;
+	}
+	for ( j = 0; j < n; j++ )
+	{
+		entry = wkb_get_int32(pcb->bytes + pcb->size + 4 * (size_t)j, flip_endian);
+		if ( entry < last || entry > limit )
+		{
+			pcerror("%s: block index entry %u is out of order", __func__, j);
+			goto fail;
+		}
+		last = entry;
+	}
+	return PC_SUCCESS;
+
+fail:
+	pcb->size += pcb->indexsize;
+	pcb->indexsize = 0;
+	return PC_FAILURE;
+}
+
+/* The index words are kept in the byte order of the values */
+static void
+pc_bytes_index_flip_endian(PCBYTES *pcb)
+{
+	uint32_t i;
+	uint8_t *ptr = pcb->bytes + pcb->size;
+
+	for ( i = 0; i < pcb->indexsize / 4; i++ )
+	{
+		uint8_t tmp;
+		tmp = ptr[0]; ptr[0] = ptr[3]; ptr[3] = tmp;
+		tmp = ptr[1]; ptr[1] = ptr[2]; ptr[2] = tmp;
+		ptr += 4;
+	}
+}
+
+/* The compression to encode bytes like pcb with, its block index included */
+int
+pc_bytes_encoding(const PCBYTES *pcb)
+{
+	return pcb->compression | (pcb->indexsize ? PC_DIM_INDEXED : 0);
+}
+
 PCBYTES
 pc_bytes_encode(PCBYTES pcb, int compression)
 {
 	PCBYTES epcb;
+	/* RLE bytes always get their index, zlib ones on request */
+	int indexed = compression & PC_DIM_INDEXED;
+	PC_COUNTER_START(t0);
+	compression &= ~PC_DIM_INDEXED;
 	switch ( compression )
 	{
 	case PC_DIM_RLE:
@@ -80,7 +222,23 @@ pc_bytes_encode(PCBYTES pcb, int compression)
 	}
 	case PC_DIM_ZLIB:
 	{
-		epcb = pc_bytes_zlib_encode(pcb);
+		epcb = pc_bytes_zlib_encode(pcb, indexed);
+		break;
+	}
+	case PC_DIM_ZSTD:
+	{
+		epcb = pc_bytes_zstd_encode(pcb);
+		break;
+	}
+	case PC_DIM_LZ4:
+	{
+		epcb = pc_bytes_lz4_encode(pcb);
+		break;
+	}
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
+	{
+		epcb = pc_bytes_delta_encode(pcb, compression == PC_DIM_DELTA2 ? 2 : 1);
 		break;
 	}
 	case PC_DIM_NONE:
@@ -91,8 +249,10 @@ pc_bytes_encode(PCBYTES pcb, int compression)
 	default:
 	{
 		pcerror("%s: Uh oh", __func__);
+		return pcb;
 	}
 	}
+	PC_COUNTER_STOP(PC_OP_DIM_ENCODE + compression, t0, pcb.npoints, pcb.size, epcb.size);
 	return epcb;
 }
 
@@ -100,6 +260,7 @@ PCBYTES
 pc_bytes_decode(PCBYTES epcb)
 {
 	PCBYTES pcb;
+	PC_COUNTER_START(t0);
 	switch ( epcb.compression )
 	{
 	case PC_DIM_RLE:
@@ -117,6 +278,22 @@ pc_bytes_decode(PCBYTES epcb)
 		pcb = pc_bytes_zlib_decode(epcb);
 		break;
 	}
+	case PC_DIM_ZSTD:
+	{
+		pcb = pc_bytes_zstd_decode(epcb);
+		break;
+	}
+	case PC_DIM_LZ4:
+	{
+		pcb = pc_bytes_lz4_decode(epcb);
+		break;
+	}
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
+	{
+		pcb = pc_bytes_delta_decode(epcb);
+		break;
+	}
 	case PC_DIM_NONE:
 	{
 		pcb = pc_bytes_clone(epcb);
@@ -125,8 +302,10 @@ pc_bytes_decode(PCBYTES epcb)
 	default:
 	{
 		pcerror("%s: Uh oh", __func__);
+		return epcb;
 	}
 	}
+	PC_COUNTER_STOP(PC_OP_DIM_DECODE + epcb.compression, t0, epcb.npoints, epcb.size, pcb.size);
 	return pcb;
 }
 
@@ -157,6 +336,38 @@ pc_bytes_run_count(const PCBYTES *pcb)
 	return runcount;
 }
 
+/**
+* Append the block index of RLE bytes with more than PC_INDEX_RUNS
+* runs: entry j is the number of points in the first
+* (j+1) * PC_INDEX_RUNS runs.
+*/
+static void
+pc_bytes_run_length_index(PCBYTES *pcb)
+{
+	size_t sz = 1 + pc_interpretation_size(pcb->interpretation);
+	uint32_t nruns = pcb->size / sz;
+	uint32_t nentries, npoints = 0;
+	uint32_t i, j = 0;
+	uint32_t *entries;
+
+	pcb->indexsize = 0;
+	if ( nruns <= PC_INDEX_RUNS )
+		return;
+
+	nentries = (nruns - 1) / PC_INDEX_RUNS;
+	entries = pcalloc(nentries * sizeof(uint32_t));
+	for ( i = 0; j < nentries; i++ )
+	{
+		npoints += pcb->bytes[i * sz];
+		if ( (i + 1) % PC_INDEX_RUNS == 0 )
+			entries[j++] = npoints;
+	}
+
+	pcb->bytes = pcrealloc(pcb->bytes, pcb->size + 4 * (nentries + 2));
+	pcb->indexsize = pc_bytes_index_write(pcb->bytes + pcb->size, entries, nentries, PC_INDEX_RUNS);
+	pcfree(entries);
+}
+
 /**
 * Take the uncompressed bytes and run-length encode (RLE) them.
 * Structure of RLE array as:
@@ -214,6 +425,7 @@ pc_bytes_run_length_encode(const PCBYTES pcb)
 	pcbout.bytes = bytes_rle;
 	pcbout.compression = PC_DIM_RLE;
 	pcbout.readonly = PC_FALSE;
+	pc_bytes_run_length_index(&pcbout);
 	return pcbout;
 }
 
@@ -269,6 +481,7 @@ pc_bytes_run_length_decode(const PCBYTES pcb)
 	pcbout.size = size_out;
 	pcbout.bytes = bytes;
 	pcbout.readonly = PC_FALSE;
+	pcbout.indexsize = 0;
 	return pcbout;
 }
 
@@ -297,8 +510,9 @@ pc_bytes_run_length_flip_endian(PCBYTES pcb)
 	if ( pcb.readonly == PC_TRUE )
 	{
 		uint8_t *oldbytes = pcb.bytes;
-		pcb.bytes = pcalloc(pcb.size);
-		memcpy(pcb.bytes, oldbytes, pcb.size);
+		pcb.bytes = pcalloc(pcb.size + pcb.indexsize);
+		memcpy(pcb.bytes, oldbytes, pcb.size + pcb.indexsize);
+		PC_COUNT_COPY(pcb.size + pcb.indexsize);
 		pcb.readonly = PC_FALSE;
 	}
 
@@ -1045,6 +1259,111 @@ pc_bytes_sigbits_decode_16(const PCBYTES pcb)
 	return pcbout;
 }
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PC_SIGBITS_AVX2 1
+#endif
+
+typedef void (*pc_bytes_sigbits_unpack_32_func)(const uint32_t *words, size_t nwords, uint32_t nbits, uint32_t commonvalue, uint32_t *out, uint32_t npoints);
+
+#ifdef PC_SIGBITS_AVX2
+/*
+* Value i starts at bit i*nbits of the packed words (most significant
+* bit first), so it can be pulled out of the two words around it on its
+* own, without carrying a read head from one value to the next.
+*/
+static inline uint32_t
+pc_bytes_sigbits_unpack_value_32(const uint32_t *words, size_t nwords, uint32_t nbits, uint32_t i)
+{
+	uint64_t bitoffset = (uint64_t)i * nbits;
+	size_t w = bitoffset / 32;
+	uint32_t r = bitoffset % 32;
+	uint32_t val = words[w] << r;
+	/* The next word is only read if the value is split over it */
+	if ( r + nbits > 32 && w + 1 < nwords )
+		val |= words[w+1] >> (32 - r);
+	return val >> (32 - nbits);
+}
+
+/*
+* AVX2 unpacking, eight values per step: gather the two words around
+* each value, join them with per-lane variable shifts and keep the top
+* nbits. Needs nbits > 0.
+*/
+__attribute__((target("avx2")))
+static void
+pc_bytes_sigbits_unpack_32_avx2(const uint32_t *words, size_t nwords, uint32_t nbits, uint32_t commonvalue, uint32_t *out, uint32_t npoints)
+{
+	uint32_t i = 0;
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i vnbits = _mm256_set1_epi32(nbits);
+	const __m256i vcommon = _mm256_set1_epi32(commonvalue);
+	const __m256i v31 = _mm256_set1_epi32(31);
+	const __m256i v32 = _mm256_set1_epi32(32);
+	const __m128i vtop = _mm_cvtsi32_si128(32 - nbits);
+
+	/* Lane bit offsets are computed in 32 bits, so huge arrays stay scalar */
+	if ( (uint64_t)npoints * nbits < ((uint64_t)1 << 31) )
+	{
+		/* Stop while the second word of the last lane is still in the array */
+		while ( i + 8 <= npoints && ((uint64_t)(i + 8) * nbits) / 32 + 1 < nwords )
+		{
+			__m256i idx = _mm256_add_epi32(_mm256_set1_epi32(i), lanes);
+			__m256i off = _mm256_mullo_epi32(idx, vnbits);
+			__m256i w = _mm256_srli_epi32(off, 5);
+			__m256i r = _mm256_and_si256(off, v31);
+			__m256i w0 = _mm256_i32gather_epi32((const int*)words, w, 4);
+			__m256i w1 = _mm256_i32gather_epi32((const int*)(words + 1), w, 4);
+			/* srlv by 32 yields zero, which covers the r == 0 lanes */
+			__m256i val = _mm256_or_si256(_mm256_sllv_epi32(w0, r),
+			                              _mm256_srlv_epi32(w1, _mm256_sub_epi32(v32, r)));
+			val = _mm256_srl_epi32(val, vtop);
+			val = _mm256_or_si256(val, vcommon);
+			_mm256_storeu_si256((__m256i*)(out + i), val);
+			i += 8;
+		}
+	}
+
+	for ( ; i < npoints; i++ )
+		out[i] = commonvalue | pc_bytes_sigbits_unpack_value_32(words, nwords, nbits, i);
+}
+#endif
+
+/**
+* Vector kernel for 32 bit sigbits decoding, picked once from the CPU
+* features. NULL when the CPU has none, in which case the scalar loop
+* of pc_bytes_sigbits_decode_32 is used.
+*/
+static pc_bytes_sigbits_unpack_32_func pc_bytes_sigbits_unpack_32 = NULL;
+
+static void
+pc_bytes_sigbits_unpack_32_select(void)
+{
+#ifdef PC_SIGBITS_AVX2
+	__builtin_cpu_init();
+	if ( __builtin_cpu_supports("avx2") )
+		pc_bytes_sigbits_unpack_32 = pc_bytes_sigbits_unpack_32_avx2;
+#endif
+}
+
+/* Dimensions are decoded on the thread pool, so the pick is made under pthread_once */
+static pc_bytes_sigbits_unpack_32_func
+pc_bytes_sigbits_unpack_32_kernel(void)
+{
+#ifdef HAVE_PTHREAD
+	static pthread_once_t selected = PTHREAD_ONCE_INIT;
+	pthread_once(&selected, pc_bytes_sigbits_unpack_32_select);
+#else
+	static int selected = PC_FALSE;
+	if ( ! selected )
+	{
+		pc_bytes_sigbits_unpack_32_select();
+		selected = PC_TRUE;
+	}
+#endif
+	return pc_bytes_sigbits_unpack_32;
+}
+
 PCBYTES
 pc_bytes_sigbits_decode_32(const PCBYTES pcb)
 {
@@ -1059,6 +1378,7 @@ pc_bytes_sigbits_decode_32(const PCBYTES pcb)
 	uint8_t *outbytes = pcalloc(outbytes_size);
 	uint32_t *obytes = (uint32_t*)outbytes;
 	PCBYTES pcbout = pcb;
+	pc_bytes_sigbits_unpack_32_func unpack = pc_bytes_sigbits_unpack_32_kernel();
 
 	/* How many unique bits? */
 	nbits = *bytes_ptr;
@@ -1069,39 +1389,47 @@ pc_bytes_sigbits_decode_32(const PCBYTES pcb)
 	/* Calculate mask */
 	mask = (0xFFFFFFFF >> (bit-nbits));
 
-	for ( i = 0; i < pcb.npoints; i++ )
+	if ( unpack && nbits )
 	{
-		int shift = bit - nbits;
-		uint32_t val = *bytes_ptr;
-		if ( shift >= 0 )
+		/* Packed words follow the two metadata words */
+		unpack(bytes_ptr, pcb.size / sizeof(uint32_t) - 2, nbits, commonvalue, obytes, pcb.npoints);
+	}
+	else
+	{
+		for ( i = 0; i < pcb.npoints; i++ )
 		{
-			val >>= shift;
-			val &= mask;
-			val |= commonvalue;
-			obytes[i] = val;
-			bit -= nbits;
-			if ( bit <= 0 )
+			int shift = bit - nbits;
+			uint32_t val = *bytes_ptr;
+			if ( shift >= 0 )
+			{
+				val >>= shift;
+				val &= mask;
+				val |= commonvalue;
+				obytes[i] = val;
+				bit -= nbits;
+				if ( bit <= 0 )
+				{
+					bytes_ptr++;
+					bit = bitwidth;
+				}
+			}
+			else
 			{
+				int s = abs(shift);
+				val <<= s;
+				val &= mask;
+				val |= commonvalue;
+				obytes[i] = val;
 				bytes_ptr++;
 				bit = bitwidth;
+				val = *bytes_ptr;
+				shift = bit - s;
+				val >>= shift;
+				val &= mask;
+				bit -= s;
+				obytes[i] |= val;
 			}
 		}
-		else
-		{
-			int s = abs(shift);
-			val <<= s;
-			val &= mask;
-			val |= commonvalue;
-			obytes[i] = val;
-			bytes_ptr++;
-			bit = bitwidth;
-			val = *bytes_ptr;
-			shift = bit - s;
-			val >>= shift;
-			val &= mask;
-			bit -= s;
-			obytes[i] |= val;
-		}
 	}
 
 	pcbout.size = outbytes_size;
@@ -1224,21 +1552,13 @@ pc_zlib_free(voidpf opaque, voidpf ptr)
 
 /* TO DO look for Z_STREAM_END on the write */
 
-/**
-* Returns compressed byte array with
-* <size_t> size of compressed portion
-* <size_t> size of original data
-* <.....> compresssed bytes
-*/
-PCBYTES
-pc_bytes_zlib_encode(const PCBYTES pcb)
+/* Deflate insize bytes into the outsize long out, returns the compressed size */
+static size_t
+pc_bytes_zlib_deflate(const uint8_t *in, size_t insize, uint8_t *out, size_t outsize)
 {
 	z_stream strm;
 	int ret;
 	size_t have;
-	size_t bufsize = 4*pcb.size;
-	uint8_t *buf = pcalloc(bufsize);
-	PCBYTES pcbout = pcb;
 
 	/* Use our own allocators */
 	strm.zalloc = pc_zlib_alloc;
@@ -1246,43 +1566,25 @@ pc_bytes_zlib_encode(const PCBYTES pcb)
 	strm.opaque = Z_NULL;
 	ret = deflateInit(&strm, 9);
 	/* Set up input buffer */
-	strm.avail_in = pcb.size;
-	strm.next_in = pcb.bytes;
+	strm.avail_in = insize;
+	strm.next_in = (uint8_t*)in;
 	/* Set up output buffer */
-	strm.avail_out = bufsize;
-	strm.next_out = buf;
+	strm.avail_out = outsize;
+	strm.next_out = out;
 	/* Compress */
 	ret = deflate(&strm, Z_FINISH);
 	assert(ret != Z_STREAM_ERROR);
 	have = strm.total_out;
-	pcbout.size = have;
-	pcbout.bytes = pcalloc(pcbout.size);
-	pcbout.compression = PC_DIM_ZLIB;
-	pcbout.readonly = PC_FALSE;
-	memcpy(pcbout.bytes, buf, have);
-	pcfree(buf);
 	deflateEnd(&strm);
-	return pcbout;
+	return have;
 }
 
-/**
-* Returns uncompressed byte array from input with
-* <size_t> size of compressed portion
-* <size_t> size of original data
-* <.....> compresssed bytes
-*/
-PCBYTES
-pc_bytes_zlib_decode(const PCBYTES pcb)
+/* Inflate the insize bytes of in into the outsize long out */
+static void
+pc_bytes_zlib_inflate(const uint8_t *in, size_t insize, uint8_t *out, size_t outsize)
 {
 	z_stream strm;
 	int ret;
-	PCBYTES pcbout = pcb;
-
-	pcbout.size = pc_interpretation_size(pcb.interpretation) * pcb.npoints;
-
-	/* Set up output memory */
-	pcbout.bytes = pcalloc(pcbout.size);
-	pcbout.readonly = PC_FALSE;
 
 	/* Use our own allocators */
 	strm.zalloc = pc_zlib_alloc;
@@ -1290,117 +1592,659 @@ pc_bytes_zlib_decode(const PCBYTES pcb)
 	strm.opaque = Z_NULL;
 	ret = inflateInit(&strm);
 	/* Set up input buffer */
-	strm.avail_in = pcb.size;
-	strm.next_in = pcb.bytes;
+	strm.avail_in = insize;
+	strm.next_in = (uint8_t*)in;
 
-	strm.avail_out = pcbout.size;
-	strm.next_out = pcbout.bytes;
+	strm.avail_out = outsize;
+	strm.next_out = out;
 	ret = inflate(&strm, Z_FINISH);
 	assert(ret != Z_STREAM_ERROR);
 	inflateEnd(&strm);
-
-	pcbout.compression = PC_DIM_NONE;
-	return pcbout;
 }
 
 /**
-* This flips bytes in-place, so won't work on readonly bytes
+* Returns compressed byte array with
+* <.....> compresssed bytes
+* When indexed, arrays of more than PC_INDEX_VALUES values are deflated
+* a block of PC_INDEX_VALUES values at a time, and indexed by the end
+* offset of each block in the compressed bytes. That costs some ratio,
+* so it is only done when asked for.
 */
 PCBYTES
-pc_bytes_flip_endian(PCBYTES pcb)
+pc_bytes_zlib_encode(const PCBYTES pcb, int indexed)
 {
-	if ( pcb.readonly )
-		pcerror("pc_bytes_flip_endian: cannot flip readonly bytes");
+	size_t sz = pc_interpretation_size(pcb.interpretation);
+	uint32_t nblocks = 1, b;
+	uint32_t *entries = NULL;
+	size_t bufsize, have = 0;
+	uint8_t *buf;
+	PCBYTES pcbout = pcb;
 
-	switch(pcb.compression)
+	if ( indexed && pcb.npoints > PC_INDEX_VALUES )
 	{
-	case PC_DIM_NONE:
-		return pcb;
-	case PC_DIM_SIGBITS:
-		return pc_bytes_sigbits_flip_endian(pcb);
-	case PC_DIM_ZLIB:
-		return pcb;
-	case PC_DIM_RLE:
-		return pc_bytes_run_length_flip_endian(pcb);
-	default:
-		pcerror("%s: unknown compression", __func__);
+		nblocks = (pcb.npoints + PC_INDEX_VALUES - 1) / PC_INDEX_VALUES;
+		entries = pcalloc(nblocks * sizeof(uint32_t));
 	}
 
-	return pcb;
-}
+	/* Room for the worst case of every block, and the index */
+	bufsize = 4*pcb.size + 64*nblocks;
+	buf = pcalloc(bufsize);
 
-size_t
-pc_bytes_serialized_size(const PCBYTES *pcb)
-{
-	/* compression type (1) + size of data (4) + data */
-	return 1 + 4 + pcb->size;
+	if ( ! entries )
+	{
+		have = pc_bytes_zlib_deflate(pcb.bytes, pcb.size, buf, bufsize);
+	}
+	else
+	{
+		size_t blocksize = sz * PC_INDEX_VALUES;
+		for ( b = 0; b < nblocks; b++ )
+		{
+			size_t offset = b * blocksize;
+			size_t insize = pcb.size - offset < blocksize ? pcb.size - offset : blocksize;
+			have += pc_bytes_zlib_deflate(pcb.bytes + offset, insize, buf + have, bufsize - have);
+			entries[b] = have;
+		}
+	}
+
+	pcbout.size = have;
+	pcbout.indexsize = entries ? 4 * (nblocks + 2) : 0;
+	pcbout.bytes = pcalloc(pcbout.size + pcbout.indexsize);
+	pcbout.compression = PC_DIM_ZLIB;
+	pcbout.readonly = PC_FALSE;
+	memcpy(pcbout.bytes, buf, have);
+	if ( entries )
+	{
+		pc_bytes_index_write(pcbout.bytes + have, entries, nblocks, PC_INDEX_VALUES);
+		pcfree(entries);
+	}
+	pcfree(buf);
+	return pcbout;
 }
 
-int
-pc_bytes_serialize(const PCBYTES *pcb, uint8_t *buf, size_t *size)
+/**
+* Returns uncompressed byte array from input with
+* <.....> compresssed bytes
+*/
+PCBYTES
+pc_bytes_zlib_decode(const PCBYTES pcb)
 {
-	static int compression_num_size = 1;
-	static int size_num_size = 4;
-	int32_t pcbsize = pcb->size;
+	size_t sz = pc_interpretation_size(pcb.interpretation);
+	PCBYTES pcbout = pcb;
 
-	/* Compression type number */
-	*buf = pcb->compression;
-	buf += compression_num_size;
-	/* Buffer size */
-	memcpy(buf, &pcbsize, size_num_size);
-	buf += size_num_size;
-	/* Buffer contents */
-	memcpy(buf, pcb->bytes, pcb->size);
-	/* Return total size */
-	*size = compression_num_size + size_num_size + pcbsize;
-	return PC_SUCCESS;
-}
+	pcbout.size = sz * pcb.npoints;
 
-int
-pc_bytes_deserialize(const uint8_t *buf, const PCDIMENSION *dim, PCBYTES *pcb, int readonly, int flip_endian)
-{
-	pcb->compression = buf[0];
-	pcb->size = wkb_get_int32(buf+1, flip_endian);
-	pcb->readonly = readonly;
-	if ( readonly && flip_endian )
-		pcerror("pc_bytes_deserialize: cannot create a read-only buffer on byteswapped input");
-	if ( readonly )
+	/* Set up output memory */
+	pcbout.bytes = pcalloc(pcbout.size);
+	pcbout.readonly = PC_FALSE;
+	pcbout.indexsize = 0;
+
+	if ( ! pcb.indexsize )
 	{
-		pcb->bytes = (uint8_t*)(buf+5);
+		pc_bytes_zlib_inflate(pcb.bytes, pcb.size, pcbout.bytes, pcbout.size);
 	}
 	else
 	{
-		pcb->bytes = pcalloc(pcb->size);
-		memcpy(pcb->bytes, buf+5, pcb->size);
-		if ( flip_endian )
+		/* Each block inflates on its own */
+		uint32_t nblocks = pc_bytes_index_count(&pcb);
+		size_t blocksize = sz * pc_bytes_index_get(&pcb, nblocks);
+		uint32_t b, start = 0;
+		for ( b = 0; b < nblocks; b++ )
 		{
-			*pcb = pc_bytes_flip_endian(*pcb);
+			uint32_t end = pc_bytes_index_get(&pcb, b);
+			size_t offset = b * blocksize;
+			if ( end < start || end > pcb.size || offset >= pcbout.size )
+			{
+				pcerror("%s: bad block index", __func__);
+				break;
+			}
+			pc_bytes_zlib_inflate(pcb.bytes + start, end - start, pcbout.bytes + offset,
+			                      pcbout.size - offset < blocksize ? pcbout.size - offset : blocksize);
+			start = end;
 		}
 	}
-	pcb->interpretation = dim->interpretation;
-	/* WARNING, still need to set externally */
-	/*   pcb.npoints */
-	return PC_SUCCESS;
+
+	pcbout.compression = PC_DIM_NONE;
+	return pcbout;
 }
 
+/*
+* Zstandard, in place of deflate where decoding speed matters more
+* than the last few percent of size. Optional at build time, so
+* patches only get it when asked for, and can then only be read by
+* builds that have it.
+*/
+#define PC_ZSTD_LEVEL 3
 
-static int
-pc_bytes_uncompressed_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+PCBYTES
+pc_bytes_zstd_encode(const PCBYTES pcb)
 {
-	int i;
-	int element_size = pc_interpretation_size(pcb->interpretation);
-	double d;
+	PCBYTES pcbout = pcb;
+#ifdef HAVE_ZSTD
+	size_t bufsize = ZSTD_compressBound(pcb.size);
+	uint8_t *buf = pcalloc(bufsize);
+	size_t have = ZSTD_compress(buf, bufsize, pcb.bytes, pcb.size, PC_ZSTD_LEVEL);
+
+	if ( ZSTD_isError(have) )
+	{
+		pcfree(buf);
+		pcerror("%s: %s", __func__, ZSTD_getErrorName(have));
+		return pc_bytes_clone(pcb);
+	}
+	pcbout.size = have;
+	pcbout.bytes = pcalloc(pcbout.size);
+	pcbout.compression = PC_DIM_ZSTD;
+	pcbout.readonly = PC_FALSE;
+	memcpy(pcbout.bytes, buf, have);
+	pcfree(buf);
+#else
+	pcerror("%s: zstd compression is not supported by this build", __func__);
+	pcbout = pc_bytes_clone(pcb);
+#endif
+	return pcbout;
+}
+
+PCBYTES
+pc_bytes_zstd_decode(const PCBYTES pcb)
+{
+	PCBYTES pcbout = pcb;
+
+	pcbout.size = pc_interpretation_size(pcb.interpretation) * pcb.npoints;
+	pcbout.bytes = pcalloc(pcbout.size ? pcbout.size : 1);
+	pcbout.compression = PC_DIM_NONE;
+	pcbout.readonly = PC_FALSE;
+#ifdef HAVE_ZSTD
+	{
+		size_t have = ZSTD_decompress(pcbout.bytes, pcbout.size, pcb.bytes, pcb.size);
+		if ( ZSTD_isError(have) || have != pcbout.size )
+			pcerror("%s: %s", __func__, ZSTD_isError(have) ? ZSTD_getErrorName(have) : "short output");
+	}
+#else
+	pcerror("%s: zstd compression is not supported by this build", __func__);
+#endif
+	return pcbout;
+}
+
+/*
+* lz4, for dimensions read far more often than they are written:
+* it decodes faster still than zstd, at a lower ratio. Optional at
+* build time like zstd.
+*/
+PCBYTES
+pc_bytes_lz4_encode(const PCBYTES pcb)
+{
+	PCBYTES pcbout = pcb;
+#ifdef HAVE_LZ4
+	int bufsize = LZ4_compressBound(pcb.size);
+	uint8_t *buf = pcalloc(bufsize ? bufsize : 1);
+	int have = LZ4_compress_default((const char *)pcb.bytes, (char *)buf, pcb.size, bufsize);
+
+	if ( have <= 0 && pcb.size )
+	{
+		pcfree(buf);
+		pcerror("%s: compression failed", __func__);
+		return pc_bytes_clone(pcb);
+	}
+	pcbout.size = have;
+	pcbout.bytes = pcalloc(pcbout.size ? pcbout.size : 1);
+	pcbout.compression = PC_DIM_LZ4;
+	pcbout.readonly = PC_FALSE;
+	memcpy(pcbout.bytes, buf, have);
+	pcfree(buf);
+#else
+	pcerror("%s: lz4 compression is not supported by this build", __func__);
+	pcbout = pc_bytes_clone(pcb);
+#endif
+	return pcbout;
+}
+
+PCBYTES
+pc_bytes_lz4_decode(const PCBYTES pcb)
+{
+	PCBYTES pcbout = pcb;
+
+	pcbout.size = pc_interpretation_size(pcb.interpretation) * pcb.npoints;
+	pcbout.bytes = pcalloc(pcbout.size ? pcbout.size : 1);
+	pcbout.compression = PC_DIM_NONE;
+	pcbout.readonly = PC_FALSE;
+#ifdef HAVE_LZ4
+	{
+		int have = LZ4_decompress_safe((const char *)pcb.bytes, (char *)pcbout.bytes, pcb.size, pcbout.size);
+		if ( have < 0 || (size_t)have != pcbout.size )
+			pcerror("%s: %s", __func__, have < 0 ? "corrupt input" : "short output");
+	}
+#else
+	pcerror("%s: lz4 compression is not supported by this build", __func__);
+#endif
+	return pcbout;
+}
+
+int
+pc_bytes_compression_available(int compression)
+{
+#ifndef HAVE_ZSTD
+	if ( compression == PC_DIM_ZSTD )
+		return PC_FALSE;
+#endif
+#ifndef HAVE_LZ4
+	if ( compression == PC_DIM_LZ4 )
+		return PC_FALSE;
+#endif
+	return compression >= 0 && compression < PC_DIM_NUM_COMPRESSIONS;
+}
+
+/*
+* Delta encoding, for sorted or scan ordered values like
+* timestamps or coordinates along a scan line. Each value is stored
+* as its difference to the one before (order 1), or as the
+* difference of that to the difference before (order 2), as a
+* zig-zag varint in the fewest bytes that hold it. The first value
+* is taken against a zero, so the stream needs no header.
+*
+* Values are handled as integers of their size, floating point ones
+* by their bit pattern, so the round trip is always exact.
+*/
+
+static uint64_t
+pc_bytes_delta_get(const uint8_t *ptr, uint32_t interpretation)
+{
+	switch( interpretation )
+	{
+	case PC_UINT8:
+	{
+		uint8_t v;
+		memcpy(&v, ptr, sizeof(uint8_t));
+		return v;
+	}
+	case PC_UINT16:
+	{
+		uint16_t v;
+		memcpy(&v, ptr, sizeof(uint16_t));
+		return v;
+	}
+	case PC_UINT32:
+	{
+		uint32_t v;
+		memcpy(&v, ptr, sizeof(uint32_t));
+		return v;
+	}
+	case PC_INT8:
+	{
+		int8_t v;
+		memcpy(&v, ptr, sizeof(int8_t));
+		return (uint64_t)(int64_t)v;
+	}
+	case PC_INT16:
+	{
+		int16_t v;
+		memcpy(&v, ptr, sizeof(int16_t));
+		return (uint64_t)(int64_t)v;
+	}
+	case PC_INT32:
+	case PC_FLOAT:
+	{
+		int32_t v;
+		memcpy(&v, ptr, sizeof(int32_t));
+		return (uint64_t)(int64_t)v;
+	}
+	case PC_UINT64:
+	case PC_INT64:
+	case PC_DOUBLE:
+	{
+		uint64_t v;
+		memcpy(&v, ptr, sizeof(uint64_t));
+		return v;
+	}
+	default:
+	{
+		pcerror("%s: cannot handle interpretation %d", __func__, interpretation);
+	}
+	}
+	return 0;
+}
+
+static void
+pc_bytes_delta_put(uint8_t *ptr, uint32_t interpretation, uint64_t val)
+{
+	switch( pc_interpretation_size(interpretation) )
+	{
+	case 1:
+	{
+		uint8_t v = (uint8_t)val;
+		memcpy(ptr, &v, sizeof(uint8_t));
+		break;
+	}
+	case 2:
+	{
+		uint16_t v = (uint16_t)val;
+		memcpy(ptr, &v, sizeof(uint16_t));
+		break;
+	}
+	case 4:
+	{
+		uint32_t v = (uint32_t)val;
+		memcpy(ptr, &v, sizeof(uint32_t));
+		break;
+	}
+	case 8:
+	{
+		memcpy(ptr, &val, sizeof(uint64_t));
+		break;
+	}
+	default:
+	{
+		pcerror("%s: cannot handle interpretation %d", __func__, interpretation);
+	}
+	}
+}
+
+/* Signed differences wrap around, small in magnitude either way */
+static inline uint64_t
+pc_bytes_delta_zigzag(uint64_t d)
+{
+	return (d << 1) ^ (uint64_t)((int64_t)d >> 63);
+}
+
+static inline uint64_t
+pc_bytes_delta_unzigzag(uint64_t z)
+{
+	return (z >> 1) ^ -(z & 1);
+}
+
+static inline uint32_t
+pc_bytes_delta_varint_size(uint64_t z)
+{
+	uint32_t n = 1;
+	while ( z >= 0x80 )
+	{
+		z >>= 7;
+		n++;
+	}
+	return n;
+}
+
+/* Compression type of a delta order */
+static inline int
+pc_bytes_delta_order(uint32_t compression)
+{
+	return compression == PC_DIM_DELTA2 ? 2 : 1;
+}
+
+/*
+* Walks the values of a delta stream. Call next npoints times at
+* most, each call returns the following value.
+*/
+typedef struct
+{
+	const uint8_t *ptr;
+	const uint8_t *end;
+	int order;
+	uint64_t val;
+	uint64_t delta;
+} PCDELTAREADER;
+
+static void
+pc_bytes_delta_reader_init(PCDELTAREADER *rd, const PCBYTES *pcb)
+{
+	rd->ptr = pcb->bytes;
+	rd->end = pcb->bytes + pcb->size;
+	rd->order = pc_bytes_delta_order(pcb->compression);
+	rd->val = 0;
+	rd->delta = 0;
+}
+
+static inline uint64_t
+pc_bytes_delta_reader_next(PCDELTAREADER *rd)
+{
+	uint64_t z = 0;
+	int shift = 0;
+
+	while ( rd->ptr < rd->end )
+	{
+		uint8_t b = *(rd->ptr++);
+		z |= (uint64_t)(b & 0x7F) << shift;
+		if ( ! (b & 0x80) )
+			break;
+		shift += 7;
+	}
+
+	if ( rd->order == 2 )
+	{
+		rd->delta += pc_bytes_delta_unzigzag(z);
+		rd->val += rd->delta;
+	}
+	else
+	{
+		rd->val += pc_bytes_delta_unzigzag(z);
+	}
+	return rd->val;
+}
+
+uint32_t
+pc_bytes_delta_count(const PCBYTES *pcb, int order)
+{
+	int sz = pc_interpretation_size(pcb->interpretation);
+	const uint8_t *ptr = pcb->bytes;
+	uint64_t prev = 0, prevdelta = 0;
+	uint32_t i, size = 0;
+
+	assert(pcb->compression == PC_DIM_NONE);
+
+	for ( i = 0; i < pcb->npoints; i++ )
+	{
+		uint64_t val = pc_bytes_delta_get(ptr, pcb->interpretation);
+		uint64_t delta = val - prev;
+		size += pc_bytes_delta_varint_size(pc_bytes_delta_zigzag(order == 2 ? delta - prevdelta : delta));
+		prevdelta = delta;
+		prev = val;
+		ptr += sz;
+	}
+	return size;
+}
+
+PCBYTES
+pc_bytes_delta_encode(const PCBYTES pcb, int order)
+{
+	int sz = pc_interpretation_size(pcb.interpretation);
+	const uint8_t *ptr = pcb.bytes;
+	uint64_t prev = 0, prevdelta = 0;
+	uint32_t i;
+	uint8_t *out;
+	PCBYTES pcbout = pcb;
+
+	pcbout.size = pc_bytes_delta_count(&pcb, order);
+	pcbout.bytes = out = pcalloc(pcbout.size ? pcbout.size : 1);
+	pcbout.compression = order == 2 ? PC_DIM_DELTA2 : PC_DIM_DELTA;
+	pcbout.readonly = PC_FALSE;
+
+	for ( i = 0; i < pcb.npoints; i++ )
+	{
+		uint64_t val = pc_bytes_delta_get(ptr, pcb.interpretation);
+		uint64_t delta = val - prev;
+		uint64_t z = pc_bytes_delta_zigzag(order == 2 ? delta - prevdelta : delta);
+		while ( z >= 0x80 )
+		{
+			*out++ = (uint8_t)(z | 0x80);
+			z >>= 7;
+		}
+		*out++ = (uint8_t)z;
+		prevdelta = delta;
+		prev = val;
+		ptr += sz;
+	}
+	return pcbout;
+}
+
+PCBYTES
+pc_bytes_delta_decode(const PCBYTES pcb)
+{
+	int sz = pc_interpretation_size(pcb.interpretation);
+	PCDELTAREADER rd;
+	PCBYTES pcbout = pcb;
+	uint8_t *ptr;
+	uint32_t i;
+
+	assert(pcb.compression == PC_DIM_DELTA || pcb.compression == PC_DIM_DELTA2);
+
+	pcbout.size = sz * pcb.npoints;
+	pcbout.bytes = ptr = pcalloc(pcbout.size ? pcbout.size : 1);
+	pcbout.compression = PC_DIM_NONE;
+	pcbout.readonly = PC_FALSE;
+
+	pc_bytes_delta_reader_init(&rd, &pcb);
+	for ( i = 0; i < pcb.npoints; i++ )
+	{
+		pc_bytes_delta_put(ptr, pcb.interpretation, pc_bytes_delta_reader_next(&rd));
+		ptr += sz;
+	}
+	return pcbout;
+}
+
+/**
+* This flips bytes in-place, so won't work on readonly bytes
+*/
+PCBYTES
+pc_bytes_flip_endian(PCBYTES pcb)
+{
+	if ( pcb.readonly )
+		pcerror("pc_bytes_flip_endian: cannot flip readonly bytes");
+
+	switch(pcb.compression)
+	{
+	case PC_DIM_NONE:
+		return pcb;
+	case PC_DIM_SIGBITS:
+		return pc_bytes_sigbits_flip_endian(pcb);
+	case PC_DIM_ZLIB:
+		pc_bytes_index_flip_endian(&pcb);
+		return pcb;
+	case PC_DIM_ZSTD:
+	case PC_DIM_LZ4:
+		return pcb;
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
+		/* Varints are written a byte at a time */
+		return pcb;
+	case PC_DIM_RLE:
+		pcb = pc_bytes_run_length_flip_endian(pcb);
+		pc_bytes_index_flip_endian(&pcb);
+		return pcb;
+	default:
+		pcerror("%s: unknown compression", __func__);
+	}
+
+	return pcb;
+}
+
+size_t
+pc_bytes_serialized_size(const PCBYTES *pcb)
+{
+	/* compression type (1) + size of data (4) + data + index */
+	return 1 + 4 + pcb->size + pcb->indexsize;
+}
+
+int
+pc_bytes_serialize(const PCBYTES *pcb, uint8_t *buf, size_t *size)
+{
+	static int compression_num_size = 1;
+	static int size_num_size = 4;
+	int32_t pcbsize = pcb->size + pcb->indexsize;
+
+	/* Compression type number */
+	*buf = pcb->compression | (pcb->indexsize ? PC_DIM_INDEXED : 0);
+	buf += compression_num_size;
+	/* Buffer size */
+	memcpy(buf, &pcbsize, size_num_size);
+	buf += size_num_size;
+	/* Buffer contents, index included */
+	memcpy(buf, pcb->bytes, pcbsize);
+	/* Return total size */
+	*size = compression_num_size + size_num_size + pcbsize;
+	return PC_SUCCESS;
+}
+
+int
+pc_bytes_deserialize(const uint8_t *buf, const PCDIMENSION *dim, PCBYTES *pcb, int readonly, int flip_endian)
+{
+	pcb->compression = buf[0];
+	pcb->size = wkb_get_int32(buf+1, flip_endian);
+	pcb->interpretation = dim->interpretation;
+	pcb->readonly = readonly;
+	if ( readonly && flip_endian )
+		pcerror("pc_bytes_deserialize: cannot create a read-only buffer on byteswapped input");
+	if ( readonly )
+	{
+		pcb->bytes = (uint8_t*)(buf+5);
+	}
+	else
+	{
+		pcb->bytes = pcalloc(pcb->size);
+		memcpy(pcb->bytes, buf+5, pcb->size);
+	}
+	if ( pc_bytes_index_split(pcb, flip_endian) != PC_SUCCESS )
+		return PC_FAILURE;
+	if ( flip_endian && ! readonly )
+	{
+		*pcb = pc_bytes_flip_endian(*pcb);
+	}
+	/* WARNING, pcb.npoints must be set beforehand, to check the index */
+	return PC_SUCCESS;
+}
+
+/**
+* Like pc_bytes_deserialize, for the bytes located by a directory
+* entry within the dimensional data in buf.
+*/
+int
+pc_bytes_from_dimentry(const uint8_t *buf, const PCDIMENTRY *entry, const PCDIMENSION *dim, uint32_t npoints, PCBYTES *pcb, int readonly, int flip_endian)
+{
+	pcb->compression = entry->compression;
+	pcb->size = entry->size;
+	pcb->npoints = npoints;
+	pcb->interpretation = dim->interpretation;
+	pcb->readonly = readonly;
+	if ( readonly && flip_endian )
+	{
+		pcerror("%s: cannot create a read-only buffer on byteswapped input", __func__);
+		return PC_FAILURE;
+	}
+	if ( readonly )
+	{
+		pcb->bytes = (uint8_t*)(buf + entry->offset);
+	}
+	else
+	{
+		pcb->bytes = pcalloc(pcb->size);
+		memcpy(pcb->bytes, buf + entry->offset, pcb->size);
+	}
+	if ( pc_bytes_index_split(pcb, flip_endian) != PC_SUCCESS )
+		return PC_FAILURE;
+	if ( flip_endian && ! readonly )
+		*pcb = pc_bytes_flip_endian(*pcb);
+	return PC_SUCCESS;
+}
+
+
+static int
+pc_bytes_uncompressed_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+{
+	uint32_t i, k, n;
+	size_t element_size = pc_interpretation_size(pcb->interpretation);
+	double vals[PC_VALUES_CHUNK];
 	double mn = FLT_MAX;
 	double mx = -1*FLT_MAX;
 	double sm = 0.0;
-	for ( i = 0; i < pcb->npoints; i++ )
+	for ( k = 0; k < pcb->npoints; k += n )
 	{
-		d = pc_double_from_ptr(pcb->bytes + i*element_size, pcb->interpretation);
-		if ( d < mn )
-			mn = d;
-		if ( d > mx )
-			mx = d;
-		sm += d;
+		n = pcb->npoints - k < PC_VALUES_CHUNK ? pcb->npoints - k : PC_VALUES_CHUNK;
+		pc_values_to_double(pcb->bytes + k * element_size, element_size, pcb->interpretation, 1, 0, n, vals);
+		for ( i = 0; i < n; i++ )
+		{
+			if ( vals[i] < mn )
+				mn = vals[i];
+			if ( vals[i] > mx )
+				mx = vals[i];
+			sm += vals[i];
+		}
 	}
 	*min = mn;
 	*max = mx;
@@ -1449,24 +2293,97 @@ pc_bytes_run_length_minmax(const PCBYTES *pcb, double *min, double *max, double
 }
 
 
+/**
+* Inflate a deflated stream a chunk of values at a time, folding
+* them into min, max and sum as they come out, so the decoded array
+* is never materialized.
+*/
+static int
+pc_bytes_zlib_minmax_stream(const uint8_t *in, size_t insize, uint32_t interpretation, double *mn, double *mx, double *sm)
+{
+	z_stream strm;
+	int ret;
+	uint32_t i, n;
+	size_t sz = pc_interpretation_size(interpretation);
+	uint8_t chunk[PC_VALUES_CHUNK * 8];
+	double vals[PC_VALUES_CHUNK];
+
+	/* Use our own allocators */
+	strm.zalloc = pc_zlib_alloc;
+	strm.zfree = pc_zlib_free;
+	strm.opaque = Z_NULL;
+	if ( inflateInit(&strm) != Z_OK )
+		return PC_FAILURE;
+	strm.avail_in = insize;
+	strm.next_in = (uint8_t*)in;
+
+	do
+	{
+		/* Whole chunks hold whole values */
+		strm.avail_out = PC_VALUES_CHUNK * sz;
+		strm.next_out = chunk;
+		ret = inflate(&strm, Z_NO_FLUSH);
+		if ( ret != Z_OK && ret != Z_STREAM_END )
+			break;
+		n = (PC_VALUES_CHUNK * sz - strm.avail_out) / sz;
+		pc_values_to_double(chunk, sz, interpretation, 1, 0, n, vals);
+		for ( i = 0; i < n; i++ )
+		{
+			if ( vals[i] < *mn ) *mn = vals[i];
+			if ( vals[i] > *mx ) *mx = vals[i];
+			*sm += vals[i];
+		}
+	}
+	while ( ret != Z_STREAM_END );
+
+	inflateEnd(&strm);
+	return ret == Z_STREAM_END ? PC_SUCCESS : PC_FAILURE;
+}
+
 static int
 pc_bytes_zlib_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
 {
-	PCBYTES zcb = pc_bytes_zlib_decode(*pcb);
-	int rv = pc_bytes_uncompressed_minmax(&zcb, min, max, avg);
-	pc_bytes_free(zcb);
+	double mn = FLT_MAX;
+	double mx = -1*FLT_MAX;
+	double sm = 0.0;
+	int rv = PC_SUCCESS;
+
+	if ( ! pcb->indexsize )
+	{
+		rv = pc_bytes_zlib_minmax_stream(pcb->bytes, pcb->size, pcb->interpretation, &mn, &mx, &sm);
+	}
+	else
+	{
+		/* Blocks are separate streams */
+		uint32_t b, start = 0;
+		uint32_t nblocks = pc_bytes_index_count(pcb);
+		for ( b = 0; b < nblocks && rv == PC_SUCCESS; b++ )
+		{
+			uint32_t end = pc_bytes_index_get(pcb, b);
+			if ( end < start || end > pcb->size )
+				return PC_FAILURE;
+			rv = pc_bytes_zlib_minmax_stream(pcb->bytes + start, end - start, pcb->interpretation, &mn, &mx, &sm);
+			start = end;
+		}
+	}
+
+	*min = mn;
+	*max = mx;
+	*avg = sm / pcb->npoints;
 	return rv;
 }
 
 static int
-pc_bytes_sigbits_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+pc_bytes_decoded_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
 {
-	PCBYTES zcb = pc_bytes_sigbits_decode(*pcb);
-	int rv = pc_bytes_uncompressed_minmax(&zcb, min, max, avg);
-	pc_bytes_free(zcb);
+	PCBYTES dpcb = pc_bytes_decode(*pcb);
+	int rv = pc_bytes_uncompressed_minmax(&dpcb, min, max, avg);
+	pc_bytes_free(dpcb);
 	return rv;
 }
 
+static int pc_bytes_sigbits_minmax(const PCBYTES *pcb, double *min, double *max, double *avg);
+
 int
 pc_bytes_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
 {
@@ -1478,6 +2395,11 @@ pc_bytes_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
 		return pc_bytes_sigbits_minmax(pcb, min, max, avg);
 	case PC_DIM_ZLIB:
 		return pc_bytes_zlib_minmax(pcb, min, max, avg);
+	case PC_DIM_ZSTD:
+	case PC_DIM_LZ4:
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
+		return pc_bytes_decoded_minmax(pcb, min, max, avg);
 	case PC_DIM_RLE:
 		return pc_bytes_run_length_minmax(pcb, min, max, avg);
 	default:
@@ -1486,23 +2408,45 @@ pc_bytes_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
 	return PC_FAILURE;
 }
 
+int
+pc_bytes_get_values(const PCBYTES *pcb, const PCDIMENSION *dim, double *vals)
+{
+	PCBYTES dpcb = *pcb;
+	size_t sz = pc_interpretation_size(pcb->interpretation);
+
+	if ( pcb->compression != PC_DIM_NONE )
+		dpcb = pc_bytes_decode(*pcb);
+
+	pc_values_to_double(dpcb.bytes, sz, dpcb.interpretation, dim->scale, dim->offset, dpcb.npoints, vals);
+
+	if ( pcb->compression != PC_DIM_NONE )
+		pc_bytes_free(dpcb);
+	return PC_SUCCESS;
+}
+
 /* NOTE: stats are gathered without applying scale and offset */
 static PCBYTES
 pc_bytes_uncompressed_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
 {
-	int i = 0, j = 0;
+	uint32_t w, nwords = PC_BITMAP_NWORDS(pcb->npoints);
 	double d;
-	PCBYTES fpcb = pc_bytes_clone(*pcb);
+	PCBYTES fpcb = *pcb;
 	int interp = pcb->interpretation;
 	int sz = pc_interpretation_size(interp);
-	uint8_t *buf = pcb->bytes;
-	uint8_t *fbuf = fpcb.bytes;
+	uint8_t *fbuf;
+
+	/* Only the survivors are written, no need to copy the input first */
+	fpcb.bytes = pcalloc(map->nset * sz);
+	fpcb.readonly = PC_FALSE;
+	fbuf = fpcb.bytes;
 
-	while ( i < pcb->npoints )
+	for ( w = 0; w < nwords; w++ )
 	{
-		/* This entry is flagged to copy, so... */
-		if ( pc_bitmap_get(map, i) )
+		uint64_t bits = map->map[w];
+		/* Visit only the entries flagged to copy */
+		while ( bits )
 		{
+			const uint8_t *buf = pcb->bytes + ((size_t)w * 64 + pc_bitmap_ctz(bits)) * sz;
 			/* Update stats on filtered bytes */
 			if ( stats )
 			{
@@ -1514,13 +2458,11 @@ pc_bytes_uncompressed_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLEST
 			/* Copy into filtered byte array */
 			memcpy(fbuf, buf, sz);
 			fbuf += sz;
-			j++;
+			bits &= bits - 1;
 		}
-		buf += sz;
-		i++;
 	}
 	fpcb.size = fbuf - fpcb.bytes;
-	fpcb.npoints = j;
+	fpcb.npoints = fpcb.size / sz;
 	return fpcb;
 }
 
@@ -1528,17 +2470,22 @@ pc_bytes_uncompressed_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLEST
 static PCBYTES
 pc_bytes_run_length_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
 {
-	int i = 0, j = 0, npoints = 0;
+	int i = 0, npoints = 0;
 	double d;
 
-	PCBYTES fpcb = pc_bytes_clone(*pcb);
+	PCBYTES fpcb = *pcb;
 	int sz = pc_interpretation_size(pcb->interpretation);
-	uint8_t *fptr = fpcb.bytes;
+	uint8_t *fptr;
 	uint8_t *ptr = pcb->bytes;
 	uint8_t *ptr_end = pcb->bytes + pcb->size;
 	uint8_t count;
 	uint8_t fcount;
 
+	/* The filtered runs never outgrow the input ones */
+	fpcb.bytes = pcalloc(pcb->size);
+	fpcb.readonly = PC_FALSE;
+	fptr = fpcb.bytes;
+
 	while( ptr < ptr_end )
 	{
 		/* Read unfiltered count */
@@ -1547,13 +2494,7 @@ pc_bytes_run_length_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT
 		fcount = 0;
 
 		/* How many filtered points are in this value entry? */
-		for ( j = i; j < i+count; j++ )
-		{
-			if ( pc_bitmap_get(map, j) )
-			{
-				fcount++;
-			}
-		}
+		fcount = pc_bitmap_count_range(map, i, count);
 
 		/* If there are some, we need to copy */
 		if ( fcount )
@@ -1585,9 +2526,320 @@ pc_bytes_run_length_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT
 	}
 	fpcb.size = fptr - fpcb.bytes;
 	fpcb.npoints = npoints;
+	pc_bytes_run_length_index(&fpcb);
 	return fpcb;
 }
 
+/*
+* Decode-free filtering of sigbits arrays.
+*
+* All the values of a sigbits array lie between the common value and the
+* common value with every unique bit set, so the header alone can often
+* decide a filter for the whole array. Otherwise the packed values are
+* read one at a time, without materializing the decoded array.
+*/
+
+/**
+* Can the filter be decided for a whole array from its value range?
+* Returns PC_TRUE if every value passes, PC_FALSE if none does and -1
+* if the values have to be tested one by one.
+*/
+static int
+pc_bytes_sigbits_range_filter(const PCBYTES *pcb, int nbits, const uint8_t *minptr, const uint8_t *maxptr, PC_FILTERTYPE filter, double val1, double val2)
+{
+	double min, max;
+	int width = 8 * pc_interpretation_size(pcb->interpretation);
+
+	switch ( pcb->interpretation )
+	{
+	case PC_UINT8:
+	case PC_UINT16:
+	case PC_UINT32:
+	case PC_UINT64:
+		break;
+	case PC_INT8:
+	case PC_INT16:
+	case PC_INT32:
+	case PC_INT64:
+		/* Without a common sign bit the range wraps around */
+		if ( nbits < width )
+			break;
+		return -1;
+	default:
+		/* Float bit patterns don't sort like their values */
+		if ( nbits == 0 )
+			break;
+		return -1;
+	}
+
+	min = pc_double_from_ptr(minptr, pcb->interpretation);
+	max = pc_double_from_ptr(maxptr, pcb->interpretation);
+
+	switch ( filter )
+	{
+	case PC_GT:
+		if ( min > val1 ) return PC_TRUE;
+		if ( max <= val1 ) return PC_FALSE;
+		break;
+	case PC_LT:
+		if ( max < val1 ) return PC_TRUE;
+		if ( min >= val1 ) return PC_FALSE;
+		break;
+	case PC_EQUAL:
+		if ( min == val1 && max == val1 ) return PC_TRUE;
+		if ( max < val1 || min > val1 ) return PC_FALSE;
+		break;
+	case PC_BETWEEN:
+		if ( min > val1 && max < val2 ) return PC_TRUE;
+		if ( max <= val1 || min >= val2 ) return PC_FALSE;
+		break;
+	}
+	return -1;
+}
+
+/**
+* Read the next unique part off a packed sigbits array,
+* advancing the read head (word pointer and bit position).
+*/
+#define PC_BYTES_SIGBITS_NEXT(N) \
+static inline uint##N##_t \
+pc_bytes_sigbits_next_##N(const uint##N##_t **words, int *bit, int nbits, uint##N##_t mask) \
+{ \
+	uint##N##_t val; \
+	int shift = *bit - nbits; \
+	/* The unique part is all in this word */ \
+	if ( shift >= 0 ) \
+	{ \
+		val = (uint##N##_t)(**words >> shift); \
+		*bit = shift; \
+		if ( shift == 0 ) \
+		{ \
+			(*words)++; \
+			*bit = N; \
+		} \
+	} \
+	/* The unique part is split over this word and the next */ \
+	else \
+	{ \
+		val = (uint##N##_t)(**words << -shift); \
+		(*words)++; \
+		*bit = N + shift; \
+		val |= (uint##N##_t)(**words >> *bit); \
+	} \
+	return val & mask; \
+}
+
+#define PC_BYTES_SIGBITS_BITMAP(N) \
+static PCBITMAP * \
+pc_bytes_sigbits_bitmap_##N(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2, PCARENA *arena) \
+{ \
+	uint32_t i; \
+	const uint##N##_t *words = (const uint##N##_t*)(pcb->bytes); \
+	/* How many unique bits? */ \
+	int nbits = words[0]; \
+	/* What is the shared bit value? */ \
+	uint##N##_t commonvalue = words[1]; \
+	/* Mask for just the unique parts */ \
+	uint##N##_t mask = nbits ? ((uint##N##_t)~(uint##N##_t)0) >> (N - nbits) : 0; \
+	uint##N##_t maxvalue = commonvalue | mask; \
+	int bit = N; \
+	PCBITMAP *map = pc_bitmap_new_in(arena, pcb->npoints); \
+	\
+	uint64_t bits = 0; \
+	double lo, hi; \
+	\
+	switch ( pc_bytes_sigbits_range_filter(pcb, nbits, (uint8_t*)&commonvalue, (uint8_t*)&maxvalue, filter, val1, val2) ) \
+	{ \
+	case PC_TRUE: \
+		pc_bitmap_set_range(map, 0, pcb->npoints); \
+		return map; \
+	case PC_FALSE: \
+		return map; \
+	} \
+	if ( ! pc_filter_range(filter, val1, val2, &lo, &hi) ) \
+		return map; \
+	\
+	words += 2; \
+	for ( i = 0; i < pcb->npoints; i++ ) \
+	{ \
+		uint##N##_t val = commonvalue | pc_bytes_sigbits_next_##N(&words, &bit, nbits, mask); \
+		double d = pc_double_from_ptr((uint8_t*)&val, pcb->interpretation); \
+		bits |= (uint64_t)((d >= lo) & (d <= hi)) << (i & 63); \
+		if ( (i & 63) == 63 ) \
+		{ \
+			map->map[i >> 6] = bits; \
+			bits = 0; \
+		} \
+	} \
+	if ( i & 63 ) \
+		map->map[i >> 6] = bits; \
+	pc_bitmap_update_nset(map); \
+	return map; \
+}
+
+/* NOTE: stats are gathered without applying scale and offset */
+#define PC_BYTES_SIGBITS_FILTER(N) \
+static PCBYTES \
+pc_bytes_sigbits_filter_##N(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats) \
+{ \
+	uint32_t i, j = 0; \
+	const uint##N##_t *words = (const uint##N##_t*)(pcb->bytes); \
+	int nbits = words[0]; \
+	uint##N##_t commonvalue = words[1]; \
+	uint##N##_t mask = nbits ? ((uint##N##_t)~(uint##N##_t)0) >> (N - nbits) : 0; \
+	int bit = N; \
+	/* Only the surviving values are written out */ \
+	uint##N##_t *fbytes = pcalloc(sizeof(uint##N##_t) * (map->nset ? map->nset : 1)); \
+	PCBYTES fpcb = *pcb; \
+	PCBYTES efpcb; \
+	\
+	words += 2; \
+	for ( i = 0; i < pcb->npoints && j < map->nset; i++ ) \
+	{ \
+		uint##N##_t val = commonvalue; \
+		if ( nbits ) \
+			val |= pc_bytes_sigbits_next_##N(&words, &bit, nbits, mask); \
+		if ( ! pc_bitmap_get(map, i) ) \
+			continue; \
+		/* Update stats on filtered values */ \
+		if ( stats ) \
+		{ \
+			double d = pc_double_from_ptr((uint8_t*)&val, pcb->interpretation); \
+			if ( d < stats->min ) stats->min = d; \
+			if ( d > stats->max ) stats->max = d; \
+			stats->sum += d; \
+		} \
+		fbytes[j++] = val; \
+	} \
+	\
+	fpcb.bytes = (uint8_t*)fbytes; \
+	fpcb.size = j * sizeof(uint##N##_t); \
+	fpcb.npoints = j; \
+	fpcb.compression = PC_DIM_NONE; \
+	fpcb.readonly = PC_FALSE; \
+	efpcb = pc_bytes_sigbits_encode(fpcb); \
+	pc_bytes_free(fpcb); \
+	return efpcb; \
+}
+
+PC_BYTES_SIGBITS_NEXT(8)
+PC_BYTES_SIGBITS_NEXT(16)
+PC_BYTES_SIGBITS_NEXT(32)
+PC_BYTES_SIGBITS_NEXT(64)
+
+PC_BYTES_SIGBITS_BITMAP(8)
+PC_BYTES_SIGBITS_BITMAP(16)
+PC_BYTES_SIGBITS_BITMAP(32)
+PC_BYTES_SIGBITS_BITMAP(64)
+
+PC_BYTES_SIGBITS_FILTER(8)
+PC_BYTES_SIGBITS_FILTER(16)
+PC_BYTES_SIGBITS_FILTER(32)
+PC_BYTES_SIGBITS_FILTER(64)
+
+/**
+* Stats read straight off the packed values, in one pass and
+* without decoding them to an array first. With no unique bits
+* every value is the common one.
+*/
+#define PC_BYTES_SIGBITS_MINMAX(N) \
+static int \
+pc_bytes_sigbits_minmax_##N(const PCBYTES *pcb, double *min, double *max, double *avg) \
+{ \
+	uint32_t i; \
+	const uint##N##_t *words = (const uint##N##_t*)(pcb->bytes); \
+	int nbits = words[0]; \
+	uint##N##_t commonvalue = words[1]; \
+	uint##N##_t mask = nbits ? ((uint##N##_t)~(uint##N##_t)0) >> (N - nbits) : 0; \
+	int bit = N; \
+	double mn = FLT_MAX; \
+	double mx = -1*FLT_MAX; \
+	double sm = 0.0; \
+	\
+	if ( ! nbits ) \
+	{ \
+		*min = *max = *avg = pc_double_from_ptr((uint8_t*)&commonvalue, pcb->interpretation); \
+		return PC_SUCCESS; \
+	} \
+	\
+	words += 2; \
+	for ( i = 0; i < pcb->npoints; i++ ) \
+	{ \
+		uint##N##_t val = commonvalue | pc_bytes_sigbits_next_##N(&words, &bit, nbits, mask); \
+		double d = pc_double_from_ptr((uint8_t*)&val, pcb->interpretation); \
+		if ( d < mn ) mn = d; \
+		if ( d > mx ) mx = d; \
+		sm += d; \
+	} \
+	*min = mn; \
+	*max = mx; \
+	*avg = sm / pcb->npoints; \
+	return PC_SUCCESS; \
+}
+
+PC_BYTES_SIGBITS_MINMAX(8)
+PC_BYTES_SIGBITS_MINMAX(16)
+PC_BYTES_SIGBITS_MINMAX(32)
+PC_BYTES_SIGBITS_MINMAX(64)
+
+static int
+pc_bytes_sigbits_minmax(const PCBYTES *pcb, double *min, double *max, double *avg)
+{
+	switch ( pc_interpretation_size(pcb->interpretation) )
+	{
+	case 1:
+		return pc_bytes_sigbits_minmax_8(pcb, min, max, avg);
+	case 2:
+		return pc_bytes_sigbits_minmax_16(pcb, min, max, avg);
+	case 4:
+		return pc_bytes_sigbits_minmax_32(pcb, min, max, avg);
+	case 8:
+		return pc_bytes_sigbits_minmax_64(pcb, min, max, avg);
+	default:
+		pcerror("%s: cannot handle interpretation %d", __func__, pcb->interpretation);
+	}
+	return PC_FAILURE;
+}
+
+static PCBITMAP *
+pc_bytes_sigbits_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2, PCARENA *arena)
+{
+	switch ( pc_interpretation_size(pcb->interpretation) )
+	{
+	case 1:
+		return pc_bytes_sigbits_bitmap_8(pcb, filter, val1, val2, arena);
+	case 2:
+		return pc_bytes_sigbits_bitmap_16(pcb, filter, val1, val2, arena);
+	case 4:
+		return pc_bytes_sigbits_bitmap_32(pcb, filter, val1, val2, arena);
+	case 8:
+		return pc_bytes_sigbits_bitmap_64(pcb, filter, val1, val2, arena);
+	default:
+		pcerror("%s: cannot handle interpretation %d", __func__, pcb->interpretation);
+	}
+	return NULL;
+}
+
+/* NOTE: stats are gathered without applying scale and offset */
+static PCBYTES
+pc_bytes_sigbits_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
+{
+	switch ( pc_interpretation_size(pcb->interpretation) )
+	{
+	case 1:
+		return pc_bytes_sigbits_filter_8(pcb, map, stats);
+	case 2:
+		return pc_bytes_sigbits_filter_16(pcb, map, stats);
+	case 4:
+		return pc_bytes_sigbits_filter_32(pcb, map, stats);
+	case 8:
+		return pc_bytes_sigbits_filter_64(pcb, map, stats);
+	default:
+		pcerror("%s: cannot handle interpretation %d", __func__, pcb->interpretation);
+	}
+	return *pcb;
+}
+
 /* NOTE: stats are gathered without applying scale and offset */
 PCBYTES
 pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
@@ -1601,11 +2853,17 @@ pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
 		return pc_bytes_run_length_filter(pcb, map, stats);
 
 	case PC_DIM_SIGBITS:
+		return pc_bytes_sigbits_filter(pcb, map, stats);
+
 	case PC_DIM_ZLIB:
+	case PC_DIM_ZSTD:
+	case PC_DIM_LZ4:
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
 	{
 		PCBYTES dpcb = pc_bytes_decode(*pcb);
 		PCBYTES fpcb = pc_bytes_uncompressed_filter(&dpcb, map, stats);
-		PCBYTES efpcb = pc_bytes_encode(fpcb, pcb->compression);
+		PCBYTES efpcb = pc_bytes_encode(fpcb, pc_bytes_encoding(pcb));
 		pc_bytes_free(fpcb);
 		pc_bytes_free(dpcb);
 		return efpcb;
@@ -1620,33 +2878,33 @@ pc_bytes_filter(const PCBYTES *pcb, const PCBITMAP *map, PCDOUBLESTAT *stats)
 
 
 static PCBITMAP *
-pc_bytes_run_length_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2)
+pc_bytes_run_length_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2, PCARENA *arena)
 {
-	int i = 0, run = 0;
-	double d;
-	PCBITMAP *map = pc_bitmap_new(pcb->npoints);
+	uint32_t i = 0;
+	double d, lo, hi;
+	PCBITMAP *map = pc_bitmap_new_in(arena, pcb->npoints);
 	int element_size = pc_interpretation_size(pcb->interpretation);
 	uint8_t *ptr = pcb->bytes;
 	uint8_t *ptr_end = pcb->bytes + pcb->size;
 	uint8_t count;
 
+	if ( ! pc_filter_range(filter, val1, val2, &lo, &hi) )
+		return map;
+
 	while( ptr < ptr_end )
 	{
 		/* Read count */
 		count = *ptr;
 		ptr++;
-		run = i + count;
 
 		/* Read value */
 		d = pc_double_from_ptr(ptr, pcb->interpretation);
 		ptr += element_size;
 
 		/* Apply run to bitmap */
-		while ( i < run )
-		{
-			pc_bitmap_filter(map, filter, i, d, val1, val2);
-			i++;
-		}
+		if ( d >= lo && d <= hi )
+			pc_bitmap_set_range(map, i, count);
+		i += count;
 	}
 
 	return map;
@@ -1654,42 +2912,37 @@ pc_bytes_run_length_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1
 
 
 static PCBITMAP *
-pc_bytes_uncompressed_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2)
+pc_bytes_uncompressed_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2, PCARENA *arena)
 {
-	int i = 0;
-	double d;
-	PCBITMAP *map = pc_bitmap_new(pcb->npoints);
+	PCBITMAP *map = pc_bitmap_new_in(arena, pcb->npoints);
 	int element_size = pc_interpretation_size(pcb->interpretation);
-	uint8_t *buf = pcb->bytes;
 
-	while ( i < pcb->npoints )
-	{
-		d = pc_double_from_ptr(buf, pcb->interpretation);
-		pc_bitmap_filter(map, filter, i, d, val1, val2);
-		/* Advance the pointer */
-		buf += element_size;
-		i++;
-	}
+	pc_bitmap_filter_values(map, filter, val1, val2, pcb->bytes, element_size, pcb->interpretation, 1, 0);
 	return map;
 }
 
 PCBITMAP *
-pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2)
+pc_bytes_bitmap(const PCBYTES *pcb, PC_FILTERTYPE filter, double val1, double val2, PCARENA *arena)
 {
 	switch(pcb->compression)
 	{
 	case PC_DIM_NONE:
-		return pc_bytes_uncompressed_bitmap(pcb, filter, val1, val2);
+		return pc_bytes_uncompressed_bitmap(pcb, filter, val1, val2, arena);
 	case PC_DIM_SIGBITS:
+		return pc_bytes_sigbits_bitmap(pcb, filter, val1, val2, arena);
 	case PC_DIM_ZLIB:
+	case PC_DIM_ZSTD:
+	case PC_DIM_LZ4:
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
 	{
 		PCBYTES dpcb = pc_bytes_decode(*pcb);
-		PCBITMAP *map = pc_bytes_uncompressed_bitmap(&dpcb, filter, val1, val2);
+		PCBITMAP *map = pc_bytes_uncompressed_bitmap(&dpcb, filter, val1, val2, arena);
 		pc_bytes_free(dpcb);
 		return map;
 	}
 	case PC_DIM_RLE:
-		return pc_bytes_run_length_bitmap(pcb, filter, val1, val2);
+		return pc_bytes_run_length_bitmap(pcb, filter, val1, val2, arena);
 	default:
 		pcerror("%s: unknown compression", __func__);
 	}
@@ -1715,6 +2968,27 @@ pc_bytes_run_length_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 	size_t size = pc_interpretation_size(pcb.interpretation);
 	assert(pcb.compression == PC_DIM_RLE);
 
+	/* Skip the blocks of runs that end before the n-th value */
+	if ( pcb.indexsize )
+	{
+		uint32_t nentries = pc_bytes_index_count(&pcb);
+		uint32_t blocklen = pc_bytes_index_get(&pcb, nentries);
+		uint32_t lo = 0, hi = nentries;
+		while ( lo < hi )
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+			if ( pc_bytes_index_get(&pcb, mid) <= (uint32_t)n )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if ( lo )
+		{
+			bytes_rle_ptr += (size_t)lo * blocklen * (1 + size);
+			n -= pc_bytes_index_get(&pcb, lo - 1);
+		}
+	}
+
 	while( bytes_rle_ptr < bytes_rle_end )
 	{
 		run = *bytes_rle_ptr;
@@ -1740,9 +3014,9 @@ pc_bytes_sigbits_to_ptr_##N(uint8_t *buf, PCBYTES pcb, int n) \
 	/* Mask for just the unique parts */ \
 	uint##N##_t mask = 0xFFFFFFFFFFFFFFFF >> (64-nbits); \
 	 \
-	uint##N##_t bitoffset = n*nbits; \
+	size_t bitoffset = (size_t)n * nbits; \
 	bytes_ptr += bitoffset / N; \
-	int shift = N - (bitoffset % N) - nbits; \
+	int shift = N - (int)(bitoffset % N) - nbits; \
 	 \
 	uint##N##_t res = commonvalue; \
 	uint##N##_t val = *bytes_ptr; \
@@ -1800,14 +3074,74 @@ pc_bytes_sigbits_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 }
 
 
+/* Indexed bytes only inflate the block of the n-th value */
 void
 pc_bytes_zlib_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 {
-	PCBYTES dpcb = pc_bytes_decode(pcb);
+	PCBYTES dpcb;
+	if ( pcb.indexsize )
+	{
+		size_t size = pc_interpretation_size(pcb.interpretation);
+		uint32_t nblocks = pc_bytes_index_count(&pcb);
+		uint32_t blocklen = pc_bytes_index_get(&pcb, nblocks);
+		uint32_t b, start, end;
+		uint8_t *block;
+
+		if ( blocklen == 0 || n / blocklen >= nblocks )
+		{
+			pcerror("%s: out of bound", __func__);
+			return;
+		}
+		b = n / blocklen;
+		start = b ? pc_bytes_index_get(&pcb, b - 1) : 0;
+		end = pc_bytes_index_get(&pcb, b);
+		if ( end < start || end > pcb.size )
+		{
+			pcerror("%s: bad block index", __func__);
+			return;
+		}
+		block = pcalloc(size * blocklen);
+		pc_bytes_zlib_inflate(pcb.bytes + start, end - start, block, size * blocklen);
+		memcpy(buf, block + (n - (size_t)b * blocklen) * size, size);
+		pcfree(block);
+		return;
+	}
+	dpcb = pc_bytes_decode(pcb);
+	pc_bytes_uncompressed_to_ptr(buf,dpcb,n);
+	pc_bytes_free(dpcb);
+}
+
+void
+pc_bytes_zstd_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+{
+	PCBYTES dpcb = pc_bytes_zstd_decode(pcb);
+	pc_bytes_uncompressed_to_ptr(buf,dpcb,n);
+	pc_bytes_free(dpcb);
+}
+
+void
+pc_bytes_lz4_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+{
+	PCBYTES dpcb = pc_bytes_lz4_decode(pcb);
 	pc_bytes_uncompressed_to_ptr(buf,dpcb,n);
 	pc_bytes_free(dpcb);
 }
 
+/* Runs the deltas up to the n-th value, without decoding the rest */
+void
+pc_bytes_delta_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
+{
+	PCDELTAREADER rd;
+	uint64_t val = 0;
+	int i;
+
+	assert(pcb.compression == PC_DIM_DELTA || pcb.compression == PC_DIM_DELTA2);
+	pc_bytes_delta_reader_init(&rd, &pcb);
+	for ( i = 0; i <= n; i++ )
+		val = pc_bytes_delta_reader_next(&rd);
+	pc_bytes_delta_put(buf, pcb.interpretation, val);
+}
+
 void
 pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 {
@@ -1828,6 +3162,22 @@ pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 		pc_bytes_zlib_to_ptr(buf,pcb,n);
 		break;
 	}
+	case PC_DIM_ZSTD:
+	{
+		pc_bytes_zstd_to_ptr(buf,pcb,n);
+		break;
+	}
+	case PC_DIM_LZ4:
+	{
+		pc_bytes_lz4_to_ptr(buf,pcb,n);
+		break;
+	}
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
+	{
+		pc_bytes_delta_to_ptr(buf,pcb,n);
+		break;
+	}
 	case PC_DIM_NONE:
 	{
 		pc_bytes_uncompressed_to_ptr(buf,pcb,n);
@@ -1840,3 +3190,260 @@ pc_bytes_to_ptr(uint8_t *buf, PCBYTES pcb, int n)
 	}
 }
 
+
+/*
+* Merging of byte arrays, for unions of dimensional patches.
+*
+* Arrays that share a compression are joined in their encoded form:
+* RLE runs are concatenated, sigbits streams are bit-appended when
+* they share their common value. Anything else (deltas included, as
+* each stream starts over from zero) goes through a decode,
+* a concatenation and one final encode.
+*/
+
+static PCBYTES
+pc_bytes_uncompressed_merge(const PCBYTES **pcbs, int npcbs)
+{
+	int i;
+	PCBYTES mpcb;
+	uint8_t *ptr;
+
+	mpcb.size = 0;
+	mpcb.npoints = 0;
+	mpcb.interpretation = pcbs[0]->interpretation;
+	mpcb.compression = PC_DIM_NONE;
+	mpcb.readonly = PC_FALSE;
+	mpcb.indexsize = 0;
+	for ( i = 0; i < npcbs; i++ )
+	{
+		mpcb.size += pcbs[i]->size;
+		mpcb.npoints += pcbs[i]->npoints;
+	}
+
+	ptr = mpcb.bytes = pcalloc(mpcb.size ? mpcb.size : 1);
+	for ( i = 0; i < npcbs; i++ )
+	{
+		memcpy(ptr, pcbs[i]->bytes, pcbs[i]->size);
+		ptr += pcbs[i]->size;
+	}
+	return mpcb;
+}
+
+static PCBYTES
+pc_bytes_decoded_merge(const PCBYTES **pcbs, int npcbs, uint32_t compression)
+{
+	int i;
+	PCBYTES mpcb, empcb;
+	PCBYTES *dpcbs = pcalloc(npcbs * sizeof(PCBYTES));
+	const PCBYTES **parts = pcalloc(npcbs * sizeof(PCBYTES*));
+
+	for ( i = 0; i < npcbs; i++ )
+	{
+		if ( pcbs[i]->compression == PC_DIM_NONE )
+		{
+			parts[i] = pcbs[i];
+			continue;
+		}
+		dpcbs[i] = pc_bytes_decode(*(pcbs[i]));
+		parts[i] = &(dpcbs[i]);
+	}
+
+	mpcb = pc_bytes_uncompressed_merge(parts, npcbs);
+
+	for ( i = 0; i < npcbs; i++ )
+	{
+		if ( parts[i] == &(dpcbs[i]) )
+			pc_bytes_free(dpcbs[i]);
+	}
+	pcfree(parts);
+	pcfree(dpcbs);
+
+	if ( compression == PC_DIM_NONE )
+		return mpcb;
+
+	empcb = pc_bytes_encode(mpcb, compression);
+	pc_bytes_free(mpcb);
+	return empcb;
+}
+
+static PCBYTES
+pc_bytes_run_length_merge(const PCBYTES **pcbs, int npcbs)
+{
+	int i;
+	size_t sz = pc_interpretation_size(pcbs[0]->interpretation);
+	PCBYTES mpcb;
+	uint8_t *ptr;
+	/* Last run written, where the next array may continue */
+	uint8_t *last = NULL;
+
+	mpcb.size = 0;
+	mpcb.npoints = 0;
+	mpcb.interpretation = pcbs[0]->interpretation;
+	mpcb.compression = PC_DIM_RLE;
+	mpcb.readonly = PC_FALSE;
+	mpcb.indexsize = 0;
+	for ( i = 0; i < npcbs; i++ )
+	{
+		mpcb.size += pcbs[i]->size;
+		mpcb.npoints += pcbs[i]->npoints;
+	}
+
+	ptr = mpcb.bytes = pcalloc(mpcb.size ? mpcb.size : 1);
+	for ( i = 0; i < npcbs; i++ )
+	{
+		const uint8_t *run = pcbs[i]->bytes;
+		const uint8_t *end = run + pcbs[i]->size;
+
+		/* Join runs of the same value across the boundary */
+		if ( last && run < end && *last + *run <= 255 && memcmp(last + 1, run + 1, sz) == 0 )
+		{
+			*last += *run;
+			run += sz + 1;
+		}
+
+		if ( run < end )
+		{
+			memcpy(ptr, run, end - run);
+			ptr += end - run;
+			last = ptr - (sz + 1);
+		}
+	}
+
+	mpcb.size = ptr - mpcb.bytes;
+	pc_bytes_run_length_index(&mpcb);
+	return mpcb;
+}
+
+#define PC_BYTES_SIGBITS_MERGE(N) \
+static PCBYTES \
+pc_bytes_sigbits_merge_##N(const PCBYTES **pcbs, int npcbs) \
+{ \
+	int i; \
+	const uint##N##_t *first = (const uint##N##_t*)(pcbs[0]->bytes); \
+	uint##N##_t nbits = first[0]; \
+	uint##N##_t commonvalue = first[1]; \
+	uint64_t pos = 0, totalbits = 0; \
+	size_t nwords; \
+	uint##N##_t *out; \
+	PCBYTES mpcb; \
+	\
+	/* Different common values need a new common value, so re-pack */ \
+	for ( i = 0; i < npcbs; i++ ) \
+	{ \
+		const uint##N##_t *words = (const uint##N##_t*)(pcbs[i]->bytes); \
+		if ( words[0] != nbits || words[1] != commonvalue ) \
+			return pc_bytes_decoded_merge(pcbs, npcbs, PC_DIM_SIGBITS); \
+		totalbits += (uint64_t)nbits * pcbs[i]->npoints; \
+	} \
+	\
+	/* Header, whole words and a trailing word, sized like the encoder */ \
+	nwords = 3 + totalbits / N; \
+	out = pcalloc(nwords * sizeof(uint##N##_t)); \
+	out[0] = nbits; \
+	out[1] = commonvalue; \
+	\
+	/* Append each stream behind the previous one, a word at a time */ \
+	for ( i = 0; i < npcbs; i++ ) \
+	{ \
+		const uint##N##_t *words = (const uint##N##_t*)(pcbs[i]->bytes) + 2; \
+		uint64_t nb = (uint64_t)nbits * pcbs[i]->npoints; \
+		while ( nb ) \
+		{ \
+			uint32_t take = nb < N ? nb : N; \
+			size_t idx = 2 + pos / N; \
+			uint32_t off = pos % N; \
+			uint##N##_t w = *words++; \
+			out[idx] |= (uint##N##_t)(w >> off); \
+			if ( off && off + take > N ) \
+				out[idx + 1] |= (uint##N##_t)(w << (N - off)); \
+			pos += take; \
+			nb -= take; \
+		} \
+	} \
+	\
+	mpcb = *(pcbs[0]); \
+	mpcb.bytes = (uint8_t*)out; \
+	mpcb.size = nwords * sizeof(uint##N##_t); \
+	mpcb.npoints = 0; \
+	for ( i = 0; i < npcbs; i++ ) \
+		mpcb.npoints += pcbs[i]->npoints; \
+	mpcb.readonly = PC_FALSE; \
+	return mpcb; \
+}
+
+PC_BYTES_SIGBITS_MERGE(8)
+PC_BYTES_SIGBITS_MERGE(16)
+PC_BYTES_SIGBITS_MERGE(32)
+PC_BYTES_SIGBITS_MERGE(64)
+
+static PCBYTES
+pc_bytes_sigbits_merge(const PCBYTES **pcbs, int npcbs)
+{
+	switch ( pc_interpretation_size(pcbs[0]->interpretation) )
+	{
+	case 1:
+		return pc_bytes_sigbits_merge_8(pcbs, npcbs);
+	case 2:
+		return pc_bytes_sigbits_merge_16(pcbs, npcbs);
+	case 4:
+		return pc_bytes_sigbits_merge_32(pcbs, npcbs);
+	case 8:
+		return pc_bytes_sigbits_merge_64(pcbs, npcbs);
+	default:
+		pcerror("%s: cannot handle interpretation %d", __func__, pcbs[0]->interpretation);
+	}
+	return *(pcbs[0]);
+}
+
+PCBYTES
+pc_bytes_merge(const PCBYTES **pcbs, int npcbs)
+{
+	int i;
+	uint32_t compression = pcbs[0]->compression;
+	uint32_t npoints[PC_DIM_NUM_COMPRESSIONS] = { 0 };
+
+	for ( i = 0; i < npcbs; i++ )
+	{
+		if ( pcbs[i]->compression >= PC_DIM_NUM_COMPRESSIONS )
+		{
+			pcerror("%s: unknown compression", __func__);
+			return *(pcbs[0]);
+		}
+		npoints[pcbs[i]->compression] += pcbs[i]->npoints;
+	}
+
+	for ( i = 0; i < npcbs; i++ )
+	{
+		if ( pcbs[i]->compression != compression )
+		{
+			/* Mixed inputs, use the compression that most points already have */
+			int c;
+			for ( c = 0; c < PC_DIM_NUM_COMPRESSIONS; c++ )
+			{
+				if ( npoints[c] > npoints[compression] )
+					compression = c;
+			}
+			return pc_bytes_decoded_merge(pcbs, npcbs, compression);
+		}
+	}
+
+	switch ( compression )
+	{
+	case PC_DIM_NONE:
+		return pc_bytes_uncompressed_merge(pcbs, npcbs);
+	case PC_DIM_RLE:
+		return pc_bytes_run_length_merge(pcbs, npcbs);
+	case PC_DIM_SIGBITS:
+		return pc_bytes_sigbits_merge(pcbs, npcbs);
+	case PC_DIM_ZLIB:
+		return pc_bytes_decoded_merge(pcbs, npcbs, pc_bytes_encoding(pcbs[0]));
+	case PC_DIM_ZSTD:
+	case PC_DIM_LZ4:
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
+		return pc_bytes_decoded_merge(pcbs, npcbs, compression);
+	default:
+		pcerror("%s: unknown compression", __func__);
+	}
+	return *(pcbs[0]);
+}
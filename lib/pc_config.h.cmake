@@ -6,6 +6,12 @@
 
 #cmakedefine HAVE_LAZPERF ${HAVE_LAZPERF}
 
+#cmakedefine HAVE_PTHREAD ${HAVE_PTHREAD}
+
+#cmakedefine HAVE_ZSTD ${HAVE_ZSTD}
+
+#cmakedefine HAVE_LZ4 ${HAVE_LZ4}
+
 #cmakedefine HAVE_CUNIT ${HAVE_CUNIT}
 
 #cmakedefine PROJECT_SOURCE_DIR "${PROJECT_SOURCE_DIR}"
@@ -0,0 +1,87 @@
+/***********************************************************************
+* pc_counters.c
+*
+*  Call, point and byte counts and wall-clock time of the costly
+*  operations of the library, kept only while counting is on.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <time.h>
+
+volatile int pc_counting = 0;
+
+static PCCOUNTER pc_counters[PC_NUM_OPS];
+
+static const char *COUNTER_NAMES[PC_NUM_OPS] =
+{
+	"encode none", "encode rle", "encode sigbits", "encode zlib",
+	"encode delta", "encode delta2", "encode zstd", "encode lz4",
+	"decode none", "decode rle", "decode sigbits", "decode zlib",
+	"decode delta", "decode delta2", "decode zstd", "decode lz4",
+	"encode lazperf", "decode lazperf",
+	"encode ght", "decode ght",
+	"filter", "sort", "stats",
+	"serialize", "deserialize",
+	"alloc"
+};
+
+const char *
+pc_counter_name(int op)
+{
+	if ( op >= 0 && op < PC_NUM_OPS )
+		return COUNTER_NAMES[op];
+	return "UNKNOWN";
+}
+
+void
+pc_counters_enable(int on)
+{
+	pc_counting = on ? 1 : 0;
+}
+
+void
+pc_counters_reset(void)
+{
+	memset(pc_counters, 0, sizeof(pc_counters));
+}
+
+int
+pc_counter_get(int op, PCCOUNTER *counter)
+{
+	if ( op < 0 || op >= PC_NUM_OPS )
+		return PC_FAILURE;
+	counter->calls = __sync_fetch_and_add(&(pc_counters[op].calls), 0);
+	counter->points = __sync_fetch_and_add(&(pc_counters[op].points), 0);
+	counter->bytesin = __sync_fetch_and_add(&(pc_counters[op].bytesin), 0);
+	counter->bytesout = __sync_fetch_and_add(&(pc_counters[op].bytesout), 0);
+	counter->nanos = __sync_fetch_and_add(&(pc_counters[op].nanos), 0);
+	return PC_SUCCESS;
+}
+
+uint64_t
+pc_counter_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	/* Never 0, which stands for not counting */
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec + 1;
+}
+
+/* Operations also run on the threads of the encoding pool */
+void
+pc_counter_add(int op, uint64_t start, uint64_t npoints, uint64_t bytesin, uint64_t bytesout)
+{
+	PCCOUNTER *c = pc_counters + op;
+	uint64_t now = start ? pc_counter_clock() : 0;
+
+	__sync_fetch_and_add(&(c->calls), 1);
+	__sync_fetch_and_add(&(c->points), npoints);
+	__sync_fetch_and_add(&(c->bytesin), bytesin);
+	__sync_fetch_and_add(&(c->bytesout), bytesout);
+	if ( now > start )
+		__sync_fetch_and_add(&(c->nanos), now - start);
+}
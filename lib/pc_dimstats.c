@@ -10,7 +10,14 @@
 *
 *  - run-length encoding
 *  - significant-bit removal
-*  - deflate
+*  - deflate, or zstd or lz4 when built with them
+*  - delta and delta-of-delta varints
+*
+*  The scheme is either estimated from the runs, common bits and
+*  delta sizes of the values, or picked off the actual results of
+*  encoding them with every scheme, when the stats are given a trial
+*  objective. Schemas can also set the scheme of a dimension, which
+*  then always wins.
 *
 *  PgSQL Pointcloud is free and open source software provided
 *  by the Government of Canada
@@ -20,6 +27,7 @@
 
 #include <stdarg.h>
 #include <assert.h>
+#include <time.h>
 #include "pc_api_internal.h"
 #include "stringbuffer.h"
 
@@ -46,7 +54,10 @@ typedef struct
 {
 	uint32_t total_runs;
 	uint32_t total_commonbits;
+	uint32_t total_deltabytes;
+	uint32_t total_delta2bytes;
 	uint32_t recommended_compression;
+	PCDIMTRIAL trials[PC_DIM_NUM_COMPRESSIONS];
 } PCDIMSTAT;
 
 typedef struct
@@ -54,6 +65,7 @@ typedef struct
 	int32_t ndims;
 	uint32_t total_points;
 	uint32_t total_patches;
+	PC_TRIAL_OBJECTIVE objective;
 	PCDIMSTAT *stats;
 } PCDIMSTATS;
 */
@@ -66,21 +78,42 @@ pc_dimstats_to_string(const PCDIMSTATS *pds)
 	char *str;
 
 	stringbuffer_aprintf(sb,
-		"{\"ndims\":%d,\"total_points\":%d,\"total_patches\":%d,\"dims\":[",
+		"{\"ndims\":%d,\"total_points\":%d,\"total_patches\":%d,",
 		pds->ndims,
 		pds->total_points,
 		pds->total_patches
 	);
+	if ( pds->objective != PC_TRIAL_NONE )
+		stringbuffer_aprintf(sb, "\"objective\":%d,", pds->objective);
+	stringbuffer_append(sb, "\"dims\":[");
 
 	for ( i = 0; i < pds->ndims; i++ )
 	{
 		if ( i ) stringbuffer_append(sb, ",");
 		stringbuffer_aprintf(sb,
-			"{\"total_runs\":%d,\"total_commonbits\":%d,\"recommended_compression\":%d}",
+			"{\"total_runs\":%d,\"total_commonbits\":%d,\"recommended_compression\":%d",
 			pds->stats[i].total_runs,
 			pds->stats[i].total_commonbits,
 			pds->stats[i].recommended_compression
 		);
+		if ( pds->objective != PC_TRIAL_NONE )
+		{
+			int c;
+			stringbuffer_append(sb, ",\"trials\":[");
+			for ( c = 0; c < PC_DIM_NUM_COMPRESSIONS; c++ )
+			{
+				const PCDIMTRIAL *trial = &(pds->stats[i].trials[c]);
+				if ( c ) stringbuffer_append(sb, ",");
+				stringbuffer_aprintf(sb,
+					"{\"size\":%llu,\"encode_time\":%g,\"decode_time\":%g}",
+					(unsigned long long)trial->size,
+					trial->encode_time,
+					trial->decode_time
+				);
+			}
+			stringbuffer_append(sb, "]");
+		}
+		stringbuffer_append(sb, "}");
 	}
 	stringbuffer_append(sb, "]}");
 
@@ -89,6 +122,88 @@ pc_dimstats_to_string(const PCDIMSTATS *pds)
 	return str;
 }
 
+/*
+* Encode and decode each dimension of the patch with every
+* compression, adding the sizes and times up in the stats.
+*/
+static void
+pc_dimstats_trial(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
+{
+	int i, c;
+
+	for ( i = 0; i < pds->ndims; i++ )
+	{
+		PCBYTES pcb = pdl->bytes[i];
+		if ( pc_schema_get_dimension(pdl->schema, i)->compression != PC_DIM_AUTO )
+			continue;
+		if ( pcb.compression != PC_DIM_NONE )
+			pcb = pc_bytes_decode(pcb);
+
+		for ( c = 0; c < PC_DIM_NUM_COMPRESSIONS; c++ )
+		{
+			PCDIMTRIAL *trial = &(pds->stats[i].trials[c]);
+			PCBYTES epcb, dpcb;
+			clock_t start;
+
+			if ( ! pc_bytes_compression_available(c) )
+				continue;
+
+			start = clock();
+
+			epcb = pc_bytes_encode(pcb, c);
+			trial->encode_time += (double)(clock() - start) / CLOCKS_PER_SEC;
+			trial->size += epcb.size + epcb.indexsize;
+
+			/* Uncompressed dimensions are read in place */
+			if ( c != PC_DIM_NONE )
+			{
+				start = clock();
+				dpcb = pc_bytes_decode(epcb);
+				trial->decode_time += (double)(clock() - start) / CLOCKS_PER_SEC;
+				pc_bytes_free(dpcb);
+			}
+			pc_bytes_free(epcb);
+		}
+
+		if ( pcb.bytes != pdl->bytes[i].bytes )
+			pc_bytes_free(pcb);
+	}
+}
+
+/*
+* The compression that did best for the objective in the
+* trials of a dimension. For speed, that is the fastest to
+* decode of those that make the dimension any smaller.
+*/
+static uint32_t
+pc_dimstat_trial_pick(const PCDIMSTAT *stat, PC_TRIAL_OBJECTIVE objective)
+{
+	int c;
+	uint32_t best = PC_DIM_NONE;
+	const PCDIMTRIAL *none = &(stat->trials[PC_DIM_NONE]);
+
+	for ( c = 0; c < PC_DIM_NUM_COMPRESSIONS; c++ )
+	{
+		const PCDIMTRIAL *trial = &(stat->trials[c]);
+		const PCDIMTRIAL *besttrial = &(stat->trials[best]);
+		if ( c == PC_DIM_NONE || ! pc_bytes_compression_available(c) )
+			continue;
+
+		if ( objective == PC_TRIAL_SIZE )
+		{
+			if ( trial->size < besttrial->size ||
+			     ( trial->size == besttrial->size && trial->decode_time < besttrial->decode_time ) )
+				best = c;
+		}
+		else if ( trial->size < none->size )
+		{
+			if ( best == PC_DIM_NONE || trial->decode_time < besttrial->decode_time )
+				best = c;
+		}
+	}
+	return best;
+}
+
 int
 pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
 {
@@ -105,6 +220,8 @@ pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
 		PCBYTES pcb = pdl->bytes[i];
 		pds->stats[i].total_runs += pc_bytes_run_count(&pcb);
 		pds->stats[i].total_commonbits += pc_bytes_sigbits_count(&pcb);
+		pds->stats[i].total_deltabytes += pc_bytes_delta_count(&pcb, 1);
+		pds->stats[i].total_delta2bytes += pc_bytes_delta_count(&pcb, 2);
 	}
 
 	/* Update recommended compression schema */
@@ -119,6 +236,9 @@ pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
 		double avg_commonbits_per_patch = pds->stats[i].total_commonbits / pds->total_patches;
 		double avg_uniquebits_per_patch = 8*dim->size - avg_commonbits_per_patch;
 		double sigbits_size = pds->total_patches * 2 * dim->size + pds->total_points * avg_uniquebits_per_patch / 8;
+		/* Delta size, the varints counted as is */
+		uint32_t delta = pds->stats[i].total_delta2bytes < pds->stats[i].total_deltabytes ? PC_DIM_DELTA2 : PC_DIM_DELTA;
+		double delta_size = delta == PC_DIM_DELTA2 ? pds->stats[i].total_delta2bytes : pds->stats[i].total_deltabytes;
 		/* Default to ZLib */
 		pds->stats[i].recommended_compression = PC_DIM_ZLIB;
 		/* Only use rle and sigbits compression on integer values */
@@ -136,6 +256,30 @@ pc_dimstats_update(PCDIMSTATS *pds, const PCPATCH_DIMENSIONAL *pdl)
 				pds->stats[i].recommended_compression = PC_DIM_RLE;
 			}
 		}
+		/* Deltas also have to do better than 4:1, and better than */
+		/* the others, which means 8-byte values, trials do the rest */
+		if ( dim->interpretation != PC_DOUBLE && dim->interpretation != PC_FLOAT &&
+		     raw_size/delta_size > 4.0 &&
+		     delta_size < sigbits_size && delta_size < rle_size )
+		{
+			pds->stats[i].recommended_compression = delta;
+		}
+	}
+
+	/* Go by the actual results, when asked for */
+	if ( pds->objective != PC_TRIAL_NONE )
+	{
+		pc_dimstats_trial(pds, pdl);
+		for ( i = 0; i < pds->ndims; i++ )
+			pds->stats[i].recommended_compression = pc_dimstat_trial_pick(&(pds->stats[i]), pds->objective);
+	}
+
+	/* The schema has the last word, as far as this build can follow */
+	for ( i = 0; i < pds->ndims; i++ )
+	{
+		int compression = pc_schema_get_dimension(schema, i)->compression;
+		if ( compression != PC_DIM_AUTO && pc_bytes_compression_available(compression) )
+			pds->stats[i].recommended_compression = compression;
 	}
 	return PC_SUCCESS;
 }
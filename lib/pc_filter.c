@@ -10,81 +10,186 @@
 #include "pc_api_internal.h"
 #include <assert.h>
 #include <float.h>
+#include <ctype.h>
+#include <math.h>
 
 
 PCBITMAP *
-pc_bitmap_new(uint32_t npoints)
+pc_bitmap_new_in(PCARENA *arena, uint32_t npoints)
 {
-	PCBITMAP *map = pcalloc(sizeof(PCBITMAP));
-	map->map = pcalloc(sizeof(uint8_t)*npoints);
+	uint32_t nwords = PC_BITMAP_NWORDS(npoints) ? PC_BITMAP_NWORDS(npoints) : 1;
+	size_t size = sizeof(PCBITMAP) + sizeof(uint64_t) * nwords;
+	PCBITMAP *map = arena ? pc_arena_alloc(arena, size) : pcalloc(size);
+	map->map = (uint64_t*)(map + 1);
 	map->npoints = npoints;
 	map->nset = 0;
+	map->inarena = arena != NULL;
 	return map;
 }
 
+PCBITMAP *
+pc_bitmap_new(uint32_t npoints)
+{
+	return pc_bitmap_new_in(NULL, npoints);
+}
+
 void
 pc_bitmap_free(PCBITMAP *map)
 {
-	if (map->map) pcfree(map->map);
-	pcfree(map);
+	if ( ! map->inarena )
+		pcfree(map);
 }
 
-static inline void
-pc_bitmap_set(PCBITMAP *map, int i, int val)
+void
+pc_bitmap_update_nset(PCBITMAP *map)
+{
+	uint32_t w, nwords = PC_BITMAP_NWORDS(map->npoints);
+	map->nset = 0;
+	for ( w = 0; w < nwords; w++ )
+		map->nset += pc_bitmap_popcount(map->map[w]);
+}
+
+/* Mask of the count (<= 64) bits starting at bit (<64) of a word */
+static inline uint64_t
+pc_bitmap_mask(uint32_t bit, uint32_t count)
+{
+	uint64_t mask = count >= 64 ? ~UINT64_C(0) : ((UINT64_C(1) << count) - 1);
+	return mask << bit;
+}
+
+void
+pc_bitmap_set_range(PCBITMAP *map, uint32_t first, uint32_t count)
 {
-	uint8_t curval = map->map[i];
-	if ( val && (!curval) )
-		map->nset++;
-	if ( (!val) && curval )
-		map->nset--;
+	assert(first + count <= map->npoints);
+	while ( count )
+	{
+		uint32_t w = first >> 6;
+		uint32_t bit = first & 63;
+		uint32_t n = 64 - bit < count ? 64 - bit : count;
+		uint64_t mask = pc_bitmap_mask(bit, n);
+		map->nset += pc_bitmap_popcount(mask & ~(map->map[w]));
+		map->map[w] |= mask;
+		first += n;
+		count -= n;
+	}
+}
+
+uint32_t
+pc_bitmap_count_range(const PCBITMAP *map, uint32_t first, uint32_t count)
+{
+	uint32_t nset = 0;
+	assert(first + count <= map->npoints);
+	while ( count )
+	{
+		uint32_t w = first >> 6;
+		uint32_t bit = first & 63;
+		uint32_t n = 64 - bit < count ? 64 - bit : count;
+		nset += pc_bitmap_popcount(map->map[w] & pc_bitmap_mask(bit, n));
+		first += n;
+		count -= n;
+	}
+	return nset;
+}
 
-	map->map[i] = (val!=0);
+void
+pc_bitmap_and(PCBITMAP *map, const PCBITMAP *other)
+{
+	uint32_t w, nwords = PC_BITMAP_NWORDS(map->npoints);
+	assert(map->npoints == other->npoints);
+	for ( w = 0; w < nwords; w++ )
+		map->map[w] &= other->map[w];
+	pc_bitmap_update_nset(map);
+}
+
+void
+pc_bitmap_or(PCBITMAP *map, const PCBITMAP *other)
+{
+	uint32_t w, nwords = PC_BITMAP_NWORDS(map->npoints);
+	assert(map->npoints == other->npoints);
+	for ( w = 0; w < nwords; w++ )
+		map->map[w] |= other->map[w];
+	pc_bitmap_update_nset(map);
 }
 
 void
-pc_bitmap_filter(PCBITMAP *map, PC_FILTERTYPE filter, int i, double d, double val1, double val2)
+pc_bitmap_not(PCBITMAP *map)
+{
+	uint32_t w, nwords = PC_BITMAP_NWORDS(map->npoints);
+	for ( w = 0; w < nwords; w++ )
+		map->map[w] = ~(map->map[w]);
+	/* Keep the bits past npoints clear */
+	if ( map->npoints & 63 )
+		map->map[nwords-1] &= pc_bitmap_mask(0, map->npoints & 63);
+	map->nset = map->npoints - map->nset;
+}
+
+int
+pc_filter_range(PC_FILTERTYPE filter, double val1, double val2, double *lo, double *hi)
 {
+	/* Strict bounds move to the next representable double */
 	switch ( filter )
 	{
 	case PC_GT:
-		pc_bitmap_set(map, i, (d > val1 ? 1 : 0));
-		break;
+		*lo = nextafter(val1, INFINITY);
+		*hi = INFINITY;
+		return val1 != INFINITY;
 	case PC_LT:
-		pc_bitmap_set(map, i, (d < val1 ? 1 : 0));
-		break;
+		*lo = -INFINITY;
+		*hi = nextafter(val1, -INFINITY);
+		return val1 != -INFINITY;
 	case PC_EQUAL:
-		pc_bitmap_set(map, i, (d == val1 ? 1 : 0));
-		break;
+		*lo = *hi = val1;
+		return PC_TRUE;
 	case PC_BETWEEN:
-		pc_bitmap_set(map, i, (d > val1 && d < val2 ? 1 : 0));
-		break;
+		*lo = nextafter(val1, INFINITY);
+		*hi = nextafter(val2, -INFINITY);
+		return val1 != INFINITY && val2 != -INFINITY;
 	}
+	return PC_FALSE;
 }
 
-static PCBITMAP *
-pc_patch_uncompressed_bitmap(const PCPATCH_UNCOMPRESSED *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+void
+pc_bitmap_filter_values(PCBITMAP *map, PC_FILTERTYPE filter, double val1, double val2, const uint8_t *bytes, size_t stride, uint32_t interpretation, double scale, double offset)
 {
-	PCPOINT pt;
-	uint32_t i = 0;
-	uint8_t *buf = pa->data;
-	double d;
-	size_t sz = pa->schema->size;
-	PCBITMAP *map = pc_bitmap_new(pa->npoints);
+	double lo, hi;
+	double vals[64];
+	uint64_t *words = map->map;
+	uint32_t npoints = map->npoints;
+	uint32_t w, i, nwords = PC_BITMAP_NWORDS(npoints);
 
-	pt.readonly = PC_TRUE;
-	pt.schema = pa->schema;
+	if ( ! pc_filter_range(filter, val1, val2, &lo, &hi) )
+	{
+		memset(words, 0, sizeof(uint64_t) * PC_BITMAP_NWORDS(npoints));
+		map->nset = 0;
+		return;
+	}
 
-	while ( i < pa->npoints )
+	/* Convert the 64 values behind each word, then compare them branch free */
+	for ( w = 0; w < nwords; w++ )
 	{
-		pt.data = buf;
-		pc_point_get_double(&pt, pa->schema->dims[dimnum], &d);
-		/* Apply the filter to the bitmap */
-		pc_bitmap_filter(map, filter, i, d, val1, val2);
-		/* Advance data pointer and counter */
-		buf += sz;
-		i++;
+		uint32_t n = ( w + 1 == nwords ) ? npoints - w * 64 : 64;
+		uint64_t bits = 0;
+		if ( PC_FAILURE == pc_values_to_double(bytes, stride, interpretation, scale, offset, n, vals) )
+			return;
+		for ( i = 0; i < n; i++ )
+			bits |= (uint64_t)((vals[i] >= lo) & (vals[i] <= hi)) << i;
+		words[w] = bits;
+		bytes += n * stride;
 	}
 
+	pc_bitmap_update_nset(map);
+}
+
+static PCBITMAP *
+pc_patch_uncompressed_bitmap(PCARENA *arena, const PCPATCH_UNCOMPRESSED *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+{
+	PCDIMENSION *dim = pa->schema->dims[dimnum];
+	PCBITMAP *map = pc_bitmap_new_in(arena, pa->npoints);
+
+	pc_bitmap_filter_values(map, filter, val1, val2,
+		pa->data + dim->byteoffset, pa->schema->size,
+		dim->interpretation, dim->scale, dim->offset);
+
 	return map;
 }
 
@@ -92,33 +197,37 @@ pc_patch_uncompressed_bitmap(const PCPATCH_UNCOMPRESSED *pa, uint32_t dimnum, PC
 static PCPATCH_UNCOMPRESSED *
 pc_patch_uncompressed_filter(const PCPATCH_UNCOMPRESSED *pu, const PCBITMAP *map)
 {
-	int i = 0;
+	uint32_t w, nwords = PC_BITMAP_NWORDS(pu->npoints);
 	size_t sz = pu->schema->size;
 	PCPATCH_UNCOMPRESSED *fpu = pc_patch_uncompressed_make(pu->schema, map->nset);
-	uint8_t *buf = pu->data;
 	uint8_t *fbuf = fpu->data;
 
 	assert(map->npoints == pu->npoints);
 
-	while ( i < pu->npoints )
+	for ( w = 0; w < nwords; w++ )
 	{
-		if ( pc_bitmap_get(map, i) )
+		uint64_t bits = map->map[w];
+		const uint8_t *buf = pu->data + (size_t)w * 64 * sz;
+
+		/* Whole words of survivors are copied in one go */
+		if ( bits == ~UINT64_C(0) )
+		{
+			memcpy(fbuf, buf, 64 * sz);
+			fbuf += 64 * sz;
+			continue;
+		}
+
+		while ( bits )
 		{
-			memcpy(fbuf, buf, sz);
+			memcpy(fbuf, buf + pc_bitmap_ctz(bits) * sz, sz);
 			fbuf += sz;
+			bits &= bits - 1;
 		}
-		buf += sz;
-		i++;
 	}
 
 	fpu->maxpoints = fpu->npoints = map->nset;
 
-	if ( PC_FAILURE == pc_patch_uncompressed_compute_extent(fpu) )
-	{
-		pcerror("%s: failed to compute patch extent", __func__);
-		return NULL;
-	}
-
+	/* Sets the extent too */
 	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(fpu) )
 	{
 		pcerror("%s: failed to compute patch stats", __func__);
@@ -131,13 +240,13 @@ pc_patch_uncompressed_filter(const PCPATCH_UNCOMPRESSED *pu, const PCBITMAP *map
 
 
 static PCBITMAP *
-pc_patch_dimensional_bitmap(const PCPATCH_DIMENSIONAL *pdl, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+pc_patch_dimensional_bitmap(PCARENA *arena, const PCPATCH_DIMENSIONAL *pdl, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
 {
 	assert(dimnum < pdl->schema->ndims);
 	double unscaled1 = pc_value_unscale_unoffset(val1, pdl->schema->dims[dimnum]);
 	double unscaled2 = pc_value_unscale_unoffset(val2, pdl->schema->dims[dimnum]);
 
-	return pc_bytes_bitmap(&(pdl->bytes[dimnum]), filter, unscaled1, unscaled2);
+	return pc_bytes_bitmap(&(pdl->bytes[dimnum]), filter, unscaled1, unscaled2, arena);
 }
 
 static PCPATCH_DIMENSIONAL *
@@ -218,12 +327,150 @@ pc_patch_filter_has_results(const PCSTATS *stats, uint32_t dimnum, PC_FILTERTYPE
 	return PC_TRUE;
 }
 
+/* See if the stats say every point of the patch passes the filter */
+static int
+pc_patch_filter_all_results(const PCSTATS *stats, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+{
+	double min, max;
+	pc_point_get_double_by_index(&(stats->min), dimnum, &min);
+	pc_point_get_double_by_index(&(stats->max), dimnum, &max);
+	switch ( filter )
+	{
+		case PC_GT:
+			return min > val1;
+		case PC_LT:
+			return max < val1;
+		case PC_EQUAL:
+			return min == val1 && max == val1;
+		case PC_BETWEEN:
+			return min > val1 && max < val2;
+	}
+	return PC_FALSE;
+}
+
+/* Scaled value of the n-th point, read in place or off sigbits */
+static double
+pc_sorted_value(const uint8_t *bytes, size_t stride, const PCBYTES *sigbits, const PCDIMENSION *dim, uint32_t n)
+{
+	uint8_t buf[8];
+	if ( sigbits )
+	{
+		pc_bytes_sigbits_to_ptr(buf, *sigbits, n);
+		bytes = buf;
+	}
+	else
+	{
+		bytes += (size_t)n * stride;
+	}
+	return pc_value_scale_offset(pc_double_from_ptr(bytes, dim->interpretation), dim);
+}
 
-PCPATCH *
-pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+/* First of npoints ascending values that is >= val, or > val when after is set */
+static uint32_t
+pc_sorted_search(const uint8_t *bytes, size_t stride, const PCBYTES *sigbits, const PCDIMENSION *dim, uint32_t npoints, double val, int after)
+{
+	uint32_t first = 0, count = npoints;
+	while ( count )
+	{
+		uint32_t half = count / 2;
+		double v = pc_sorted_value(bytes, stride, sigbits, dim, first + half);
+		if ( after ? v <= val : v < val )
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+		{
+			count = half;
+		}
+	}
+	return first;
+}
+
+/*
+* Points sorted by the filtered dimension pass the filter as one run,
+* found by binary search. Uncompressed points are copied in one go,
+* dimensional patches keep their compression. Sigbits keys are read
+* in place, other compressed keys are decoded for the search only.
+*/
+static PCPATCH *
+pc_patch_filter_sorted(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+{
+	const PCDIMENSION *dim = pa->schema->dims[dimnum];
+	const PCBYTES *sigbits = NULL;
+	const uint8_t *bytes;
+	size_t stride;
+	PCBYTES pcb;
+	int owned = PC_FALSE;
+	uint32_t first, last;
+	double lo, hi;
+	PCPATCH *paout;
+
+	if ( ! pc_filter_range(filter, val1, val2, &lo, &hi) || lo > hi )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	if ( pa->type == PC_NONE )
+	{
+		bytes = ((PCPATCH_UNCOMPRESSED*)pa)->data + dim->byteoffset;
+		stride = pa->schema->size;
+	}
+	else
+	{
+		pcb = ((PCPATCH_DIMENSIONAL*)pa)->bytes[dimnum];
+		if ( pcb.compression == PC_DIM_SIGBITS )
+		{
+			sigbits = &(((PCPATCH_DIMENSIONAL*)pa)->bytes[dimnum]);
+		}
+		else if ( pcb.compression != PC_DIM_NONE )
+		{
+			pcb = pc_bytes_decode(pcb);
+			owned = PC_TRUE;
+		}
+		bytes = pcb.bytes;
+		stride = dim->size;
+	}
+
+	first = pc_sorted_search(bytes, stride, sigbits, dim, pa->npoints, lo, PC_FALSE);
+	last = pc_sorted_search(bytes, stride, sigbits, dim, pa->npoints, hi, PC_TRUE);
+	if ( owned )
+		pc_bytes_free(pcb);
+
+	if ( last <= first )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	if ( pa->type == PC_NONE )
+	{
+		size_t sz = pa->schema->size;
+		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_make(pa->schema, last - first);
+		memcpy(pu->data, ((PCPATCH_UNCOMPRESSED*)pa)->data + first * sz, (last - first) * sz);
+		pu->npoints = last - first;
+		if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(pu) )
+		{
+			pcerror("%s: failed to compute patch extent and stats", __func__);
+			return NULL;
+		}
+		paout = (PCPATCH*)pu;
+	}
+	else
+	{
+		PCARENA arena;
+		PCBITMAP *map;
+		pc_arena_begin(&arena);
+		map = pc_bitmap_new_in(&arena, pa->npoints);
+		pc_bitmap_set_range(map, first, last - first);
+		paout = (PCPATCH*)pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pa, map);
+		pc_arena_end(&arena);
+	}
+
+	return paout;
+}
+
+
+static PCPATCH *
+pc_patch_filter_run(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
 {
-	if ( ! pa ) return NULL;
 	PCPATCH *paout;
+	PCARENA arena;
 
 	/* If the stats say this filter returns an empty result, do that */
 	if ( pa->stats && ! pc_patch_filter_has_results(pa->stats, dimnum, filter, val1, val2) )
@@ -233,27 +480,44 @@ pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double
 		return paout;
 	}
 
+	/* Points sorted by the filtered dimension need no scan */
+	if ( pa->sortdim == dimnum + 1 && pa->schema->dims[dimnum]->scale > 0 &&
+	     ( pa->type == PC_NONE || pa->type == PC_DIMENSIONAL ) )
+	{
+		paout = pc_patch_filter_sorted(pa, dimnum, filter, val1, val2);
+		if ( paout && paout->npoints )
+			paout->sortdim = pa->sortdim;
+		return paout;
+	}
+
+	/* The bitmaps only live for the filter */
+	pc_arena_begin(&arena);
+
 	switch ( pa->type )
 	{
 	case PC_NONE:
 	{
-		PCBITMAP *map = pc_patch_uncompressed_bitmap((PCPATCH_UNCOMPRESSED*)pa, dimnum, filter, val1, val2);
-		PCPATCH_UNCOMPRESSED *pu;
+		PCBITMAP *map = pc_patch_uncompressed_bitmap(&arena, (PCPATCH_UNCOMPRESSED*)pa, dimnum, filter, val1, val2);
 		if ( map->nset == 0 )
 		{
-			pc_bitmap_free(map);
-			return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+			paout = (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+			break;
 		}
-		pu = pc_patch_uncompressed_filter((PCPATCH_UNCOMPRESSED*)pa, map);
-		pc_bitmap_free(map);
 		/* pc_patch_uncompressed_filter computes stats and bounds, so we're ready to return here */
 		/* TODO, it could/should compute bounds and stats while filtering the points */
-		paout = (PCPATCH*)pu;
+		paout = (PCPATCH*)pc_patch_uncompressed_filter((PCPATCH_UNCOMPRESSED*)pa, map);
 		break;
 	}
 	case PC_GHT:
 	{
-		PCPATCH_GHT *pgh = pc_patch_ght_filter((PCPATCH_GHT*)pa, dimnum, filter, val1, val2);
+		PCPATCH_GHT *pgh;
+		/* A filter keeping every point needs no tree built */
+		if ( pa->stats && pc_patch_filter_all_results(pa->stats, dimnum, filter, val1, val2) )
+		{
+			paout = (PCPATCH*)pc_patch_ght_clone((PCPATCH_GHT*)pa);
+			break;
+		}
+		pgh = pc_patch_ght_filter((PCPATCH_GHT*)pa, dimnum, filter, val1, val2);
 		/* pc_patch_ght_filter computes the bounds itself */
 		/* TODO: add stats computation to pc_patch_ght_filter */
 		/* pc_patch_ght_filter is just re-using the input stats, which is wrong */
@@ -262,48 +526,57 @@ pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double
 	}
 	case PC_DIMENSIONAL:
 	{
-		PCBITMAP *map = pc_patch_dimensional_bitmap((PCPATCH_DIMENSIONAL*)pa, dimnum, filter, val1, val2);
-		PCPATCH_DIMENSIONAL *pdl;
+		PCBITMAP *map = pc_patch_dimensional_bitmap(&arena, (PCPATCH_DIMENSIONAL*)pa, dimnum, filter, val1, val2);
 		if ( map->nset == 0 )
 		{
-			pc_bitmap_free(map);
-			return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+			paout = (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+			break;
 		}
-		pdl = pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pa, map);
-		pc_bitmap_free(map);
 		/* pc_patch_dimensional_filter computes both stats and bounds, so we're done*/
-		paout = (PCPATCH*)pdl;
+		paout = (PCPATCH*)pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pa, map);
 		break;
 	}
 	case PC_LAZPERF:
 	{
 		PCBITMAP *map;
-		PCPATCH_UNCOMPRESSED *pu;
 		PCPATCH_UNCOMPRESSED *pau;
 
 		pau = pc_patch_uncompressed_from_lazperf( (PCPATCH_LAZPERF*) pa );
-		map = pc_patch_uncompressed_bitmap(pau, dimnum, filter, val1, val2);
+		map = pc_patch_uncompressed_bitmap(&arena, pau, dimnum, filter, val1, val2);
 		if ( map->nset == 0 )
-		{
-			pc_bitmap_free(map);
-			pc_patch_free((PCPATCH*) pau);
-			return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
-		}
-
-		pu = pc_patch_uncompressed_filter(pau, map);
-		pc_bitmap_free(map);
+			paout = (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+		else
+			paout = (PCPATCH*)pc_patch_uncompressed_filter(pau, map);
 		pc_patch_free((PCPATCH*) pau);
 		/* pc_patch_uncompressed_filter computes stats and bounds, so we're ready to return here */
 		/* TODO, it could/should compute bounds and stats while filtering the points */
-		paout = (PCPATCH*)pu;
-
 		break;
 	}
 	default:
+		pc_arena_end(&arena);
 		pcerror("%s: failure", __func__);
 		return NULL;
 	}
 
+	pc_arena_end(&arena);
+
+	/* Filtering keeps the order of the points, trees have their own */
+	if ( paout && paout->npoints && paout->type != PC_GHT )
+		paout->sortdim = pa->sortdim;
+
+	return paout;
+}
+
+PCPATCH *
+pc_patch_filter(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+{
+	PCPATCH *paout;
+	PC_COUNTER_START(t0);
+
+	if ( ! pa ) return NULL;
+	paout = pc_patch_filter_run(pa, dimnum, filter, val1, val2);
+	if ( paout )
+		PC_COUNTER_STOP(PC_OP_FILTER, t0, pa->npoints, pa->npoints * pa->schema->size, paout->npoints * pa->schema->size);
 	return paout;
 }
 
@@ -353,3 +626,1298 @@ pc_patch_filter_between_by_name(const PCPATCH *pa, const char *name, double val1
 
 	return pc_patch_filter(pa, d->position, PC_BETWEEN, val1, val2);
 }
+
+
+/****************************************************************************
+* FILTER EXPRESSIONS
+*/
+
+#define PC_FILTER_NONE 0
+#define PC_FILTER_SOME 1
+#define PC_FILTER_ALL  2
+
+static PCBITMAP *
+pc_bitmap_new_full(PCARENA *arena, uint32_t npoints)
+{
+	PCBITMAP *map = pc_bitmap_new_in(arena, npoints);
+	pc_bitmap_set_range(map, 0, npoints);
+	return map;
+}
+
+static int
+pc_filterexpr_clause_stats(const PCSTATS *stats, const PCFILTEREXPR *expr)
+{
+	if ( ! stats )
+		return PC_FILTER_SOME;
+	if ( ! pc_patch_filter_has_results(stats, expr->dimnum, expr->filter, expr->val1, expr->val2) )
+		return PC_FILTER_NONE;
+	if ( pc_patch_filter_all_results(stats, expr->dimnum, expr->filter, expr->val1, expr->val2) )
+		return PC_FILTER_ALL;
+	return PC_FILTER_SOME;
+}
+
+static int
+pc_filterexpr_invert(int rv)
+{
+	if ( rv == PC_FILTER_NONE ) return PC_FILTER_ALL;
+	if ( rv == PC_FILTER_ALL ) return PC_FILTER_NONE;
+	return rv;
+}
+
+/* What the stats alone can say about the expression */
+static int
+pc_filterexpr_stats(const PCSTATS *stats, const PCFILTEREXPR *expr)
+{
+	uint32_t i;
+	int nall = 0, nnone = 0;
+
+	if ( expr->type == PC_FILTEREXPR_CLAUSE )
+		return pc_filterexpr_clause_stats(stats, expr);
+
+	if ( expr->type == PC_FILTEREXPR_NOT )
+		return pc_filterexpr_invert(pc_filterexpr_stats(stats, expr->args[0]));
+
+	for ( i = 0; i < expr->nargs; i++ )
+	{
+		int rv = pc_filterexpr_stats(stats, expr->args[i]);
+		if ( rv == PC_FILTER_ALL ) nall++;
+		if ( rv == PC_FILTER_NONE ) nnone++;
+	}
+
+	if ( expr->type == PC_FILTEREXPR_AND )
+	{
+		if ( nnone ) return PC_FILTER_NONE;
+		if ( nall == expr->nargs ) return PC_FILTER_ALL;
+	}
+	else
+	{
+		if ( nall ) return PC_FILTER_ALL;
+		if ( nnone == expr->nargs ) return PC_FILTER_NONE;
+	}
+	return PC_FILTER_SOME;
+}
+
+/*
+* Evaluate the expression over an uncompressed or dimensional patch.
+* Returns PC_FILTER_NONE or PC_FILTER_ALL when no bitmap is needed,
+* otherwise PC_FILTER_SOME with the selected points in *map, taken
+* from the arena like all the bitmaps along the way.
+*/
+static int
+pc_filterexpr_eval(PCARENA *arena, const PCPATCH *pa, const PCSTATS *stats, const PCFILTEREXPR *expr, PCBITMAP **map)
+{
+	PCBITMAP *acc = NULL;
+	uint32_t i;
+
+	*map = NULL;
+
+	if ( expr->type == PC_FILTEREXPR_CLAUSE )
+	{
+		int rv = pc_filterexpr_clause_stats(stats, expr);
+		if ( rv != PC_FILTER_SOME )
+			return rv;
+
+		if ( pa->type == PC_DIMENSIONAL )
+			acc = pc_patch_dimensional_bitmap(arena, (PCPATCH_DIMENSIONAL*)pa, expr->dimnum, expr->filter, expr->val1, expr->val2);
+		else
+			acc = pc_patch_uncompressed_bitmap(arena, (PCPATCH_UNCOMPRESSED*)pa, expr->dimnum, expr->filter, expr->val1, expr->val2);
+
+		if ( acc->nset == 0 || acc->nset == acc->npoints )
+			return acc->nset ? PC_FILTER_ALL : PC_FILTER_NONE;
+		*map = acc;
+		return PC_FILTER_SOME;
+	}
+
+	if ( expr->type == PC_FILTEREXPR_NOT )
+	{
+		int rv = pc_filterexpr_eval(arena, pa, stats, expr->args[0], map);
+		if ( rv == PC_FILTER_SOME )
+			pc_bitmap_not(*map);
+		return pc_filterexpr_invert(rv);
+	}
+
+	/* Settle the whole node from the stats before building any bitmap */
+	if ( stats )
+	{
+		int rv = pc_filterexpr_stats(stats, expr);
+		if ( rv != PC_FILTER_SOME )
+			return rv;
+	}
+
+	for ( i = 0; i < expr->nargs; i++ )
+	{
+		PCBITMAP *argmap;
+		int rv = pc_filterexpr_eval(arena, pa, stats, expr->args[i], &argmap);
+
+		if ( expr->type == PC_FILTEREXPR_AND )
+		{
+			if ( rv == PC_FILTER_ALL )
+				continue;
+			if ( rv == PC_FILTER_NONE )
+				return PC_FILTER_NONE;
+		}
+		else
+		{
+			if ( rv == PC_FILTER_NONE )
+				continue;
+			if ( rv == PC_FILTER_ALL )
+				return PC_FILTER_ALL;
+		}
+
+		if ( ! acc )
+		{
+			acc = argmap;
+			continue;
+		}
+
+		if ( expr->type == PC_FILTEREXPR_AND )
+			pc_bitmap_and(acc, argmap);
+		else
+			pc_bitmap_or(acc, argmap);
+
+		/* No later argument can change a settled result */
+		if ( acc->nset == 0 || acc->nset == acc->npoints )
+			return acc->nset ? PC_FILTER_ALL : PC_FILTER_NONE;
+	}
+
+	/* Every argument was settled by the stats */
+	if ( ! acc )
+		return expr->type == PC_FILTEREXPR_AND ? PC_FILTER_ALL : PC_FILTER_NONE;
+
+	*map = acc;
+	return PC_FILTER_SOME;
+}
+
+/**
+* True when the stats alone show every point of the patch passes
+* the expression, so callers can use the patch itself as the result.
+*/
+int
+pc_patch_filter_expr_keeps_all(const PCPATCH *pa, const PCFILTEREXPR *expr)
+{
+	return pa->stats && pc_filterexpr_stats(pa->stats, expr) == PC_FILTER_ALL;
+}
+
+/**
+* True when the stats alone show every point of the patch passes
+* the dimension filter.
+*/
+int
+pc_patch_filter_keeps_all(const PCPATCH *pa, uint32_t dimnum, PC_FILTERTYPE filter, double val1, double val2)
+{
+	return pa->stats && pc_patch_filter_all_results(pa->stats, dimnum, filter, val1, val2);
+}
+
+static PCPATCH *
+pc_patch_filter_expr_run(const PCPATCH *pa, const PCFILTEREXPR *expr)
+{
+	PCPATCH *pu = NULL;
+	const PCPATCH *pf = pa;
+	PCPATCH *paout;
+	PCBITMAP *map;
+	PCARENA arena;
+	int rv;
+
+	if ( ! ( pa && expr ) ) return NULL;
+
+	/* If the stats say this filter returns an empty result, do that */
+	if ( pa->stats && pc_filterexpr_stats(pa->stats, expr) == PC_FILTER_NONE )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	/* GHT and LAZPERF have no per-dimension bitmaps, filter them uncompressed */
+	if ( pa->type == PC_GHT || pa->type == PC_LAZPERF )
+	{
+		pu = pc_patch_uncompress(pa);
+		if ( ! pu ) return NULL;
+		pf = pu;
+	}
+	else if ( pa->type != PC_NONE && pa->type != PC_DIMENSIONAL )
+	{
+		pcerror("%s: unknown patch compression %d", __func__, pa->type);
+		return NULL;
+	}
+
+	/* All the bitmaps of the evaluation go at once */
+	pc_arena_begin(&arena);
+	rv = pc_filterexpr_eval(&arena, pf, pa->stats, expr, &map);
+
+	if ( rv == PC_FILTER_NONE )
+	{
+		pc_arena_end(&arena);
+		if ( pu ) pc_patch_free(pu);
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+	}
+
+	/* Every point passes, still materialize a copy the caller can free */
+	if ( rv == PC_FILTER_ALL )
+		map = pc_bitmap_new_full(&arena, pf->npoints);
+
+	if ( pf->type == PC_DIMENSIONAL )
+		paout = (PCPATCH*)pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pf, map);
+	else
+		paout = (PCPATCH*)pc_patch_uncompressed_filter((PCPATCH_UNCOMPRESSED*)pf, map);
+
+	pc_arena_end(&arena);
+	if ( pu ) pc_patch_free(pu);
+	return paout;
+}
+
+PCPATCH *
+pc_patch_filter_expr(const PCPATCH *pa, const PCFILTEREXPR *expr)
+{
+	PCPATCH *paout;
+	PC_COUNTER_START(t0);
+
+	if ( ! ( pa && expr ) ) return NULL;
+	paout = pc_patch_filter_expr_run(pa, expr);
+	if ( paout )
+		PC_COUNTER_STOP(PC_OP_FILTER, t0, pa->npoints, pa->npoints * pa->schema->size, paout->npoints * pa->schema->size);
+	return paout;
+}
+
+PCPATCH *
+pc_patch_filter_by_expression(const PCPATCH *pa, const char *str)
+{
+	PCFILTEREXPR *expr;
+	PCPATCH *paout;
+
+	if ( ! pa ) return NULL;
+
+	expr = pc_filterexpr_parse(pa->schema, str);
+	if ( ! expr ) return NULL;
+
+	paout = pc_patch_filter_expr(pa, expr);
+	pc_filterexpr_free(expr);
+	return paout;
+}
+
+void
+pc_filterexpr_free(PCFILTEREXPR *expr)
+{
+	uint32_t i;
+	if ( ! expr ) return;
+	for ( i = 0; i < expr->nargs; i++ )
+		pc_filterexpr_free(expr->args[i]);
+	if ( expr->args ) pcfree(expr->args);
+	pcfree(expr);
+}
+
+/*
+* Recursive descent parser for
+*
+*   expr   := term { OR term }
+*   term   := factor { AND factor }
+*   factor := NOT factor
+*           | '(' expr ')'
+*           | name ( '<' | '>' | '=' ) number
+*           | name BETWEEN number AND number
+*
+* Keywords and names are case insensitive, names that are not
+* plain words can be double quoted.
+*/
+typedef struct
+{
+	const PCSCHEMA *schema;
+	const char *str;
+	const char *cur;
+} PCFILTERPARSER;
+
+static PCFILTEREXPR* pc_filterexpr_parse_expr(PCFILTERPARSER *p);
+
+static void
+pc_filterexpr_error(const PCFILTERPARSER *p, const char *msg)
+{
+	pcerror("pc_filterexpr_parse: %s at character %d of \"%s\"", msg, (int)(p->cur - p->str) + 1, p->str);
+}
+
+static void
+pc_filterexpr_skip_space(PCFILTERPARSER *p)
+{
+	while ( isspace((unsigned char)*(p->cur)) )
+		p->cur++;
+}
+
+static int
+pc_filterexpr_is_namechar(char c)
+{
+	return isalnum((unsigned char)c) || c == '_';
+}
+
+/* Consume the keyword if it is next in the input */
+static int
+pc_filterexpr_keyword(PCFILTERPARSER *p, const char *kw)
+{
+	size_t len = strlen(kw);
+	pc_filterexpr_skip_space(p);
+	if ( strncasecmp(p->cur, kw, len) || pc_filterexpr_is_namechar(p->cur[len]) )
+		return PC_FALSE;
+	p->cur += len;
+	return PC_TRUE;
+}
+
+static int
+pc_filterexpr_number(PCFILTERPARSER *p, double *d)
+{
+	char *end;
+	pc_filterexpr_skip_space(p);
+	*d = strtod(p->cur, &end);
+	if ( end == p->cur )
+	{
+		pc_filterexpr_error(p, "expected a number");
+		return PC_FAILURE;
+	}
+	p->cur = end;
+	return PC_SUCCESS;
+}
+
+static PCFILTEREXPR *
+pc_filterexpr_new(PC_FILTEREXPR_TYPE type)
+{
+	PCFILTEREXPR *expr = pcalloc(sizeof(PCFILTEREXPR));
+	expr->type = type;
+	return expr;
+}
+
+static void
+pc_filterexpr_add_arg(PCFILTEREXPR *expr, PCFILTEREXPR *arg)
+{
+	expr->args = pcrealloc(expr->args, (expr->nargs + 1) * sizeof(PCFILTEREXPR*));
+	expr->args[expr->nargs++] = arg;
+}
+
+static PCFILTEREXPR *
+pc_filterexpr_parse_clause(PCFILTERPARSER *p)
+{
+	const char *start;
+	char *name;
+	size_t len;
+	PCDIMENSION *dim;
+	PCFILTEREXPR *expr;
+
+	/* Dimension name, either a bare word or double quoted */
+	pc_filterexpr_skip_space(p);
+	if ( *(p->cur) == '"' )
+	{
+		start = ++(p->cur);
+		while ( *(p->cur) && *(p->cur) != '"' )
+			p->cur++;
+		if ( ! *(p->cur) )
+		{
+			pc_filterexpr_error(p, "unterminated quoted name");
+			return NULL;
+		}
+		len = p->cur - start;
+		p->cur++;
+	}
+	else
+	{
+		start = p->cur;
+		while ( pc_filterexpr_is_namechar(*(p->cur)) )
+			p->cur++;
+		len = p->cur - start;
+		if ( ! len )
+		{
+			pc_filterexpr_error(p, "expected a dimension name");
+			return NULL;
+		}
+	}
+
+	name = pcalloc(len + 1);
+	memcpy(name, start, len);
+	dim = pc_schema_get_dimension_by_name(p->schema, name);
+	if ( ! dim )
+	{
+		pcerror("pc_filterexpr_parse: dimension \"%s\" does not exist", name);
+		pcfree(name);
+		return NULL;
+	}
+	pcfree(name);
+
+	expr = pc_filterexpr_new(PC_FILTEREXPR_CLAUSE);
+	expr->dimnum = dim->position;
+
+	if ( pc_filterexpr_keyword(p, "BETWEEN") )
+	{
+		expr->filter = PC_BETWEEN;
+		if ( PC_FAILURE == pc_filterexpr_number(p, &(expr->val1)) )
+			goto fail;
+		if ( ! pc_filterexpr_keyword(p, "AND") )
+		{
+			pc_filterexpr_error(p, "expected AND");
+			goto fail;
+		}
+		if ( PC_FAILURE == pc_filterexpr_number(p, &(expr->val2)) )
+			goto fail;
+		/* Ensure val1 < val2 always */
+		if ( expr->val1 > expr->val2 )
+		{
+			double tmp = expr->val1;
+			expr->val1 = expr->val2;
+			expr->val2 = tmp;
+		}
+		return expr;
+	}
+
+	pc_filterexpr_skip_space(p);
+	switch ( *(p->cur) )
+	{
+	case '<':
+		expr->filter = PC_LT;
+		break;
+	case '>':
+		expr->filter = PC_GT;
+		break;
+	case '=':
+		expr->filter = PC_EQUAL;
+		break;
+	default:
+		pc_filterexpr_error(p, "expected <, >, = or BETWEEN");
+		goto fail;
+	}
+	p->cur++;
+
+	/* PC_FILTERTYPE has no inclusive or negated comparisons */
+	if ( *(p->cur) == '=' || *(p->cur) == '>' )
+	{
+		pc_filterexpr_error(p, "unsupported operator");
+		goto fail;
+	}
+
+	if ( PC_FAILURE == pc_filterexpr_number(p, &(expr->val1)) )
+		goto fail;
+	expr->val2 = expr->val1;
+	return expr;
+
+fail:
+	pc_filterexpr_free(expr);
+	return NULL;
+}
+
+static PCFILTEREXPR *
+pc_filterexpr_parse_factor(PCFILTERPARSER *p)
+{
+	PCFILTEREXPR *expr;
+
+	if ( pc_filterexpr_keyword(p, "NOT") )
+	{
+		PCFILTEREXPR *arg = pc_filterexpr_parse_factor(p);
+		if ( ! arg )
+			return NULL;
+		expr = pc_filterexpr_new(PC_FILTEREXPR_NOT);
+		pc_filterexpr_add_arg(expr, arg);
+		return expr;
+	}
+
+	pc_filterexpr_skip_space(p);
+	if ( *(p->cur) != '(' )
+		return pc_filterexpr_parse_clause(p);
+
+	p->cur++;
+	expr = pc_filterexpr_parse_expr(p);
+	if ( ! expr )
+		return NULL;
+
+	pc_filterexpr_skip_space(p);
+	if ( *(p->cur) != ')' )
+	{
+		pc_filterexpr_error(p, "expected )");
+		pc_filterexpr_free(expr);
+		return NULL;
+	}
+	p->cur++;
+	return expr;
+}
+
+/* Parse a list of operands joined by kw, collapsing single operands */
+static PCFILTEREXPR *
+pc_filterexpr_parse_list(PCFILTERPARSER *p, PC_FILTEREXPR_TYPE type, const char *kw)
+{
+	PCFILTEREXPR *list, *arg;
+
+	arg = ( type == PC_FILTEREXPR_OR ) ? pc_filterexpr_parse_list(p, PC_FILTEREXPR_AND, "AND") : pc_filterexpr_parse_factor(p);
+	if ( ! arg )
+		return NULL;
+
+	if ( ! pc_filterexpr_keyword(p, kw) )
+		return arg;
+
+	list = pc_filterexpr_new(type);
+	pc_filterexpr_add_arg(list, arg);
+	do
+	{
+		arg = ( type == PC_FILTEREXPR_OR ) ? pc_filterexpr_parse_list(p, PC_FILTEREXPR_AND, "AND") : pc_filterexpr_parse_factor(p);
+		if ( ! arg )
+		{
+			pc_filterexpr_free(list);
+			return NULL;
+		}
+		pc_filterexpr_add_arg(list, arg);
+	}
+	while ( pc_filterexpr_keyword(p, kw) );
+
+	return list;
+}
+
+static PCFILTEREXPR *
+pc_filterexpr_parse_expr(PCFILTERPARSER *p)
+{
+	return pc_filterexpr_parse_list(p, PC_FILTEREXPR_OR, "OR");
+}
+
+PCFILTEREXPR *
+pc_filterexpr_parse(const PCSCHEMA *schema, const char *str)
+{
+	PCFILTERPARSER p;
+	PCFILTEREXPR *expr;
+
+	if ( ! ( schema && str ) ) return NULL;
+
+	p.schema = schema;
+	p.str = p.cur = str;
+
+	expr = pc_filterexpr_parse_expr(&p);
+	if ( ! expr )
+		return NULL;
+
+	pc_filterexpr_skip_space(&p);
+	if ( *(p.cur) )
+	{
+		pc_filterexpr_error(&p, "unexpected input");
+		pc_filterexpr_free(expr);
+		return NULL;
+	}
+	return expr;
+}
+
+
+/***********************************************************************
+* POLYGON FILTER
+*/
+
+#define WKB_POLYGON 3
+#define WKB_MULTIPOLYGON 6
+#define EWKB_Z 0x80000000
+#define EWKB_M 0x40000000
+#define EWKB_SRID 0x20000000
+
+/* Most cells along each side of the grid laid over a patch */
+#define PC_POLYGON_GRID 32
+/* Points per cell the grid is sized for */
+#define PC_POLYGON_CELL_POINTS 16
+
+#define PC_CELL_OUT 0
+#define PC_CELL_IN 1
+#define PC_CELL_EDGE 2
+
+typedef struct
+{
+	const uint8_t *cur;
+	const uint8_t *end;
+	int swap;
+} PCWKBREADER;
+
+static int
+pc_wkb_read_uint32(PCWKBREADER *r, uint32_t *val)
+{
+	if ( r->end - r->cur < 4 ) return PC_FAILURE;
+	*val = (uint32_t)wkb_get_int32(r->cur, r->swap);
+	r->cur += 4;
+	return PC_SUCCESS;
+}
+
+static int
+pc_wkb_read_double(PCWKBREADER *r, double *val)
+{
+	uint8_t buf[8];
+	int i;
+	if ( r->end - r->cur < 8 ) return PC_FAILURE;
+	for ( i = 0; i < 8; i++ )
+		buf[i] = r->swap ? r->cur[7-i] : r->cur[i];
+	memcpy(val, buf, 8);
+	r->cur += 8;
+	return PC_SUCCESS;
+}
+
+/* Byte order, type and srid, with the Z and M flags of EWKB or ISO WKB */
+static int
+pc_wkb_read_header(PCWKBREADER *r, uint32_t *type, uint32_t *ndims, uint32_t *srid)
+{
+	uint32_t t;
+
+	if ( r->end - r->cur < 1 ) return PC_FAILURE;
+	r->swap = ( r->cur[0] != machine_endian() );
+	r->cur++;
+
+	if ( PC_FAILURE == pc_wkb_read_uint32(r, &t) ) return PC_FAILURE;
+	*ndims = 2 + ( (t & EWKB_Z) != 0 ) + ( (t & EWKB_M) != 0 );
+	if ( (t & EWKB_SRID) && PC_FAILURE == pc_wkb_read_uint32(r, srid) )
+		return PC_FAILURE;
+
+	t &= 0x0FFFFFFF;
+	*ndims += ( t / 1000 == 3 ) ? 2 : ( t / 1000 ? 1 : 0 );
+	*type = t % 1000;
+	return PC_SUCCESS;
+}
+
+static int
+pc_polygon_read_rings(PCWKBREADER *r, PCPOLYGON *poly, uint32_t ndims)
+{
+	uint32_t nrings, npoints, i, j, k;
+	double d;
+
+	/* Counts are checked against the bytes left before any allocation */
+	if ( PC_FAILURE == pc_wkb_read_uint32(r, &nrings) || nrings > (r->end - r->cur) / 4 )
+		return PC_FAILURE;
+	poly->rings = pcrealloc(poly->rings, (poly->nrings + nrings + 1) * sizeof(uint32_t));
+
+	for ( i = 0; i < nrings; i++ )
+	{
+		if ( PC_FAILURE == pc_wkb_read_uint32(r, &npoints) || npoints > (r->end - r->cur) / (8 * ndims) )
+			return PC_FAILURE;
+		if ( npoints )
+			poly->xy = pcrealloc(poly->xy, (poly->npoints + npoints) * 2 * sizeof(double));
+
+		for ( j = 0; j < npoints; j++ )
+		{
+			double *xy = poly->xy + 2 * (poly->npoints + j);
+			pc_wkb_read_double(r, xy);
+			pc_wkb_read_double(r, xy + 1);
+			for ( k = 2; k < ndims; k++ )
+				pc_wkb_read_double(r, &d);
+
+			if ( xy[0] < poly->bounds.xmin ) poly->bounds.xmin = xy[0];
+			if ( xy[0] > poly->bounds.xmax ) poly->bounds.xmax = xy[0];
+			if ( xy[1] < poly->bounds.ymin ) poly->bounds.ymin = xy[1];
+			if ( xy[1] > poly->bounds.ymax ) poly->bounds.ymax = xy[1];
+		}
+		poly->npoints += npoints;
+		poly->rings[++poly->nrings] = poly->npoints;
+	}
+	return PC_SUCCESS;
+}
+
+PCPOLYGON *
+pc_polygon_from_wkb(const uint8_t *wkb, size_t wkbsize)
+{
+	PCWKBREADER r;
+	PCPOLYGON *poly;
+	uint32_t type, ndims, srid, ngeoms, i;
+	int rv;
+
+	r.cur = wkb;
+	r.end = wkb + wkbsize;
+
+	poly = pcalloc(sizeof(PCPOLYGON));
+	poly->rings = pcalloc(sizeof(uint32_t));
+	poly->xy = pcalloc(2 * sizeof(double));
+	pc_bounds_init(&(poly->bounds));
+
+	rv = pc_wkb_read_header(&r, &type, &ndims, &(poly->srid));
+	if ( rv == PC_SUCCESS && type == WKB_POLYGON )
+	{
+		rv = pc_polygon_read_rings(&r, poly, ndims);
+	}
+	else if ( rv == PC_SUCCESS && type == WKB_MULTIPOLYGON )
+	{
+		rv = pc_wkb_read_uint32(&r, &ngeoms);
+		for ( i = 0; rv == PC_SUCCESS && i < ngeoms; i++ )
+		{
+			rv = pc_wkb_read_header(&r, &type, &ndims, &srid);
+			if ( rv == PC_SUCCESS )
+				rv = type == WKB_POLYGON ? pc_polygon_read_rings(&r, poly, ndims) : PC_FAILURE;
+		}
+	}
+	else
+	{
+		rv = PC_FAILURE;
+	}
+
+	if ( rv == PC_FAILURE )
+	{
+		pc_polygon_free(poly);
+		pcerror("%s: not a polygon or multipolygon WKB", __func__);
+		return NULL;
+	}
+	return poly;
+}
+
+void
+pc_polygon_free(PCPOLYGON *poly)
+{
+	if ( ! poly ) return;
+	pcfree(poly->rings);
+	pcfree(poly->xy);
+	pcfree(poly);
+}
+
+/* Does the edge a-b cross the ray going right from x/y? */
+static inline int
+pc_polygon_crosses(double x, double y, const double *a, const double *b)
+{
+	return ( (a[1] > y) != (b[1] > y) ) &&
+	       ( x < (b[0] - a[0]) * (y - a[1]) / (b[1] - a[1]) + a[0] );
+}
+
+/* Is x/y on the edge a-b? */
+static inline int
+pc_polygon_touches(double x, double y, const double *a, const double *b)
+{
+	return x >= fmin(a[0], b[0]) && x <= fmax(a[0], b[0]) &&
+	       y >= fmin(a[1], b[1]) && y <= fmax(a[1], b[1]) &&
+	       (b[0] - a[0]) * (y - a[1]) == (b[1] - a[1]) * (x - a[0]);
+}
+
+/* Points on an edge or a vertex are in, as ST_Intersects has them */
+int
+pc_polygon_contains(const PCPOLYGON *poly, double x, double y)
+{
+	uint32_t i, j;
+	int inside = 0;
+
+	for ( i = 0; i < poly->nrings; i++ )
+	{
+		uint32_t first = poly->rings[i];
+		uint32_t last = poly->rings[i+1];
+		for ( j = first; j < last; j++ )
+		{
+			const double *a = poly->xy + 2 * ( j == first ? last - 1 : j - 1 );
+			if ( pc_polygon_touches(x, y, a, poly->xy + 2 * j) )
+				return 1;
+			inside ^= pc_polygon_crosses(x, y, a, poly->xy + 2 * j);
+		}
+	}
+	return inside;
+}
+
+/**
+* Grid over the bounds of a patch, each cell inside the polygon,
+* outside of it, or crossed by an edge. Each row lists the edges
+* spanning it in y, which are all an exact test of a point of the
+* row has to look at.
+*/
+typedef struct
+{
+	double xmin, ymin;
+	double cw, ch;       /* cell size, 0 along a flat side */
+	uint32_t nx, ny;
+	uint8_t *cells;
+	double *edges;       /* x1 y1 x2 y2 per edge */
+	uint32_t *rows;      /* ny+1 offsets into rowedges */
+	uint32_t *rowedges;
+	uint32_t nin, nedge;
+} PCPOLYGRID;
+
+static inline uint32_t
+pc_polygrid_cell(double v, double min, double size, uint32_t n)
+{
+	double c = size > 0 ? (v - min) / size : 0;
+	if ( ! ( c > 0 ) ) return 0;
+	if ( c >= n ) return n - 1;
+	return (uint32_t)c;
+}
+
+#define PC_POLYGRID_COL(g, x) pc_polygrid_cell((x), (g)->xmin, (g)->cw, (g)->nx)
+#define PC_POLYGRID_ROW(g, y) pc_polygrid_cell((y), (g)->ymin, (g)->ch, (g)->ny)
+
+static int
+pc_polygrid_contains(const PCPOLYGRID *g, uint32_t row, double x, double y)
+{
+	uint32_t k;
+	int inside = 0;
+	for ( k = g->rows[row]; k < g->rows[row+1]; k++ )
+	{
+		const double *e = g->edges + 4 * g->rowedges[k];
+		if ( pc_polygon_touches(x, y, e, e + 2) )
+			return 1;
+		inside ^= pc_polygon_crosses(x, y, e, e + 2);
+	}
+	return inside;
+}
+
+/* Flag the cells of a row the part of an edge within the row runs through */
+static void
+pc_polygrid_mark_edge(PCPOLYGRID *g, uint32_t r, const double *e)
+{
+	/* Slack for rounding, cells grazed by an edge must not be missed */
+	double slack = g->ch * 1e-9;
+	double lo = r == 0 ? -INFINITY : g->ymin + r * g->ch - slack;
+	double hi = r == g->ny - 1 ? INFINITY : g->ymin + (r + 1) * g->ch + slack;
+	double xa = e[0], xb = e[2];
+	uint32_t c, c0, c1;
+
+	if ( e[1] != e[3] )
+	{
+		double ya = fmax(lo, fmin(e[1], e[3]));
+		double yb = fmin(hi, fmax(e[1], e[3]));
+		xa = e[0] + (e[2] - e[0]) * (ya - e[1]) / (e[3] - e[1]);
+		xb = e[0] + (e[2] - e[0]) * (yb - e[1]) / (e[3] - e[1]);
+	}
+	if ( xa > xb )
+	{
+		double t = xa;
+		xa = xb;
+		xb = t;
+	}
+
+	slack = g->cw * 1e-9;
+	c0 = PC_POLYGRID_COL(g, xa - slack);
+	c1 = PC_POLYGRID_COL(g, xb + slack);
+	for ( c = c0; c <= c1; c++ )
+		g->cells[r * g->nx + c] = PC_CELL_EDGE;
+}
+
+static void
+pc_polygrid_init(PCARENA *arena, PCPOLYGRID *g, const PCPOLYGON *poly, const PCBOUNDS *b, uint32_t npoints)
+{
+	uint32_t n = (uint32_t)sqrt((double)npoints / PC_POLYGON_CELL_POINTS);
+	uint32_t nedges = poly->npoints;
+	uint32_t i, j, e, r, c;
+	uint32_t *fill;
+
+	n = n < 1 ? 1 : ( n > PC_POLYGON_GRID ? PC_POLYGON_GRID : n );
+	g->xmin = b->xmin;
+	g->ymin = b->ymin;
+	g->nx = b->xmax > b->xmin ? n : 1;
+	g->ny = b->ymax > b->ymin ? n : 1;
+	g->cw = (b->xmax - b->xmin) / g->nx;
+	g->ch = (b->ymax - b->ymin) / g->ny;
+	g->cells = pc_arena_alloc(arena, g->nx * g->ny);
+	g->edges = pc_arena_alloc(arena, 4 * nedges * sizeof(double));
+	g->rows = pc_arena_alloc(arena, (g->ny + 1) * sizeof(uint32_t));
+	fill = pc_arena_alloc(arena, g->ny * sizeof(uint32_t));
+
+	/* Edges of each ring, closed on its first vertex */
+	for ( i = 0, e = 0; i < poly->nrings; i++ )
+	{
+		uint32_t first = poly->rings[i];
+		uint32_t last = poly->rings[i+1];
+		for ( j = first; j < last; j++, e++ )
+		{
+			const double *a = poly->xy + 2 * ( j == first ? last - 1 : j - 1 );
+			memcpy(g->edges + 4 * e, a, 2 * sizeof(double));
+			memcpy(g->edges + 4 * e + 2, poly->xy + 2 * j, 2 * sizeof(double));
+		}
+	}
+
+	/* Count the edges of each row, then list them */
+	for ( e = 0; e < nedges; e++ )
+	{
+		const double *ed = g->edges + 4 * e;
+		uint32_t r0 = PC_POLYGRID_ROW(g, fmin(ed[1], ed[3]));
+		uint32_t r1 = PC_POLYGRID_ROW(g, fmax(ed[1], ed[3]));
+		for ( r = r0; r <= r1; r++ )
+			fill[r]++;
+	}
+	for ( r = 0; r < g->ny; r++ )
+	{
+		g->rows[r+1] = g->rows[r] + fill[r];
+		fill[r] = g->rows[r];
+	}
+	g->rowedges = pc_arena_alloc(arena, g->rows[g->ny] * sizeof(uint32_t));
+	for ( e = 0; e < nedges; e++ )
+	{
+		const double *ed = g->edges + 4 * e;
+		uint32_t r0 = PC_POLYGRID_ROW(g, fmin(ed[1], ed[3]));
+		uint32_t r1 = PC_POLYGRID_ROW(g, fmax(ed[1], ed[3]));
+		for ( r = r0; r <= r1; r++ )
+		{
+			g->rowedges[fill[r]++] = e;
+			pc_polygrid_mark_edge(g, r, ed);
+		}
+	}
+
+	/*
+	* No edge runs through a stretch of cells between edge cells,
+	* so the center of its first cell settles the whole stretch.
+	*/
+	g->nin = g->nedge = 0;
+	for ( r = 0; r < g->ny; r++ )
+	{
+		int state = -1;
+		for ( c = 0; c < g->nx; c++ )
+		{
+			uint8_t *cell = g->cells + r * g->nx + c;
+			if ( *cell == PC_CELL_EDGE )
+			{
+				g->nedge++;
+				state = -1;
+				continue;
+			}
+			if ( state < 0 )
+				state = pc_polygrid_contains(g, r, g->xmin + (c + 0.5) * g->cw, g->ymin + (r + 0.5) * g->ch);
+			*cell = state ? PC_CELL_IN : PC_CELL_OUT;
+			g->nin += state;
+		}
+	}
+}
+
+/* Points of inside cells pass, those of edge cells are tested exactly */
+static PCBITMAP *
+pc_polygrid_bitmap(PCARENA *arena, const PCPOLYGRID *g, const PCPATCH *pa)
+{
+	const PCSCHEMA *s = pa->schema;
+	const PCDIMENSION *xdim = s->xdim;
+	const PCDIMENSION *ydim = s->ydim;
+	PCBITMAP *map = pc_bitmap_new_in(arena, pa->npoints);
+	PCBYTES xpcb, ypcb;
+	const uint8_t *xptr, *yptr;
+	size_t xstride, ystride;
+	double xs[64], ys[64];
+	uint32_t w, i, nwords = PC_BITMAP_NWORDS(pa->npoints);
+
+	/* Only the X and Y columns of dimensional patches are decoded */
+	if ( pa->type == PC_DIMENSIONAL )
+	{
+		const PCPATCH_DIMENSIONAL *pdl = (const PCPATCH_DIMENSIONAL*)pa;
+		xpcb = pdl->bytes[xdim->position];
+		ypcb = pdl->bytes[ydim->position];
+		if ( xpcb.compression != PC_DIM_NONE )
+			xpcb = pc_bytes_decode(xpcb);
+		if ( ypcb.compression != PC_DIM_NONE )
+			ypcb = pc_bytes_decode(ypcb);
+		xptr = xpcb.bytes;
+		yptr = ypcb.bytes;
+		xstride = xdim->size;
+		ystride = ydim->size;
+	}
+	else
+	{
+		const PCPATCH_UNCOMPRESSED *pu = (const PCPATCH_UNCOMPRESSED*)pa;
+		xptr = pu->data + xdim->byteoffset;
+		yptr = pu->data + ydim->byteoffset;
+		xstride = ystride = s->size;
+	}
+
+	for ( w = 0; w < nwords; w++ )
+	{
+		uint32_t n = ( w + 1 == nwords ) ? pa->npoints - w * 64 : 64;
+		uint64_t bits = 0;
+
+		pc_values_to_double(xptr, xstride, xdim->interpretation, xdim->scale, xdim->offset, n, xs);
+		pc_values_to_double(yptr, ystride, ydim->interpretation, ydim->scale, ydim->offset, n, ys);
+		for ( i = 0; i < n; i++ )
+		{
+			uint32_t r = PC_POLYGRID_ROW(g, ys[i]);
+			int cell = g->cells[r * g->nx + PC_POLYGRID_COL(g, xs[i])];
+			if ( cell == PC_CELL_EDGE )
+				cell = pc_polygrid_contains(g, r, xs[i], ys[i]);
+			bits |= (uint64_t)cell << i;
+		}
+		map->map[w] = bits;
+		xptr += n * xstride;
+		yptr += n * ystride;
+	}
+
+	if ( pa->type == PC_DIMENSIONAL )
+	{
+		const PCPATCH_DIMENSIONAL *pdl = (const PCPATCH_DIMENSIONAL*)pa;
+		if ( xpcb.bytes != pdl->bytes[xdim->position].bytes )
+			pc_bytes_free(xpcb);
+		if ( ypcb.bytes != pdl->bytes[ydim->position].bytes )
+			pc_bytes_free(ypcb);
+	}
+
+	pc_bitmap_update_nset(map);
+	return map;
+}
+
+/**
+* The bounds of the patch against those of the polygon first, then
+* a grid over the patch, so only points in cells an edge runs through
+* get an exact point in polygon test, against the edges of their row.
+*/
+static PCPATCH *
+pc_patch_filter_polygon_run(const PCPATCH *pa, const PCPOLYGON *poly)
+{
+	PCPATCH *pu = NULL;
+	const PCPATCH *pf = pa;
+	PCPATCH *paout;
+	PCPOLYGRID grid;
+	PCBITMAP *map;
+	PCARENA arena;
+
+	if ( ! ( pa && poly ) ) return NULL;
+
+	if ( ! ( pa->schema->xdim && pa->schema->ydim ) )
+	{
+		pcerror("%s: patch schema has no X and Y dimensions", __func__);
+		return NULL;
+	}
+
+	if ( ! pa->npoints || ! poly->npoints || ! pc_bounds_intersects(&(pa->bounds), &(poly->bounds)) )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	if ( pa->type != PC_NONE && pa->type != PC_DIMENSIONAL &&
+	     pa->type != PC_GHT && pa->type != PC_LAZPERF )
+	{
+		pcerror("%s: unknown patch compression %d", __func__, pa->type);
+		return NULL;
+	}
+
+	/* The grid reads no points, so it goes before any decompression */
+	pc_arena_begin(&arena);
+	pc_polygrid_init(&arena, &grid, poly, &(pa->bounds), pa->npoints);
+
+	/* The grid alone may settle the whole patch */
+	if ( grid.nin == 0 && grid.nedge == 0 )
+	{
+		pc_arena_end(&arena);
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+	}
+	if ( grid.nin == grid.nx * grid.ny && pa->type == PC_GHT )
+	{
+		pc_arena_end(&arena);
+		return (PCPATCH*)pc_patch_ght_clone((PCPATCH_GHT*)pa);
+	}
+
+	/* GHT and LAZPERF have no columns to read, filter them uncompressed */
+	if ( pa->type == PC_GHT || pa->type == PC_LAZPERF )
+	{
+		pu = pc_patch_uncompress(pa);
+		if ( ! pu )
+		{
+			pc_arena_end(&arena);
+			return NULL;
+		}
+		pf = pu;
+	}
+
+	if ( grid.nin == grid.nx * grid.ny )
+		map = pc_bitmap_new_full(&arena, pf->npoints);
+	else
+		map = pc_polygrid_bitmap(&arena, &grid, pf);
+
+	if ( ! map || ! map->nset )
+		paout = (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+	else if ( pf->type == PC_DIMENSIONAL )
+		paout = (PCPATCH*)pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pf, map);
+	else
+		paout = (PCPATCH*)pc_patch_uncompressed_filter((PCPATCH_UNCOMPRESSED*)pf, map);
+
+	pc_arena_end(&arena);
+	if ( pu ) pc_patch_free(pu);
+	return paout;
+}
+
+PCPATCH *
+pc_patch_filter_polygon(const PCPATCH *pa, const PCPOLYGON *poly)
+{
+	PCPATCH *paout;
+	PC_COUNTER_START(t0);
+
+	if ( ! ( pa && poly ) ) return NULL;
+	paout = pc_patch_filter_polygon_run(pa, poly);
+	if ( paout )
+		PC_COUNTER_STOP(PC_OP_FILTER, t0, pa->npoints, pa->npoints * pa->schema->size, paout->npoints * pa->schema->size);
+	return paout;
+}
+
+static const char *DECIMATION_NAMES[PC_DECIMATE_NUM_METHODS] =
+{
+	"stride", "random", "grid"
+};
+
+const char *
+pc_decimation_name(int method)
+{
+	if ( method >= 0 && method < PC_DECIMATE_NUM_METHODS )
+		return DECIMATION_NAMES[method];
+	return "UNKNOWN";
+}
+
+int
+pc_decimation_number(const char *str)
+{
+	int i;
+	for ( i = 0; i < PC_DECIMATE_NUM_METHODS; i++ )
+	{
+		if ( str && strcasecmp(str, DECIMATION_NAMES[i]) == 0 )
+			return i;
+	}
+	return -1;
+}
+
+static inline void
+pc_bitmap_set_bit(PCBITMAP *map, uint32_t i)
+{
+	map->map[i >> 6] |= UINT64_C(1) << (i & 63);
+}
+
+/* Every npoints/n-th point, starting with the first */
+static PCBITMAP *
+pc_decimate_stride_bitmap(PCARENA *arena, uint32_t npoints, uint32_t n)
+{
+	PCBITMAP *map = pc_bitmap_new_in(arena, npoints);
+	uint32_t j;
+
+	for ( j = 0; j < n; j++ )
+		pc_bitmap_set_bit(map, (uint32_t)((uint64_t)j * npoints / n));
+
+	map->nset = n;
+	return map;
+}
+
+/* Next value of a splitmix64 sequence */
+static inline uint64_t
+pc_decimate_random_next(uint64_t *state)
+{
+	uint64_t z = (*state += UINT64_C(0x9E3779B97F4A7C15));
+	z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+	z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+	return z ^ (z >> 31);
+}
+
+/*
+* n points drawn uniformly in one pass (Knuth's selection sampling),
+* from a sequence seeded with the number of points, so the same patch
+* always gives the same sample.
+*/
+static PCBITMAP *
+pc_decimate_random_bitmap(PCARENA *arena, uint32_t npoints, uint32_t n)
+{
+	PCBITMAP *map = pc_bitmap_new_in(arena, npoints);
+	uint64_t state = npoints;
+	uint32_t i, left = n;
+
+	for ( i = 0; i < npoints && left; i++ )
+	{
+		/* Uniform in [0, npoints - i) from the top 53 bits */
+		double u = (pc_decimate_random_next(&state) >> 11) * (1.0 / 9007199254740992.0);
+		if ( u * (npoints - i) < left )
+		{
+			pc_bitmap_set_bit(map, i);
+			left--;
+		}
+	}
+
+	map->nset = n;
+	return map;
+}
+
+/*
+* The first point of each cell of a square grid over the bounds of
+* the patch, with cells sized to number about n. Clustered points
+* fill fewer cells, and so give fewer points.
+*/
+static PCBITMAP *
+pc_decimate_grid_bitmap(PCARENA *arena, const PCPATCH *pa, uint32_t n)
+{
+	const PCBOUNDS *b = &(pa->bounds);
+	PCDIMENSION *dims[2];
+	PCBITMAP *map, *cells;
+	double *xy, *xs, *ys;
+	double w = b->xmax - b->xmin;
+	double h = b->ymax - b->ymin;
+	double cellsize = sqrt(w * h / n);
+	uint64_t nx, ny;
+	uint32_t i, npoints = pa->npoints;
+
+	/* Long and narrow bounds still give at most about 3n cells */
+	if ( cellsize < w / n ) cellsize = w / n;
+	if ( cellsize < h / n ) cellsize = h / n;
+	if ( ! ( cellsize > 0 ) ) cellsize = 1;
+
+	nx = (uint64_t)(w / cellsize) + 1;
+	ny = (uint64_t)(h / cellsize) + 1;
+	if ( nx * ny > UINT32_MAX )
+	{
+		pcerror("%s: too many cells", __func__);
+		return NULL;
+	}
+
+	dims[0] = pa->schema->xdim;
+	dims[1] = pa->schema->ydim;
+	xy = pc_arena_alloc(arena, 2 * (size_t)npoints * sizeof(double));
+	xs = xy;
+	ys = xy + npoints;
+	if ( PC_FAILURE == pc_patch_get_values_multi(pa, dims, 2, xy) )
+		return NULL;
+
+	map = pc_bitmap_new_in(arena, npoints);
+	cells = pc_bitmap_new_in(arena, (uint32_t)(nx * ny));
+	for ( i = 0; i < npoints; i++ )
+	{
+		uint64_t ix = (uint64_t)((xs[i] - b->xmin) / cellsize);
+		uint64_t iy = (uint64_t)((ys[i] - b->ymin) / cellsize);
+		uint32_t c;
+
+		if ( ix >= nx ) ix = nx - 1;
+		if ( iy >= ny ) iy = ny - 1;
+		c = (uint32_t)(iy * nx + ix);
+		if ( ! pc_bitmap_get(cells, c) )
+		{
+			pc_bitmap_set_bit(cells, c);
+			pc_bitmap_set_bit(map, i);
+		}
+	}
+
+	pc_bitmap_update_nset(map);
+	return map;
+}
+
+/**
+* About n points of the patch, in their order, picked by method.
+* Dimensional patches are decimated column by column and stay
+* dimensional. Returns pa itself when n covers it.
+*/
+PCPATCH *
+pc_patch_decimate(const PCPATCH *pa, int method, uint32_t n)
+{
+	PCPATCH *pu = NULL;
+	const PCPATCH *pf = pa;
+	PCPATCH *paout;
+	PCBITMAP *map;
+	PCARENA arena;
+
+	if ( ! pa ) return NULL;
+
+	if ( method < 0 || method >= PC_DECIMATE_NUM_METHODS )
+	{
+		pcerror("%s: unknown decimation method %d", __func__, method);
+		return NULL;
+	}
+
+	if ( n >= pa->npoints )
+		return (PCPATCH*)pa;
+
+	if ( ! n )
+		return (PCPATCH*)pc_patch_uncompressed_make(pa->schema, 0);
+
+	if ( method == PC_DECIMATE_GRID && ! ( pa->schema->xdim && pa->schema->ydim ) )
+	{
+		pcerror("%s: patch schema has no X and Y dimensions", __func__);
+		return NULL;
+	}
+
+	/* GHT and LAZPERF have no columns to read, decimate them uncompressed */
+	if ( pa->type == PC_GHT || pa->type == PC_LAZPERF )
+	{
+		pu = pc_patch_uncompress(pa);
+		if ( ! pu ) return NULL;
+		pf = pu;
+	}
+	else if ( pa->type != PC_NONE && pa->type != PC_DIMENSIONAL )
+	{
+		pcerror("%s: unknown patch compression %d", __func__, pa->type);
+		return NULL;
+	}
+
+	pc_arena_begin(&arena);
+	if ( method == PC_DECIMATE_STRIDE )
+		map = pc_decimate_stride_bitmap(&arena, pf->npoints, n);
+	else if ( method == PC_DECIMATE_RANDOM )
+		map = pc_decimate_random_bitmap(&arena, pf->npoints, n);
+	else
+		map = pc_decimate_grid_bitmap(&arena, pf, n);
+
+	if ( ! map )
+		paout = NULL;
+	else if ( pf->type == PC_DIMENSIONAL )
+		paout = (PCPATCH*)pc_patch_dimensional_filter((PCPATCH_DIMENSIONAL*)pf, map);
+	else
+		paout = (PCPATCH*)pc_patch_uncompressed_filter((PCPATCH_UNCOMPRESSED*)pf, map);
+
+	pc_arena_end(&arena);
+	if ( pu ) pc_patch_free(pu);
+	return paout;
+}
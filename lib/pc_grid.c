@@ -0,0 +1,570 @@
+/***********************************************************************
+* pc_grid.c
+*
+*  Binning the points of patches in square cells, with the count,
+*  sum, min and max of one dimension gathered per cell.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+
+/* Pixel type and band flag of PostGIS rasters */
+#define PC_RASTER_PT_64BF 11
+#define PC_RASTER_HASNODATA (1 << 6)
+
+static const char *GRID_AGG_NAMES[PC_GRID_NUM_AGGS] =
+{
+	"count", "min", "max", "sum", "avg"
+};
+
+const char *
+pc_grid_agg_name(int agg)
+{
+	if ( agg >= 0 && agg < PC_GRID_NUM_AGGS )
+		return GRID_AGG_NAMES[agg];
+	return "UNKNOWN";
+}
+
+int
+pc_grid_agg_number(const char *str)
+{
+	int i;
+	for ( i = 0; i < PC_GRID_NUM_AGGS; i++ )
+	{
+		if ( str && strcasecmp(str, GRID_AGG_NAMES[i]) == 0 )
+			return i;
+	}
+	return -1;
+}
+
+PCGRID *
+pc_grid_new(double cellsize)
+{
+	PCGRID *grid;
+
+	if ( ! ( cellsize > 0 && isfinite(cellsize) ) )
+	{
+		pcerror("%s: cell size must be positive", __func__);
+		return NULL;
+	}
+
+	grid = pcalloc(sizeof(PCGRID));
+	grid->cellsize = cellsize;
+	grid->invcellsize = 1.0 / cellsize;
+	return grid;
+}
+
+void
+pc_grid_free(PCGRID *grid)
+{
+	if ( ! grid )
+		return;
+	if ( grid->count ) pcfree(grid->count);
+	if ( grid->sum ) pcfree(grid->sum);
+	if ( grid->min ) pcfree(grid->min);
+	if ( grid->max ) pcfree(grid->max);
+	pcfree(grid);
+}
+
+/**
+* Move the cells to a wider range of columns and rows, the new
+* cells being empty. The range holds the current one.
+*/
+static int
+pc_grid_resize(PCGRID *grid, int64_t ix, int64_t iy, uint32_t nx, uint32_t ny)
+{
+	size_t ncells = (size_t)nx * ny;
+	uint32_t *count;
+	double *sum, *min, *max;
+	size_t i;
+	uint32_t r;
+
+	if ( ix == grid->ix && iy == grid->iy && nx == grid->nx && ny == grid->ny )
+		return PC_SUCCESS;
+
+	if ( ncells > PC_GRID_MAX_CELLS )
+	{
+		pcerror("%s: grid of %u x %u cells is too large, use a larger cell size", __func__, nx, ny);
+		return PC_FAILURE;
+	}
+
+	count = pcalloc(ncells * sizeof(uint32_t));
+	sum = pcalloc(ncells * sizeof(double));
+	min = pcalloc(ncells * sizeof(double));
+	max = pcalloc(ncells * sizeof(double));
+	for ( i = 0; i < ncells; i++ )
+	{
+		min[i] = DBL_MAX;
+		max[i] = -DBL_MAX;
+	}
+
+	/* Rows of the old cells go in one piece each */
+	for ( r = 0; r < grid->ny; r++ )
+	{
+		size_t from = (size_t)r * grid->nx;
+		size_t to = (size_t)(r + grid->iy - iy) * nx + (grid->ix - ix);
+		memcpy(count + to, grid->count + from, grid->nx * sizeof(uint32_t));
+		memcpy(sum + to, grid->sum + from, grid->nx * sizeof(double));
+		memcpy(min + to, grid->min + from, grid->nx * sizeof(double));
+		memcpy(max + to, grid->max + from, grid->nx * sizeof(double));
+	}
+
+	if ( grid->count ) pcfree(grid->count);
+	if ( grid->sum ) pcfree(grid->sum);
+	if ( grid->min ) pcfree(grid->min);
+	if ( grid->max ) pcfree(grid->max);
+
+	grid->count = count;
+	grid->sum = sum;
+	grid->min = min;
+	grid->max = max;
+	grid->ix = ix;
+	grid->iy = iy;
+	grid->nx = nx;
+	grid->ny = ny;
+	return PC_SUCCESS;
+}
+
+/* Grow the grid to cover columns ix0..ix1 and rows iy0..iy1 too */
+static int
+pc_grid_extend_cells(PCGRID *grid, int64_t ix0, int64_t iy0, int64_t ix1, int64_t iy1)
+{
+	if ( grid->nx && grid->ny )
+	{
+		if ( grid->ix < ix0 ) ix0 = grid->ix;
+		if ( grid->iy < iy0 ) iy0 = grid->iy;
+		if ( grid->ix + grid->nx - 1 > ix1 ) ix1 = grid->ix + grid->nx - 1;
+		if ( grid->iy + grid->ny - 1 > iy1 ) iy1 = grid->iy + grid->ny - 1;
+	}
+
+	if ( ix1 - ix0 >= UINT32_MAX || iy1 - iy0 >= UINT32_MAX ||
+	     (double)(ix1 - ix0 + 1) * (iy1 - iy0 + 1) > PC_GRID_MAX_CELLS )
+	{
+		pcerror("%s: grid is too large, use a larger cell size", __func__);
+		return PC_FAILURE;
+	}
+
+	return pc_grid_resize(grid, ix0, iy0, ix1 - ix0 + 1, iy1 - iy0 + 1);
+}
+
+/**
+* Cells are counted from 0,0 in steps of the cell size, so that the
+* grids of any patches line up and can be merged.
+*/
+int
+pc_grid_extend(PCGRID *grid, const PCBOUNDS *bounds)
+{
+	double x0, y0, x1, y1;
+
+	assert(grid);
+	assert(bounds);
+
+	/* Nothing to cover, as for bounds of no points */
+	if ( bounds->xmin > bounds->xmax || bounds->ymin > bounds->ymax )
+		return PC_SUCCESS;
+
+	x0 = floor(bounds->xmin * grid->invcellsize);
+	y0 = floor(bounds->ymin * grid->invcellsize);
+	x1 = floor(bounds->xmax * grid->invcellsize);
+	y1 = floor(bounds->ymax * grid->invcellsize);
+	if ( ! ( fabs(x0) < INT32_MAX && fabs(y0) < INT32_MAX &&
+	         fabs(x1) < INT32_MAX && fabs(y1) < INT32_MAX ) )
+	{
+		pcerror("%s: bounds are out of reach of the cell size", __func__);
+		return PC_FAILURE;
+	}
+
+	return pc_grid_extend_cells(grid, (int64_t)x0, (int64_t)y0, (int64_t)x1, (int64_t)y1);
+}
+
+/* Bin a chunk of decoded values, the ones outside the grid are left out */
+static void
+pc_grid_add_values(PCGRID *grid, const double *xs, const double *ys, const double *vs, uint32_t n)
+{
+	const double ox = (double)grid->ix;
+	const double oy = (double)grid->iy;
+	uint32_t i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		double cx = floor(xs[i] * grid->invcellsize) - ox;
+		double cy = floor(ys[i] * grid->invcellsize) - oy;
+		size_t c;
+
+		/* Also false for NaN */
+		if ( ! ( cx >= 0 && cx < grid->nx && cy >= 0 && cy < grid->ny ) )
+			continue;
+
+		c = (size_t)cy * grid->nx + (size_t)cx;
+		grid->count[c]++;
+		if ( vs )
+		{
+			double v = vs[i];
+			grid->sum[c] += v;
+			if ( v < grid->min[c] ) grid->min[c] = v;
+			if ( v > grid->max[c] ) grid->max[c] = v;
+		}
+	}
+}
+
+/* Bin n points of X, Y and dim values read stride bytes apart */
+static void
+pc_grid_add_columns(PCGRID *grid, const PCSCHEMA *s, const PCDIMENSION *dim,
+                    const uint8_t *xptr, size_t xstride,
+                    const uint8_t *yptr, size_t ystride,
+                    const uint8_t *vptr, size_t vstride, uint32_t npoints)
+{
+	const PCDIMENSION *xdim = s->xdim;
+	const PCDIMENSION *ydim = s->ydim;
+	double xs[PC_VALUES_CHUNK], ys[PC_VALUES_CHUNK], vs[PC_VALUES_CHUNK];
+	uint32_t k, n;
+
+	for ( k = 0; k < npoints; k += n )
+	{
+		n = npoints - k < PC_VALUES_CHUNK ? npoints - k : PC_VALUES_CHUNK;
+		pc_values_to_double(xptr, xstride, xdim->interpretation, xdim->scale, xdim->offset, n, xs);
+		pc_values_to_double(yptr, ystride, ydim->interpretation, ydim->scale, ydim->offset, n, ys);
+		if ( dim )
+			pc_values_to_double(vptr, vstride, dim->interpretation, dim->scale, dim->offset, n, vs);
+		pc_grid_add_values(grid, xs, ys, dim ? vs : NULL, n);
+
+		xptr += n * xstride;
+		yptr += n * ystride;
+		if ( dim )
+			vptr += n * vstride;
+	}
+}
+
+/* Only the X, Y and dim columns are decoded, once each */
+static int
+pc_grid_add_dimensional(PCGRID *grid, const PCPATCH_DIMENSIONAL *pdl, const PCDIMENSION *dim)
+{
+	const PCSCHEMA *s = pdl->schema;
+	const PCDIMENSION *cdims[3];
+	PCBYTES pcb[3];
+	int j, k;
+
+	cdims[0] = s->xdim;
+	cdims[1] = s->ydim;
+	cdims[2] = dim;
+	for ( j = 0; j < 3; j++ )
+	{
+		if ( ! cdims[j] )
+			continue;
+		pcb[j] = pdl->bytes[cdims[j]->position];
+		for ( k = 0; k < j; k++ )
+		{
+			if ( cdims[k] == cdims[j] )
+				break;
+		}
+		if ( k < j )
+			pcb[j] = pcb[k];
+		else if ( pcb[j].compression != PC_DIM_NONE )
+			pcb[j] = pc_bytes_decode(pcb[j]);
+	}
+
+	pc_grid_add_columns(grid, s, dim,
+	                    pcb[0].bytes, s->xdim->size,
+	                    pcb[1].bytes, s->ydim->size,
+	                    dim ? pcb[2].bytes : NULL, dim ? dim->size : 0,
+	                    pdl->npoints);
+
+	for ( j = 0; j < 3; j++ )
+	{
+		if ( ! cdims[j] )
+			continue;
+		for ( k = 0; k < j; k++ )
+		{
+			if ( cdims[k] == cdims[j] )
+				break;
+		}
+		if ( k == j && pcb[j].bytes != pdl->bytes[cdims[j]->position].bytes )
+			pc_bytes_free(pcb[j]);
+	}
+	return PC_SUCCESS;
+}
+
+static void
+pc_grid_add_rows(PCGRID *grid, const PCSCHEMA *s, const PCDIMENSION *dim, const uint8_t *data, uint32_t npoints)
+{
+	pc_grid_add_columns(grid, s, dim,
+	                    data + s->xdim->byteoffset, s->size,
+	                    data + s->ydim->byteoffset, s->size,
+	                    dim ? data + dim->byteoffset : NULL, s->size,
+	                    npoints);
+}
+
+/* Points stream out of the decoder a chunk at a time */
+static int
+pc_grid_add_lazperf(PCGRID *grid, const PCPATCH_LAZPERF *pal, const PCDIMENSION *dim)
+{
+	const PCSCHEMA *s = pal->schema;
+	LAZPERF_DECODER *dec;
+	PCARENA arena;
+	uint8_t *buf;
+	uint32_t k, n;
+	int rv = PC_SUCCESS;
+
+	dec = pc_patch_lazperf_decoder_new(pal);
+	if ( ! dec )
+		return PC_FAILURE;
+
+	pc_arena_begin(&arena);
+	buf = pc_arena_alloc(&arena, s->size * PC_VALUES_CHUNK);
+	for ( k = 0; k < pal->npoints; k += n )
+	{
+		n = pal->npoints - k < PC_VALUES_CHUNK ? pal->npoints - k : PC_VALUES_CHUNK;
+		if ( pc_patch_lazperf_decoder_read(dec, buf, n) != n )
+		{
+			pcerror("%s: lazperf uncompression failed", __func__);
+			rv = PC_FAILURE;
+			break;
+		}
+		pc_grid_add_rows(grid, s, dim, buf, n);
+	}
+
+	pc_arena_end(&arena);
+	pc_patch_lazperf_decoder_free(dec);
+	return rv;
+}
+
+/**
+* One pass over the X, Y and dim values of the patch, with the points
+* outside of the grid left out. A NULL dim only counts the points.
+*/
+int
+pc_grid_add_patch(PCGRID *grid, const PCPATCH *pa, const PCDIMENSION *dim)
+{
+	const PCSCHEMA *s;
+	PCPATCH *pu;
+
+	assert(grid);
+	assert(pa);
+
+	s = pa->schema;
+	if ( ! ( s->xdim && s->ydim ) )
+	{
+		pcerror("%s: patch schema has no X and Y dimensions", __func__);
+		return PC_FAILURE;
+	}
+
+	if ( ! ( pa->npoints && grid->nx && grid->ny ) )
+		return PC_SUCCESS;
+
+	switch ( pa->type )
+	{
+	case PC_NONE:
+		pc_grid_add_rows(grid, s, dim, ((const PCPATCH_UNCOMPRESSED*)pa)->data, pa->npoints);
+		return PC_SUCCESS;
+	case PC_DIMENSIONAL:
+		return pc_grid_add_dimensional(grid, (const PCPATCH_DIMENSIONAL*)pa, dim);
+	case PC_LAZPERF:
+		return pc_grid_add_lazperf(grid, (const PCPATCH_LAZPERF*)pa, dim);
+	case PC_GHT:
+		pu = pc_patch_uncompress(pa);
+		if ( ! pu )
+			return PC_FAILURE;
+		pc_grid_add_rows(grid, s, dim, ((PCPATCH_UNCOMPRESSED*)pu)->data, pu->npoints);
+		pc_patch_free(pu);
+		return PC_SUCCESS;
+	default:
+		pcerror("%s: unsupported compression %d requested", __func__, pa->type);
+		return PC_FAILURE;
+	}
+}
+
+/** Grid over the bounds of the patch, with its points binned */
+PCGRID *
+pc_grid_from_patch(const PCPATCH *pa, double cellsize, const PCDIMENSION *dim)
+{
+	PCGRID *grid = pc_grid_new(cellsize);
+
+	if ( ! grid )
+		return NULL;
+
+	if ( PC_FAILURE == pc_grid_extend(grid, &(pa->bounds)) ||
+	     PC_FAILURE == pc_grid_add_patch(grid, pa, dim) )
+	{
+		pc_grid_free(grid);
+		return NULL;
+	}
+	return grid;
+}
+
+/**
+* Fold the cells of other into grid, which grows to cover them.
+* Both grids have to share their cell size.
+*/
+int
+pc_grid_merge(PCGRID *grid, const PCGRID *other)
+{
+	uint32_t r, i;
+
+	assert(grid);
+	assert(other);
+
+	if ( grid->cellsize != other->cellsize )
+	{
+		pcerror("%s: grids of different cell sizes (%g != %g)", __func__, grid->cellsize, other->cellsize);
+		return PC_FAILURE;
+	}
+
+	if ( ! ( other->nx && other->ny ) )
+		return PC_SUCCESS;
+
+	if ( PC_FAILURE == pc_grid_extend_cells(grid, other->ix, other->iy,
+	                                        other->ix + other->nx - 1, other->iy + other->ny - 1) )
+		return PC_FAILURE;
+
+	for ( r = 0; r < other->ny; r++ )
+	{
+		size_t from = (size_t)r * other->nx;
+		size_t to = (size_t)(r + other->iy - grid->iy) * grid->nx + (other->ix - grid->ix);
+		for ( i = 0; i < other->nx; i++ )
+		{
+			grid->count[to + i] += other->count[from + i];
+			grid->sum[to + i] += other->sum[from + i];
+			if ( other->min[from + i] < grid->min[to + i] ) grid->min[to + i] = other->min[from + i];
+			if ( other->max[from + i] > grid->max[to + i] ) grid->max[to + i] = other->max[from + i];
+		}
+	}
+	return PC_SUCCESS;
+}
+
+/**
+* The agg value of every cell, nx values a row with the northern row
+* first, as in raster images. Cells without points are flagged in
+* isnull, except for counts where they are 0.
+*/
+int
+pc_grid_get_values(const PCGRID *grid, int agg, double *vals, uint8_t *isnull)
+{
+	uint32_t r, i;
+
+	if ( agg < 0 || agg >= PC_GRID_NUM_AGGS )
+	{
+		pcerror("%s: unknown grid aggregate %d", __func__, agg);
+		return PC_FAILURE;
+	}
+
+	for ( r = 0; r < grid->ny; r++ )
+	{
+		size_t from = (size_t)(grid->ny - 1 - r) * grid->nx;
+		size_t to = (size_t)r * grid->nx;
+		for ( i = 0; i < grid->nx; i++ )
+		{
+			uint32_t count = grid->count[from + i];
+			double v;
+
+			switch ( agg )
+			{
+			case PC_GRID_COUNT: v = count; break;
+			case PC_GRID_MIN: v = grid->min[from + i]; break;
+			case PC_GRID_MAX: v = grid->max[from + i]; break;
+			case PC_GRID_SUM: v = grid->sum[from + i]; break;
+			default: v = count ? grid->sum[from + i] / count : 0; break;
+			}
+
+			vals[to + i] = ( agg == PC_GRID_COUNT || count ) ? v : 0;
+			if ( isnull )
+				isnull[to + i] = ( agg != PC_GRID_COUNT && ! count );
+		}
+	}
+	return PC_SUCCESS;
+}
+
+/**
+* One band raster of the agg values in the WKB layout of PostGIS,
+* which ST_RastFromWKB reads:
+*
+*   uint8:    endianness
+*   uint16:   version (0)
+*   uint16:   nbands (1, 0 for an empty grid)
+*   double:   scalex, scaley (cell size, negative cell size)
+*   double:   ipx, ipy (upper left corner)
+*   double:   skewx, skewy (0)
+*   int32:    srid
+*   uint16:   width, height
+*   uint8:    pixel type (64BF) and nodata flag
+*   double:   nodata value
+*   double[]: pixels, row by row from the upper left
+*/
+uint8_t *
+pc_grid_to_raster_wkb(const PCGRID *grid, int agg, int32_t srid, size_t *wkbsize)
+{
+	static const size_t hdrsz = 1 + 2 + 2 + 6 * 8 + 4 + 2 + 2;
+	size_t ncells = (size_t)grid->nx * grid->ny;
+	uint16_t version = 0, nbands = ncells ? 1 : 0;
+	uint16_t width = grid->nx, height = grid->ny;
+	double georef[6];
+	double nodata = -DBL_MAX;
+	uint8_t *wkb, *buf, *isnull;
+	double *vals;
+	size_t size, i;
+	uint8_t bandtype;
+
+	if ( grid->nx > UINT16_MAX || grid->ny > UINT16_MAX )
+	{
+		pcerror("%s: grid of %u x %u cells is too large for a raster", __func__, grid->nx, grid->ny);
+		return NULL;
+	}
+
+	size = hdrsz + ( nbands ? 1 + 8 + ncells * 8 : 0 );
+	wkb = pcalloc(size);
+
+	georef[0] = grid->cellsize;
+	georef[1] = -grid->cellsize;
+	georef[2] = grid->ix * grid->cellsize;
+	georef[3] = (grid->iy + grid->ny) * grid->cellsize;
+	georef[4] = georef[5] = 0;
+
+	buf = wkb;
+	*buf = machine_endian();             buf += 1;
+	memcpy(buf, &version, 2);            buf += 2;
+	memcpy(buf, &nbands, 2);             buf += 2;
+	memcpy(buf, georef, sizeof(georef)); buf += sizeof(georef);
+	memcpy(buf, &srid, 4);               buf += 4;
+	memcpy(buf, &width, 2);              buf += 2;
+	memcpy(buf, &height, 2);             buf += 2;
+
+	if ( nbands )
+	{
+		vals = pcalloc(ncells * sizeof(double));
+		isnull = pcalloc(ncells);
+		if ( PC_FAILURE == pc_grid_get_values(grid, agg, vals, isnull) )
+		{
+			pcfree(vals);
+			pcfree(isnull);
+			pcfree(wkb);
+			return NULL;
+		}
+
+		/* Counts have no empty cells */
+		bandtype = PC_RASTER_PT_64BF;
+		if ( agg != PC_GRID_COUNT )
+		{
+			bandtype |= PC_RASTER_HASNODATA;
+			for ( i = 0; i < ncells; i++ )
+			{
+				if ( isnull[i] )
+					vals[i] = nodata;
+			}
+		}
+		pcfree(isnull);
+
+		*buf = bandtype;       buf += 1;
+		memcpy(buf, &nodata, 8); buf += 8;
+		memcpy(buf, vals, ncells * sizeof(double));
+		pcfree(vals);
+	}
+
+	if ( wkbsize )
+		*wkbsize = size;
+	return wkb;
+}
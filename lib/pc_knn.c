@@ -0,0 +1,374 @@
+/***********************************************************************
+* pc_knn.c
+*
+*  The k points of one or more patches nearest to a location, kept
+*  in a bounded max-heap as the X/Y(/Z) columns are scanned.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <assert.h>
+#include <math.h>
+
+PCKNN *
+pc_knn_new(const PCSCHEMA *schema, double x, double y, double z, int usez, uint32_t k)
+{
+	PCKNN *knn;
+
+	if ( ! k )
+	{
+		pcerror("%s: number of points must be positive", __func__);
+		return NULL;
+	}
+
+	if ( ! ( schema->xdim && schema->ydim ) )
+	{
+		pcerror("%s: schema has no X and Y dimensions", __func__);
+		return NULL;
+	}
+
+	knn = pcalloc(sizeof(PCKNN));
+	knn->schema = schema;
+	knn->x = x;
+	knn->y = y;
+	knn->z = z;
+	knn->usez = usez && schema->zdim;
+	knn->k = k;
+	knn->hits = pcalloc(k * sizeof(PCKNNHIT));
+	knn->rows = pcalloc(k * schema->size);
+	knn->scratch = pcalloc(k * schema->size);
+	return knn;
+}
+
+void
+pc_knn_free(PCKNN *knn)
+{
+	if ( ! knn )
+		return;
+	pcfree(knn->hits);
+	pcfree(knn->rows);
+	pcfree(knn->scratch);
+	pcfree(knn);
+}
+
+/* Squared distance of the farthest point held, once k are held */
+static inline double
+pc_knn_worst(const PCKNN *knn)
+{
+	return knn->nhits < knn->k ? INFINITY : knn->hits[0].dist;
+}
+
+double
+pc_knn_max_distance(const PCKNN *knn)
+{
+	return sqrt(pc_knn_worst(knn));
+}
+
+static void
+pc_knn_sift_down(PCKNNHIT *hits, uint32_t n, uint32_t i)
+{
+	PCKNNHIT h = hits[i];
+	for (;;)
+	{
+		uint32_t c = 2 * i + 1;
+		if ( c >= n )
+			break;
+		if ( c + 1 < n && hits[c + 1].dist > hits[c].dist )
+			c++;
+		if ( hits[c].dist <= h.dist )
+			break;
+		hits[i] = hits[c];
+		i = c;
+	}
+	hits[i] = h;
+}
+
+static void
+pc_knn_sift_up(PCKNNHIT *hits, uint32_t i)
+{
+	PCKNNHIT h = hits[i];
+	while ( i > 0 )
+	{
+		uint32_t p = (i - 1) / 2;
+		if ( hits[p].dist >= h.dist )
+			break;
+		hits[i] = hits[p];
+		i = p;
+	}
+	hits[i] = h;
+}
+
+/* Offer the points of a chunk, first being the index of xs[0] */
+static void
+pc_knn_add_values(PCKNN *knn, const double *xs, const double *ys, const double *zs, uint32_t first, uint32_t n)
+{
+	double worst = pc_knn_worst(knn);
+	uint32_t i;
+
+	for ( i = 0; i < n; i++ )
+	{
+		double dx = xs[i] - knn->x;
+		double dy = ys[i] - knn->y;
+		double d = dx * dx + dy * dy;
+		PCKNNHIT *h;
+
+		if ( zs )
+		{
+			double dz = zs[i] - knn->z;
+			d += dz * dz;
+		}
+
+		/* Also false for NaN */
+		if ( ! ( d < worst ) )
+			continue;
+
+		if ( knn->nhits < knn->k )
+		{
+			h = knn->hits + knn->nhits;
+			h->dist = d;
+			h->idx = first + i;
+			h->fresh = PC_TRUE;
+			pc_knn_sift_up(knn->hits, knn->nhits++);
+		}
+		else
+		{
+			h = knn->hits;
+			h->dist = d;
+			h->idx = first + i;
+			h->fresh = PC_TRUE;
+			pc_knn_sift_down(knn->hits, knn->nhits, 0);
+		}
+		worst = pc_knn_worst(knn);
+	}
+}
+
+/* Offer n points of X, Y and Z values read stride bytes apart */
+static void
+pc_knn_add_columns(PCKNN *knn,
+                   const uint8_t *xptr, size_t xstride,
+                   const uint8_t *yptr, size_t ystride,
+                   const uint8_t *zptr, size_t zstride, uint32_t npoints)
+{
+	const PCDIMENSION *xdim = knn->schema->xdim;
+	const PCDIMENSION *ydim = knn->schema->ydim;
+	const PCDIMENSION *zdim = knn->schema->zdim;
+	double xs[PC_VALUES_CHUNK], ys[PC_VALUES_CHUNK], zs[PC_VALUES_CHUNK];
+	uint32_t k, n;
+
+	for ( k = 0; k < npoints; k += n )
+	{
+		n = npoints - k < PC_VALUES_CHUNK ? npoints - k : PC_VALUES_CHUNK;
+		pc_values_to_double(xptr, xstride, xdim->interpretation, xdim->scale, xdim->offset, n, xs);
+		pc_values_to_double(yptr, ystride, ydim->interpretation, ydim->scale, ydim->offset, n, ys);
+		if ( knn->usez )
+			pc_values_to_double(zptr, zstride, zdim->interpretation, zdim->scale, zdim->offset, n, zs);
+		pc_knn_add_values(knn, xs, ys, knn->usez ? zs : NULL, k, n);
+
+		xptr += n * xstride;
+		yptr += n * ystride;
+		if ( knn->usez )
+			zptr += n * zstride;
+	}
+}
+
+static void
+pc_knn_add_rows(PCKNN *knn, const uint8_t *data, uint32_t npoints)
+{
+	const PCSCHEMA *s = knn->schema;
+	pc_knn_add_columns(knn,
+	                   data + s->xdim->byteoffset, s->size,
+	                   data + s->ydim->byteoffset, s->size,
+	                   knn->usez ? data + s->zdim->byteoffset : NULL, s->size,
+	                   npoints);
+}
+
+/* Only the X, Y and Z columns are decoded */
+static void
+pc_knn_add_dimensional(PCKNN *knn, const PCPATCH_DIMENSIONAL *pdl)
+{
+	const PCSCHEMA *s = knn->schema;
+	const PCDIMENSION *cdims[3];
+	PCBYTES pcb[3];
+	int j;
+
+	cdims[0] = s->xdim;
+	cdims[1] = s->ydim;
+	cdims[2] = knn->usez ? s->zdim : NULL;
+	for ( j = 0; j < 3; j++ )
+	{
+		if ( ! cdims[j] )
+			continue;
+		pcb[j] = pdl->bytes[cdims[j]->position];
+		if ( pcb[j].compression != PC_DIM_NONE )
+			pcb[j] = pc_bytes_decode(pcb[j]);
+	}
+
+	pc_knn_add_columns(knn,
+	                   pcb[0].bytes, s->xdim->size,
+	                   pcb[1].bytes, s->ydim->size,
+	                   knn->usez ? pcb[2].bytes : NULL, knn->usez ? s->zdim->size : 0,
+	                   pdl->npoints);
+
+	for ( j = 0; j < 3; j++ )
+	{
+		if ( cdims[j] && pcb[j].bytes != pdl->bytes[cdims[j]->position].bytes )
+			pc_bytes_free(pcb[j]);
+	}
+}
+
+/**
+* Rows of the points held, those found in the patch just scanned
+* copied out of its uncompressed points.
+*/
+static void
+pc_knn_keep_rows(PCKNN *knn, const uint8_t *data)
+{
+	size_t size = knn->schema->size;
+	uint8_t *rows;
+	uint32_t j;
+
+	for ( j = 0; j < knn->nhits; j++ )
+	{
+		PCKNNHIT *h = knn->hits + j;
+		const uint8_t *from = h->fresh ? data : knn->rows;
+		memcpy(knn->scratch + j * size, from + (size_t)h->idx * size, size);
+		h->idx = j;
+		h->fresh = PC_FALSE;
+	}
+
+	rows = knn->rows;
+	knn->rows = knn->scratch;
+	knn->scratch = rows;
+}
+
+/**
+* Offer the points of a patch of the schema of knn. Once k points are
+* held, patches whose bounds are farther than all of them are passed
+* over without reading any point.
+*/
+int
+pc_knn_add_patch(PCKNN *knn, const PCPATCH *pa)
+{
+	PCPATCH *pu = NULL;
+	const uint8_t *data;
+	double bd;
+	uint32_t j, nfresh = 0;
+
+	assert(knn);
+	assert(pa);
+
+	if ( pa->schema->pcid != knn->schema->pcid || pa->schema->size != knn->schema->size )
+	{
+		pcerror("%s: patch does not have the schema of the search", __func__);
+		return PC_FAILURE;
+	}
+
+	if ( ! pa->npoints )
+		return PC_SUCCESS;
+
+	bd = pc_bounds_distance(&(pa->bounds), knn->x, knn->y);
+	if ( ! ( bd * bd < pc_knn_worst(knn) ) )
+		return PC_SUCCESS;
+
+	switch ( pa->type )
+	{
+	case PC_NONE:
+		pc_knn_add_rows(knn, ((const PCPATCH_UNCOMPRESSED*)pa)->data, pa->npoints);
+		break;
+	case PC_DIMENSIONAL:
+		pc_knn_add_dimensional(knn, (const PCPATCH_DIMENSIONAL*)pa);
+		break;
+	case PC_GHT:
+	case PC_LAZPERF:
+		pu = pc_patch_uncompress(pa);
+		if ( ! pu )
+			return PC_FAILURE;
+		pc_knn_add_rows(knn, ((PCPATCH_UNCOMPRESSED*)pu)->data, pu->npoints);
+		break;
+	default:
+		pcerror("%s: unsupported compression %d requested", __func__, pa->type);
+		return PC_FAILURE;
+	}
+
+	for ( j = 0; j < knn->nhits; j++ )
+		nfresh += knn->hits[j].fresh;
+
+	/* Whole rows are only read for patches holding some of the nearest points */
+	if ( nfresh )
+	{
+		if ( ! pu && pa->type != PC_NONE )
+		{
+			pu = pc_patch_uncompress(pa);
+			if ( ! pu )
+				return PC_FAILURE;
+		}
+		data = pu ? ((PCPATCH_UNCOMPRESSED*)pu)->data : ((const PCPATCH_UNCOMPRESSED*)pa)->data;
+		pc_knn_keep_rows(knn, data);
+	}
+
+	if ( pu && pu != pa )
+		pc_patch_free(pu);
+	return PC_SUCCESS;
+}
+
+static int
+pc_knn_hit_cmp(const void *a, const void *b)
+{
+	const PCKNNHIT *ha = a, *hb = b;
+	if ( ha->dist != hb->dist )
+		return ha->dist < hb->dist ? -1 : 1;
+	return ha->idx < hb->idx ? -1 : ( ha->idx > hb->idx );
+}
+
+/** Patch of the points held, nearest first */
+PCPATCH_UNCOMPRESSED *
+pc_knn_get_patch(const PCKNN *knn)
+{
+	size_t size = knn->schema->size;
+	PCPATCH_UNCOMPRESSED *pu;
+	PCKNNHIT *hits;
+	uint32_t j;
+
+	pu = pc_patch_uncompressed_make(knn->schema, knn->nhits);
+	if ( ! knn->nhits )
+		return pu;
+
+	hits = pcalloc(knn->nhits * sizeof(PCKNNHIT));
+	memcpy(hits, knn->hits, knn->nhits * sizeof(PCKNNHIT));
+	qsort(hits, knn->nhits, sizeof(PCKNNHIT), pc_knn_hit_cmp);
+	for ( j = 0; j < knn->nhits; j++ )
+		memcpy(pu->data + j * size, knn->rows + (size_t)hits[j].idx * size, size);
+	pcfree(hits);
+
+	pu->npoints = knn->nhits;
+	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(pu) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free((PCPATCH*)pu);
+		return NULL;
+	}
+	return pu;
+}
+
+/**
+* The k points of the patch nearest to x, y, and z when usez is set
+* and the schema has a Z dimension, nearest first.
+*/
+PCPATCH *
+pc_patch_knn(const PCPATCH *pa, double x, double y, double z, int usez, uint32_t k)
+{
+	PCKNN *knn = pc_knn_new(pa->schema, x, y, z, usez, k);
+	PCPATCH *paout = NULL;
+
+	if ( ! knn )
+		return NULL;
+
+	if ( PC_SUCCESS == pc_knn_add_patch(knn, pa) )
+		paout = (PCPATCH*)pc_knn_get_patch(knn);
+
+	pc_knn_free(knn);
+	return paout;
+}
@@ -26,6 +26,8 @@ struct pc_context_t
 
 static struct pc_context_t pc_context;
 
+size_t pc_bytes_copied = 0;
+
 /*
 * Default allocators
 *
@@ -91,6 +93,9 @@ void pc_install_default_handlers(void)
 	pc_context.info = default_info_handler;
 	pc_context.warn = default_warn_handler;
 
+	/* One thread per processor for the dimensions of big patches */
+	pc_set_num_threads(0);
+
 #ifdef HAVE_LIBGHT
 	ght_set_handlers(
 		(void *)default_allocator,    (void *)default_reallocator,
@@ -106,6 +111,10 @@ void pc_set_handlers(
 	pc_deallocator deallocator, pc_message_handler error_handler,
 	pc_message_handler info_handler, pc_message_handler warn_handler)
 {
+	/* Custom allocators need not be thread safe */
+	if ( allocator || reallocator || deallocator )
+		pc_set_num_threads(1);
+
 	if ( ! allocator ) allocator = pc_context.alloc;
 	if ( ! reallocator ) reallocator = pc_context.realloc;
 	if ( ! deallocator ) deallocator = pc_context.free;
@@ -138,6 +147,9 @@ pcalloc(size_t size)
 {
 	void *mem;
 	if ( ! size ) return NULL;
+	/* Counted, but not timed, a clock read would cost more than most */
+	if ( pc_counting )
+		pc_counter_add(PC_OP_ALLOC, 0, 0, 0, size);
 	mem = pc_context.alloc(size);
 	memset(mem, 0, size); /* Always clean memory */
 	return mem;
@@ -164,6 +176,73 @@ pcfree(void * mem)
 	pc_context.free(mem);
 }
 
+/*
+* Blocks of an arena beyond its initial bytes, newest first. The
+* header is padded so the memory that follows keeps its alignment.
+*/
+typedef struct PCARENABLOCK_t
+{
+	struct PCARENABLOCK_t *next;
+	uint64_t pad;
+} PCARENABLOCK;
+
+#define PC_ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+void
+pc_arena_begin(PCARENA *arena)
+{
+	arena->blocks = NULL;
+	arena->ptr = (uint8_t*)(arena->initial);
+	arena->avail = sizeof(arena->initial);
+}
+
+void *
+pc_arena_alloc(PCARENA *arena, size_t size)
+{
+	PCARENABLOCK *block;
+	uint8_t *mem;
+
+	if ( ! size ) return NULL;
+	size = PC_ARENA_ALIGN(size);
+
+	if ( size > arena->avail )
+	{
+		size_t blocksize = size > PC_ARENA_BLOCKSIZE / 4 ? size : PC_ARENA_BLOCKSIZE;
+		block = pc_context.alloc(sizeof(PCARENABLOCK) + blocksize);
+		block->next = arena->blocks;
+		arena->blocks = block;
+		mem = (uint8_t*)(block + 1);
+
+		/* Big requests get a block of their own, the current one carries on */
+		if ( blocksize != PC_ARENA_BLOCKSIZE )
+		{
+			memset(mem, 0, size);
+			return mem;
+		}
+		arena->ptr = mem;
+		arena->avail = blocksize;
+	}
+
+	mem = arena->ptr;
+	arena->ptr += size;
+	arena->avail -= size;
+	memset(mem, 0, size);
+	return mem;
+}
+
+void
+pc_arena_end(PCARENA *arena)
+{
+	PCARENABLOCK *block = arena->blocks;
+	while ( block )
+	{
+		PCARENABLOCK *next = block->next;
+		pc_context.free(block);
+		block = next;
+	}
+	pc_arena_begin(arena);
+}
+
 void
 pcerror(const char *fmt, ...)
 {
@@ -46,29 +46,24 @@ pc_patch_compute_stats(PCPATCH *pa)
 		return pc_patch_uncompressed_compute_stats((PCPATCH_UNCOMPRESSED*)pa);
 
 	case PC_DIMENSIONAL:
-	{
-		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_dimensional((PCPATCH_DIMENSIONAL*)pa);
-		pc_patch_uncompressed_compute_stats(pu);
-		pa->stats = pu->stats; pu->stats = NULL;
-		pc_patch_uncompressed_free(pu);
-		return PC_SUCCESS;
-	}
+		return pc_patch_dimensional_compute_stats((PCPATCH_DIMENSIONAL*)pa);
+
 	case PC_GHT:
 	{
+		PCARENA arena;
+		PCDOUBLESTATS *dstats;
 		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_ght((PCPATCH_GHT*)pa);
-		pc_patch_uncompressed_compute_stats(pu);
-		pa->stats = pc_stats_clone(pu->stats);
+		if ( ! pu ) return PC_FAILURE;
+		pc_arena_begin(&arena);
+		dstats = pc_dstats_new_in(&arena, pa->schema->ndims);
+		pc_dstats_add_points(dstats, pu->schema, pu->data, pu->npoints);
+		pc_patch_set_dstats(pa, dstats);
+		pc_arena_end(&arena);
 		pc_patch_uncompressed_free(pu);
 		return PC_SUCCESS;
 	}
 	case PC_LAZPERF:
-	{
-		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_lazperf((PCPATCH_LAZPERF*)pa);
-		pc_patch_uncompressed_compute_stats(pu);
-		pa->stats = pc_stats_clone(pu->stats);
-		pc_patch_uncompressed_free(pu);
-		return PC_SUCCESS;
-	}
+		return pc_patch_lazperf_compute_stats((PCPATCH_LAZPERF*)pa);
 	default:
 	{
 		pcerror("%s: unknown compression type", __func__, pa->type);
@@ -125,9 +120,53 @@ pc_patch_from_pointlist(const PCPOINTLIST *ptl)
 	return (PCPATCH*)pc_patch_uncompressed_from_pointlist(ptl);
 }
 
-
 PCPATCH *
-pc_patch_compress(const PCPATCH *patch, void *userdata)
+pc_patch_from_pointlist_take(PCPOINTLIST *ptl)
+{
+	PCPATCH_UNCOMPRESSED *pu;
+
+	/* Only rows the list owns can be taken over */
+	if ( ! ( ptl && ptl->schema && ptl->npoints && ptl->data == ptl->mem ) )
+		return pc_patch_from_pointlist(ptl);
+
+	pu = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
+	pu->type = PC_NONE;
+	pu->readonly = PC_FALSE;
+	pu->schema = ptl->schema;
+	pu->npoints = ptl->npoints;
+	pu->maxpoints = ptl->maxpoints;
+	pu->datasize = ptl->schema->size * ptl->maxpoints;
+	pu->data = ptl->data;
+	ptl->mem = ptl->data = NULL;
+	ptl->npoints = ptl->maxpoints = 0;
+
+	/* Sets the extent too */
+	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(pu) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		return NULL;
+	}
+	return (PCPATCH*)pu;
+}
+
+
+/* Dimensionalize into scratch memory and compress out of it */
+static PCPATCH *
+pc_patch_dimensional_compress_uncompressed(const PCPATCH_UNCOMPRESSED *pu, PCDIMSTATS *pds)
+{
+	PCPATCH_DIMENSIONAL *pdu, *pdc = NULL;
+	PCARENA arena;
+
+	pc_arena_begin(&arena);
+	pdu = pc_patch_dimensional_from_uncompressed_in(&arena, pu);
+	if ( pdu )
+		pdc = pc_patch_dimensional_compress(pdu, pds);
+	pc_arena_end(&arena);
+	return (PCPATCH*)pdc;
+}
+
+static PCPATCH *
+pc_patch_compress_ordered(const PCPATCH *patch, void *userdata)
 {
 	uint32_t schema_compression = patch->schema->compression;
 	uint32_t patch_compression = patch->type;
@@ -139,10 +178,7 @@ pc_patch_compress(const PCPATCH *patch, void *userdata)
 		if ( patch_compression == PC_NONE )
 		{
 			/* Dimensionalize, dimensionally compress, return */
-			PCPATCH_DIMENSIONAL *pcdu = pc_patch_dimensional_from_uncompressed((PCPATCH_UNCOMPRESSED*)patch);
-			PCPATCH_DIMENSIONAL *pcdd = pc_patch_dimensional_compress(pcdu, (PCDIMSTATS*)userdata);
-			pc_patch_dimensional_free(pcdu);
-			return (PCPATCH*)pcdd;
+			return pc_patch_dimensional_compress_uncompressed((PCPATCH_UNCOMPRESSED*)patch, (PCDIMSTATS*)userdata);
 		}
 		else if ( patch_compression == PC_DIMENSIONAL )
 		{
@@ -153,18 +189,16 @@ pc_patch_compress(const PCPATCH *patch, void *userdata)
 		{
 			/* Uncompress, dimensionalize, dimensionally compress, return */
 			PCPATCH_UNCOMPRESSED *pcu = pc_patch_uncompressed_from_ght((PCPATCH_GHT*)patch);
-			PCPATCH_DIMENSIONAL *pcdu  = pc_patch_dimensional_from_uncompressed(pcu);
-			PCPATCH_DIMENSIONAL *pcdc  = pc_patch_dimensional_compress(pcdu, NULL);
-			pc_patch_dimensional_free(pcdu);
-			return (PCPATCH*)pcdc;
+			PCPATCH *pcdc = pc_patch_dimensional_compress_uncompressed(pcu, (PCDIMSTATS*)userdata);
+			pc_patch_free((PCPATCH*)pcu);
+			return pcdc;
 		}
 		else if ( patch_compression == PC_LAZPERF )
 		{
 			PCPATCH_UNCOMPRESSED *pcu = pc_patch_uncompressed_from_lazperf( (PCPATCH_LAZPERF*) patch );
-			PCPATCH_DIMENSIONAL *pal = pc_patch_dimensional_from_uncompressed( pcu );
-			PCPATCH_DIMENSIONAL *palc = pc_patch_dimensional_compress( pal, NULL );
-			pc_patch_dimensional_free(pal);
-			return (PCPATCH*) palc;
+			PCPATCH *palc = pc_patch_dimensional_compress_uncompressed(pcu, (PCDIMSTATS*)userdata);
+			pc_patch_free((PCPATCH*)pcu);
+			return palc;
 		}
 		else
 		{
@@ -268,6 +302,36 @@ pc_patch_compress(const PCPATCH *patch, void *userdata)
 	return NULL;
 }
 
+/**
+* Compress a patch to its schema compression, ordering the points along
+* the schema curve first when it sets one. Dimensional and lazperf
+* encodings are the ones that gain from neighbours being close.
+*/
+PCPATCH *
+pc_patch_compress(const PCPATCH *patch, void *userdata)
+{
+	uint32_t schema_compression = patch->schema->compression;
+	PCPATCH *sorted, *compressed;
+
+	/* Points sorted on a dimension keep their order */
+	if ( patch->schema->spatialsort == PC_CURVE_NONE || patch->npoints < 2 || patch->sortdim ||
+	     ! ( schema_compression == PC_DIMENSIONAL || schema_compression == PC_LAZPERF ) )
+	{
+		compressed = pc_patch_compress_ordered(patch, userdata);
+		if ( compressed && compressed != patch && compressed->type != PC_GHT )
+			compressed->sortdim = patch->sortdim;
+		return compressed;
+	}
+
+	sorted = pc_patch_order_curve(patch, patch->schema->spatialsort);
+	if ( ! sorted )
+		return NULL;
+	compressed = pc_patch_compress_ordered(sorted, userdata);
+	if ( compressed != sorted )
+		pc_patch_free(sorted);
+	return compressed;
+}
+
 
 PCPATCH *
 pc_patch_uncompress(const PCPATCH *patch)
@@ -277,6 +341,8 @@ pc_patch_uncompress(const PCPATCH *patch)
 	if ( patch_compression == PC_DIMENSIONAL )
 	{
 		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_dimensional((PCPATCH_DIMENSIONAL*)patch);
+		if ( pu )
+			pu->sortdim = patch->sortdim;
 		return (PCPATCH*)pu;
 	}
 
@@ -294,6 +360,8 @@ pc_patch_uncompress(const PCPATCH *patch)
 	if ( patch_compression == PC_LAZPERF )
 	{
 		PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_from_lazperf( (PCPATCH_LAZPERF*)patch );
+		if ( pu )
+			pu->sortdim = patch->sortdim;
 		return (PCPATCH*) pu;
 	}
 
@@ -362,9 +430,7 @@ pc_patch_from_wkb(const PCSCHEMA *s, uint8_t *wkb, size_t wkbsize)
 	}
 	}
 
-	if ( PC_FAILURE == pc_patch_compute_extent(patch) )
-		pcerror("%s: pc_patch_compute_extent failed", __func__);
-
+	/* One pass over the points gives the stats and the extent */
 	if ( PC_FAILURE == pc_patch_compute_stats(patch) )
 		pcerror("%s: pc_patch_compute_stats failed", __func__);
 
@@ -432,9 +498,14 @@ PCPATCH *
 pc_patch_from_patchlist(PCPATCH **palist, int numpatches)
 {
 	int i;
+	int alldimensional = PC_TRUE;
+#ifdef HAVE_LIBGHT
+	int allght = PC_TRUE;
+#endif
 	uint32_t totalpoints = 0;
 	PCPATCH_UNCOMPRESSED *paout;
 	const PCSCHEMA *schema = NULL;
+	PCDOUBLESTATS *dstats;
 	uint8_t *buf;
 
 	assert(palist);
@@ -451,17 +522,39 @@ pc_patch_from_patchlist(PCPATCH **palist, int numpatches)
 			pcerror("%s: inconsistent schemas in input", __func__);
 			return NULL;
 		}
+		if ( palist[i]->type != PC_DIMENSIONAL )
+			alldimensional = PC_FALSE;
+#ifdef HAVE_LIBGHT
+		if ( palist[i]->type != PC_GHT )
+			allght = PC_FALSE;
+#endif
 		totalpoints += palist[i]->npoints;
 	}
 
+	/* Dimensional inputs are merged without decompression */
+	if ( alldimensional && totalpoints )
+		return (PCPATCH*)pc_patch_dimensional_from_patchlist((PCPATCH_DIMENSIONAL**)palist, numpatches);
+
+	/* GHT inputs are merged node by node, unless libght turns one down */
+#ifdef HAVE_LIBGHT
+	if ( allght && totalpoints )
+	{
+		PCPATCH_GHT *paght = pc_patch_ght_from_patchlist((PCPATCH_GHT**)palist, numpatches);
+		if ( paght )
+			return (PCPATCH*)paght;
+	}
+#endif
+
 	/* Blank output */
 	paout = pc_patch_uncompressed_make(schema, totalpoints);
 	buf = paout->data;
+	dstats = pc_dstats_new(schema->ndims);
 
 	/* Uncompress dimensionals, copy uncompressed */
 	for ( i = 0; i < numpatches; i++ )
 	{
 		const PCPATCH *pa = palist[i];
+		uint8_t *start = buf;
 
 		/* Update bounds */
 		pc_bounds_merge(&(paout->bounds), &(pa->bounds));
@@ -509,16 +602,264 @@ pc_patch_from_patchlist(PCPATCH **palist, int numpatches)
 			break;
 		}
 		}
+
+		/* Stats of the points just written, while they are at hand */
+		pc_dstats_add_points(dstats, schema, start, (buf - start) / schema->size);
 	}
 
 	paout->npoints = totalpoints;
+	pc_patch_set_dstats((PCPATCH*)paout, dstats);
+	pc_dstats_free(dstats);
 
-	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(paout) )
+	return (PCPATCH*)paout;
+}
+
+PCPATCH_UNION *
+pc_patch_union_new(const PCSCHEMA *schema)
+{
+	PCPATCH_UNION *pcu = pcalloc(sizeof(PCPATCH_UNION));
+	pcu->schema = schema;
+	pc_bounds_init(&(pcu->bounds));
+	return pcu;
+}
+
+void
+pc_patch_union_free(PCPATCH_UNION *pcu)
+{
+	if ( pcu->pdl )
+		pc_patch_free((PCPATCH*)pcu->pdl);
+	if ( pcu->pu )
+		pc_patch_free((PCPATCH*)pcu->pu);
+	if ( pcu->dstats )
+		pc_dstats_free(pcu->dstats);
+	pcfree(pcu);
+}
+
+/*
+* Append the points of an uncompressed patch to the point buffer,
+* doubling it as needed.
+*/
+static void
+pc_patch_union_append(PCPATCH_UNION *pcu, const PCPATCH_UNCOMPRESSED *pa)
+{
+	PCPATCH_UNCOMPRESSED *pu = pcu->pu;
+	size_t sz = pu->schema->size;
+
+	if ( pu->npoints + pa->npoints > pu->maxpoints )
 	{
-		pcerror("%s: stats computation failed", __func__);
-		return NULL;
+		if ( ! pu->maxpoints )
+			pu->maxpoints = 1;
+		while ( pu->npoints + pa->npoints > pu->maxpoints )
+			pu->maxpoints *= 2;
+		pu->datasize = pu->maxpoints * sz;
+		pu->data = pu->data ? pcrealloc(pu->data, pu->datasize) : pcalloc(pu->datasize);
+	}
+
+	memcpy(pu->data + pu->npoints * sz, pa->data, pa->npoints * sz);
+
+	/* The stored averages are rounded, so sum the points themselves */
+	pc_dstats_add_points(pcu->dstats, pu->schema, pu->data + pu->npoints * sz, pa->npoints);
+
+	pu->npoints += pa->npoints;
+}
+
+/*
+* Decode each dimension of a dimensional patch onto the end of the
+* matching column, doubling the columns as needed. Only one decoded
+* dimension is held on top of the columns at any time.
+*/
+static void
+pc_patch_union_append_dimensional(PCPATCH_UNION *pcu, const PCPATCH_DIMENSIONAL *pa)
+{
+	const PCSCHEMA *schema = pcu->schema;
+	PCPATCH_DIMENSIONAL *pdl = pcu->pdl;
+	int i;
+
+	if ( ! pdl )
+	{
+		pdl = pcu->pdl = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+		pdl->type = PC_DIMENSIONAL;
+		pdl->readonly = PC_FALSE;
+		pdl->schema = schema;
+		pdl->bytes = pcalloc(schema->ndims * sizeof(PCBYTES));
+		for ( i = 0; i < schema->ndims; i++ )
+		{
+			pdl->bytes[i].interpretation = schema->dims[i]->interpretation;
+			pdl->bytes[i].compression = PC_DIM_NONE;
+			pdl->bytes[i].readonly = PC_FALSE;
+		}
 	}
 
+	if ( pdl->npoints + pa->npoints > pcu->maxpoints )
+	{
+		if ( ! pcu->maxpoints )
+			pcu->maxpoints = 1;
+		while ( pdl->npoints + pa->npoints > pcu->maxpoints )
+			pcu->maxpoints *= 2;
+		for ( i = 0; i < schema->ndims; i++ )
+		{
+			PCBYTES *col = &(pdl->bytes[i]);
+			size_t size = pcu->maxpoints * schema->dims[i]->size;
+			col->bytes = col->bytes ? pcrealloc(col->bytes, size) : pcalloc(size);
+		}
+	}
+
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		PCBYTES *col = &(pdl->bytes[i]);
+		PCBYTES pcb = pa->bytes[i];
+
+		if ( pcb.compression != PC_DIM_NONE )
+			pcb = pc_bytes_decode(pcb);
+		memcpy(col->bytes + col->size, pcb.bytes, pcb.size);
+		col->size += pcb.size;
+		col->npoints += pa->npoints;
+		if ( pcb.bytes != pa->bytes[i].bytes )
+			pc_bytes_free(pcb);
+	}
+	pdl->npoints += pa->npoints;
+}
+
+/*
+* Move the columns gathered so far into the point buffer, used as
+* soon as the first non-dimensional input arrives.
+*/
+static void
+pc_patch_union_to_uncompressed(PCPATCH_UNION *pcu)
+{
+	const PCSCHEMA *schema = pcu->schema;
+	PCPATCH_DIMENSIONAL *pdl = pcu->pdl;
+	PCPATCH_UNCOMPRESSED *pu;
+	uint32_t i, j;
+
+	pu = pcu->pu = pc_patch_uncompressed_make(schema, pdl ? pdl->npoints : 0);
+	pcu->dstats = pc_dstats_new(schema->ndims);
+	if ( ! pdl )
+		return;
+
+	/* Each column is let go as soon as it is in the points */
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		const PCDIMENSION *dim = schema->dims[i];
+		const uint8_t *in = pdl->bytes[i].bytes;
+		uint8_t *out = pu->data + dim->byteoffset;
+
+		for ( j = 0; j < pdl->npoints; j++ )
+		{
+			memcpy(out, in, dim->size);
+			in += dim->size;
+			out += schema->size;
+		}
+		pc_bytes_free(pdl->bytes[i]);
+		pdl->bytes[i].readonly = PC_TRUE;
+	}
+	pu->npoints = pdl->npoints;
+	pc_dstats_add_points(pcu->dstats, schema, pu->data, pu->npoints);
+
+	pc_patch_free((PCPATCH*)pdl);
+	pcu->pdl = NULL;
+	pcu->maxpoints = 0;
+}
+
+int
+pc_patch_union_add(PCPATCH_UNION *pcu, const PCPATCH *pa)
+{
+	if ( pcu->schema->pcid != pa->schema->pcid )
+	{
+		pcerror("%s: inconsistent schemas in input", __func__);
+		return PC_FAILURE;
+	}
+
+	if ( ! pa->npoints )
+		return PC_SUCCESS;
+
+	/* Keep the points in columns for as long as every input is dimensional */
+	if ( pa->type == PC_DIMENSIONAL && ! pcu->pu )
+	{
+		pc_patch_union_append_dimensional(pcu, (const PCPATCH_DIMENSIONAL*)pa);
+	}
+	else
+	{
+		PCPATCH_UNCOMPRESSED *pu;
+
+		if ( ! pcu->pu )
+			pc_patch_union_to_uncompressed(pcu);
+
+		pu = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompress(pa);
+		if ( ! pu )
+		{
+			pcerror("%s: unknown compression type (%d)", __func__, pa->type);
+			return PC_FAILURE;
+		}
+		pc_patch_union_append(pcu, pu);
+		if ( (PCPATCH*)pu != pa )
+			pc_patch_free((PCPATCH*)pu);
+	}
+
+	pcu->npoints += pa->npoints;
+	pc_bounds_merge(&(pcu->bounds), &(pa->bounds));
+	return PC_SUCCESS;
+}
+
+int
+pc_patch_union_merge(PCPATCH_UNION *pcu, const PCPATCH_UNION *other)
+{
+	int rv = PC_SUCCESS;
+
+	/* The columns of the other union are added as one dimensional patch */
+	if ( other->pdl )
+	{
+		PCPATCH_DIMENSIONAL view = *(other->pdl);
+		view.bounds = other->bounds;
+		rv = pc_patch_union_add(pcu, (PCPATCH*)&view);
+	}
+
+	if ( other->pu && other->npoints )
+	{
+		PCPATCH *pa = pc_patch_union_result(other);
+		rv = pc_patch_union_add(pcu, pa);
+		pc_patch_free(pa);
+	}
+
+	return rv;
+}
+
+PCPATCH *
+pc_patch_union_result(const PCPATCH_UNION *pcu)
+{
+	PCPATCH_UNCOMPRESSED *paout;
+
+	if ( pcu->pdl )
+	{
+		/* Stats off the columns, then a compressed copy of them */
+		PCPATCH_DIMENSIONAL view = *(pcu->pdl);
+		PCPATCH_DIMENSIONAL *pdl = NULL;
+
+		view.stats = NULL;
+		if ( PC_SUCCESS == pc_patch_dimensional_compute_stats(&view) )
+			pdl = pc_patch_dimensional_compress(&view, NULL);
+		else
+			pcerror("%s: stats computation failed", __func__);
+		if ( view.stats )
+			pc_stats_free(view.stats);
+		return (PCPATCH*)pdl;
+	}
+
+	if ( ! pcu->pu )
+	{
+		/* Nothing but empty inputs */
+		paout = pc_patch_uncompressed_make(pcu->schema, 0);
+		pc_patch_uncompressed_compute_stats(paout);
+		return (PCPATCH*)paout;
+	}
+
+	/* Read-only view on the point buffer, so the union stays usable */
+	paout = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
+	memcpy(paout, pcu->pu, sizeof(PCPATCH_UNCOMPRESSED));
+	paout->readonly = PC_TRUE;
+	paout->maxpoints = 0;
+	paout->bounds = pcu->bounds;
+	paout->stats = pc_stats_new_from_dstats(pcu->schema, pcu->dstats);
 	return (PCPATCH*)paout;
 }
 
@@ -527,9 +868,8 @@ pc_patch_from_patchlist(PCPATCH **palist, int numpatches)
 PCPATCH *
 pc_patch_range(const PCPATCH *pa, int first, int count)
 {
-	PCPATCH_UNCOMPRESSED *paout, *pu;
+	PCPATCH_UNCOMPRESSED *paout;
 	int countmax;
-	uint8_t *buf;
 	size_t size;
 	size_t start;
 
@@ -547,41 +887,202 @@ pc_patch_range(const PCPATCH *pa, int first, int count)
 	if ( count == pa->npoints )
 		return (PCPATCH *) pa;
 
-	paout = pc_patch_uncompressed_make(pa->schema, count);
-	if ( !paout )
-		return NULL;
-	paout->npoints = count;
+	if ( pa->type == PC_LAZPERF )
+	{
+		/* Only decode the points up to the end of the range */
+		paout = pc_patch_lazperf_range((PCPATCH_LAZPERF *) pa, first, count);
+		if ( !paout )
+			return NULL;
+	}
+	else if ( pa->type == PC_NONE )
+	{
+		/* A readonly view on the input points, no copy */
+		paout = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
+		paout->type = PC_NONE;
+		paout->readonly = PC_TRUE;
+		paout->schema = pa->schema;
+		paout->npoints = count;
+		paout->maxpoints = 0;
+		paout->datasize = pa->schema->size * count;
+		paout->data = ((PCPATCH_UNCOMPRESSED *) pa)->data + pa->schema->size * first;
+	}
+	else
+	{
+		/* Cut the range out of the freshly decoded points in place */
+		paout = (PCPATCH_UNCOMPRESSED *) pc_patch_uncompress(pa);
+		if ( !paout )
+			return NULL;
 
-	pu = (PCPATCH_UNCOMPRESSED *) pc_patch_uncompress(pa);
-	if ( !pu )
+		start = pa->schema->size * first;
+		size = pa->schema->size * count;
+		memmove(paout->data, paout->data + start, size);
+		paout->npoints = count;
+		paout->datasize = size;
+	}
+
+	/* Sets the extent too */
+	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(paout) )
 	{
+		pcerror("%s: stats computation failed", __func__);
 		pc_patch_free((PCPATCH *) paout);
 		return NULL;
 	}
 
-	buf = paout->data;
-	start = pa->schema->size * first;
-	size = pa->schema->size * count;
+	/* A run of sorted points is sorted */
+	paout->sortdim = pa->sortdim;
+	return (PCPATCH *) paout;
+}
 
-	memcpy(buf, pu->data + start, size);
+int
+pc_patch_get_values(const PCPATCH *patch, const PCDIMENSION *dim, double *vals)
+{
+	return pc_patch_get_values_multi(patch, (PCDIMENSION **)&dim, 1, vals);
+}
 
-	if ( ((PCPATCH *) pu) != pa )
-		pc_patch_free((PCPATCH *) pu);
+int
+pc_patch_get_values_multi(const PCPATCH *patch, PCDIMENSION **dims, uint32_t ndims, double *vals)
+{
+	PCPATCH_UNCOMPRESSED *pu;
+	PCPOINT pt;
+	uint32_t d, i;
 
-	if ( PC_FAILURE == pc_patch_uncompressed_compute_extent(paout) )
+	if ( patch->type == PC_DIMENSIONAL )
 	{
-		pcerror("%s: extent computation failed", __func__);
-		pc_patch_free((PCPATCH *) paout);
-		return NULL;
+		const PCPATCH_DIMENSIONAL *pdl = (const PCPATCH_DIMENSIONAL *)patch;
+		for ( d = 0; d < ndims; d++ )
+		{
+			if ( PC_FAILURE == pc_bytes_get_values(&(pdl->bytes[dims[d]->position]), dims[d], vals + (size_t)d * patch->npoints) )
+				return PC_FAILURE;
+		}
+		return PC_SUCCESS;
 	}
-	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(paout) )
+
+	/* Other patches are decoded once for all the dimensions */
+	pu = (PCPATCH_UNCOMPRESSED *)pc_patch_uncompress(patch);
+	if ( ! pu )
+		return PC_FAILURE;
+
+	/* Point on stack for fast access to values in patch */
+	pt.readonly = PC_TRUE;
+	pt.schema = patch->schema;
+	for ( d = 0; d < ndims; d++ )
 	{
-		pcerror("%s: stats computation failed", __func__);
-		pc_patch_free((PCPATCH *) paout);
+		double *dvals = vals + (size_t)d * pu->npoints;
+		pt.data = pu->data;
+		for ( i = 0; i < pu->npoints; i++ )
+		{
+			pc_point_get_double(&pt, dims[d], &(dvals[i]));
+			pt.data += patch->schema->size;
+		}
+	}
+
+	if ( (PCPATCH *)pu != patch )
+		pc_patch_free((PCPATCH *)pu);
+	return PC_SUCCESS;
+}
+
+PCPATCH_CURSOR *
+pc_patch_cursor_new(const PCPATCH *pa, uint32_t batchsize)
+{
+	PCPATCH_CURSOR *cur;
+
+	assert(pa);
+	if ( batchsize == 0 )
+		batchsize = 1;
+
+	cur = pcalloc(sizeof(PCPATCH_CURSOR));
+	cur->patch = pa;
+	cur->next = 0;
+	cur->batchsize = batchsize;
+
+	switch ( pa->type )
+	{
+	case PC_NONE:
+		cur->pu = (const PCPATCH_UNCOMPRESSED *) pa;
+		break;
+	case PC_GHT:
+		cur->pu_owned = pc_patch_uncompressed_from_ght((const PCPATCH_GHT *) pa);
+		cur->pu = cur->pu_owned;
+		break;
+	case PC_DIMENSIONAL:
+		cur->pdl = pc_patch_dimensional_decompress((const PCPATCH_DIMENSIONAL *) pa);
+		cur->buf = pcalloc(batchsize * pa->schema->size);
+		break;
+	case PC_LAZPERF:
+		cur->decoder = pc_patch_lazperf_decoder_new((const PCPATCH_LAZPERF *) pa);
+		cur->buf = pcalloc(batchsize * pa->schema->size);
+		break;
+	default:
+		pcerror("%s: unsupported compression %d requested", __func__, pa->type);
+		pcfree(cur);
 		return NULL;
 	}
 
-	return (PCPATCH *) paout;
+	return cur;
+}
+
+uint32_t
+pc_patch_cursor_next(PCPATCH_CURSOR *cur, const uint8_t **points)
+{
+	const PCSCHEMA *schema = cur->patch->schema;
+	uint32_t n = cur->patch->npoints - cur->next;
+	uint32_t i, j;
+
+	if ( n > cur->batchsize )
+		n = cur->batchsize;
+	if ( n == 0 )
+		return 0;
+
+	if ( cur->pu )
+	{
+		/* Already in the point layout, read in place */
+		*points = cur->pu->data + (size_t)cur->next * schema->size;
+	}
+	else if ( cur->pdl )
+	{
+		/* Interleave the batch of every decoded dimension */
+		for ( i = 0; i < schema->ndims; i++ )
+		{
+			const PCDIMENSION *dim = schema->dims[i];
+			const uint8_t *src = cur->pdl->bytes[i].bytes + (size_t)cur->next * dim->size;
+			uint8_t *dst = cur->buf + dim->byteoffset;
+			for ( j = 0; j < n; j++ )
+			{
+				memcpy(dst, src, dim->size);
+				src += dim->size;
+				dst += schema->size;
+			}
+		}
+		*points = cur->buf;
+	}
+	else
+	{
+		if ( pc_patch_lazperf_decoder_read(cur->decoder, cur->buf, n) != n )
+		{
+			pcerror("%s: lazperf decoding failed", __func__);
+			return 0;
+		}
+		*points = cur->buf;
+	}
+
+	cur->next += n;
+	return n;
+}
+
+void
+pc_patch_cursor_free(PCPATCH_CURSOR *cur)
+{
+	if ( ! cur )
+		return;
+	if ( cur->pu_owned )
+		pc_patch_free((PCPATCH *) cur->pu_owned);
+	if ( cur->pdl )
+		pc_patch_dimensional_free(cur->pdl);
+	if ( cur->decoder )
+		pc_patch_lazperf_decoder_free(cur->decoder);
+	if ( cur->buf )
+		pcfree(cur->buf);
+	pcfree(cur);
 }
 
 /** get point n from patch */
@@ -610,119 +1111,14 @@ PCPOINT *pc_patch_pointn(const PCPATCH *patch, int n)
 }
 
 
-static void
-pc_patch_point_set(
-		PCPOINT *p, const uint8_t *data, PCDIMENSION **dims, const uint8_t *def)
-{
-	size_t i;
-	for ( i = 0; i < p->schema->ndims; i++ )
-	{
-		const PCDIMENSION *ddim = dims[i];
-		const PCDIMENSION *pdim = p->schema->dims[i];
-		uint8_t *pdata = p->data + pdim->byteoffset;
-		const uint8_t *ddata = ddim ?
-			data + ddim->byteoffset : def + pdim->byteoffset;
-		memcpy(pdata, ddata, pdim->size);
-	}
-}
-
-
 /** set schema for patch */
 PCPATCH*
 pc_patch_set_schema(PCPATCH *patch, const PCSCHEMA *new_schema, double def)
 {
-	PCDIMENSION** new_dimensions = new_schema->dims;
-	PCDIMENSION* old_dimensions[new_schema->ndims];
-	const PCSCHEMA *old_schema = patch->schema;
-	PCPATCH_UNCOMPRESSED *paout;
-	PCPOINT opt, npt;
-	PCPATCH *pain;
-	PCPOINT *dpt;
-	size_t i, j;
-
-	// create a point for storing the default values
-	dpt = pc_point_make(new_schema);
-
-	for ( j = 0; j < new_schema->ndims; j++ )
-	{
-		PCDIMENSION *ndim = new_dimensions[j];
-		PCDIMENSION *odim = pc_schema_get_dimension_by_name(
-				old_schema, ndim->name);
-		old_dimensions[j] = odim;
-		if ( odim )
-		{
-			if ( ndim->interpretation != odim->interpretation )
-			{
-				pcerror("dimension interpretations are not matching");
-				pc_point_free(dpt);
-				return NULL;
-			}
-		}
-		else
-		{
-			pc_point_set_double(dpt, ndim, def);
-		}
-	}
-
-	pain = pc_patch_uncompress(patch);
-	paout = pc_patch_uncompressed_make(new_schema, patch->npoints);
-	paout->npoints = pain->npoints;
-
-	opt.schema = old_schema;
-	npt.schema = new_schema;
-	opt.readonly = PC_TRUE;
-	npt.readonly = PC_TRUE;
-
-	opt.data = ((PCPATCH_UNCOMPRESSED *) pain)->data;
-	npt.data = paout->data;
-
-	for ( i = 0; i < patch->npoints; i++ )
-	{
-		pc_patch_point_set(&npt, opt.data, old_dimensions, dpt->data);
-		opt.data += old_schema->size;
-		npt.data += new_schema->size;
-	}
-
-	if ( patch->stats )
-	{
-		paout->stats = pc_stats_new(new_schema);
-
-		opt.data = patch->stats->min.data;
-		npt.data = paout->stats->min.data;
-		pc_patch_point_set(&npt, opt.data, old_dimensions, dpt->data);
-
-		opt.data = patch->stats->max.data;
-		npt.data = paout->stats->max.data;
-		pc_patch_point_set(&npt, opt.data, old_dimensions, dpt->data);
-
-		opt.data = patch->stats->avg.data;
-		npt.data = paout->stats->avg.data;
-		pc_patch_point_set(&npt, opt.data, old_dimensions, dpt->data);
-
-		pc_point_get_x(&paout->stats->min, &paout->bounds.xmin);
-		pc_point_get_y(&paout->stats->min, &paout->bounds.ymin);
-		pc_point_get_x(&paout->stats->max, &paout->bounds.xmax);
-		pc_point_get_y(&paout->stats->max, &paout->bounds.ymax);
-	}
-	else
-	{
-		double xscale = npt.schema->xdim->scale / opt.schema->xdim->scale;
-		double yscale = npt.schema->ydim->scale / opt.schema->ydim->scale;
-		double xoffset = npt.schema->xdim->offset - opt.schema->xdim->offset;
-		double yoffset = npt.schema->ydim->offset - opt.schema->ydim->offset;
-
-		paout->bounds.xmin = patch->bounds.xmin * xscale + xoffset;
-		paout->bounds.xmax = patch->bounds.xmax * xscale + xoffset;
-		paout->bounds.ymin = patch->bounds.ymin * yscale + yoffset;
-		paout->bounds.xmax = patch->bounds.ymax * yscale + yoffset;
-	}
-
-	pc_point_free(dpt);
-
-	if ( pain != patch )
-		pc_patch_free(pain);
-
-	return (PCPATCH*) paout;
+	PCREMAP *remap = pc_remap_new(patch->schema, new_schema, def, PC_FALSE);
+	PCPATCH *paout = pc_remap_patch(remap, patch);
+	pc_remap_free(remap);
+	return paout;
 }
 
 
@@ -733,77 +1129,8 @@ pc_patch_set_schema(PCPATCH *patch, const PCSCHEMA *new_schema, double def)
 PCPATCH*
 pc_patch_transform(const PCPATCH *patch, const PCSCHEMA *new_schema, double def)
 {
-	PCDIMENSION** new_dimensions = new_schema->dims;
-	PCDIMENSION* old_dimensions[new_schema->ndims];
-	const PCSCHEMA *old_schema = patch->schema;
-	PCPATCH_UNCOMPRESSED *paout;
-	PCPOINT opt, npt;
-	PCPATCH *pain;
-	size_t i, j;
-
-	if ( old_schema->srid != new_schema->srid )
-	{
-		pcwarn("old and new schemas have different srids, and data "
-			   "reprojection is not yet supported");
-		return NULL;
-	}
-
-	for ( j = 0; j < new_schema->ndims; j++ )
-	{
-		PCDIMENSION *ndim = new_dimensions[j];
-		PCDIMENSION *odim = pc_schema_get_dimension_by_name(
-				old_schema, ndim->name);
-		old_dimensions[j] = odim;
-	}
-
-	pain = pc_patch_uncompress(patch);
-
-	paout = pc_patch_uncompressed_make(new_schema, patch->npoints);
-	paout->npoints = pain->npoints;
-
-	opt.schema = old_schema;
-	npt.schema = new_schema;
-	opt.readonly = PC_TRUE;
-	npt.readonly = PC_TRUE;
-
-	opt.data = ((PCPATCH_UNCOMPRESSED *) pain)->data;
-	npt.data = paout->data;
-
-	// reinterpret the data and fill the output patch
-	//
-	// TODO: for the case where the old and new dimension sets don't intersect (all
-	// the values in old_dimensions are NULL) a faster path could probably be used
-	for ( i = 0; i <patch->npoints; i++ )
-	{
-		for ( j = 0; j < new_schema->ndims; j++ )
-		{
-			// pc_point_get_double returns immediately w/o changing val if the
-			// dimension it is passed is NULL
-			double val = def;
-			pc_point_get_double(&opt, old_dimensions[j], &val);
-			pc_point_set_double(&npt, new_dimensions[j], val);
-		}
-
-		opt.data += old_schema->size;
-		npt.data += new_schema->size;
-	}
-
-	if ( pain != patch )
-		pc_patch_free(pain);
-
-	if ( PC_FAILURE == pc_patch_uncompressed_compute_extent(paout) )
-	{
-		pcerror("%s: failed to compute patch extent", __func__);
-		pc_patch_free((PCPATCH *)paout);
-		return NULL;
-	}
-
-	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(paout) )
-	{
-		pcerror("%s: failed to compute patch stats", __func__);
-		pc_patch_free((PCPATCH *)paout);
-		return NULL;
-	}
-
-	return (PCPATCH*) paout;
+	PCREMAP *remap = pc_remap_new(patch->schema, new_schema, def, PC_TRUE);
+	PCPATCH *paout = pc_remap_patch(remap, patch);
+	pc_remap_free(remap);
+	return paout;
 }
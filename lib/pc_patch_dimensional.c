@@ -52,6 +52,101 @@ pc_patch_dimensional_serialized_size(const PCPATCH_DIMENSIONAL *patch)
 	return size;
 }
 
+size_t
+pc_patch_dimensional_directory_serialized_size(const PCPATCH_DIMENSIONAL *patch)
+{
+	int i;
+	size_t size = 1 + patch->schema->ndims * PC_DIMENTRY_SIZE;
+	for ( i = 0; i < patch->schema->ndims; i++ )
+	{
+		size += patch->bytes[i].size + patch->bytes[i].indexsize;
+	}
+	return size;
+}
+
+/**
+* Write the marker, then the (offset, size, compression) of each
+* dimension, then the bytes of the dimensions one after the other.
+* The buffer is pc_patch_dimensional_directory_serialized_size long.
+*/
+int
+pc_patch_dimensional_directory_serialize(const PCPATCH_DIMENSIONAL *patch, uint8_t *buf)
+{
+	int i;
+	uint8_t *entry = buf + 1;
+	uint32_t offset = 1 + patch->schema->ndims * PC_DIMENTRY_SIZE;
+
+	buf[0] = PC_DIMENSIONAL_DIRECTORY;
+	for ( i = 0; i < patch->schema->ndims; i++ )
+	{
+		const PCBYTES *pcb = &(patch->bytes[i]);
+		uint32_t size = pcb->size + pcb->indexsize;
+		memcpy(entry, &offset, 4);
+		memcpy(entry + 4, &size, 4);
+		entry[8] = pcb->compression | (pcb->indexsize ? PC_DIM_INDEXED : 0);
+		memcpy(buf + offset, pcb->bytes, size);
+		entry += PC_DIMENTRY_SIZE;
+		offset += size;
+	}
+	return PC_SUCCESS;
+}
+
+/**
+* Fill dir with the location of each of the ndims dimensions in
+* the bufsize long serialized dimensional data in buf, read off
+* the directory or, in the older layout with no directory, off
+* the compression and size ahead of each dimension.
+*/
+int
+pc_patch_dimensional_directory_read(const uint8_t *buf, size_t bufsize, uint32_t ndims, int flip_endian, PCDIMENTRY *dir)
+{
+	int i;
+	size_t offset = 0;
+
+	if ( bufsize > 0 && buf[0] == PC_DIMENSIONAL_DIRECTORY )
+	{
+		const uint8_t *entry = buf + 1;
+		if ( bufsize < 1 + (size_t)ndims * PC_DIMENTRY_SIZE )
+		{
+			pcerror("%s: dimension directory overruns the buffer", __func__);
+			return PC_FAILURE;
+		}
+		for ( i = 0; i < ndims; i++ )
+		{
+			dir[i].offset = wkb_get_int32(entry, flip_endian);
+			dir[i].size = wkb_get_int32(entry + 4, flip_endian);
+			dir[i].compression = entry[8];
+			if ( dir[i].offset > bufsize || dir[i].size > bufsize - dir[i].offset )
+			{
+				pcerror("%s: dimension %d overruns the buffer", __func__, i);
+				return PC_FAILURE;
+			}
+			entry += PC_DIMENTRY_SIZE;
+		}
+		return PC_SUCCESS;
+	}
+
+	for ( i = 0; i < ndims; i++ )
+	{
+		/* Compression byte and int32 size */
+		if ( bufsize - offset < 5 )
+		{
+			pcerror("%s: dimension %d overruns the buffer", __func__, i);
+			return PC_FAILURE;
+		}
+		dir[i].compression = buf[offset];
+		dir[i].size = wkb_get_int32(buf + offset + 1, flip_endian);
+		dir[i].offset = offset + 5;
+		if ( dir[i].size > bufsize - dir[i].offset )
+		{
+			pcerror("%s: dimension %d overruns the buffer", __func__, i);
+			return PC_FAILURE;
+		}
+		offset = dir[i].offset + dir[i].size;
+	}
+	return PC_SUCCESS;
+}
+
 
 char *
 pc_patch_dimensional_to_string(const PCPATCH_DIMENSIONAL *pa)
@@ -62,8 +157,13 @@ pc_patch_dimensional_to_string(const PCPATCH_DIMENSIONAL *pa)
 	return str;
 }
 
-PCPATCH_DIMENSIONAL *
-pc_patch_dimensional_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
+/*
+* Dimensionalize into the arena, or onto the heap when it is NULL.
+* A patch in an arena borrows the stats of the input and is never
+* freed on its own, it goes with the arena.
+*/
+static PCPATCH_DIMENSIONAL *
+pc_patch_dimensional_from_uncompressed_mem(PCARENA *arena, const PCPATCH_UNCOMPRESSED *pa)
 {
 	PCPATCH_DIMENSIONAL *pdl;
 	const PCSCHEMA *schema;
@@ -78,19 +178,32 @@ pc_patch_dimensional_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 	if ( npoints == 0 ) return NULL;
 
 	/* Initialize dimensional */
-	pdl = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+	pdl = arena ? pc_arena_alloc(arena, sizeof(PCPATCH_DIMENSIONAL)) : pcalloc(sizeof(PCPATCH_DIMENSIONAL));
 	pdl->type = PC_DIMENSIONAL;
 	pdl->readonly = PC_FALSE;
 	pdl->schema = schema;
 	pdl->npoints = npoints;
 	pdl->bounds = pa->bounds;
-	pdl->stats = pc_stats_clone(pa->stats);
-	pdl->bytes = pcalloc(ndims * sizeof(PCBYTES));
+	pdl->stats = arena ? pa->stats : pc_stats_clone(pa->stats);
+	pdl->bytes = arena ? pc_arena_alloc(arena, ndims * sizeof(PCBYTES)) : pcalloc(ndims * sizeof(PCBYTES));
 
 	for ( i = 0; i < ndims; i++ )
 	{
 		PCDIMENSION *dim = pc_schema_get_dimension(schema, i);
-		pdl->bytes[i] = pc_bytes_make(dim, npoints);
+		if ( arena )
+		{
+			PCBYTES *pcb = &(pdl->bytes[i]);
+			pcb->size = dim->size * npoints;
+			pcb->bytes = pc_arena_alloc(arena, pcb->size);
+			pcb->npoints = npoints;
+			pcb->interpretation = dim->interpretation;
+			pcb->compression = PC_DIM_NONE;
+			pcb->readonly = PC_TRUE;
+		}
+		else
+		{
+			pdl->bytes[i] = pc_bytes_make(dim, npoints);
+		}
 		for ( j = 0; j < npoints; j++ )
 		{
 			uint8_t *to = pdl->bytes[i].bytes + dim->size * j;
@@ -101,13 +214,96 @@ pc_patch_dimensional_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 	return pdl;
 }
 
+PCPATCH_DIMENSIONAL *
+pc_patch_dimensional_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
+{
+	return pc_patch_dimensional_from_uncompressed_mem(NULL, pa);
+}
+
+PCPATCH_DIMENSIONAL *
+pc_patch_dimensional_from_uncompressed_in(PCARENA *arena, const PCPATCH_UNCOMPRESSED *pa)
+{
+	return pc_patch_dimensional_from_uncompressed_mem(arena, pa);
+}
+
+/* The dimensions of a patch encoded or decoded by pc_pool_run */
+typedef struct
+{
+	const PCPATCH_DIMENSIONAL *in;
+	PCPATCH_DIMENSIONAL *out;
+	const PCDIMSTATS *pds;
+} PCDIMTASKS;
+
+static void
+pc_patch_dimensional_encode_task(void *arg, int i)
+{
+	PCDIMTASKS *t = arg;
+	t->out->bytes[i] = pc_bytes_encode(t->in->bytes[i], t->pds->stats[i].recommended_compression);
+}
+
+static void
+pc_patch_dimensional_decode_task(void *arg, int i)
+{
+	PCDIMTASKS *t = arg;
+
+	/* Read uncompressed dimensions in place */
+	if ( t->in->bytes[i].compression == PC_DIM_NONE )
+	{
+		t->out->bytes[i] = t->in->bytes[i];
+		t->out->bytes[i].readonly = PC_TRUE;
+	}
+	else
+	{
+		t->out->bytes[i] = pc_bytes_decode(t->in->bytes[i]);
+	}
+}
+
+/*
+* Run a task on each dimension, on the thread pool for big enough
+* patches. The dimensions are handed out the most work first, so a
+* few large zlib ones start right away and the threads done with
+* them pick up the small ones left.
+*/
+static void
+pc_patch_dimensional_run(pc_pool_task task, PCDIMTASKS *t)
+{
+	int i, j;
+	int ndims = t->in->schema->ndims;
+	PCARENA arena;
+	int *order;
+	size_t *work;
+
+	if ( t->in->npoints < PC_POOL_MIN_POINTS || ndims < 2 || pc_get_num_threads() < 2 )
+	{
+		for ( i = 0; i < ndims; i++ )
+			task(t, i);
+		return;
+	}
+
+	pc_arena_begin(&arena);
+	order = pc_arena_alloc(&arena, ndims * sizeof(int));
+	work = pc_arena_alloc(&arena, ndims * sizeof(size_t));
+	for ( i = 0; i < ndims; i++ )
+	{
+		const PCBYTES *pcb = &(t->in->bytes[i]);
+		int compression = t->pds ? t->pds->stats[i].recommended_compression : pcb->compression;
+		work[i] = (compression & ~PC_DIM_INDEXED) == PC_DIM_ZLIB ? 4 * pcb->size : pcb->size;
+		for ( j = i; j > 0 && work[order[j-1]] < work[i]; j-- )
+			order[j] = order[j-1];
+		order[j] = i;
+	}
+
+	pc_pool_run(task, t, order, ndims);
+	pc_arena_end(&arena);
+}
+
 PCPATCH_DIMENSIONAL *
 pc_patch_dimensional_compress(const PCPATCH_DIMENSIONAL *pdl, PCDIMSTATS *pds_in)
 {
-	int i;
 	int ndims = pdl->schema->ndims;
 	PCPATCH_DIMENSIONAL *pdl_compressed;
 	PCDIMSTATS *pds = pds_in;
+	PCDIMTASKS tasks;
 
 	assert(pdl);
 	assert(pdl->schema);
@@ -125,10 +321,10 @@ pc_patch_dimensional_compress(const PCPATCH_DIMENSIONAL *pdl, PCDIMSTATS *pds_in
 	pdl_compressed->stats = pc_stats_clone(pdl->stats);
 
 	/* Compress each dimension as dictated by stats */
-	for ( i = 0; i < ndims; i++ )
-	{
-		pdl_compressed->bytes[i] = pc_bytes_encode(pdl->bytes[i], pds->stats[i].recommended_compression);
-	}
+	tasks.in = pdl;
+	tasks.out = pdl_compressed;
+	tasks.pds = pds;
+	pc_patch_dimensional_run(pc_patch_dimensional_encode_task, &tasks);
 
 	if ( pds != pds_in ) pc_dimstats_free(pds);
 
@@ -138,9 +334,9 @@ pc_patch_dimensional_compress(const PCPATCH_DIMENSIONAL *pdl, PCDIMSTATS *pds_in
 PCPATCH_DIMENSIONAL *
 pc_patch_dimensional_decompress(const PCPATCH_DIMENSIONAL *pdl)
 {
-	int i;
 	int ndims = pdl->schema->ndims;
 	PCPATCH_DIMENSIONAL *pdl_decompressed;
+	PCDIMTASKS tasks;
 
 	assert(pdl);
 	assert(pdl->schema);
@@ -149,11 +345,11 @@ pc_patch_dimensional_decompress(const PCPATCH_DIMENSIONAL *pdl)
 	memcpy(pdl_decompressed, pdl, sizeof(PCPATCH_DIMENSIONAL));
 	pdl_decompressed->bytes = pcalloc(ndims*sizeof(PCBYTES));
 
-	/* Compress each dimension as dictated by stats */
-	for ( i = 0; i < ndims; i++ )
-	{
-		pdl_decompressed->bytes[i] = pc_bytes_decode(pdl->bytes[i]);
-	}
+	/* Decompress each dimension */
+	tasks.in = pdl;
+	tasks.out = pdl_decompressed;
+	tasks.pds = NULL;
+	pc_patch_dimensional_run(pc_patch_dimensional_decode_task, &tasks);
 
 	return pdl_decompressed;
 }
@@ -176,6 +372,58 @@ pc_patch_dimensional_free(PCPATCH_DIMENSIONAL *pdl)
 	pcfree(pdl);
 }
 
+/**
+* Merge dimensional patches dimension by dimension, without going
+* through an uncompressed copy. Stats and bounds are combined from
+* the inputs rather than recomputed.
+*/
+PCPATCH_DIMENSIONAL *
+pc_patch_dimensional_from_patchlist(PCPATCH_DIMENSIONAL **palist, int numpatches)
+{
+	int i, j;
+	const PCSCHEMA *schema;
+	PCPATCH_DIMENSIONAL *pdl;
+	const PCBYTES **pcbs;
+
+	assert(palist);
+	assert(numpatches);
+	schema = palist[0]->schema;
+
+	pdl = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+	pdl->type = PC_DIMENSIONAL;
+	pdl->readonly = PC_FALSE;
+	pdl->schema = schema;
+	pdl->bytes = pcalloc(schema->ndims * sizeof(PCBYTES));
+	pc_bounds_init(&(pdl->bounds));
+
+	for ( j = 0; j < numpatches; j++ )
+	{
+		pdl->npoints += palist[j]->npoints;
+		pc_bounds_merge(&(pdl->bounds), &(palist[j]->bounds));
+	}
+
+	pcbs = pcalloc(numpatches * sizeof(PCBYTES*));
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		for ( j = 0; j < numpatches; j++ )
+			pcbs[j] = &(palist[j]->bytes[i]);
+		pdl->bytes[i] = pc_bytes_merge(pcbs, numpatches);
+	}
+	pcfree(pcbs);
+
+	/*
+	* The stored averages are rounded to the dimension, so the merged
+	* ones are read back from the merged bytes rather than weighted
+	*/
+	if ( PC_FAILURE == pc_patch_dimensional_compute_stats(pdl) )
+	{
+		pcerror("%s: stats computation failed", __func__);
+		return NULL;
+	}
+
+	return pdl;
+}
+
 int
 pc_patch_dimensional_compute_extent(PCPATCH_DIMENSIONAL *pdl)
 {
@@ -209,6 +457,44 @@ pc_patch_dimensional_compute_extent(PCPATCH_DIMENSIONAL *pdl)
 	return PC_SUCCESS;
 }
 
+/**
+* Stats read off each dimension in its own encoding, so the
+* patch is never copied out to an uncompressed buffer.
+*/
+int
+pc_patch_dimensional_compute_stats(PCPATCH_DIMENSIONAL *pdl)
+{
+	int i;
+	double min, max, avg;
+	const PCSCHEMA *schema = pdl->schema;
+	PCARENA arena;
+	PCDOUBLESTATS *dstats;
+	PC_COUNTER_START(t0);
+
+	pc_arena_begin(&arena);
+	dstats = pc_dstats_new_in(&arena, schema->ndims);
+	for ( i = 0; pdl->npoints && i < schema->ndims; i++ )
+	{
+		const PCDIMENSION *dim = schema->dims[i];
+		if ( PC_FAILURE == pc_bytes_minmax(&(pdl->bytes[i]), &min, &max, &avg) )
+		{
+			pc_arena_end(&arena);
+			return PC_FAILURE;
+		}
+		min = pc_value_scale_offset(min, dim);
+		max = pc_value_scale_offset(max, dim);
+		dstats->dims[i].min = min < max ? min : max;
+		dstats->dims[i].max = min < max ? max : min;
+		dstats->dims[i].sum = pc_value_scale_offset(avg, dim) * pdl->npoints;
+	}
+	dstats->npoints = pdl->npoints;
+
+	pc_patch_set_dstats((PCPATCH*)pdl, dstats);
+	pc_arena_end(&arena);
+	PC_COUNTER_STOP(PC_OP_STATS, t0, pdl->npoints, pc_patch_dimensional_serialized_size(pdl), 0);
+	return PC_SUCCESS;
+}
+
 uint8_t *
 pc_patch_dimensional_to_wkb(const PCPATCH_DIMENSIONAL *patch, size_t *wkbsize)
 {
@@ -258,12 +544,14 @@ pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t
 	uint32:   pcid (key to POINTCLOUD_SCHEMAS)
 	uint32:   compression (0 = no compression, 1 = dimensional, 2 = GHT)
 	uint32:   npoints
-	dimensions[]:  dims (interpret relative to pcid and compressions)
+	dimensions[]:  dims (interpret relative to pcid and compressions),
+	               optionally behind a dimension directory
 	*/
 	static size_t hdrsz = 1+4+4+4; /* endian + pcid + compression + npoints */
 	PCPATCH_DIMENSIONAL *patch;
 	uint8_t swap_endian = (wkb[0] != machine_endian());
 	uint32_t npoints, ndims;
+	PCDIMENTRY *dir;
 	const uint8_t *buf;
 	int i;
 
@@ -276,6 +564,20 @@ pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t
 	npoints = wkb_get_npoints(wkb);
 	ndims = schema->ndims;
 
+	if ( wkbsize < hdrsz )
+	{
+		pcerror("%s: wkb is too short to hold a patch", __func__);
+		return NULL;
+	}
+
+	buf = wkb+hdrsz;
+	dir = pcalloc(ndims*sizeof(PCDIMENTRY));
+	if ( pc_patch_dimensional_directory_read(buf, wkbsize - hdrsz, ndims, swap_endian, dir) == PC_FAILURE )
+	{
+		pcfree(dir);
+		return NULL;
+	}
+
 	patch = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
 	patch->type = PC_DIMENSIONAL;
 	patch->readonly = PC_FALSE;
@@ -283,16 +585,12 @@ pc_patch_dimensional_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t
 	patch->npoints = npoints;
 	patch->bytes = pcalloc(ndims*sizeof(PCBYTES));
 
-	buf = wkb+hdrsz;
 	for ( i = 0; i < ndims; i++ )
 	{
-		PCBYTES *pcb = &(patch->bytes[i]);
-		PCDIMENSION *dim = schema->dims[i];
-		pc_bytes_deserialize(buf, dim, pcb, PC_FALSE /*readonly*/, swap_endian);
-		pcb->npoints = npoints;
-		buf += pc_bytes_serialized_size(pcb);
+		pc_bytes_from_dimentry(buf, &(dir[i]), schema->dims[i], npoints, &(patch->bytes[i]), PC_FALSE /*readonly*/, swap_endian);
 	}
 
+	pcfree(dir);
 	return (PCPATCH*)patch;
 }
 
@@ -77,16 +77,12 @@ ght_schema_from_pc_schema(const PCSCHEMA *pcschema)
 	return schema;
 }
 
+/* Tree of a patch whose attributes refer to the dimensions of ghtschema */
 static GhtTreePtr
-ght_tree_from_pc_patch(const PCPATCH_GHT *paght)
+ght_tree_from_pc_patch_schema(const PCPATCH_GHT *paght, GhtSchemaPtr ghtschema)
 {
 	GhtTreePtr tree;
 	GhtReaderPtr reader;
-	GhtSchemaPtr ghtschema;
-
-	ghtschema = ght_schema_from_pc_schema(paght->schema);
-	if ( ! ghtschema )
-		return NULL;
 
 	if ( GHT_OK != ght_reader_new_mem(paght->ght, paght->ghtsize, ghtschema, &reader) )
 		return NULL;
@@ -96,6 +92,18 @@ ght_tree_from_pc_patch(const PCPATCH_GHT *paght)
 
 	return tree;
 }
+
+static GhtTreePtr
+ght_tree_from_pc_patch(const PCPATCH_GHT *paght)
+{
+	GhtSchemaPtr ghtschema;
+
+	ghtschema = ght_schema_from_pc_schema(paght->schema);
+	if ( ! ghtschema )
+		return NULL;
+
+	return ght_tree_from_pc_patch_schema(paght, ghtschema);
+}
 #endif /* HAVE_LIBGHT */
 
 PCPATCH_GHT *
@@ -125,6 +133,7 @@ pc_patch_ght_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 	PCDIMENSION *xdim, *ydim;
 	PCPATCH_GHT *paght = NULL;
 	size_t pt_size = pa->schema->size;
+	PC_COUNTER_START(t0);
 
 	/* Cannot handle empty patches */
 	if ( ! pa || ! pa->npoints ) return NULL;
@@ -215,6 +224,7 @@ pc_patch_ght_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 		paght->ght = pcalloc(paght->ghtsize);
 		ght_writer_get_bytes(writer, paght->ght);
 		ght_writer_free(writer);
+		PC_COUNTER_STOP(PC_OP_GHT_ENCODE, t0, pa->npoints, pa->datasize, paght->ghtsize);
 	}
 
 	// Let the hierarchical memory manager clean up the tree
@@ -263,6 +273,7 @@ pc_patch_uncompressed_from_ght(const PCPATCH_GHT *paght)
 	GhtNodePtr node;
 	GhtTreePtr tree;
 	GhtAttributePtr attr;
+	PC_COUNTER_START(t0);
 
 	/* Build a structured tree from the tree serialization */
 	if ( ! paght || ! paght->ght ) return NULL;
@@ -322,6 +333,8 @@ pc_patch_uncompressed_from_ght(const PCPATCH_GHT *paght)
 	ght_nodelist_free_deep(nodelist);
 	// ght_tree_free(tree);
 
+	PC_COUNTER_STOP(PC_OP_GHT_DECODE, t0, npoints, paght->ghtsize, patch->datasize);
+
 	/* Done */
 	return patch;
 #endif
@@ -572,6 +585,159 @@ pc_patch_ght_filter(const PCPATCH_GHT *patch, uint32_t dimnum, PC_FILTERTYPE fil
 }
 
 
+/**
+* Copy of the patch, for filters the stats or bounds say it passes
+* whole. The tree buffer is copied as it is, never read.
+*/
+PCPATCH_GHT *
+pc_patch_ght_clone(const PCPATCH_GHT *patch)
+{
+	PCPATCH_GHT *paght = pcalloc(sizeof(PCPATCH_GHT));
+
+	paght->type = PC_GHT;
+	paght->readonly = PC_FALSE;
+	paght->schema = patch->schema;
+	paght->npoints = patch->npoints;
+	paght->bounds = patch->bounds;
+	paght->stats = pc_stats_clone(patch->stats);
+	paght->ghtsize = patch->ghtsize;
+	if ( patch->ghtsize )
+	{
+		paght->ght = pcalloc(patch->ghtsize);
+		memcpy(paght->ght, patch->ght, patch->ghtsize);
+	}
+	return paght;
+}
+
+/**
+* Merge GHT patches into one tree. Each input tree is read from its
+* buffer and its leaves are moved into the new tree with the hashes
+* and attributes they already have, so no point is decoded to
+* coordinates and hashed again. Bounds and stats are combined from the
+* inputs. Returns NULL, without an error, when libght turns a node
+* down, the caller can then merge the points.
+*/
+PCPATCH_GHT *
+pc_patch_ght_from_patchlist(PCPATCH_GHT **palist, int numpatches)
+{
+#ifndef HAVE_LIBGHT
+	pcerror("%s: libght support is not enabled", __func__);
+	return NULL;
+#else
+	const PCSCHEMA *schema;
+	GhtSchemaPtr ghtschema;
+	GhtTreePtr tree;
+	GhtNodeListPtr nodelist;
+	GhtNodePtr node;
+	GhtWriterPtr writer;
+	PCPATCH_GHT *paght;
+	PCDOUBLESTATS *dstats;
+	int i, j, npoints;
+	uint32_t totalpoints = 0;
+
+	assert(palist);
+	assert(numpatches);
+	schema = palist[0]->schema;
+
+	/* One libght schema for all the trees, so their attributes compare */
+	ghtschema = ght_schema_from_pc_schema(schema);
+	if ( ! ghtschema || ght_tree_new(ghtschema, &tree) != GHT_OK )
+		return NULL;
+
+	for ( i = 0; i < numpatches; i++ )
+	{
+		GhtTreePtr intree;
+
+		if ( ! palist[i]->npoints )
+			continue;
+		totalpoints += palist[i]->npoints;
+
+		intree = ght_tree_from_pc_patch_schema(palist[i], ghtschema);
+		if ( ! intree )
+			goto fail;
+
+		/* The list holds copies of the leaves, the input tree can go */
+		ght_nodelist_new(palist[i]->npoints, &nodelist);
+		ght_tree_to_nodelist(intree, nodelist);
+		ght_tree_free(intree);
+
+		ght_nodelist_get_num_nodes(nodelist, &npoints);
+		for ( j = 0; j < npoints; j++ )
+		{
+			ght_nodelist_get_node(nodelist, j, &node);
+			if ( ght_tree_insert_node(tree, node) != GHT_OK )
+			{
+				/* Nodes not handed to the tree yet are still ours */
+				for ( j++; j < npoints; j++ )
+				{
+					ght_nodelist_get_node(nodelist, j, &node);
+					ght_node_free(node);
+				}
+				ght_nodelist_free_shallow(nodelist);
+				goto fail;
+			}
+		}
+		/* The nodes now belong to the new tree */
+		ght_nodelist_free_shallow(nodelist);
+	}
+
+	/* Points libght folded together would throw the merged stats off */
+	if ( ght_tree_compact_attributes(tree) != GHT_OK )
+		goto fail;
+	ght_tree_get_numpoints(tree, &npoints);
+	if ( npoints != (int)totalpoints )
+		goto fail;
+
+	paght = pcalloc(sizeof(PCPATCH_GHT));
+	paght->type = PC_GHT;
+	paght->readonly = PC_FALSE;
+	paght->schema = schema;
+	paght->npoints = npoints;
+	pc_bounds_init(&(paght->bounds));
+	for ( i = 0; i < numpatches; i++ )
+		pc_bounds_merge(&(paght->bounds), &(palist[i]->bounds));
+
+	ght_writer_new_mem(&writer);
+	ght_tree_write(tree, writer);
+	ght_writer_get_size(writer, &(paght->ghtsize));
+	paght->ght = pcalloc(paght->ghtsize);
+	ght_writer_get_bytes(writer, paght->ght);
+	ght_writer_free(writer);
+	ght_tree_free(tree);
+
+	/*
+	* Min and max of the inputs, their averages weighted by point count.
+	* Those averages are rounded to the precision of their dimension,
+	* so the merged one is within that precision. Inputs without stats
+	* leave the merged points to be read.
+	*/
+	dstats = pc_dstats_new(schema->ndims);
+	for ( i = 0; i < numpatches; i++ )
+	{
+		if ( palist[i]->npoints && ! palist[i]->stats )
+			break;
+		if ( palist[i]->npoints )
+			pc_dstats_add_stats(dstats, palist[i]->stats, palist[i]->npoints);
+	}
+	if ( i == numpatches )
+		paght->stats = pc_stats_new_from_dstats(schema, dstats);
+	pc_dstats_free(dstats);
+
+	if ( ! paght->stats && PC_FAILURE == pc_patch_compute_stats((PCPATCH*)paght) )
+	{
+		pc_patch_ght_free(paght);
+		pcerror("%s: stats computation failed", __func__);
+		return NULL;
+	}
+
+	return paght;
+
+fail:
+	ght_tree_free(tree);
+	return NULL;
+#endif
+}
+
 PCPOINTLIST *
 pc_pointlist_from_ght(const PCPATCH_GHT *pag)
 {
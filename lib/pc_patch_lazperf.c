@@ -16,7 +16,10 @@ void
 pc_patch_lazperf_free(PCPATCH_LAZPERF *pal)
 {
 	assert(pal);
-	pcfree(pal->lazperf);
+	/* A readonly patch points into its serialized form, */
+	/* so only free a readwrite buffer */
+	if ( ! pal->readonly )
+		pcfree(pal->lazperf);
 	pcfree(pal);
 }
 
@@ -40,6 +43,7 @@ pc_patch_lazperf_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 
 	PCPATCH_LAZPERF *palaz = NULL;
 	uint8_t *compressed;
+	PC_COUNTER_START(t0);
 
 	// cpp call to get compressed data from pcpatch
 	size_t compressSize = lazperf_compress_from_uncompressed(pa, &compressed);
@@ -51,16 +55,14 @@ pc_patch_lazperf_from_uncompressed(const PCPATCH_UNCOMPRESSED *pa)
 		palaz->readonly = PC_FALSE;
 		palaz->schema = pa->schema;
 
-		// not optimal but we have to pass by the context manager otherwise
-		// a segfault happenned (sometimes) during a pcfree of lazperf field
-		palaz->lazperf = (uint8_t*) pcalloc(compressSize);
-		memcpy(palaz->lazperf, compressed, compressSize);
-		free(compressed);
+		// the adapter writes straight into a pcalloc'd buffer
+		palaz->lazperf = compressed;
 
 		palaz->npoints = pa->npoints;
 		palaz->bounds = pa->bounds;
 		palaz->stats = pc_stats_clone(pa->stats);
 		palaz->lazperfsize = compressSize;
+		PC_COUNTER_STOP(PC_OP_LAZPERF_ENCODE, t0, pa->npoints, pa->datasize, compressSize);
 	}
 	else
 		pcerror("%s: LAZ compressionf failed", __func__);
@@ -88,10 +90,12 @@ pc_patch_uncompressed_from_lazperf(const PCPATCH_LAZPERF *palaz)
 #endif
 
 	PCPATCH_UNCOMPRESSED *pcu = NULL;
-	uint8_t *decompressed;
+	size_t datasize = palaz->schema->size * palaz->npoints;
+	uint8_t *decompressed = (uint8_t*) pcalloc(datasize);
+	PC_COUNTER_START(t0);
 
-	// cpp call to uncompressed data
-	size_t size = lazperf_uncompress_from_compressed(palaz, &decompressed);
+	// cpp call to decompress straight into the patch buffer
+	size_t size = lazperf_uncompress_from_compressed(palaz, decompressed);
 
 	if (size != -1)
 	{
@@ -102,17 +106,16 @@ pc_patch_uncompressed_from_lazperf(const PCPATCH_LAZPERF *palaz)
 		pcu->npoints = palaz->npoints;
 		pcu->bounds = palaz->bounds;
 		pcu->stats = pc_stats_clone(palaz->stats);
-
-		// not optimal but we have to pass by the context manager otherwise
-		// a segfault happenned (sometimes) during a pcfree of lazperf field
-		pcu->data = (uint8_t*) pcalloc(palaz->schema->size * palaz->npoints);
-		memcpy(pcu->data, decompressed, palaz->schema->size * palaz->npoints);
-		free(decompressed);
-
+		pcu->data = decompressed;
+		pcu->datasize = datasize;
 		pcu->maxpoints = palaz->npoints;
+		PC_COUNTER_STOP(PC_OP_LAZPERF_DECODE, t0, palaz->npoints, palaz->lazperfsize, datasize);
 	}
 	else
+	{
+		pcfree(decompressed);
 		pcerror("%s: lazperf uncompression failed", __func__);
+	}
 
 	return pcu;
 }
@@ -221,16 +224,61 @@ pc_patch_lazperf_from_wkb(const PCSCHEMA *schema, const uint8_t *wkb, size_t wkb
 #endif
 }
 
+/**
+* Stats and extent folded in as the points stream out of the decoder,
+* a chunk at a time, so the patch is never decompressed whole.
+*/
 int
-pc_patch_lazperf_compute_extent(PCPATCH_LAZPERF *patch)
+pc_patch_lazperf_compute_stats(PCPATCH_LAZPERF *patch)
 {
 #ifndef HAVE_LAZPERF
 	pcerror("%s: lazperf support is not enabled", __func__);
 	return PC_FAILURE;
 #endif
 
-	PCPATCH_UNCOMPRESSED *pau = pc_patch_uncompressed_from_lazperf(patch);
-	return pc_patch_uncompressed_compute_extent(pau);
+	const PCSCHEMA *schema = patch->schema;
+	PCDOUBLESTATS *dstats;
+	PCARENA arena;
+	LAZPERF_DECODER *dec;
+	uint8_t *buf;
+	uint32_t k, n;
+	int rv = PC_SUCCESS;
+
+	dec = lazperf_decoder_new(patch);
+	if ( ! dec )
+	{
+		pcerror("%s: lazperf uncompression failed", __func__);
+		return PC_FAILURE;
+	}
+
+	pc_arena_begin(&arena);
+	dstats = pc_dstats_new_in(&arena, schema->ndims);
+	buf = pc_arena_alloc(&arena, schema->size * PC_VALUES_CHUNK);
+	for ( k = 0; k < patch->npoints; k += n )
+	{
+		n = patch->npoints - k < PC_VALUES_CHUNK ? patch->npoints - k : PC_VALUES_CHUNK;
+		if ( lazperf_decoder_read(dec, buf, n) != n )
+		{
+			pcerror("%s: lazperf uncompression failed", __func__);
+			rv = PC_FAILURE;
+			break;
+		}
+		pc_dstats_add_points(dstats, schema, buf, n);
+	}
+
+	if ( rv == PC_SUCCESS )
+		pc_patch_set_dstats((PCPATCH*)patch, dstats);
+
+	pc_arena_end(&arena);
+	lazperf_decoder_free(dec);
+	return rv;
+}
+
+/* The extent comes with the stats, in the same pass */
+int
+pc_patch_lazperf_compute_extent(PCPATCH_LAZPERF *patch)
+{
+	return pc_patch_lazperf_compute_stats(patch);
 }
 
 PCPOINT *
@@ -242,9 +290,86 @@ pc_patch_lazperf_pointn(const PCPATCH_LAZPERF *patch, int n)
 #endif
 
 	PCPOINT *pt = pc_point_make(patch->schema);
-	PCPATCH_UNCOMPRESSED *pau = pc_patch_uncompressed_from_lazperf(patch);
-	size_t size = patch->schema->size;
-	memcpy(pt->data, pau->data + n * size, size);
-	pc_patch_free((PCPATCH*) pau);
+
+	// only the points up to n are decoded
+	if (lazperf_uncompress_range(patch, n, 1, pt->data) != 1)
+	{
+		pc_point_free(pt);
+		pcerror("%s: lazperf uncompression failed", __func__);
+		return NULL;
+	}
+
 	return pt;
 }
+
+// first: the first element to select (0-based indexing)
+// count: the number of points to select
+PCPATCH_UNCOMPRESSED *
+pc_patch_lazperf_range(const PCPATCH_LAZPERF *patch, int first, int count)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return NULL;
+#endif
+
+	PCPATCH_UNCOMPRESSED *pu = pc_patch_uncompressed_make(patch->schema, count);
+	if (!pu)
+		return NULL;
+
+	if (lazperf_uncompress_range(patch, first, count, pu->data) != count)
+	{
+		pc_patch_free((PCPATCH*) pu);
+		pcerror("%s: lazperf uncompression failed", __func__);
+		return NULL;
+	}
+	pu->npoints = count;
+
+	return pu;
+}
+
+LAZPERF_DECODER *
+pc_patch_lazperf_decoder_new(const PCPATCH_LAZPERF *patch)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return NULL;
+#endif
+
+	return lazperf_decoder_new(patch);
+}
+
+int
+pc_patch_lazperf_decoder_next(LAZPERF_DECODER *dec, PCPOINT *pt)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return PC_FAILURE;
+#endif
+
+	if (lazperf_decoder_read(dec, pt->data, 1) != 1)
+		return PC_FAILURE;
+
+	return PC_SUCCESS;
+}
+
+uint32_t
+pc_patch_lazperf_decoder_read(LAZPERF_DECODER *dec, uint8_t *buf, uint32_t npoints)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return 0;
+#endif
+
+	return lazperf_decoder_read(dec, buf, npoints);
+}
+
+void
+pc_patch_lazperf_decoder_free(LAZPERF_DECODER *dec)
+{
+#ifndef HAVE_LAZPERF
+	pcerror("%s: lazperf support is not enabled", __func__);
+	return;
+#endif
+
+	lazperf_decoder_free(dec);
+}
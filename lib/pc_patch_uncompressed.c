@@ -188,27 +188,34 @@ pc_patch_uncompressed_make(const PCSCHEMA *s, uint32_t maxpoints)
 int
 pc_patch_uncompressed_compute_extent(PCPATCH_UNCOMPRESSED *patch)
 {
-	int i;
-	PCPOINT *pt = pc_point_from_data(patch->schema, patch->data);
+	uint32_t i, k, n;
+	const PCSCHEMA *schema = patch->schema;
+	const PCDIMENSION *xdim = schema->xdim;
+	const PCDIMENSION *ydim = schema->ydim;
+	double xs[PC_VALUES_CHUNK], ys[PC_VALUES_CHUNK];
 	PCBOUNDS b;
-	double x, y;
 
-	/* Calculate bounds */
+	if ( ! ( xdim && ydim ) )
+		return PC_FAILURE;
+
+	/* Calculate bounds, converting a chunk of points at a time */
 	pc_bounds_init(&b);
-	for ( i = 0; i < patch->npoints; i++ )
+	for ( k = 0; k < patch->npoints; k += n )
 	{
-		/* Just push the data buffer forward by one point at a time */
-		pt->data = patch->data + i * patch->schema->size;
-		pc_point_get_x(pt, &x);
-		pc_point_get_y(pt, &y);
-		if ( b.xmin > x ) b.xmin = x;
-		if ( b.ymin > y ) b.ymin = y;
-		if ( b.xmax < x ) b.xmax = x;
-		if ( b.ymax < y ) b.ymax = y;
+		const uint8_t *ptr = patch->data + (size_t)k * schema->size;
+		n = patch->npoints - k < PC_VALUES_CHUNK ? patch->npoints - k : PC_VALUES_CHUNK;
+		pc_values_to_double(ptr + xdim->byteoffset, schema->size, xdim->interpretation, xdim->scale, xdim->offset, n, xs);
+		pc_values_to_double(ptr + ydim->byteoffset, schema->size, ydim->interpretation, ydim->scale, ydim->offset, n, ys);
+		for ( i = 0; i < n; i++ )
+		{
+			if ( b.xmin > xs[i] ) b.xmin = xs[i];
+			if ( b.ymin > ys[i] ) b.ymin = ys[i];
+			if ( b.xmax < xs[i] ) b.xmax = xs[i];
+			if ( b.ymax < ys[i] ) b.ymax = ys[i];
+		}
 	}
 
 	patch->bounds = b;
-	pcfree(pt);
 	return PC_SUCCESS;
 }
 
@@ -291,6 +298,15 @@ pc_patch_uncompressed_from_pointlist(const PCPOINTLIST *pl)
 	pch->schema = s;
 	pch->npoints = 0;
 
+	/* Rows are copied in one go */
+	if ( pl->schema )
+	{
+		memcpy(ptr, pl->data, pch->datasize);
+		PC_COUNT_COPY(pch->datasize);
+		pch->npoints = numpts;
+		numpts = 0;
+	}
+
 	for ( i = 0; i < numpts; i++ )
 	{
 		pt = pc_pointlist_get_point(pl, i);
@@ -311,12 +327,7 @@ pc_patch_uncompressed_from_pointlist(const PCPOINTLIST *pl)
 		}
 	}
 
-	if ( PC_FAILURE == pc_patch_uncompressed_compute_extent(pch) )
-	{
-		pcerror("%s: failed to compute patch extent", __func__);
-		return NULL;
-	}
-
+	/* Sets the extent too */
 	if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(pch) )
 	{
 		pcerror("%s: failed to compute patch stats", __func__);
@@ -416,6 +427,7 @@ pc_patch_uncompressed_add_point(PCPATCH_UNCOMPRESSED *c, const PCPOINT *p)
 	ptr = c->data + sz * c->npoints;
 	memcpy(ptr, p->data, sz);
 	c->npoints += 1;
+	c->sortdim = 0;
 
 	/* Update bounding box */
 	pc_point_get_x(p, &x);
@@ -24,24 +24,124 @@ pc_pointlist_make(uint32_t npoints)
 	return pl;
 }
 
+/* Point the views from first on at their rows */
+static void
+pc_pointlist_set_views(PCPOINTLIST *pl, uint32_t first)
+{
+	uint32_t i;
+	size_t sz = pl->schema->size;
+	for ( i = first; i < pl->npoints; i++ )
+	{
+		PCPOINT *pt = &(pl->views[i]);
+		pt->readonly = PC_TRUE;
+		pt->schema = pl->schema;
+		pt->data = pl->data + i * sz;
+		pl->points[i] = pt;
+	}
+}
+
+/* Room for maxpoints rows, the rows and views may move */
+static void
+pc_pointlist_grow_rows(PCPOINTLIST *pl, uint32_t maxpoints)
+{
+	size_t sz = pl->schema->size;
+	if ( pl->mem != pl->data && pl->data )
+	{
+		pcerror("%s: cannot add points to the rows of a patch", __func__);
+		return;
+	}
+	if ( pl->data )
+	{
+		pl->data = pcrealloc(pl->data, maxpoints * sz);
+		pl->points = pcrealloc(pl->points, maxpoints * sizeof(PCPOINT*));
+		pl->views = pcrealloc(pl->views, maxpoints * sizeof(PCPOINT));
+	}
+	else
+	{
+		pl->data = pcalloc(maxpoints * sz);
+		pl->points = pcalloc(maxpoints * sizeof(PCPOINT*));
+		pl->views = pcalloc(maxpoints * sizeof(PCPOINT));
+	}
+	pl->mem = pl->data;
+	pl->maxpoints = maxpoints;
+	pc_pointlist_set_views(pl, 0);
+}
+
+PCPOINTLIST *
+pc_pointlist_make_rows(const PCSCHEMA *schema, uint32_t npoints)
+{
+	PCPOINTLIST *pl = pcalloc(sizeof(PCPOINTLIST));
+	pl->schema = schema;
+	if ( npoints )
+		pc_pointlist_grow_rows(pl, npoints);
+	return pl;
+}
+
+/**
+* A list of views into npoints rows of data, which it frees with
+* itself when mem is data. Rows owned elsewhere cannot be added to.
+*/
+PCPOINTLIST *
+pc_pointlist_from_rows(const PCSCHEMA *schema, uint8_t *data, uint32_t npoints, void *mem)
+{
+	PCPOINTLIST *pl = pcalloc(sizeof(PCPOINTLIST));
+	pl->schema = schema;
+	pl->data = data;
+	pl->mem = mem;
+	pl->npoints = pl->maxpoints = npoints;
+	pl->points = pcalloc(sizeof(PCPOINT*) * npoints);
+	pl->views = pcalloc(sizeof(PCPOINT) * npoints);
+	pc_pointlist_set_views(pl, 0);
+	return pl;
+}
+
 void
 pc_pointlist_free(PCPOINTLIST *pl)
 {
 	int i;
-	for ( i = 0; i < pl->npoints; i++ )
+	/* The points of a list of rows are views into them */
+	for ( i = 0; ! pl->schema && i < pl->npoints; i++ )
 	{
 		pc_point_free(pl->points[i]);
 	}
 	if ( pl->mem )
 		pcfree(pl->mem);
-	pcfree(pl->points);
+	if ( pl->views )
+		pcfree(pl->views);
+	if ( pl->points )
+		pcfree(pl->points);
 	pcfree(pl);
 	return;
 }
 
+void
+pc_pointlist_add_row(PCPOINTLIST *pl, const uint8_t *data)
+{
+	size_t sz = pl->schema->size;
+	if ( pl->npoints >= pl->maxpoints )
+		pc_pointlist_grow_rows(pl, pl->maxpoints ? 2 * pl->maxpoints : 1);
+
+	memcpy(pl->data + pl->npoints * sz, data, sz);
+	pl->npoints += 1;
+	pc_pointlist_set_views(pl, pl->npoints - 1);
+}
+
 void
 pc_pointlist_add_point(PCPOINTLIST *pl, PCPOINT *pt)
 {
+	/* Lists of rows take a copy, the point is theirs to free all the same */
+	if ( pl->schema )
+	{
+		if ( pt->schema->pcid != pl->schema->pcid )
+		{
+			pcerror("%s: points do not share a schema", __func__);
+			return;
+		}
+		pc_pointlist_add_row(pl, pt->data);
+		pc_point_free(pt);
+		return;
+	}
+
 	if ( pl->npoints >= pl->maxpoints )
 	{
 		if ( pl->maxpoints < 1 ) pl->maxpoints = 1;
@@ -63,35 +163,15 @@ pc_pointlist_get_point(const PCPOINTLIST *pl, int i)
 PCPOINTLIST *
 pc_pointlist_from_dimensional(const PCPATCH_DIMENSIONAL *pdl)
 {
+	PCPATCH_UNCOMPRESSED *pu;
 	PCPOINTLIST *pl;
-	PCPATCH_DIMENSIONAL *pdl_uncompressed;
-	const PCSCHEMA *schema = pdl->schema;
-	int i, j, ndims, npoints;
-	uint8_t *data;
 	assert(pdl);
 
-	pdl_uncompressed = pc_patch_dimensional_decompress(pdl);
-
-	ndims = schema->ndims;
-	npoints = pdl->npoints;
-	pl = pc_pointlist_make(npoints);
-	pl->mem = data = pcalloc(npoints * schema->size);
-
-	for ( i = 0; i < npoints; i++ )
-	{
-		PCPOINT *pt = pc_point_from_data(schema,data);
-		for ( j = 0; j < ndims; j++ )
-		{
-			PCDIMENSION *dim = pc_schema_get_dimension(schema, j);
-
-			uint8_t *in = pdl_uncompressed->bytes[j].bytes + dim->size * i;
-			uint8_t *out = data + dim->byteoffset;
-			memcpy(out, in, dim->size);
-		}
-		pc_pointlist_add_point(pl, pt);
-		data += schema->size;
-	}
-	pc_patch_dimensional_free(pdl_uncompressed);
+	/* Rows of the decoded patch, handed over to the list */
+	pu = pc_patch_uncompressed_from_dimensional(pdl);
+	pl = pc_pointlist_from_rows(pdl->schema, pu->data, pu->npoints, NULL);
+	pl->mem = pc_patch_uncompressed_readonly(pu);
+	pc_patch_free((PCPATCH*)pu);
 
 	return pl;
 }
@@ -99,17 +179,8 @@ pc_pointlist_from_dimensional(const PCPATCH_DIMENSIONAL *pdl)
 PCPOINTLIST *
 pc_pointlist_from_uncompressed(const PCPATCH_UNCOMPRESSED *patch)
 {
-	int i;
-	PCPOINTLIST *pl;
-	size_t pt_size = patch->schema->size;
-	uint32_t npoints = patch->npoints;
-
-	pl = pc_pointlist_make(npoints);
-	for ( i = 0; i < npoints; i++ )
-	{
-		pc_pointlist_add_point(pl, pc_point_from_data(patch->schema, patch->data + i*pt_size));
-	}
-	return pl;
+	/* Views straight into the patch, which must outlive the list */
+	return pc_pointlist_from_rows(patch->schema, patch->data, patch->npoints, NULL);
 }
 
 PCPOINTLIST *
@@ -0,0 +1,187 @@
+/***********************************************************************
+* pc_pool.c
+*
+*  A small pool of threads to work on the dimensions of a patch
+*  concurrently. The threads are started on first use and stay
+*  around for the life of the process.
+*
+*  Only the default allocators are known to be thread safe, so setting
+*  custom ones (as the PgSQL backend does) turns the pool off.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+/* 1 to stay serial, 0 for one thread per processor */
+static int pc_num_threads = 1;
+
+void
+pc_set_num_threads(int nthreads)
+{
+	pc_num_threads = nthreads < 0 ? 1 : nthreads;
+}
+
+int
+pc_get_num_threads(void)
+{
+#ifdef HAVE_PTHREAD
+	if ( pc_num_threads == 0 )
+	{
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		return ncpus > 1 ? (int)ncpus : 1;
+	}
+	return pc_num_threads;
+#else
+	return 1;
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+
+/*
+* One job at a time runs on the pool. Its tasks are claimed one by
+* one, in the given order, by the workers and the calling thread
+* alike, so the threads that draw short tasks come back for more
+* while others are still busy with long ones.
+*/
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	pthread_mutex_t joblock;
+	pthread_t *threads;
+	int nthreads;
+	unsigned int generation;
+	int maxbusy;
+	int busy;
+	pc_pool_task task;
+	void *arg;
+	const int *order;
+	int ntasks;
+	int next;
+} pc_pool =
+{
+	PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER,
+	PTHREAD_MUTEX_INITIALIZER,
+	NULL, 0, 0, 0, 0, NULL, NULL, NULL, 0, 0
+};
+
+/* Run tasks until none are left, called and returns with the lock held */
+static void
+pc_pool_drain(void)
+{
+	while ( pc_pool.next < pc_pool.ntasks )
+	{
+		int n = pc_pool.next++;
+		int task = pc_pool.order ? pc_pool.order[n] : n;
+		pthread_mutex_unlock(&pc_pool.lock);
+		pc_pool.task(pc_pool.arg, task);
+		pthread_mutex_lock(&pc_pool.lock);
+	}
+}
+
+static void *
+pc_pool_worker(void *unused)
+{
+	unsigned int seen = 0;
+
+	pthread_mutex_lock(&pc_pool.lock);
+	for (;;)
+	{
+		while ( pc_pool.generation == seen )
+			pthread_cond_wait(&pc_pool.wake, &pc_pool.lock);
+		seen = pc_pool.generation;
+
+		/* Sit this job out if it asked for fewer threads */
+		if ( pc_pool.busy >= pc_pool.maxbusy )
+			continue;
+
+		pc_pool.busy++;
+		pc_pool_drain();
+		pc_pool.busy--;
+		if ( pc_pool.busy == 0 )
+			pthread_cond_signal(&pc_pool.done);
+	}
+	return NULL;
+}
+
+/* Make sure there are nworkers threads, returns how many there are */
+static int
+pc_pool_grow(int nworkers)
+{
+	pthread_t *threads;
+
+	if ( pc_pool.nthreads >= nworkers )
+		return pc_pool.nthreads;
+
+	threads = realloc(pc_pool.threads, nworkers * sizeof(pthread_t));
+	if ( ! threads )
+		return pc_pool.nthreads;
+	pc_pool.threads = threads;
+
+	while ( pc_pool.nthreads < nworkers )
+	{
+		if ( pthread_create(&(pc_pool.threads[pc_pool.nthreads]), NULL, pc_pool_worker, NULL) )
+			break;
+		pthread_detach(pc_pool.threads[pc_pool.nthreads]);
+		pc_pool.nthreads++;
+	}
+	return pc_pool.nthreads;
+}
+
+#endif /* HAVE_PTHREAD */
+
+/**
+* Run task(arg, t) for the ntasks tasks t, taken in the order given
+* (or 0 to ntasks-1 when order is NULL), and return once they are all
+* done. They run on the pool when it is on and free, and on the
+* calling thread otherwise, so callers need not care which.
+*/
+void
+pc_pool_run(pc_pool_task task, void *arg, const int *order, int ntasks)
+{
+	int i;
+#ifdef HAVE_PTHREAD
+	int nthreads = pc_get_num_threads();
+	if ( nthreads > ntasks )
+		nthreads = ntasks;
+
+	/* Go serial when another thread has the pool */
+	if ( nthreads > 1 && pthread_mutex_trylock(&pc_pool.joblock) == 0 )
+	{
+		pthread_mutex_lock(&pc_pool.lock);
+		pc_pool.maxbusy = pc_pool_grow(nthreads - 1);
+		if ( pc_pool.maxbusy > nthreads - 1 )
+			pc_pool.maxbusy = nthreads - 1;
+		pc_pool.task = task;
+		pc_pool.arg = arg;
+		pc_pool.order = order;
+		pc_pool.ntasks = ntasks;
+		pc_pool.next = 0;
+		pc_pool.generation++;
+		pthread_cond_broadcast(&pc_pool.wake);
+
+		pc_pool_drain();
+		while ( pc_pool.busy > 0 )
+			pthread_cond_wait(&pc_pool.done, &pc_pool.lock);
+
+		pthread_mutex_unlock(&pc_pool.lock);
+		pthread_mutex_unlock(&pc_pool.joblock);
+		return;
+	}
+#endif
+	for ( i = 0; i < ntasks; i++ )
+		task(arg, order ? order[i] : i);
+}
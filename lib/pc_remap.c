@@ -0,0 +1,335 @@
+/***********************************************************************
+* pc_remap.c
+*
+*  Moving patches from one schema to another, following a plan
+*  worked out once per pair of schemas.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*
+***********************************************************************/
+
+#include "pc_api_internal.h"
+#include <assert.h>
+
+
+/**
+* Work out how each dimension of nschema is filled from oschema.
+* Dimensions of the same name are copied byte for byte, except
+* when rescale is set and their interpretation, scale or offset
+* differ, in which case their values are converted. The others
+* take the def value. Without rescale, matching dimensions must
+* share their interpretation, and are copied whatever their scale.
+*/
+PCREMAP *
+pc_remap_new(const PCSCHEMA *oschema, const PCSCHEMA *nschema, double def, int rescale)
+{
+	PCREMAP *remap;
+	PCPOINT dpt;
+	uint32_t j;
+
+	if ( rescale && oschema->srid != nschema->srid )
+	{
+		pcwarn("old and new schemas have different srids, and data "
+			   "reprojection is not yet supported");
+		return NULL;
+	}
+
+	remap = pcalloc(sizeof(PCREMAP));
+	remap->oschema = oschema;
+	remap->nschema = nschema;
+	remap->def = def;
+	remap->rescale = rescale;
+	remap->dims = pcalloc(nschema->ndims * sizeof(PCREMAPDIM));
+	remap->segments = pcalloc(nschema->ndims * sizeof(PCREMAPSEGMENT));
+	remap->defrow = pcalloc(nschema->size);
+
+	dpt.readonly = PC_TRUE;
+	dpt.schema = nschema;
+	dpt.data = remap->defrow;
+
+	for ( j = 0; j < nschema->ndims; j++ )
+	{
+		PCREMAPDIM *rd = remap->dims + j;
+		PCDIMENSION *ndim = nschema->dims[j];
+		PCDIMENSION *odim = pc_schema_get_dimension_by_name(oschema, ndim->name);
+
+		rd->ndim = ndim;
+		rd->odim = odim;
+
+		if ( ! odim )
+		{
+			rd->op = PC_REMAP_DEFAULT;
+			pc_point_set_double(&dpt, ndim, def);
+			remap->ndefault++;
+		}
+		else if ( ! rescale && ndim->interpretation != odim->interpretation )
+		{
+			pcerror("dimension interpretations are not matching");
+			pc_remap_free(remap);
+			return NULL;
+		}
+		else if ( rescale && ( ndim->interpretation != odim->interpretation ||
+		                       ndim->scale != odim->scale || ndim->offset != odim->offset ) )
+		{
+			rd->op = PC_REMAP_RESCALE;
+			remap->nrescale++;
+		}
+		else
+		{
+			PCREMAPSEGMENT *seg = remap->segments + remap->nsegments - 1;
+			rd->op = PC_REMAP_COPY;
+			remap->ncopy++;
+
+			/* Dimensions next to each other on both sides go in one copy */
+			if ( remap->nsegments &&
+			     seg->ooffset + seg->size == odim->byteoffset &&
+			     seg->noffset + seg->size == ndim->byteoffset )
+			{
+				seg->size += ndim->size;
+			}
+			else
+			{
+				seg = remap->segments + remap->nsegments++;
+				seg->ooffset = odim->byteoffset;
+				seg->noffset = ndim->byteoffset;
+				seg->size = ndim->size;
+			}
+		}
+	}
+
+	return remap;
+}
+
+void
+pc_remap_free(PCREMAP *remap)
+{
+	if ( ! remap )
+		return;
+	pcfree(remap->dims);
+	pcfree(remap->segments);
+	pcfree(remap->defrow);
+	pcfree(remap);
+}
+
+/* Value of odim as a value of ndim */
+static inline void
+pc_remap_value(const PCREMAPDIM *rd, const uint8_t *in, uint8_t *out)
+{
+	double d = pc_double_from_ptr(in, rd->odim->interpretation);
+	d = pc_value_scale_offset(d, rd->odim);
+	d = pc_value_unscale_unoffset(d, rd->ndim);
+	pc_double_to_ptr(out, rd->ndim->interpretation, d);
+}
+
+/* One row of oschema into a zeroed row of nschema */
+static void
+pc_remap_row(const PCREMAP *remap, const uint8_t *in, uint8_t *out)
+{
+	uint32_t j;
+
+	if ( remap->ndefault )
+		memcpy(out, remap->defrow, remap->nschema->size);
+
+	for ( j = 0; j < remap->nsegments; j++ )
+	{
+		const PCREMAPSEGMENT *seg = remap->segments + j;
+		memcpy(out + seg->noffset, in + seg->ooffset, seg->size);
+	}
+
+	for ( j = 0; remap->nrescale && j < remap->nschema->ndims; j++ )
+	{
+		const PCREMAPDIM *rd = remap->dims + j;
+		if ( rd->op == PC_REMAP_RESCALE )
+			pc_remap_value(rd, in + rd->odim->byteoffset, out + rd->ndim->byteoffset);
+	}
+}
+
+/* The sortdim of the input holds if its dimension is copied over */
+static uint32_t
+pc_remap_sortdim(const PCREMAP *remap, uint32_t sortdim)
+{
+	uint32_t j;
+	for ( j = 0; sortdim && j < remap->nschema->ndims; j++ )
+	{
+		const PCREMAPDIM *rd = remap->dims + j;
+		if ( rd->op == PC_REMAP_COPY && rd->odim->position + 1 == sortdim )
+			return j + 1;
+	}
+	return 0;
+}
+
+/* Stats of the input carried over, converting the rescaled dimensions */
+static void
+pc_remap_stats(const PCREMAP *remap, const PCPATCH *pa, PCPATCH *paout)
+{
+	if ( ! pa->stats )
+		return;
+
+	paout->stats = pc_stats_new(remap->nschema);
+	pc_remap_row(remap, pa->stats->min.data, paout->stats->min.data);
+	pc_remap_row(remap, pa->stats->max.data, paout->stats->max.data);
+	pc_remap_row(remap, pa->stats->avg.data, paout->stats->avg.data);
+}
+
+static void
+pc_remap_bounds(PCPATCH *paout)
+{
+	pc_bounds_init(&(paout->bounds));
+	pc_point_get_x(&(paout->stats->min), &(paout->bounds.xmin));
+	pc_point_get_y(&(paout->stats->min), &(paout->bounds.ymin));
+	pc_point_get_x(&(paout->stats->max), &(paout->bounds.xmax));
+	pc_point_get_y(&(paout->stats->max), &(paout->bounds.ymax));
+}
+
+static PCPATCH_UNCOMPRESSED *
+pc_remap_uncompressed(const PCREMAP *remap, const PCPATCH_UNCOMPRESSED *pu)
+{
+	PCPATCH_UNCOMPRESSED *paout;
+	const uint8_t *in = pu->data;
+	uint8_t *out;
+	uint32_t i;
+
+	paout = pc_patch_uncompressed_make(remap->nschema, pu->npoints);
+	paout->npoints = pu->npoints;
+
+	out = paout->data;
+	for ( i = 0; i < pu->npoints; i++ )
+	{
+		pc_remap_row(remap, in, out);
+		in += remap->oschema->size;
+		out += remap->nschema->size;
+	}
+
+	/* Converted values are gathered again, the rest carried over */
+	if ( pu->stats && ! remap->nrescale )
+	{
+		pc_remap_stats(remap, (PCPATCH*)pu, (PCPATCH*)paout);
+		pc_remap_bounds((PCPATCH*)paout);
+	}
+	else if ( PC_FAILURE == pc_patch_uncompressed_compute_stats(paout) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free((PCPATCH*)paout);
+		return NULL;
+	}
+
+	return paout;
+}
+
+/*
+* Column by column, copied dimensions keep their compressed bytes
+* as they are, only the rescaled ones are decoded. Defaults go in
+* a single run.
+*/
+static PCPATCH_DIMENSIONAL *
+pc_remap_dimensional(const PCREMAP *remap, const PCPATCH_DIMENSIONAL *pdl)
+{
+	PCPATCH_DIMENSIONAL *paout;
+	uint32_t npoints = pdl->npoints;
+	uint32_t i, j;
+
+	paout = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+	paout->type = PC_DIMENSIONAL;
+	paout->readonly = PC_FALSE;
+	paout->schema = remap->nschema;
+	paout->npoints = npoints;
+	paout->sortdim = pc_remap_sortdim(remap, pdl->sortdim);
+	paout->bytes = pcalloc(remap->nschema->ndims * sizeof(PCBYTES));
+	pc_remap_stats(remap, (PCPATCH*)pdl, (PCPATCH*)paout);
+
+	for ( j = 0; j < remap->nschema->ndims; j++ )
+	{
+		const PCREMAPDIM *rd = remap->dims + j;
+		const PCDIMENSION *ndim = rd->ndim;
+		PCBYTES pcb, opcb;
+
+		if ( rd->op == PC_REMAP_COPY )
+		{
+			paout->bytes[j] = pc_bytes_clone(pdl->bytes[rd->odim->position]);
+			continue;
+		}
+
+		pcb = pc_bytes_make(ndim, npoints);
+		if ( rd->op == PC_REMAP_DEFAULT )
+		{
+			for ( i = 0; i < npoints; i++ )
+				memcpy(pcb.bytes + i * ndim->size, remap->defrow + ndim->byteoffset, ndim->size);
+			paout->bytes[j] = pc_bytes_run_length_encode(pcb);
+			pc_bytes_free(pcb);
+			continue;
+		}
+
+		opcb = pdl->bytes[rd->odim->position];
+		if ( opcb.compression != PC_DIM_NONE )
+			opcb = pc_bytes_decode(opcb);
+		for ( i = 0; i < npoints; i++ )
+			pc_remap_value(rd, opcb.bytes + i * rd->odim->size, pcb.bytes + i * ndim->size);
+		if ( opcb.bytes != pdl->bytes[rd->odim->position].bytes )
+			pc_bytes_free(opcb);
+
+		/* Stats of the converted values, read off them while decoded */
+		if ( paout->stats && npoints )
+		{
+			double min, max, avg;
+			pc_bytes_minmax(&pcb, &min, &max, &avg);
+			pc_double_to_ptr(paout->stats->min.data + ndim->byteoffset, ndim->interpretation, min);
+			pc_double_to_ptr(paout->stats->max.data + ndim->byteoffset, ndim->interpretation, max);
+			pc_double_to_ptr(paout->stats->avg.data + ndim->byteoffset, ndim->interpretation, avg);
+		}
+
+		/* The compression of the input suits the same interpretation */
+		if ( ndim->interpretation == rd->odim->interpretation )
+			paout->bytes[j] = pc_bytes_encode(pcb, pc_bytes_encoding(&(pdl->bytes[rd->odim->position])));
+		else
+			paout->bytes[j] = pc_bytes_encode(pcb, PC_DIM_ZLIB);
+		pc_bytes_free(pcb);
+	}
+
+	/* Without input stats, all of them are gathered */
+	if ( paout->stats )
+		pc_remap_bounds((PCPATCH*)paout);
+	else if ( PC_FAILURE == pc_patch_dimensional_compute_stats(paout) )
+	{
+		pcerror("%s: failed to compute patch stats", __func__);
+		pc_patch_free((PCPATCH*)paout);
+		return NULL;
+	}
+
+	return paout;
+}
+
+/**
+* Run the plan of remap over a patch of its old schema. Dimensional
+* patches stay dimensional, others come out uncompressed.
+*/
+PCPATCH *
+pc_remap_patch(const PCREMAP *remap, const PCPATCH *pa)
+{
+	PCPATCH *pain, *paout;
+
+	if ( ! remap || ! pa )
+		return NULL;
+
+	if ( pa->schema->pcid != remap->oschema->pcid || pa->schema->size != remap->oschema->size )
+	{
+		pcerror("%s: patch does not have the schema of the remap", __func__);
+		return NULL;
+	}
+
+	if ( pa->type == PC_DIMENSIONAL )
+		return (PCPATCH*)pc_remap_dimensional(remap, (const PCPATCH_DIMENSIONAL*)pa);
+
+	pain = pc_patch_uncompress(pa);
+	if ( ! pain )
+		return NULL;
+
+	paout = (PCPATCH*)pc_remap_uncompressed(remap, (PCPATCH_UNCOMPRESSED*)pain);
+	if ( paout )
+		paout->sortdim = pc_remap_sortdim(remap, pa->sortdim);
+
+	if ( pain != pa )
+		pc_patch_free(pain);
+
+	return paout;
+}
@@ -107,6 +107,60 @@ pc_compression_name(int num)
 	}
 }
 
+static const char *CURVE_NAMES[] =
+{
+	"none", "morton", "hilbert", "progressive"
+};
+
+const char*
+pc_curve_name(int num)
+{
+	if ( num >= PC_CURVE_NONE && num <= PC_CURVE_PROGRESSIVE )
+		return CURVE_NAMES[num];
+	return "UNKNOWN";
+}
+
+int
+pc_curve_number(const char *str)
+{
+	int i;
+	for ( i = PC_CURVE_MORTON; i <= PC_CURVE_PROGRESSIVE; i++ )
+	{
+		if ( str && strcasecmp(str, CURVE_NAMES[i]) == 0 )
+			return i;
+	}
+	return PC_CURVE_NONE;
+}
+
+static const char *DIM_COMPRESSION_NAMES[PC_DIM_NUM_COMPRESSIONS] =
+{
+	"none", "rle", "sigbits", "zlib", "delta", "delta2", "zstd", "lz4"
+};
+
+const char*
+pc_dim_compression_name(int num)
+{
+	if ( num == PC_DIM_AUTO )
+		return "auto";
+	if ( num >= 0 && num < PC_DIM_NUM_COMPRESSIONS )
+		return DIM_COMPRESSION_NAMES[num];
+	return "UNKNOWN";
+}
+
+static int
+pc_dim_compression_number(const char *str)
+{
+	int i;
+	for ( i = 0; i < PC_DIM_NUM_COMPRESSIONS; i++ )
+	{
+		if ( strcasecmp(str, DIM_COMPRESSION_NAMES[i]) == 0 )
+			return i;
+	}
+	if ( strcasecmp(str, "auto") != 0 )
+		pcwarn("unknown dimension compression \"%s\" encountered", str);
+	return PC_DIM_AUTO;
+}
+
 static int
 pc_compression_number(const char *str)
 {
@@ -162,6 +216,7 @@ pc_dimension_new()
 	PCDIMENSION *pcd = pcalloc(sizeof(PCDIMENSION));
 	/* Default scaling value is 1! */
 	pcd->scale = 1.0;
+	pcd->compression = PC_DIM_AUTO;
 	return pcd;
 }
 
@@ -235,6 +290,7 @@ pc_schema_clone(const PCSCHEMA *s)
 	pcs->pcid = s->pcid;
 	pcs->srid = s->srid;
 	pcs->compression = s->compression;
+	pcs->spatialsort = s->spatialsort;
 	for ( i = 0; i < pcs->ndims; i++ )
 	{
 		if ( s->dims[i] )
@@ -288,6 +344,8 @@ pc_schema_to_json(const PCSCHEMA *pcs)
 		stringbuffer_aprintf(sb, "\"srid\" : %d,\n", pcs->srid);
 	if ( pcs->compression )
 		stringbuffer_aprintf(sb, "\"compression\" : %d,\n", pcs->compression);
+	if ( pcs->spatialsort )
+		stringbuffer_aprintf(sb, "\"spatialsort\" : \"%s\",\n", pc_curve_name(pcs->spatialsort));
 
 
 	if ( pcs->ndims )
@@ -314,6 +372,8 @@ pc_schema_to_json(const PCSCHEMA *pcs)
 				stringbuffer_aprintf(sb, "  \"scale\" : %g,\n", d->scale);
 				stringbuffer_aprintf(sb, "  \"interpretation\" : \"%s\",\n", pc_interpretation_string(d->interpretation));
 				stringbuffer_aprintf(sb, "  \"offset\" : %g,\n", d->offset);
+				if ( d->compression != PC_DIM_AUTO )
+					stringbuffer_aprintf(sb, "  \"compression\" : \"%s\",\n", pc_dim_compression_name(d->compression));
 
 				stringbuffer_aprintf(sb, "  \"active\" : %d\n", d->active);
 				stringbuffer_append(sb, " }");
@@ -481,6 +541,8 @@ pc_schema_from_xml(const char *xml_str)
 							d->scale = atof(content);
 						else if ( strcmp(name, "offset") == 0 )
 							d->offset = atof(content);
+						else if ( strcmp(name, "compression") == 0 )
+							d->compression = pc_dim_compression_number(content);
 						else if ( strcmp(name, "uuid") == 0 )
 							/* Ignore this tag for now */ {}
 						else if ( strcmp(name, "parent_uuid") == 0 )
@@ -554,6 +616,13 @@ pc_schema_from_xml(const char *xml_str)
 					s->compression = compression;
 				}
 			}
+			/* Points of new patches are to be ordered along a curve */
+			else if ( strcmp(metadata_name, "spatialsort") == 0 )
+			{
+				s->spatialsort = pc_curve_number(metadata_value);
+				if ( s->spatialsort == PC_CURVE_NONE && metadata_value && strcasecmp(metadata_value, "none") != 0 )
+					pcwarn("unknown spatial sort \"%s\" encountered", metadata_value);
+			}
 			xmlFree(metadata_name);
 		}
 	}
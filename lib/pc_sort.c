@@ -10,24 +10,60 @@
 ***********************************************************************/
 #include "pc_api_internal.h"
 #include <assert.h>
-#include "sort_r/sort_r.h"
+#include <float.h>
 
 // NULL terminated array of PCDIMENSION pointers
 typedef PCDIMENSION ** PCDIMENSION_LIST;
 
 /**
 * Comparators
+*
+* Integers are compared as integers, so 64-bit values past 2^53 order
+* exactly as the radix keys below sort them.
 */
 
+#define PC_COMPARE_AS(T, a, b) \
+	do { \
+		T va, vb; \
+		memcpy(&va, (a), sizeof(T)); \
+		memcpy(&vb, (b), sizeof(T)); \
+		return (va > vb) - (va < vb); \
+	} while (0)
+
+static int
+pc_compare_values(const void *a, const void *b, uint32_t interpretation)
+{
+	double da, db;
+	switch( interpretation )
+	{
+	case PC_UINT8:
+		PC_COMPARE_AS(uint8_t, a, b);
+	case PC_UINT16:
+		PC_COMPARE_AS(uint16_t, a, b);
+	case PC_UINT32:
+		PC_COMPARE_AS(uint32_t, a, b);
+	case PC_UINT64:
+		PC_COMPARE_AS(uint64_t, a, b);
+	case PC_INT8:
+		PC_COMPARE_AS(int8_t, a, b);
+	case PC_INT16:
+		PC_COMPARE_AS(int16_t, a, b);
+	case PC_INT32:
+		PC_COMPARE_AS(int32_t, a, b);
+	case PC_INT64:
+		PC_COMPARE_AS(int64_t, a, b);
+	}
+	da = pc_double_from_ptr(a,interpretation);
+	db = pc_double_from_ptr(b,interpretation);
+	return ((da > db) - (da < db));
+}
+
 int
 pc_compare_dim (const void *a, const void *b, void *arg)
 {
 	PCDIMENSION_LIST dim = (PCDIMENSION_LIST)arg;
 	uint32_t byteoffset     = dim[0]->byteoffset;
-	uint32_t interpretation = dim[0]->interpretation;
-	double da = pc_double_from_ptr(a+byteoffset,interpretation);
-	double db = pc_double_from_ptr(b+byteoffset,interpretation);
-	int cmp = ((da > db) - (da < db));
+	int cmp = pc_compare_values(a+byteoffset,b+byteoffset,dim[0]->interpretation);
 	return ( cmp == 0 && dim[1]) ? pc_compare_dim(a,b,dim+1) : cmp;
 }
 
@@ -35,31 +71,507 @@ int
 pc_compare_pcb (const void *a, const void *b, const void *arg)
 {
 	PCBYTES *pcb = (PCBYTES *)arg;
-	double da = pc_double_from_ptr(a,pcb->interpretation);
-	double db = pc_double_from_ptr(b,pcb->interpretation);
-	return ((da > db) - (da < db));
+	return pc_compare_values(a,b,pcb->interpretation);
 }
 
 
 /**
 * Sort
+*
+* The sort keys are extracted once per dimension into unsigned 64-bit
+* keys that order like the values do, then (key, index) pairs are
+* radix sorted, least significant dimension first. Each pass is
+* stable, so ties keep their input order, and the rows or columns
+* are gathered once at the end following the resulting permutation.
 */
 
-PCPATCH_UNCOMPRESSED *
-pc_patch_uncompressed_sort(const PCPATCH_UNCOMPRESSED *pu, PCDIMENSION_LIST dim)
+#define PC_SORT_SIGN UINT64_C(0x8000000000000000)
+
+#define PC_SORT_KEYS_UINT(NAME, T) \
+static void \
+pc_sort_keys_##NAME(uint64_t *keys, const uint8_t *base, size_t stride, const uint32_t *perm, uint32_t n) \
+{ \
+	uint32_t i; \
+	T v; \
+	for ( i = 0; i < n; i++ ) \
+	{ \
+		memcpy(&v, base + (size_t)perm[i] * stride, sizeof(T)); \
+		keys[i] = (uint64_t)v; \
+	} \
+}
+
+#define PC_SORT_KEYS_INT(NAME, T) \
+static void \
+pc_sort_keys_##NAME(uint64_t *keys, const uint8_t *base, size_t stride, const uint32_t *perm, uint32_t n) \
+{ \
+	uint32_t i; \
+	T v; \
+	for ( i = 0; i < n; i++ ) \
+	{ \
+		memcpy(&v, base + (size_t)perm[i] * stride, sizeof(T)); \
+		keys[i] = (uint64_t)(int64_t)v ^ PC_SORT_SIGN; \
+	} \
+}
+
+/* Negative numbers have all their bits flipped, -0 sorts with 0 */
+#define PC_SORT_KEYS_FLOAT(NAME, T) \
+static void \
+pc_sort_keys_##NAME(uint64_t *keys, const uint8_t *base, size_t stride, const uint32_t *perm, uint32_t n) \
+{ \
+	uint32_t i; \
+	T v; \
+	double d; \
+	uint64_t u; \
+	for ( i = 0; i < n; i++ ) \
+	{ \
+		memcpy(&v, base + (size_t)perm[i] * stride, sizeof(T)); \
+		d = v == 0 ? 0.0 : (double)v; \
+		memcpy(&u, &d, sizeof(uint64_t)); \
+		keys[i] = ( u & PC_SORT_SIGN ) ? ~u : u ^ PC_SORT_SIGN; \
+	} \
+}
+
+PC_SORT_KEYS_UINT(uint8, uint8_t)
+PC_SORT_KEYS_UINT(uint16, uint16_t)
+PC_SORT_KEYS_UINT(uint32, uint32_t)
+PC_SORT_KEYS_UINT(uint64, uint64_t)
+PC_SORT_KEYS_INT(int8, int8_t)
+PC_SORT_KEYS_INT(int16, int16_t)
+PC_SORT_KEYS_INT(int32, int32_t)
+PC_SORT_KEYS_INT(int64, int64_t)
+PC_SORT_KEYS_FLOAT(float, float)
+PC_SORT_KEYS_FLOAT(double, double)
+
+/* Keys of the n values stride bytes apart from base, taken in perm order */
+static int
+pc_sort_keys(uint64_t *keys, const uint8_t *base, size_t stride, uint32_t interpretation, const uint32_t *perm, uint32_t n)
+{
+	switch( interpretation )
+	{
+	case PC_UINT8:
+		pc_sort_keys_uint8(keys, base, stride, perm, n);
+		break;
+	case PC_UINT16:
+		pc_sort_keys_uint16(keys, base, stride, perm, n);
+		break;
+	case PC_UINT32:
+		pc_sort_keys_uint32(keys, base, stride, perm, n);
+		break;
+	case PC_UINT64:
+		pc_sort_keys_uint64(keys, base, stride, perm, n);
+		break;
+	case PC_INT8:
+		pc_sort_keys_int8(keys, base, stride, perm, n);
+		break;
+	case PC_INT16:
+		pc_sort_keys_int16(keys, base, stride, perm, n);
+		break;
+	case PC_INT32:
+		pc_sort_keys_int32(keys, base, stride, perm, n);
+		break;
+	case PC_INT64:
+		pc_sort_keys_int64(keys, base, stride, perm, n);
+		break;
+	case PC_FLOAT:
+		pc_sort_keys_float(keys, base, stride, perm, n);
+		break;
+	case PC_DOUBLE:
+		pc_sort_keys_double(keys, base, stride, perm, n);
+		break;
+	default:
+		pcerror("%s: unknown interpretation %d", __func__, interpretation);
+		return PC_FAILURE;
+	}
+	return PC_SUCCESS;
+}
+
+/*
+* Stable LSD radix sort of idx by keys, a byte at a time. The counts
+* of all eight bytes are taken in one pass, and the bytes that are
+* the same for every key (the high bytes of narrow types) are skipped.
+*/
+static void
+pc_sort_radix(PCARENA *arena, uint64_t *keys, uint32_t *idx, uint64_t *tkeys, uint32_t *tidx, uint32_t n)
+{
+	uint32_t (*counts)[256];
+	uint64_t *k = keys, *tk = tkeys, *swapk;
+	uint32_t *x = idx, *tx = tidx, *swapx;
+	uint32_t i, b;
+
+	if ( n < 2 )
+		return;
+	counts = pc_arena_alloc(arena, 8 * 256 * sizeof(uint32_t));
+
+	for ( i = 0; i < n; i++ )
+		for ( b = 0; b < 8; b++ )
+			counts[b][(keys[i] >> (8 * b)) & 0xFF]++;
+
+	for ( b = 0; b < 8; b++ )
+	{
+		uint32_t *c = counts[b];
+		uint32_t sum = 0, v;
+		int shift = 8 * b;
+
+		if ( c[(k[0] >> shift) & 0xFF] == n )
+			continue;
+
+		for ( v = 0; v < 256; v++ )
+		{
+			uint32_t cv = c[v];
+			c[v] = sum;
+			sum += cv;
+		}
+		for ( i = 0; i < n; i++ )
+		{
+			uint32_t pos = c[(k[i] >> shift) & 0xFF]++;
+			tk[pos] = k[i];
+			tx[pos] = x[i];
+		}
+		swapk = k; k = tk; tk = swapk;
+		swapx = x; x = tx; tx = swapx;
+	}
+
+	if ( x != idx )
+		memcpy(idx, x, n * sizeof(uint32_t));
+}
+
+/*
+* The order of n values on the dimensions of the list, from columns
+* (one base pointer and stride per dimension) or rows alike.
+* Returns the permutation, sorted position to input index, which like
+* all the scratch space of the sort lives in the arena.
+*/
+static uint32_t *
+pc_sort_permutation(PCARENA *arena, PCDIMENSION_LIST dim, const uint8_t **bases, const size_t *strides, uint32_t n)
+{
+	uint32_t *perm = pc_arena_alloc(arena, (n ? n : 1) * sizeof(uint32_t));
+	uint32_t *tperm = pc_arena_alloc(arena, (n ? n : 1) * sizeof(uint32_t));
+	uint64_t *keys = pc_arena_alloc(arena, (n ? n : 1) * sizeof(uint64_t));
+	uint64_t *tkeys = pc_arena_alloc(arena, (n ? n : 1) * sizeof(uint64_t));
+	int ndims = 0, d;
+	uint32_t i;
+
+	for ( i = 0; i < n; i++ )
+		perm[i] = i;
+	while ( dim[ndims] )
+		ndims++;
+
+	for ( d = ndims - 1; d >= 0; d-- )
+	{
+		pc_sort_keys(keys, bases[d], strides[d], dim[d]->interpretation, perm, n);
+		pc_sort_radix(arena, keys, perm, tkeys, tperm, n);
+	}
+
+	return perm;
+}
+
+/* Rows of the sorted patch, gathered from the input rows */
+static PCPATCH_UNCOMPRESSED *
+pc_patch_uncompressed_gather(const PCPATCH_UNCOMPRESSED *pu, const uint32_t *perm)
 {
 	PCPATCH_UNCOMPRESSED *spu = pc_patch_uncompressed_make(pu->schema, pu->npoints);
+	size_t size = pu->schema->size;
+	uint32_t i;
+
+	for ( i = 0; i < pu->npoints; i++ )
+		memcpy(spu->data + i * size, pu->data + (size_t)perm[i] * size, size);
+	PC_COUNT_COPY(pu->datasize);
 
-	memcpy(spu->data, pu->data, pu->datasize);
 	spu->npoints = pu->npoints;
 	spu->bounds  = pu->bounds;
 	spu->stats   = pc_stats_clone(pu->stats);
+	return spu;
+}
 
-	sort_r(spu->data, spu->npoints, pu->schema->size, pc_compare_dim, dim);
+PCPATCH_UNCOMPRESSED *
+pc_patch_uncompressed_sort(const PCPATCH_UNCOMPRESSED *pu, PCDIMENSION_LIST dim)
+{
+	PCPATCH_UNCOMPRESSED *spu;
+	PCARENA arena;
+	const uint8_t **bases;
+	size_t *strides;
+	uint32_t *perm;
+	int ndims = 0, d;
+
+	while ( dim[ndims] )
+		ndims++;
+	pc_arena_begin(&arena);
+	bases = pc_arena_alloc(&arena, ndims * sizeof(uint8_t *));
+	strides = pc_arena_alloc(&arena, ndims * sizeof(size_t));
+	for ( d = 0; d < ndims; d++ )
+	{
+		bases[d] = pu->data + dim[d]->byteoffset;
+		strides[d] = pu->schema->size;
+	}
+
+	perm = pc_sort_permutation(&arena, dim, bases, strides, pu->npoints);
+	spu = pc_patch_uncompressed_gather(pu, perm);
 
+	pc_arena_end(&arena);
 	return spu;
 }
 
+/*
+* Columns of the sorted patch, decoded and permuted one by one, then
+* encoded again with the compression of the input column when encode
+* is set. Columns already decoded by the caller are taken from decoded
+* when it is given.
+*/
+static PCPATCH_DIMENSIONAL *
+pc_patch_dimensional_gather(const PCPATCH_DIMENSIONAL *pdl, const uint32_t *perm, const PCBYTES *decoded, int encode)
+{
+	const PCSCHEMA *schema = pdl->schema;
+	PCPATCH_DIMENSIONAL *spdl;
+	uint32_t i, j;
+
+	spdl = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+	memcpy(spdl, pdl, sizeof(PCPATCH_DIMENSIONAL));
+	spdl->sortdim = 0;
+	spdl->stats = pc_stats_clone(pdl->stats);
+	spdl->bytes = pcalloc(schema->ndims * sizeof(PCBYTES));
+
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		const PCDIMENSION *di = schema->dims[i];
+		const PCBYTES *in = pdl->bytes + i;
+		int owned = ! ( decoded && decoded[i].bytes ) && in->compression != PC_DIM_NONE;
+		PCBYTES pcb = ( decoded && decoded[i].bytes ) ? decoded[i] :
+			( in->compression == PC_DIM_NONE ? *in : pc_bytes_decode(*in) );
+		PCBYTES spcb = pc_bytes_make(di, pdl->npoints);
+		for ( j = 0; j < pdl->npoints; j++ )
+			memcpy(spcb.bytes + (size_t)j * di->size, pcb.bytes + (size_t)perm[j] * di->size, di->size);
+		/* Uncompressed inputs are read in place */
+		if ( owned )
+			pc_bytes_free(pcb);
+		if ( encode && in->compression != PC_DIM_NONE )
+		{
+			spdl->bytes[i] = pc_bytes_encode(spcb, pc_bytes_encoding(in));
+			pc_bytes_free(spcb);
+		}
+		else
+		{
+			spdl->bytes[i] = spcb;
+		}
+	}
+
+	return spdl;
+}
+
+static PCPATCH_DIMENSIONAL *
+pc_patch_dimensional_sort(const PCPATCH_DIMENSIONAL *pdl, PCDIMENSION_LIST dim)
+{
+	const PCSCHEMA *schema = pdl->schema;
+	PCPATCH_DIMENSIONAL *spdl;
+	PCARENA arena;
+	PCBYTES *decoded;
+	const uint8_t **bases;
+	size_t *strides;
+	uint32_t *perm;
+	uint32_t i;
+	int ndims = 0, d;
+
+	while ( dim[ndims] )
+		ndims++;
+
+	/* Only the sort dimensions are needed to find the order */
+	pc_arena_begin(&arena);
+	decoded = pc_arena_alloc(&arena, schema->ndims * sizeof(PCBYTES));
+	bases = pc_arena_alloc(&arena, ndims * sizeof(uint8_t *));
+	strides = pc_arena_alloc(&arena, ndims * sizeof(size_t));
+	for ( d = 0; d < ndims; d++ )
+	{
+		uint32_t pos = dim[d]->position;
+		if ( ! decoded[pos].bytes && pdl->bytes[pos].compression != PC_DIM_NONE )
+			decoded[pos] = pc_bytes_decode(pdl->bytes[pos]);
+		bases[d] = decoded[pos].bytes ? decoded[pos].bytes : pdl->bytes[pos].bytes;
+		strides[d] = dim[d]->size;
+	}
+	perm = pc_sort_permutation(&arena, dim, bases, strides, pdl->npoints);
+	spdl = pc_patch_dimensional_gather(pdl, perm, decoded, PC_TRUE);
+
+	for ( i = 0; i < schema->ndims; i++ )
+		if ( decoded[i].bytes )
+			pc_bytes_free(decoded[i]);
+	pc_arena_end(&arena);
+	return spdl;
+}
+
+/*
+* Curve keys of points from their X/Y values, quantized to 32 bits
+* each over the bounds of the points
+*/
+static uint32_t
+pc_curve_quantize(double v, double min, double range)
+{
+	double q = range > 0 ? (v - min) / range * 4294967295.0 : 0;
+	if ( ! ( q > 0 ) ) return 0;
+	if ( q >= 4294967295.0 ) return UINT32_MAX;
+	return (uint32_t) q;
+}
+
+/* Spread the 32 bits of v over the even bits of a 64-bit word */
+static uint64_t
+pc_morton_spread(uint32_t v)
+{
+	uint64_t x = v;
+	x = (x | (x << 16)) & UINT64_C(0x0000FFFF0000FFFF);
+	x = (x | (x << 8))  & UINT64_C(0x00FF00FF00FF00FF);
+	x = (x | (x << 4))  & UINT64_C(0x0F0F0F0F0F0F0F0F);
+	x = (x | (x << 2))  & UINT64_C(0x3333333333333333);
+	x = (x | (x << 1))  & UINT64_C(0x5555555555555555);
+	return x;
+}
+
+static uint64_t
+pc_morton_key(uint32_t x, uint32_t y)
+{
+	return pc_morton_spread(x) | (pc_morton_spread(y) << 1);
+}
+
+/* Distance along the Hilbert curve filling the 2^32 by 2^32 grid */
+static uint64_t
+pc_hilbert_key(uint32_t x, uint32_t y)
+{
+	uint64_t d = 0;
+	uint32_t s, rx, ry, t;
+	for ( s = UINT32_C(1) << 31; s > 0; s >>= 1 )
+	{
+		rx = ( x & s ) > 0;
+		ry = ( y & s ) > 0;
+		d += (uint64_t)s * s * ((3 * rx) ^ ry);
+		/* Rotate the quadrant */
+		if ( ry == 0 )
+		{
+			if ( rx == 1 )
+			{
+				x = ~x;
+				y = ~y;
+			}
+			t = x; x = y; y = t;
+		}
+	}
+	return d;
+}
+
+/*
+* Ranks along the curve taken in bit-reversed order, skipping those
+* past n, so the first k points are about every n/k-th one along the
+* curve, spread over the whole patch.
+*/
+static void
+pc_curve_progressive(const uint32_t *perm, uint32_t *out, uint32_t n)
+{
+	uint32_t bits = 0, r, j = 0;
+
+	while ( bits < 32 && (UINT64_C(1) << bits) < n )
+		bits++;
+
+	for ( r = 0; j < n; r++ )
+	{
+		uint32_t v = r, rev = 0, b;
+		for ( b = 0; b < bits; b++ )
+		{
+			rev = (rev << 1) | (v & 1);
+			v >>= 1;
+		}
+		if ( rev < n )
+			out[j++] = perm[rev];
+	}
+}
+
+static PCPATCH *
+pc_patch_curve_gather(const PCPATCH *pa, int curve, int encode)
+{
+	const PCSCHEMA *schema = pa->schema;
+	PCDIMENSION *dims[2];
+	const PCPATCH *src = pa;
+	PCPATCH *ps;
+	PCARENA arena;
+	double *xy, *xs, *ys;
+	double xmin = DBL_MAX, xmax = -DBL_MAX, ymin = DBL_MAX, ymax = -DBL_MAX;
+	uint64_t *keys, *tkeys;
+	uint32_t *perm, *tperm;
+	uint32_t i, n = pa->npoints;
+
+	if ( curve != PC_CURVE_MORTON && curve != PC_CURVE_HILBERT && curve != PC_CURVE_PROGRESSIVE )
+	{
+		pcerror("%s: unknown curve %d", __func__, curve);
+		return NULL;
+	}
+
+	/* Rows are gathered from one decoded copy, columns straight from the patch */
+	if ( pa->type != PC_DIMENSIONAL )
+	{
+		src = pc_patch_uncompress(pa);
+		if ( ! src )
+		{
+			pcerror("%s: patch uncompression failed", __func__);
+			return NULL;
+		}
+	}
+
+	dims[0] = schema->xdim;
+	dims[1] = schema->ydim;
+	pc_arena_begin(&arena);
+	xy = pc_arena_alloc(&arena, 2 * (n ? n : 1) * sizeof(double));
+	xs = xy;
+	ys = xy + n;
+	pc_patch_get_values_multi(src, dims, 2, xy);
+	for ( i = 0; i < n; i++ )
+	{
+		if ( xs[i] < xmin ) xmin = xs[i];
+		if ( xs[i] > xmax ) xmax = xs[i];
+		if ( ys[i] < ymin ) ymin = ys[i];
+		if ( ys[i] > ymax ) ymax = ys[i];
+	}
+
+	keys = pc_arena_alloc(&arena, (n ? n : 1) * sizeof(uint64_t));
+	tkeys = pc_arena_alloc(&arena, (n ? n : 1) * sizeof(uint64_t));
+	perm = pc_arena_alloc(&arena, (n ? n : 1) * sizeof(uint32_t));
+	tperm = pc_arena_alloc(&arena, (n ? n : 1) * sizeof(uint32_t));
+	for ( i = 0; i < n; i++ )
+	{
+		uint32_t qx = pc_curve_quantize(xs[i], xmin, xmax - xmin);
+		uint32_t qy = pc_curve_quantize(ys[i], ymin, ymax - ymin);
+		keys[i] = curve == PC_CURVE_HILBERT ? pc_hilbert_key(qx, qy) : pc_morton_key(qx, qy);
+		perm[i] = i;
+	}
+	pc_sort_radix(&arena, keys, perm, tkeys, tperm, n);
+	if ( curve == PC_CURVE_PROGRESSIVE )
+	{
+		pc_curve_progressive(perm, tperm, n);
+		perm = tperm;
+	}
+
+	if ( src->type == PC_DIMENSIONAL )
+		ps = (PCPATCH *) pc_patch_dimensional_gather((const PCPATCH_DIMENSIONAL *)src, perm, NULL, encode);
+	else
+		ps = (PCPATCH *) pc_patch_uncompressed_gather((const PCPATCH_UNCOMPRESSED *)src, perm);
+
+	if ( src != pa )
+		pc_patch_free((PCPATCH *)src);
+	pc_arena_end(&arena);
+	return ps;
+}
+
+PCPATCH *
+pc_patch_sort_curve(const PCPATCH *pa, int curve)
+{
+	PCPATCH *ps;
+	PC_COUNTER_START(t0);
+
+	ps = pc_patch_curve_gather(pa, curve, PC_TRUE);
+	if ( ps )
+		PC_COUNTER_STOP(PC_OP_SORT, t0, pa->npoints, 0, 0);
+	return ps;
+}
+
+PCPATCH *
+pc_patch_order_curve(const PCPATCH *pa, int curve)
+{
+	return pc_patch_curve_gather(pa, curve, PC_FALSE);
+}
+
 PCDIMENSION_LIST pc_schema_get_dimensions_by_name(const PCSCHEMA *schema, const char ** name, int ndims)
 {
 	PCDIMENSION_LIST dim = pcalloc( (ndims+1) * sizeof(PCDIMENSION *));
@@ -77,22 +589,60 @@ PCDIMENSION_LIST pc_schema_get_dimensions_by_name(const PCSCHEMA *schema, const
 	return dim;
 }
 
-PCPATCH *
-pc_patch_sort(const PCPATCH *pa, const char ** name, int ndims)
+static PCPATCH *
+pc_patch_sort_run(const PCPATCH *pa, const char ** name, int ndims)
 {
-	PCDIMENSION_LIST dim = pc_schema_get_dimensions_by_name(pa->schema, name, ndims);
-	PCPATCH *pu = pc_patch_uncompress(pa);
+	PCDIMENSION_LIST dim;
+	PCPATCH *pu;
+	PCPATCH *ps;
+
+	/* Curve names, unless the schema has a dimension by that name */
+	if ( ndims == 1 && pc_curve_number(name[0]) != PC_CURVE_NONE &&
+	     ! pc_schema_get_dimension_by_name(pa->schema, name[0]) )
+		return pc_patch_curve_gather(pa, pc_curve_number(name[0]), PC_TRUE);
+
+	dim = pc_schema_get_dimensions_by_name(pa->schema, name, ndims);
+	if ( ! dim )
+		return NULL;
+
+	if ( pa->type == PC_DIMENSIONAL )
+	{
+		ps = (PCPATCH *) pc_patch_dimensional_sort((const PCPATCH_DIMENSIONAL *)pa, dim);
+		if ( ps )
+			ps->sortdim = dim[0]->position + 1;
+		pcfree(dim);
+		return ps;
+	}
+
+	pu = pc_patch_uncompress(pa);
 	if ( !pu ) {
 		pcfree(dim);
 		pcerror("Patch uncompression failed");
 		return NULL;
 	}
-	PCPATCH_UNCOMPRESSED *ps = pc_patch_uncompressed_sort((PCPATCH_UNCOMPRESSED *)pu, dim);
 
-	pcfree(dim);
+	ps = (PCPATCH *) pc_patch_uncompressed_sort((PCPATCH_UNCOMPRESSED *)pu, dim);
+	if ( ps )
+		ps->sortdim = dim[0]->position + 1;
+
+	/* Freshly decoded points are not needed any more */
 	if ( pu != pa )
 		pc_patch_free(pu);
-	return (PCPATCH *) ps;
+
+	pcfree(dim);
+	return ps;
+}
+
+PCPATCH *
+pc_patch_sort(const PCPATCH *pa, const char ** name, int ndims)
+{
+	PCPATCH *ps;
+	PC_COUNTER_START(t0);
+
+	ps = pc_patch_sort_run(pa, name, ndims);
+	if ( ps )
+		PC_COUNTER_STOP(PC_OP_SORT, t0, pa->npoints, 0, 0);
+	return ps;
 }
 
 
@@ -154,6 +704,40 @@ pc_bytes_zlib_is_sorted(const PCBYTES *pcb, char strict)
 }
 
 
+uint32_t
+pc_bytes_zstd_is_sorted(const PCBYTES *pcb, char strict)
+{
+	assert(pcb->compression == PC_DIM_ZSTD);
+	PCBYTES dpcb = pc_bytes_decode(*pcb);
+	uint32_t is_sorted = pc_bytes_uncompressed_is_sorted(&dpcb,strict);
+	pc_bytes_free(dpcb);
+	return is_sorted;
+}
+
+
+uint32_t
+pc_bytes_lz4_is_sorted(const PCBYTES *pcb, char strict)
+{
+	assert(pcb->compression == PC_DIM_LZ4);
+	PCBYTES dpcb = pc_bytes_decode(*pcb);
+	uint32_t is_sorted = pc_bytes_uncompressed_is_sorted(&dpcb,strict);
+	pc_bytes_free(dpcb);
+	return is_sorted;
+}
+
+
+uint32_t
+pc_bytes_delta_is_sorted(const PCBYTES *pcb, char strict)
+{
+	assert(pcb->compression == PC_DIM_DELTA || pcb->compression == PC_DIM_DELTA2);
+	/* A single pass, like reading the values would be */
+	PCBYTES dpcb = pc_bytes_delta_decode(*pcb);
+	uint32_t is_sorted = pc_bytes_uncompressed_is_sorted(&dpcb,strict);
+	pc_bytes_free(dpcb);
+	return is_sorted;
+}
+
+
 uint32_t
 pc_bytes_run_length_is_sorted(const PCBYTES *pcb, char strict)
 {
@@ -211,6 +795,19 @@ pc_patch_dimensional_is_sorted(const PCPATCH_DIMENSIONAL *pdl, PCDIMENSION_LIST
 	{
 		return pc_bytes_zlib_is_sorted(pcb,strict);
 	}
+	case PC_DIM_ZSTD:
+	{
+		return pc_bytes_zstd_is_sorted(pcb,strict);
+	}
+	case PC_DIM_LZ4:
+	{
+		return pc_bytes_lz4_is_sorted(pcb,strict);
+	}
+	case PC_DIM_DELTA:
+	case PC_DIM_DELTA2:
+	{
+		return pc_bytes_delta_is_sorted(pcb,strict);
+	}
 	case PC_DIM_NONE:
 	{
 		return pc_bytes_uncompressed_is_sorted(pcb,strict);
@@ -258,6 +855,13 @@ pc_patch_is_sorted(const PCPATCH *pa, const char **name, int ndims, char strict)
 	if ( ! dim ) return is_sorted;
 	strict = (strict > 0); // ensure 0-1 value
 
+	/* Sorted by the only dimension asked for, duplicates allowed */
+	if ( ndims == 1 && strict && pa->sortdim == dim[0]->position + 1 )
+	{
+		pcfree(dim);
+		return PC_TRUE;
+	}
+
 	switch( pa->type )
 	{
 	case PC_NONE:
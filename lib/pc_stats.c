@@ -12,14 +12,16 @@
 
 /*
 * Instantiate a new PCDOUBLESTATS for calculation, and set up
-* initial values for min/max/sum
+* initial values for min/max/sum. The accumulators follow the
+* struct in the same allocation, from the arena when there is one.
 */
-static PCDOUBLESTATS *
-pc_dstats_new(int ndims)
+PCDOUBLESTATS *
+pc_dstats_new_in(PCARENA *arena, int ndims)
 {
 	int i;
-	PCDOUBLESTATS *stats = pcalloc(sizeof(PCDOUBLESTATS));
-	stats->dims = pcalloc(sizeof(PCDOUBLESTAT)*ndims);
+	size_t size = sizeof(PCDOUBLESTATS) + sizeof(PCDOUBLESTAT) * ndims;
+	PCDOUBLESTATS *stats = arena ? pc_arena_alloc(arena, size) : pcalloc(size);
+	stats->dims = (PCDOUBLESTAT*)(stats + 1);
 	for ( i = 0; i < ndims; i++ )
 	{
 		stats->dims[i].min = DBL_MAX;
@@ -27,82 +29,79 @@ pc_dstats_new(int ndims)
 		stats->dims[i].sum = 0;
 	}
 	stats->npoints = 0;
+	stats->inarena = arena != NULL;
 	return stats;
 }
 
-static void
+PCDOUBLESTATS *
+pc_dstats_new(int ndims)
+{
+	return pc_dstats_new_in(NULL, ndims);
+}
+
+void
 pc_dstats_free(PCDOUBLESTATS *stats)
 {
-	if ( ! stats) return;
-	if ( stats->dims ) pcfree(stats->dims);
+	if ( ! stats || stats->inarena ) return;
 	pcfree(stats);
 	return;
 }
 
 /**
-* Free the standard stats object for in memory patches
+* Point the min, max and avg of stats at the values back to back
+* in data.
+*/
+static void
+pc_stats_set_data(PCSTATS *stats, const PCSCHEMA *schema, uint8_t *data, int readonly)
+{
+	/* All share the schema with the patch */
+	stats->min.schema = schema;
+	stats->max.schema = schema;
+	stats->avg.schema = schema;
+	stats->data = data;
+	stats->min.data = data;
+	stats->max.data = data + schema->size;
+	stats->avg.data = data + 2 * schema->size;
+	stats->min.readonly = readonly;
+	stats->max.readonly = readonly;
+	stats->avg.readonly = readonly;
+}
+
+/**
+* Free the standard stats object for in memory patches, its values
+* are either in the same allocation or in a serialization.
 */
 void
 pc_stats_free(PCSTATS *stats)
 {
-	if ( stats->min.readonly != PC_TRUE )
-		pcfree(stats->min.data);
-
-	if ( stats->max.readonly != PC_TRUE )
-		pcfree(stats->max.data);
-
-	if ( stats->avg.readonly != PC_TRUE )
-		pcfree(stats->avg.data);
-
 	pcfree(stats);
 	return;
 }
 
 /**
-* Build a standard stats object on top of a serialization, allocate just the
-* point shells and set the pointers to look into the data area of the
-* serialization.
+* Build a standard stats object on top of a serialization, allocate just
+* the shell and point it at the min, max and avg values back to back in
+* the data area of the serialization.
 */
 PCSTATS *
-pc_stats_new_from_data(const PCSCHEMA *schema, const uint8_t *mindata, const uint8_t *maxdata, const uint8_t *avgdata)
+pc_stats_new_from_data(const PCSCHEMA *schema, const uint8_t *data)
 {
-	/*size_t sz = schema->size;*/
 	PCSTATS *stats = pcalloc(sizeof(PCSTATS));
-	/* All share the schema with the patch */
-	stats->min.schema = schema;
-	stats->max.schema = schema;
-	stats->avg.schema = schema;
-	/* Data points into serialization */
-	stats->min.data = (uint8_t*)mindata;
-	stats->max.data = (uint8_t*)maxdata;
-	stats->avg.data = (uint8_t*)avgdata;
 	/* Can't modify external data */
-	stats->min.readonly = PC_TRUE;
-	stats->max.readonly = PC_TRUE;
-	stats->avg.readonly = PC_TRUE;
-	/* Done */
+	pc_stats_set_data(stats, schema, (uint8_t*)data, PC_TRUE);
 	return stats;
 }
 
 /**
-* Build a standard stats object with read/write memory, allocate the
-* point shells and the data areas underneath. Used for initial calcution
+* Build a standard stats object with read/write memory, the values
+* follow the shell in a single allocation. Used for initial calcution
 * of patch stats, when objects first created.
 */
 PCSTATS *
 pc_stats_new(const PCSCHEMA *schema)
 {
-	/*size_t sz = schema->size;*/
-	PCSTATS *stats = pcalloc(sizeof(PCSTATS));
-	stats->min.schema = schema;
-	stats->max.schema = schema;
-	stats->avg.schema = schema;
-	stats->min.readonly = PC_FALSE;
-	stats->max.readonly = PC_FALSE;
-	stats->avg.readonly = PC_FALSE;
-	stats->min.data = pcalloc(schema->size);
-	stats->max.data = pcalloc(schema->size);
-	stats->avg.data = pcalloc(schema->size);
+	PCSTATS *stats = pcalloc(sizeof(PCSTATS) + pc_stats_size(schema));
+	pc_stats_set_data(stats, schema, (uint8_t*)(stats + 1), PC_FALSE);
 	return stats;
 }
 
@@ -110,7 +109,7 @@ pc_stats_new(const PCSCHEMA *schema)
 * Allocate and populate a new PCSTATS from the raw data in
 * a PCDOUBLESTATS
 */
-static PCSTATS *
+PCSTATS *
 pc_stats_new_from_dstats(const PCSCHEMA *schema, const PCDOUBLESTATS *dstats)
 {
 	int i;
@@ -130,60 +129,127 @@ pc_stats_clone(const PCSTATS *stats)
 {
 	PCSTATS *s;
 	if ( ! stats ) return NULL;
-	s = pcalloc(sizeof(PCSTATS));
-	s->min.readonly = s->max.readonly = s->avg.readonly = PC_FALSE;
-	s->min.schema = stats->min.schema;
-	s->max.schema = stats->max.schema;
-	s->avg.schema = stats->avg.schema;
-	s->min.data = pcalloc(stats->min.schema->size);
-	s->max.data = pcalloc(stats->max.schema->size);
-	s->avg.data = pcalloc(stats->avg.schema->size);
-	memcpy(s->min.data, stats->min.data, stats->min.schema->size);
-	memcpy(s->max.data, stats->max.data, stats->max.schema->size);
-	memcpy(s->avg.data, stats->avg.data, stats->avg.schema->size);
+	s = pc_stats_new(stats->min.schema);
+	memcpy(s->data, stats->data, pc_stats_size(stats->min.schema));
 	return s;
 }
 
-int
-pc_patch_uncompressed_compute_stats(PCPATCH_UNCOMPRESSED *pa)
+/**
+* Fold the stats of npoints points into a running PCDOUBLESTATS,
+* weighting the average by the number of points.
+*/
+void
+pc_dstats_add_stats(PCDOUBLESTATS *dstats, const PCSTATS *stats, uint32_t npoints)
 {
-	int i, j;
-	const PCSCHEMA *schema = pa->schema;
-	double val;
-	PCDOUBLESTATS *dstats = pc_dstats_new(pa->schema->ndims);
+	int j;
+	const PCSCHEMA *schema = stats->min.schema;
 
-	if ( pa->stats )
-		pc_stats_free(pa->stats);
+	if ( ! npoints ) return;
+	for ( j = 0; j < schema->ndims; j++ )
+	{
+		double min, max, avg;
+		pc_point_get_double_by_index(&(stats->min), j, &min);
+		pc_point_get_double_by_index(&(stats->max), j, &max);
+		pc_point_get_double_by_index(&(stats->avg), j, &avg);
+		if ( min < dstats->dims[j].min ) dstats->dims[j].min = min;
+		if ( max > dstats->dims[j].max ) dstats->dims[j].max = max;
+		dstats->dims[j].sum += avg * npoints;
+	}
+	dstats->npoints += npoints;
+}
+
+/**
+* Fold another running PCDOUBLESTATS of ndims dimensions into dstats.
+*/
+void
+pc_dstats_merge(PCDOUBLESTATS *dstats, const PCDOUBLESTATS *other, int ndims)
+{
+	int j;
 
-	/* Point on stack for fast access to values in patch */
-	PCPOINT pt;
-	pt.readonly = PC_TRUE;
-	pt.schema = schema;
-	pt.data = pa->data;
+	if ( ! other->npoints ) return;
+	for ( j = 0; j < ndims; j++ )
+	{
+		if ( other->dims[j].min < dstats->dims[j].min ) dstats->dims[j].min = other->dims[j].min;
+		if ( other->dims[j].max > dstats->dims[j].max ) dstats->dims[j].max = other->dims[j].max;
+		dstats->dims[j].sum += other->dims[j].sum;
+	}
+	dstats->npoints += other->npoints;
+}
 
-	/* We know npoints right away */
-	dstats->npoints = pa->npoints;
+/**
+* Fold an array of npoints uncompressed points into a running PCDOUBLESTATS.
+*/
+void
+pc_dstats_add_points(PCDOUBLESTATS *dstats, const PCSCHEMA *schema, const uint8_t *data, uint32_t npoints)
+{
+	uint32_t i, j, k, n;
+	double vals[PC_VALUES_CHUNK];
 
-	for ( i = 0; i < pa->npoints; i++ )
+	/*
+	* A chunk of points at a time, one dimension after the other, so
+	* the values are converted in bulk and the sums keep point order
+	*/
+	for ( k = 0; k < npoints; k += n )
 	{
+		const uint8_t *ptr = data + (size_t)k * schema->size;
+		n = npoints - k < PC_VALUES_CHUNK ? npoints - k : PC_VALUES_CHUNK;
 		for ( j = 0; j < schema->ndims; j++ )
 		{
-			pc_point_get_double(&pt, schema->dims[j], &val);
-			/* Check minimum */
-			if ( val < dstats->dims[j].min )
-				dstats->dims[j].min = val;
-			/* Check maximum */
-			if ( val > dstats->dims[j].max )
-				dstats->dims[j].max = val;
-			/* Add to sum */
-			dstats->dims[j].sum += val;
+			const PCDIMENSION *dim = schema->dims[j];
+			PCDOUBLESTAT *ds = &(dstats->dims[j]);
+			double min = ds->min, max = ds->max, sum = ds->sum;
+
+			pc_values_to_double(ptr + dim->byteoffset, schema->size,
+				dim->interpretation, dim->scale, dim->offset, n, vals);
+			for ( i = 0; i < n; i++ )
+			{
+				if ( vals[i] < min ) min = vals[i];
+				if ( vals[i] > max ) max = vals[i];
+				sum += vals[i];
+			}
+			ds->min = min;
+			ds->max = max;
+			ds->sum = sum;
 		}
-		/* Advance to next point */
-		pt.data += schema->size;
 	}
+	dstats->npoints += npoints;
+}
+
+/**
+* The x and y ranges of the stats are the bounds of the patch, so the
+* pass that gathers the stats sets both.
+*/
+void
+pc_patch_set_dstats(PCPATCH *pa, const PCDOUBLESTATS *dstats)
+{
+	const PCSCHEMA *schema = pa->schema;
+
+	if ( pa->stats )
+		pc_stats_free(pa->stats);
+	pa->stats = pc_stats_new_from_dstats(schema, dstats);
+
+	if ( schema->xdim && schema->ydim )
+	{
+		pa->bounds.xmin = dstats->dims[schema->xdim->position].min;
+		pa->bounds.xmax = dstats->dims[schema->xdim->position].max;
+		pa->bounds.ymin = dstats->dims[schema->ydim->position].min;
+		pa->bounds.ymax = dstats->dims[schema->ydim->position].max;
+	}
+}
+
+int
+pc_patch_uncompressed_compute_stats(PCPATCH_UNCOMPRESSED *pa)
+{
+	PCARENA arena;
+	PCDOUBLESTATS *dstats;
+	PC_COUNTER_START(t0);
 
-	pa->stats = pc_stats_new_from_dstats(pa->schema, dstats);
-	pc_dstats_free(dstats);
+	pc_arena_begin(&arena);
+	dstats = pc_dstats_new_in(&arena, pa->schema->ndims);
+	pc_dstats_add_points(dstats, pa->schema, pa->data, pa->npoints);
+	pc_patch_set_dstats((PCPATCH*)pa, dstats);
+	pc_arena_end(&arena);
+	PC_COUNTER_STOP(PC_OP_STATS, t0, pa->npoints, pa->datasize, 0);
 	return PC_SUCCESS;
 }
 
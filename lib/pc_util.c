@@ -11,6 +11,7 @@
 
 #include "pc_api_internal.h"
 #include <float.h>
+#include <math.h>
 
 /**********************************************************************************
 * WKB AND ENDIANESS UTILITIES
@@ -271,6 +272,19 @@ pc_bounds_intersects(const PCBOUNDS *b1, const PCBOUNDS *b2)
 	return PC_TRUE;
 }
 
+double
+pc_bounds_distance(const PCBOUNDS *b, double x, double y)
+{
+	double dx = 0, dy = 0;
+
+	if ( x < b->xmin ) dx = b->xmin - x;
+	else if ( x > b->xmax ) dx = x - b->xmax;
+	if ( y < b->ymin ) dy = b->ymin - y;
+	else if ( y > b->ymax ) dy = y - b->ymax;
+
+	return sqrt(dx * dx + dy * dy);
+}
+
 void
 pc_bounds_init(PCBOUNDS *b)
 {
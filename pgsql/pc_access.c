@@ -12,8 +12,13 @@
 #include "pc_pgsql.h"      /* Common PgSQL support for our type */
 #include "utils/numeric.h"
 #include "funcapi.h"
+#include "executor/executor.h" /* for RegisterExprContextCallback */
+#include "utils/lsyscache.h" /* for get_typlenbyvalalign */
+#include "utils/tuplestore.h"
+#include "miscadmin.h" /* for work_mem */
 #include "lib/stringinfo.h"
 #include "pc_api_internal.h" /* for pcpatch_summary */
+#include <math.h>         /* for rint */
 
 /* cstring array utility functions */
 const char **array_to_cstring_array(ArrayType *array, int *size);
@@ -22,6 +27,7 @@ void pc_cstring_array_free(const char **array, int nelems);
 /* General SQL functions */
 Datum pcpoint_get_value(PG_FUNCTION_ARGS);
 Datum pcpoint_get_values(PG_FUNCTION_ARGS);
+Datum pcpatch_get_values(PG_FUNCTION_ARGS);
 Datum pcpatch_from_pcpoint_array(PG_FUNCTION_ARGS);
 Datum pcpatch_from_pcpatch_array(PG_FUNCTION_ARGS);
 Datum pcpatch_uncompress(PG_FUNCTION_ARGS);
@@ -29,12 +35,16 @@ Datum pcpatch_compress(PG_FUNCTION_ARGS);
 Datum pcpatch_numpoints(PG_FUNCTION_ARGS);
 Datum pcpatch_pointn(PG_FUNCTION_ARGS);
 Datum pcpatch_range(PG_FUNCTION_ARGS);
+Datum pcpatch_decimate(PG_FUNCTION_ARGS);
+Datum pcpatch_decimate_ratio(PG_FUNCTION_ARGS);
 Datum pcpatch_pcid(PG_FUNCTION_ARGS);
 Datum pcpatch_summary(PG_FUNCTION_ARGS);
 Datum pcpatch_compression(PG_FUNCTION_ARGS);
 Datum pcpatch_intersects(PG_FUNCTION_ARGS);
 Datum pcpatch_get_stat(PG_FUNCTION_ARGS);
 Datum pcpatch_filter(PG_FUNCTION_ARGS);
+Datum pcpatch_filter_expression(PG_FUNCTION_ARGS);
+Datum pcpatch_filter_polygon(PG_FUNCTION_ARGS);
 Datum pcpatch_sort(PG_FUNCTION_ARGS);
 Datum pcpatch_is_sorted(PG_FUNCTION_ARGS);
 Datum pcpatch_size(PG_FUNCTION_ARGS);
@@ -44,6 +54,9 @@ Datum pc_version(PG_FUNCTION_ARGS);
 
 /* Generic aggregation functions */
 Datum pointcloud_agg_transfn(PG_FUNCTION_ARGS);
+Datum pointcloud_agg_combinefn(PG_FUNCTION_ARGS);
+Datum pointcloud_agg_serialfn(PG_FUNCTION_ARGS);
+Datum pointcloud_agg_deserialfn(PG_FUNCTION_ARGS);
 Datum pointcloud_abs_in(PG_FUNCTION_ARGS);
 Datum pointcloud_abs_out(PG_FUNCTION_ARGS);
 
@@ -54,6 +67,27 @@ Datum pcpoint_agg_final_array(PG_FUNCTION_ARGS);
 /* Patch finalizers */
 Datum pcpatch_agg_final_array(PG_FUNCTION_ARGS);
 Datum pcpatch_agg_final_pcpatch(PG_FUNCTION_ARGS);
+Datum pcpatch_union_transfn(PG_FUNCTION_ARGS);
+Datum pcpatch_union_final(PG_FUNCTION_ARGS);
+Datum pcpatch_union_combinefn(PG_FUNCTION_ARGS);
+Datum pcpatch_union_serialfn(PG_FUNCTION_ARGS);
+Datum pcpatch_union_deserialfn(PG_FUNCTION_ARGS);
+Datum pcpatch_stats_transfn(PG_FUNCTION_ARGS);
+Datum pcpatch_stats_final(PG_FUNCTION_ARGS);
+Datum pcpatch_grid(PG_FUNCTION_ARGS);
+Datum pcpatch_grid_raster(PG_FUNCTION_ARGS);
+Datum pcpatch_grid_transfn(PG_FUNCTION_ARGS);
+Datum pcpatch_grid_final(PG_FUNCTION_ARGS);
+Datum pcpatch_grid_raster_final(PG_FUNCTION_ARGS);
+Datum pcpatch_knn(PG_FUNCTION_ARGS);
+Datum pcpatch_knn_xyz(PG_FUNCTION_ARGS);
+Datum pcpatch_knn_array(PG_FUNCTION_ARGS);
+Datum pcpatch_stats_combinefn(PG_FUNCTION_ARGS);
+Datum pcpatch_grid_combinefn(PG_FUNCTION_ARGS);
+Datum pcpatch_grid_serialfn(PG_FUNCTION_ARGS);
+Datum pcpatch_grid_deserialfn(PG_FUNCTION_ARGS);
+Datum pcpatch_stats_serialfn(PG_FUNCTION_ARGS);
+Datum pcpatch_stats_deserialfn(PG_FUNCTION_ARGS);
 
 /* Deaggregation functions */
 Datum pcpatch_unnest(PG_FUNCTION_ARGS);
@@ -118,6 +152,118 @@ Datum pcpoint_get_values(PG_FUNCTION_ARGS)
 	PG_RETURN_ARRAYTYPE_P(result);
 }
 
+/**
+* PC_Get(patch pcpatch, dimname text) returns float8[]
+* The values of one dimension for every point of the patch. Only the
+* bytes of that dimension are fetched and decoded for dimensional
+* patches, the other dimensions are skipped.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_get_values);
+Datum pcpatch_get_values(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serhdr = PG_GETHEADER_SERPATCH_P(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serhdr->pcid, fcinfo);
+	char *dim_name = text_to_cstring(PG_GETARG_TEXT_P(1));
+	PCDIMENSION *dim = pc_schema_get_dimension_by_name(schema, dim_name);
+	uint8_t *dimmask;
+	PCPATCH *patch;
+	ArrayType *result;
+	size_t nbytes;
+
+	if ( ! dim )
+		elog(ERROR, "dimension \"%s\" does not exist", dim_name);
+	pfree(dim_name);
+
+	if ( serhdr->npoints == 0 )
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT8OID));
+
+	dimmask = palloc0(schema->ndims);
+	dimmask[dim->position] = 1;
+	patch = pc_patch_deserialize_dims(PG_GETARG_DATUM(0), schema, dimmask);
+
+	/* Values are written straight into the array payload */
+	nbytes = ARR_OVERHEAD_NONULLS(1) + sizeof(float8) * patch->npoints;
+	result = (ArrayType *) palloc0(nbytes);
+	SET_VARSIZE(result, nbytes);
+	result->ndim = 1;
+	result->dataoffset = 0;
+	result->elemtype = FLOAT8OID;
+	ARR_DIMS(result)[0] = patch->npoints;
+	ARR_LBOUND(result)[0] = 1;
+
+	if ( PC_FAILURE == pc_patch_get_values(patch, dim, (double *) ARR_DATA_PTR(result)) )
+		elog(ERROR, "%s: failed to read the values of \"%s\"", __func__, dim->name);
+
+	pc_patch_free(patch);
+	pfree(dimmask);
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/**
+* PC_Get(patch pcpatch, dimnames text[]) returns float8[][]
+* The values of several dimensions for every point of the patch, one
+* row of the array per dimension, in the order asked for. Only the
+* requested dimensions are fetched and decoded for dimensional patches.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_get_values_multi);
+Datum pcpatch_get_values_multi(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serhdr = PG_GETHEADER_SERPATCH_P(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serhdr->pcid, fcinfo);
+	ArrayType *names = PG_GETARG_ARRAYTYPE_P(1);
+	PCDIMENSION **dims;
+	uint8_t *dimmask;
+	PCPATCH *patch;
+	ArrayType *result;
+	Datum *elems;
+	bool *nulls;
+	int nelems;
+	int i;
+	size_t nbytes;
+
+	deconstruct_array(names, TEXTOID, -1, false, 'i', &elems, &nulls, &nelems);
+
+	if ( nelems == 0 || serhdr->npoints == 0 )
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(FLOAT8OID));
+
+	dims = palloc(nelems * sizeof(PCDIMENSION *));
+	dimmask = palloc0(schema->ndims);
+	for ( i = 0; i < nelems; i++ )
+	{
+		char *dim_name;
+		if ( nulls[i] )
+			elog(ERROR, "dimension names must not be null");
+		dim_name = text_to_cstring(DatumGetTextP(elems[i]));
+		dims[i] = pc_schema_get_dimension_by_name(schema, dim_name);
+		if ( ! dims[i] )
+			elog(ERROR, "dimension \"%s\" does not exist", dim_name);
+		dimmask[dims[i]->position] = 1;
+		pfree(dim_name);
+	}
+
+	patch = pc_patch_deserialize_dims(PG_GETARG_DATUM(0), schema, dimmask);
+
+	/* Values are written straight into the array payload, one row per dimension */
+	nbytes = ARR_OVERHEAD_NONULLS(2) + sizeof(float8) * patch->npoints * nelems;
+	result = (ArrayType *) palloc0(nbytes);
+	SET_VARSIZE(result, nbytes);
+	result->ndim = 2;
+	result->dataoffset = 0;
+	result->elemtype = FLOAT8OID;
+	ARR_DIMS(result)[0] = nelems;
+	ARR_DIMS(result)[1] = patch->npoints;
+	ARR_LBOUND(result)[0] = 1;
+	ARR_LBOUND(result)[1] = 1;
+
+	if ( PC_FAILURE == pc_patch_get_values_multi(patch, dims, nelems, (double *) ARR_DATA_PTR(result)) )
+		elog(ERROR, "%s: failed to read the dimension values", __func__);
+
+	pc_patch_free(patch);
+	pfree(dimmask);
+	pfree(dims);
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
 
 static inline bool
 array_get_isnull(const bits8 *nullbitmap, int offset)
@@ -142,7 +288,7 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 	int i;
 	uint32 pcid = 0;
 	PCPATCH *pa;
-	PCPOINTLIST *pl;
+	PCPOINTLIST *pl = NULL;
 	PCSCHEMA *schema = 0;
 
 	/* How many things in our array? */
@@ -155,9 +301,6 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 	if ( nelems == 0 )
 		return NULL;
 
-	/* Make our holder */
-	pl = pc_pointlist_make(nelems);
-
 	offset = 0;
 	bitmap = ARR_NULLBITMAP(array);
 	for ( i = 0; i < nelems; i++ )
@@ -166,11 +309,12 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 		if ( ! array_get_isnull(bitmap, i) )
 		{
 			SERIALIZED_POINT *serpt = (SERIALIZED_POINT *)(ARR_DATA_PTR(array)+offset);
-			PCPOINT *pt;
 
+			/* Make our holder, the points go back to back in it */
 			if ( ! schema )
 			{
 				schema = pc_schema_from_pcid(serpt->pcid, fcinfo);
+				pl = pc_pointlist_make_rows(schema, nelems);
 			}
 
 			if ( ! pcid )
@@ -182,23 +326,24 @@ pcpatch_from_point_array(ArrayType *array, FunctionCallInfoData *fcinfo)
 				elog(ERROR, "pcpatch_from_point_array: pcid mismatch (%d != %d)", serpt->pcid, pcid);
 			}
 
-			pt = pc_point_deserialize(serpt, schema);
-			if ( ! pt )
+			/* Same check as pc_point_deserialize, without a point to copy through */
+			if ( schema->size != VARSIZE(serpt) + 1 - sizeof(SERIALIZED_POINT) )
 			{
-				elog(ERROR, "pcpatch_from_point_array: point deserialization failed");
+				elog(ERROR, "schema size and disk size mismatch, repair the schema");
 			}
 
-			pc_pointlist_add_point(pl, pt);
+			pc_pointlist_add_row(pl, serpt->data);
 
 			offset += INTALIGN(VARSIZE(serpt));
 		}
 
 	}
 
-	if ( pl->npoints == 0 )
+	if ( ! pl )
 		return NULL;
 
-	pa = pc_patch_from_pointlist(pl);
+	/* The patch takes over the rows, no copy */
+	pa = pc_patch_from_pointlist_take(pl);
 	pc_pointlist_free(pl);
 	return pa;
 }
@@ -370,7 +515,8 @@ Datum pointcloud_agg_transfn(PG_FUNCTION_ARGS)
 
 	if ( PG_ARGISNULL(0) )
 	{
-		a = (abs_trans*) palloc(sizeof(abs_trans));
+		/* An internal state is not copied for us, it has to live in aggcontext */
+		a = (abs_trans*) MemoryContextAlloc(aggcontext, sizeof(abs_trans));
 		a->s = NULL;
 	}
 	else
@@ -404,6 +550,102 @@ pointcloud_agg_final(abs_trans *a, MemoryContext mctx, FunctionCallInfo fcinfo)
 	return makeMdArrayResult(state, 1, dims, lbs, mctx, false);
 }
 
+/**
+* Combine the states of two partial aggregates by appending
+* the values collected by the second one to the first one.
+*/
+PG_FUNCTION_INFO_V1(pointcloud_agg_combinefn);
+Datum pointcloud_agg_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	abs_trans *a1, *a2;
+	ArrayBuildState *s2;
+	int i;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		elog(ERROR, "pointcloud_agg_combinefn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	a1 = PG_ARGISNULL(0) ? NULL : (abs_trans*) PG_GETARG_POINTER(0);
+	a2 = PG_ARGISNULL(1) ? NULL : (abs_trans*) PG_GETARG_POINTER(1);
+
+	if ( ! a2 || ! a2->s )
+	{
+		if ( ! a1 )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(a1);
+	}
+
+	if ( ! a1 )
+	{
+		a1 = (abs_trans*) MemoryContextAlloc(aggcontext, sizeof(abs_trans));
+		a1->s = NULL;
+	}
+
+	/* accumArrayResult copies the values into aggcontext */
+	s2 = a2->s;
+	for ( i = 0; i < s2->nelems; i++ )
+	{
+		a1->s = accumArrayResult(a1->s,
+			s2->dvalues[i],
+			s2->dnulls[i],
+			s2->element_type,
+			aggcontext);
+	}
+
+	PG_RETURN_POINTER(a1);
+}
+
+/**
+* The state crosses worker boundaries as the array of values
+* collected so far, which is already a flat varlena.
+*/
+PG_FUNCTION_INFO_V1(pointcloud_agg_serialfn);
+Datum pointcloud_agg_serialfn(PG_FUNCTION_ARGS)
+{
+	abs_trans *a;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pointcloud_agg_serialfn called in non-aggregate context");
+
+	a = (abs_trans*) PG_GETARG_POINTER(0);
+	PG_RETURN_BYTEA_P(DatumGetPointer(pointcloud_agg_final(a, CurrentMemoryContext, fcinfo)));
+}
+
+PG_FUNCTION_INFO_V1(pointcloud_agg_deserialfn);
+Datum pointcloud_agg_deserialfn(PG_FUNCTION_ARGS)
+{
+	ArrayType *array;
+	abs_trans *a;
+	Oid elemtype;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	Datum *elems;
+	bool *nulls;
+	int nelems;
+	int i;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pointcloud_agg_deserialfn called in non-aggregate context");
+
+	array = DatumGetArrayTypeP(PG_GETARG_DATUM(0));
+	elemtype = ARR_ELEMTYPE(array);
+	get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+	deconstruct_array(array, elemtype, typlen, typbyval, typalign, &elems, &nulls, &nelems);
+
+	a = (abs_trans*) palloc(sizeof(abs_trans));
+	a->s = NULL;
+	for ( i = 0; i < nelems; i++ )
+	{
+		a->s = accumArrayResult(a->s, elems[i], nulls[i], elemtype, CurrentMemoryContext);
+	}
+
+	PG_RETURN_POINTER(a);
+}
+
 PG_FUNCTION_INFO_V1(pcpoint_agg_final_array);
 Datum pcpoint_agg_final_array(PG_FUNCTION_ARGS)
 {
@@ -420,83 +662,1185 @@ Datum pcpoint_agg_final_array(PG_FUNCTION_ARGS)
 }
 
 
-PG_FUNCTION_INFO_V1(pcpatch_agg_final_array);
-Datum pcpatch_agg_final_array(PG_FUNCTION_ARGS)
-{
-	abs_trans *a;
-	Datum result = 0;
+PG_FUNCTION_INFO_V1(pcpatch_agg_final_array);
+Datum pcpatch_agg_final_array(PG_FUNCTION_ARGS)
+{
+	abs_trans *a;
+	Datum result = 0;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	a = (abs_trans*) PG_GETARG_POINTER(0);
+
+	result = pointcloud_agg_final(a, CurrentMemoryContext, fcinfo);
+	PG_RETURN_DATUM(result);
+}
+
+
+PG_FUNCTION_INFO_V1(pcpoint_agg_final_pcpatch);
+Datum pcpoint_agg_final_pcpatch(PG_FUNCTION_ARGS)
+{
+	ArrayType *array;
+	abs_trans *a;
+	PCPATCH *pa;
+	SERIALIZED_PATCH *serpa;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	a = (abs_trans*) PG_GETARG_POINTER(0);
+
+	array = DatumGetArrayTypeP(pointcloud_agg_final(a, CurrentMemoryContext, fcinfo));
+	pa = pcpatch_from_point_array(array, fcinfo);
+	if ( ! pa )
+		PG_RETURN_NULL();
+
+	serpa = pc_patch_serialize(pa, NULL);
+	pc_patch_free(pa);
+	PG_RETURN_POINTER(serpa);
+}
+
+
+PG_FUNCTION_INFO_V1(pcpatch_agg_final_pcpatch);
+Datum pcpatch_agg_final_pcpatch(PG_FUNCTION_ARGS)
+{
+	ArrayType *array;
+	abs_trans *a;
+	PCPATCH *pa;
+	SERIALIZED_PATCH *serpa;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	a = (abs_trans*) PG_GETARG_POINTER(0);
+
+	array = DatumGetArrayTypeP(pointcloud_agg_final(a, CurrentMemoryContext, fcinfo));
+	pa = pcpatch_from_patch_array(array, fcinfo);
+	if ( ! pa )
+		PG_RETURN_NULL();
+
+	serpa = pc_patch_serialize(pa, NULL);
+	pc_patch_free(pa);
+	PG_RETURN_POINTER(serpa);
+}
+
+
+/**
+* PC_Union transition: each patch is appended to a PCPATCH_UNION
+* kept in the aggregate context as soon as it arrives, so we never
+* hold all the input patches at once.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_union_transfn);
+Datum pcpatch_union_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	PCPATCH_UNION *pcu;
+	SERIALIZED_PATCH *serpatch;
+	PCSCHEMA *schema;
+	PCPATCH *pa;
+	int rv;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		elog(ERROR, "pcpatch_union_transfn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	pcu = PG_ARGISNULL(0) ? NULL : (PCPATCH_UNION*) PG_GETARG_POINTER(0);
+
+	if ( PG_ARGISNULL(1) )
+	{
+		if ( ! pcu )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(pcu);
+	}
+
+	serpatch = PG_GETARG_SERPATCH_P(1);
+	if ( pcu && pcu->schema->pcid != serpatch->pcid )
+	{
+		elog(ERROR, "pcpatch_union_transfn: pcid mismatch (%d != %d)", serpatch->pcid, pcu->schema->pcid);
+	}
+
+	schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	pa = pc_patch_deserialize(serpatch, schema);
+	if ( ! pa )
+	{
+		elog(ERROR, "pcpatch_union_transfn: patch deserialization failed");
+	}
+
+	/* The union and its buffers must outlive this call */
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	if ( ! pcu )
+		pcu = pc_patch_union_new(schema);
+	rv = pc_patch_union_add(pcu, pa);
+	MemoryContextSwitchTo(oldcontext);
+
+	if ( rv == PC_FAILURE )
+	{
+		elog(ERROR, "pcpatch_union_transfn: failed to add patch");
+	}
+
+	pc_patch_free(pa);
+	PG_FREE_IF_COPY(serpatch, 1);
+	PG_RETURN_POINTER(pcu);
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_union_final);
+Datum pcpatch_union_final(PG_FUNCTION_ARGS)
+{
+	PCPATCH_UNION *pcu;
+	PCPATCH *pa;
+	SERIALIZED_PATCH *serpa;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	pcu = (PCPATCH_UNION*) PG_GETARG_POINTER(0);
+
+	pa = pc_patch_union_result(pcu);
+	if ( ! pa )
+		PG_RETURN_NULL();
+
+	serpa = pc_patch_serialize(pa, NULL);
+	pc_patch_free(pa);
+	PG_RETURN_POINTER(serpa);
+}
+
+
+/**
+* Combine the states of two partial PC_Union aggregates.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_union_combinefn);
+Datum pcpatch_union_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	MemoryContext oldcontext;
+	PCPATCH_UNION *pcu1, *pcu2;
+	int rv;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		elog(ERROR, "pcpatch_union_combinefn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	pcu1 = PG_ARGISNULL(0) ? NULL : (PCPATCH_UNION*) PG_GETARG_POINTER(0);
+	pcu2 = PG_ARGISNULL(1) ? NULL : (PCPATCH_UNION*) PG_GETARG_POINTER(1);
+
+	if ( ! pcu2 )
+	{
+		if ( ! pcu1 )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(pcu1);
+	}
+
+	if ( pcu1 && pcu1->schema->pcid != pcu2->schema->pcid )
+	{
+		elog(ERROR, "pcpatch_union_combinefn: pcid mismatch (%d != %d)", pcu2->schema->pcid, pcu1->schema->pcid);
+	}
+
+	/* The second state may be short-lived, so copy its points over */
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	if ( ! pcu1 )
+		pcu1 = pc_patch_union_new(pcu2->schema);
+	rv = pc_patch_union_merge(pcu1, pcu2);
+	MemoryContextSwitchTo(oldcontext);
+
+	if ( rv == PC_FAILURE )
+	{
+		elog(ERROR, "pcpatch_union_combinefn: failed to merge states");
+	}
+
+	PG_RETURN_POINTER(pcu1);
+}
+
+/**
+* A partial PC_Union crosses worker boundaries as a serialized patch:
+* the columns of dimensional inputs are compressed again, uncompressed
+* points are sent as-is.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_union_serialfn);
+Datum pcpatch_union_serialfn(PG_FUNCTION_ARGS)
+{
+	PCPATCH_UNION *pcu;
+	PCPATCH *pa;
+	SERIALIZED_PATCH *serpa;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pcpatch_union_serialfn called in non-aggregate context");
+
+	pcu = (PCPATCH_UNION*) PG_GETARG_POINTER(0);
+	pa = pc_patch_union_result(pcu);
+	if ( pa->type == PC_NONE )
+		serpa = pc_patch_serialize_to_uncompressed(pa);
+	else
+		serpa = pc_patch_serialize(pa, NULL);
+	pc_patch_free(pa);
+
+	PG_RETURN_BYTEA_P(serpa);
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_union_deserialfn);
+Datum pcpatch_union_deserialfn(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch;
+	PCSCHEMA *schema;
+	PCPATCH_UNION *pcu;
+	PCPATCH *pa;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pcpatch_union_deserialfn called in non-aggregate context");
+
+	serpatch = (SERIALIZED_PATCH*) PG_GETARG_BYTEA_P(0);
+	schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	pa = pc_patch_deserialize(serpatch, schema);
+	if ( ! pa )
+	{
+		elog(ERROR, "pcpatch_union_deserialfn: patch deserialization failed");
+	}
+
+	pcu = pc_patch_union_new(schema);
+	if ( PC_FAILURE == pc_patch_union_add(pcu, pa) )
+	{
+		elog(ERROR, "pcpatch_union_deserialfn: failed to add patch");
+	}
+	pc_patch_free(pa);
+
+	PG_RETURN_POINTER(pcu);
+}
+
+
+/**
+* PC_StatsAgg state: running min/max/sum of every dimension,
+* built from the stats stored in the patch headers.
+*/
+typedef struct
+{
+	const PCSCHEMA *schema;
+	PCDOUBLESTATS *dstats;
+} stats_trans;
+
+static stats_trans *
+pcpatch_stats_trans_new(const PCSCHEMA *schema, MemoryContext mctx)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(mctx);
+	stats_trans *st = palloc(sizeof(stats_trans));
+	st->schema = schema;
+	st->dstats = pc_dstats_new(schema->ndims);
+	MemoryContextSwitchTo(oldcontext);
+	return st;
+}
+
+/**
+* PC_StatsAgg transition: only the header and stats slice of
+* each patch is detoasted, the points are never read.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_stats_transfn);
+Datum pcpatch_stats_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	stats_trans *st;
+	SERIALIZED_PATCH *serpa;
+	PCSTATS *stats;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		elog(ERROR, "pcpatch_stats_transfn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	st = PG_ARGISNULL(0) ? NULL : (stats_trans*) PG_GETARG_POINTER(0);
+
+	if ( PG_ARGISNULL(1) )
+	{
+		if ( ! st )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(st);
+	}
+
+	if ( ! st )
+	{
+		serpa = PG_GETHEADER_SERPATCH_P(1);
+		st = pcpatch_stats_trans_new(pc_schema_from_pcid(serpa->pcid, fcinfo), aggcontext);
+	}
+
+	serpa = PG_GETHEADERX_SERPATCH_P(1, pc_stats_size(st->schema));
+	if ( serpa->pcid != st->schema->pcid )
+	{
+		elog(ERROR, "pcpatch_stats_transfn: pcid mismatch (%d != %d)", serpa->pcid, st->schema->pcid);
+	}
+
+	stats = pc_patch_stats_deserialize(st->schema, serpa->data);
+	pc_dstats_add_stats(st->dstats, stats, serpa->npoints);
+	pc_stats_free(stats);
+
+	PG_RETURN_POINTER(st);
+}
+
+/**
+* PC_StatsAgg(p pcpatch) returns pcpoint[]
+* The min, max and point-weighted average of every dimension.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_stats_final);
+Datum pcpatch_stats_final(PG_FUNCTION_ARGS)
+{
+	stats_trans *st;
+	PCSTATS *stats;
+	Datum elems[3];
+	Oid elemtype;
+	int16 typlen;
+	bool typbyval;
+	char typalign;
+	ArrayType *result;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	st = (stats_trans*) PG_GETARG_POINTER(0);
+	if ( ! st->dstats->npoints )
+		PG_RETURN_NULL();
+
+	stats = pc_stats_new_from_dstats(st->schema, st->dstats);
+	elems[0] = PointerGetDatum(pc_point_serialize(&(stats->min)));
+	elems[1] = PointerGetDatum(pc_point_serialize(&(stats->max)));
+	elems[2] = PointerGetDatum(pc_point_serialize(&(stats->avg)));
+	pc_stats_free(stats);
+
+	elemtype = get_element_type(get_fn_expr_rettype(fcinfo->flinfo));
+	get_typlenbyvalalign(elemtype, &typlen, &typbyval, &typalign);
+	result = construct_array(elems, 3, elemtype, typlen, typbyval, typalign);
+
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_stats_combinefn);
+Datum pcpatch_stats_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	stats_trans *st1, *st2;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		elog(ERROR, "pcpatch_stats_combinefn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	st1 = PG_ARGISNULL(0) ? NULL : (stats_trans*) PG_GETARG_POINTER(0);
+	st2 = PG_ARGISNULL(1) ? NULL : (stats_trans*) PG_GETARG_POINTER(1);
+
+	if ( ! st2 )
+	{
+		if ( ! st1 )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(st1);
+	}
+
+	if ( ! st1 )
+		st1 = pcpatch_stats_trans_new(st2->schema, aggcontext);
+	else if ( st1->schema->pcid != st2->schema->pcid )
+		elog(ERROR, "pcpatch_stats_combinefn: pcid mismatch (%d != %d)", st2->schema->pcid, st1->schema->pcid);
+
+	pc_dstats_merge(st1->dstats, st2->dstats, st1->schema->ndims);
+	PG_RETURN_POINTER(st1);
+}
+
+/**
+* Serialized PC_StatsAgg state:
+*   uint32 pcid, uint32 npoints, double[ndims][3] min/max/sum
+*/
+PG_FUNCTION_INFO_V1(pcpatch_stats_serialfn);
+Datum pcpatch_stats_serialfn(PG_FUNCTION_ARGS)
+{
+	stats_trans *st;
+	size_t dimsize;
+	bytea *result;
+	uint8_t *buf;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pcpatch_stats_serialfn called in non-aggregate context");
+
+	st = (stats_trans*) PG_GETARG_POINTER(0);
+	dimsize = st->schema->ndims * sizeof(PCDOUBLESTAT);
+	result = palloc(VARHDRSZ + 2 * sizeof(uint32_t) + dimsize);
+	SET_VARSIZE(result, VARHDRSZ + 2 * sizeof(uint32_t) + dimsize);
+
+	buf = (uint8_t*) VARDATA(result);
+	memcpy(buf, &(st->schema->pcid), sizeof(uint32_t));
+	memcpy(buf + sizeof(uint32_t), &(st->dstats->npoints), sizeof(uint32_t));
+	memcpy(buf + 2 * sizeof(uint32_t), st->dstats->dims, dimsize);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_stats_deserialfn);
+Datum pcpatch_stats_deserialfn(PG_FUNCTION_ARGS)
+{
+	bytea *serst;
+	stats_trans *st;
+	uint8_t *buf;
+	uint32_t pcid;
+	size_t dimsize;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pcpatch_stats_deserialfn called in non-aggregate context");
+
+	serst = PG_GETARG_BYTEA_P(0);
+	buf = (uint8_t*) VARDATA(serst);
+	memcpy(&pcid, buf, sizeof(uint32_t));
+
+	st = pcpatch_stats_trans_new(pc_schema_from_pcid(pcid, fcinfo), CurrentMemoryContext);
+	dimsize = st->schema->ndims * sizeof(PCDOUBLESTAT);
+	if ( VARSIZE(serst) != VARHDRSZ + 2 * sizeof(uint32_t) + dimsize )
+		elog(ERROR, "pcpatch_stats_deserialfn: invalid state size");
+
+	memcpy(&(st->dstats->npoints), buf + sizeof(uint32_t), sizeof(uint32_t));
+	memcpy(st->dstats->dims, buf + 2 * sizeof(uint32_t), dimsize);
+
+	PG_RETURN_POINTER(st);
+}
+
+/**
+* Grid values as a 2-D float8 array, one row of the array per
+* row of cells with the northern one first. Empty cells are NULL,
+* but for counts.
+*/
+static ArrayType *
+pcgrid_to_array(const PCGRID *grid, int agg)
+{
+	size_t ncells = (size_t)grid->nx * grid->ny;
+	double *vals;
+	uint8_t *isnull;
+	Datum *elems;
+	bool *nulls;
+	int dims[2], lbs[2];
+	size_t i;
+	ArrayType *result;
+
+	if ( ! ncells )
+		return construct_empty_array(FLOAT8OID);
+
+	vals = palloc(ncells * sizeof(double));
+	isnull = palloc(ncells);
+	if ( PC_FAILURE == pc_grid_get_values(grid, agg, vals, isnull) )
+		elog(ERROR, "%s: failed to read the grid values", __func__);
+
+	elems = palloc(ncells * sizeof(Datum));
+	nulls = palloc(ncells * sizeof(bool));
+	for ( i = 0; i < ncells; i++ )
+	{
+		elems[i] = Float8GetDatum(vals[i]);
+		nulls[i] = isnull[i];
+	}
+
+	dims[0] = grid->ny;
+	dims[1] = grid->nx;
+	lbs[0] = lbs[1] = 1;
+	result = construct_md_array(elems, nulls, 2, dims, lbs, FLOAT8OID,
+		sizeof(float8), FLOAT8PASSBYVAL, 'd');
+
+	pfree(vals);
+	pfree(isnull);
+	pfree(elems);
+	pfree(nulls);
+	return result;
+}
+
+static bytea *
+pcgrid_to_raster(const PCGRID *grid, int agg, uint32_t srid)
+{
+	size_t wkbsize;
+	uint8_t *wkb = pc_grid_to_raster_wkb(grid, agg, srid, &wkbsize);
+	bytea *result;
+
+	if ( ! wkb )
+		elog(ERROR, "%s: failed to write the grid raster", __func__);
+
+	result = palloc(VARHDRSZ + wkbsize);
+	SET_VARSIZE(result, VARHDRSZ + wkbsize);
+	memcpy(VARDATA(result), wkb, wkbsize);
+	pfree(wkb);
+	return result;
+}
+
+static int
+pcgrid_agg_from_text(text *aggtxt)
+{
+	char *aggname = text_to_cstring(aggtxt);
+	int agg = pc_grid_agg_number(aggname);
+	if ( agg < 0 )
+		elog(ERROR, "unknown grid aggregate \"%s\", use count, min, max, sum or avg", aggname);
+	pfree(aggname);
+	return agg;
+}
+
+/**
+* Grid of the patch from the arguments of PC_Grid, only the X, Y
+* and binned dimensions are read off dimensional patches.
+*/
+static PCGRID *
+pcpatch_grid_from_args(FunctionCallInfo fcinfo, PCSCHEMA **schema)
+{
+	SERIALIZED_PATCH *serhdr = PG_GETHEADER_SERPATCH_P(0);
+	float8 cellsize = PG_GETARG_FLOAT8(1);
+	char *dim_name = text_to_cstring(PG_GETARG_TEXT_P(2));
+	PCDIMENSION *dim;
+	uint8_t *dimmask;
+	PCPATCH *patch;
+	PCGRID *grid;
+
+	*schema = pc_schema_from_pcid(serhdr->pcid, fcinfo);
+	dim = pc_schema_get_dimension_by_name(*schema, dim_name);
+	if ( ! dim )
+		elog(ERROR, "dimension \"%s\" does not exist", dim_name);
+	if ( ! ( (*schema)->xdim && (*schema)->ydim ) )
+		elog(ERROR, "patch schema has no X and Y dimensions");
+	pfree(dim_name);
+
+	if ( serhdr->npoints == 0 )
+		return pc_grid_new(cellsize);
+
+	dimmask = palloc0((*schema)->ndims);
+	dimmask[(*schema)->xdim->position] = 1;
+	dimmask[(*schema)->ydim->position] = 1;
+	dimmask[dim->position] = 1;
+	patch = pc_patch_deserialize_dims(PG_GETARG_DATUM(0), *schema, dimmask);
+
+	grid = pc_grid_from_patch(patch, cellsize, dim);
+	if ( ! grid )
+		elog(ERROR, "%s: failed to grid patch", __func__);
+
+	pc_patch_free(patch);
+	pfree(dimmask);
+	return grid;
+}
+
+/**
+* PC_Grid(patch pcpatch, cellsize float8, dimname text, agg text) returns float8[][]
+* The count, min, max, sum or avg of a dimension in square cells over
+* the patch, in a single pass. Cells are aligned on multiples of the
+* cell size.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_grid);
+Datum pcpatch_grid(PG_FUNCTION_ARGS)
+{
+	int agg = pcgrid_agg_from_text(PG_GETARG_TEXT_P(3));
+	PCSCHEMA *schema;
+	PCGRID *grid = pcpatch_grid_from_args(fcinfo, &schema);
+	ArrayType *result = pcgrid_to_array(grid, agg);
+	pc_grid_free(grid);
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/**
+* PC_GridRaster(patch pcpatch, cellsize float8, dimname text, agg text) returns bytea
+* The grid of PC_Grid as the WKB of a one band PostGIS raster,
+* in the srid of the patch. NULL for a patch without points.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_grid_raster);
+Datum pcpatch_grid_raster(PG_FUNCTION_ARGS)
+{
+	int agg = pcgrid_agg_from_text(PG_GETARG_TEXT_P(3));
+	PCSCHEMA *schema;
+	PCGRID *grid = pcpatch_grid_from_args(fcinfo, &schema);
+	bytea *result;
+
+	if ( ! ( grid->nx && grid->ny ) )
+	{
+		pc_grid_free(grid);
+		PG_RETURN_NULL();
+	}
+
+	result = pcgrid_to_raster(grid, agg, schema->srid);
+	pc_grid_free(grid);
+	PG_RETURN_BYTEA_P(result);
+}
+
+/* State of PC_GridAgg and PC_GridRasterAgg */
+typedef struct
+{
+	PCGRID *grid;
+	int agg;
+	uint32_t srid;
+	char *dimname;
+} grid_trans;
+
+static grid_trans *
+pcpatch_grid_trans_new(double cellsize, int agg, uint32_t srid, const char *dimname, MemoryContext mctx)
+{
+	MemoryContext oldcontext = MemoryContextSwitchTo(mctx);
+	grid_trans *gt = palloc(sizeof(grid_trans));
+	gt->grid = pc_grid_new(cellsize);
+	gt->agg = agg;
+	gt->srid = srid;
+	gt->dimname = pstrdup(dimname);
+	MemoryContextSwitchTo(oldcontext);
+	return gt;
+}
+
+/**
+* PC_GridAgg transition: each patch is binned in the cells of the
+* grid, which grows over the patch first. The cell size, dimension
+* and aggregate of the first row hold for all of them.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_grid_transfn);
+Datum pcpatch_grid_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, oldcontext;
+	grid_trans *gt;
+	SERIALIZED_PATCH *serhdr;
+	PCSCHEMA *schema;
+	PCDIMENSION *dim;
+	uint8_t *dimmask;
+	PCPATCH *patch;
+	int rv;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		elog(ERROR, "pcpatch_grid_transfn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	gt = PG_ARGISNULL(0) ? NULL : (grid_trans*) PG_GETARG_POINTER(0);
+
+	if ( PG_ARGISNULL(1) )
+	{
+		if ( ! gt )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(gt);
+	}
+
+	serhdr = PG_GETHEADER_SERPATCH_P(1);
+	schema = pc_schema_from_pcid(serhdr->pcid, fcinfo);
+
+	if ( ! gt )
+	{
+		char *dim_name;
+		if ( PG_ARGISNULL(2) || PG_ARGISNULL(3) || PG_ARGISNULL(4) )
+			elog(ERROR, "pcpatch_grid_transfn: cell size, dimension and aggregate must not be NULL");
+		dim_name = text_to_cstring(PG_GETARG_TEXT_P(3));
+		gt = pcpatch_grid_trans_new(PG_GETARG_FLOAT8(2), pcgrid_agg_from_text(PG_GETARG_TEXT_P(4)),
+		                            schema->srid, dim_name, aggcontext);
+		pfree(dim_name);
+	}
+
+	/* Patches of other schemas are binned on the dimension of the same name */
+	dim = pc_schema_get_dimension_by_name(schema, gt->dimname);
+	if ( ! dim )
+		elog(ERROR, "dimension \"%s\" does not exist", gt->dimname);
+	if ( ! ( schema->xdim && schema->ydim ) )
+		elog(ERROR, "patch schema has no X and Y dimensions");
+
+	if ( serhdr->npoints == 0 )
+		PG_RETURN_POINTER(gt);
+
+	dimmask = palloc0(schema->ndims);
+	dimmask[schema->xdim->position] = 1;
+	dimmask[schema->ydim->position] = 1;
+	dimmask[dim->position] = 1;
+	patch = pc_patch_deserialize_dims(PG_GETARG_DATUM(1), schema, dimmask);
+
+	/* Only the cells live in the aggregate context, not the decoded patch */
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	rv = pc_grid_extend(gt->grid, &(patch->bounds));
+	MemoryContextSwitchTo(oldcontext);
+
+	if ( rv == PC_FAILURE || PC_FAILURE == pc_grid_add_patch(gt->grid, patch, dim) )
+		elog(ERROR, "pcpatch_grid_transfn: failed to grid patch");
+
+	pc_patch_free(patch);
+	pfree(dimmask);
+	PG_RETURN_POINTER(gt);
+}
+
+/**
+* PC_GridAgg(p pcpatch, cellsize float8, dimname text, agg text) returns float8[][]
+*/
+PG_FUNCTION_INFO_V1(pcpatch_grid_final);
+Datum pcpatch_grid_final(PG_FUNCTION_ARGS)
+{
+	grid_trans *gt;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	gt = (grid_trans*) PG_GETARG_POINTER(0);
+	PG_RETURN_ARRAYTYPE_P(pcgrid_to_array(gt->grid, gt->agg));
+}
+
+/**
+* PC_GridRasterAgg(p pcpatch, cellsize float8, dimname text, agg text) returns bytea
+*/
+PG_FUNCTION_INFO_V1(pcpatch_grid_raster_final);
+Datum pcpatch_grid_raster_final(PG_FUNCTION_ARGS)
+{
+	grid_trans *gt;
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	gt = (grid_trans*) PG_GETARG_POINTER(0);
+	if ( ! ( gt->grid->nx && gt->grid->ny ) )
+		PG_RETURN_NULL();
+
+	PG_RETURN_BYTEA_P(pcgrid_to_raster(gt->grid, gt->agg, gt->srid));
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_grid_combinefn);
+Datum pcpatch_grid_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, oldcontext;
+	grid_trans *gt1, *gt2;
+	int rv;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+	{
+		elog(ERROR, "pcpatch_grid_combinefn called in non-aggregate context");
+		aggcontext = NULL;  /* keep compiler quiet */
+	}
+
+	gt1 = PG_ARGISNULL(0) ? NULL : (grid_trans*) PG_GETARG_POINTER(0);
+	gt2 = PG_ARGISNULL(1) ? NULL : (grid_trans*) PG_GETARG_POINTER(1);
+
+	if ( ! gt2 )
+	{
+		if ( ! gt1 )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(gt1);
+	}
+
+	if ( ! gt1 )
+		gt1 = pcpatch_grid_trans_new(gt2->grid->cellsize, gt2->agg, gt2->srid, gt2->dimname, aggcontext);
+
+	oldcontext = MemoryContextSwitchTo(aggcontext);
+	rv = pc_grid_merge(gt1->grid, gt2->grid);
+	MemoryContextSwitchTo(oldcontext);
+
+	if ( rv == PC_FAILURE )
+		elog(ERROR, "pcpatch_grid_combinefn: failed to merge grids");
+
+	PG_RETURN_POINTER(gt1);
+}
+
+/**
+* Serialized PC_GridAgg state:
+*   double cellsize, int32 agg, uint32 srid,
+*   int64 ix, int64 iy, uint32 nx, uint32 ny,
+*   uint32[nx*ny] count, double[nx*ny][3] sum/min/max,
+*   cstring dimname
+*/
+#define PCGRID_STATE_HDRSZ (sizeof(double) + 2 * sizeof(uint32_t) + 2 * sizeof(int64_t) + 2 * sizeof(uint32_t))
+
+PG_FUNCTION_INFO_V1(pcpatch_grid_serialfn);
+Datum pcpatch_grid_serialfn(PG_FUNCTION_ARGS)
+{
+	grid_trans *gt;
+	PCGRID *grid;
+	size_t ncells, namesize, size;
+	bytea *result;
+	uint8_t *buf;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pcpatch_grid_serialfn called in non-aggregate context");
+
+	gt = (grid_trans*) PG_GETARG_POINTER(0);
+	grid = gt->grid;
+	ncells = (size_t)grid->nx * grid->ny;
+	namesize = strlen(gt->dimname) + 1;
+	size = PCGRID_STATE_HDRSZ + ncells * (sizeof(uint32_t) + 3 * sizeof(double)) + namesize;
+
+	result = palloc(VARHDRSZ + size);
+	SET_VARSIZE(result, VARHDRSZ + size);
+	buf = (uint8_t*) VARDATA(result);
+
+	memcpy(buf, &(grid->cellsize), sizeof(double)); buf += sizeof(double);
+	memcpy(buf, &(gt->agg), sizeof(int32_t));       buf += sizeof(int32_t);
+	memcpy(buf, &(gt->srid), sizeof(uint32_t));     buf += sizeof(uint32_t);
+	memcpy(buf, &(grid->ix), sizeof(int64_t));      buf += sizeof(int64_t);
+	memcpy(buf, &(grid->iy), sizeof(int64_t));      buf += sizeof(int64_t);
+	memcpy(buf, &(grid->nx), sizeof(uint32_t));     buf += sizeof(uint32_t);
+	memcpy(buf, &(grid->ny), sizeof(uint32_t));     buf += sizeof(uint32_t);
+	if ( ncells )
+	{
+		memcpy(buf, grid->count, ncells * sizeof(uint32_t)); buf += ncells * sizeof(uint32_t);
+		memcpy(buf, grid->sum, ncells * sizeof(double));     buf += ncells * sizeof(double);
+		memcpy(buf, grid->min, ncells * sizeof(double));     buf += ncells * sizeof(double);
+		memcpy(buf, grid->max, ncells * sizeof(double));     buf += ncells * sizeof(double);
+	}
+	memcpy(buf, gt->dimname, namesize);
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_grid_deserialfn);
+Datum pcpatch_grid_deserialfn(PG_FUNCTION_ARGS)
+{
+	bytea *serst;
+	grid_trans *gt;
+	PCGRID *grid;
+	const uint8_t *buf, *end;
+	double cellsize;
+	int32_t agg;
+	uint32_t srid, nx, ny;
+	int64_t ix, iy;
+	size_t ncells;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "pcpatch_grid_deserialfn called in non-aggregate context");
+
+	serst = PG_GETARG_BYTEA_P(0);
+	buf = (const uint8_t*) VARDATA(serst);
+	end = buf + VARSIZE(serst) - VARHDRSZ;
+	if ( (size_t)(end - buf) < PCGRID_STATE_HDRSZ )
+		elog(ERROR, "pcpatch_grid_deserialfn: invalid state size");
+
+	memcpy(&cellsize, buf, sizeof(double)); buf += sizeof(double);
+	memcpy(&agg, buf, sizeof(int32_t));     buf += sizeof(int32_t);
+	memcpy(&srid, buf, sizeof(uint32_t));   buf += sizeof(uint32_t);
+	memcpy(&ix, buf, sizeof(int64_t));      buf += sizeof(int64_t);
+	memcpy(&iy, buf, sizeof(int64_t));      buf += sizeof(int64_t);
+	memcpy(&nx, buf, sizeof(uint32_t));     buf += sizeof(uint32_t);
+	memcpy(&ny, buf, sizeof(uint32_t));     buf += sizeof(uint32_t);
+
+	ncells = (size_t)nx * ny;
+	if ( ncells > PC_GRID_MAX_CELLS ||
+	     (size_t)(end - buf) <= ncells * (sizeof(uint32_t) + 3 * sizeof(double)) ||
+	     end[-1] != '\0' )
+		elog(ERROR, "pcpatch_grid_deserialfn: invalid state size");
+
+	gt = pcpatch_grid_trans_new(cellsize, agg, srid,
+	                            (const char*)(buf + ncells * (sizeof(uint32_t) + 3 * sizeof(double))),
+	                            CurrentMemoryContext);
+	grid = gt->grid;
+	if ( ncells )
+	{
+		grid->ix = ix;
+		grid->iy = iy;
+		grid->nx = nx;
+		grid->ny = ny;
+		grid->count = palloc(ncells * sizeof(uint32_t));
+		grid->sum = palloc(ncells * sizeof(double));
+		grid->min = palloc(ncells * sizeof(double));
+		grid->max = palloc(ncells * sizeof(double));
+		memcpy(grid->count, buf, ncells * sizeof(uint32_t)); buf += ncells * sizeof(uint32_t);
+		memcpy(grid->sum, buf, ncells * sizeof(double));     buf += ncells * sizeof(double);
+		memcpy(grid->min, buf, ncells * sizeof(double));     buf += ncells * sizeof(double);
+		memcpy(grid->max, buf, ncells * sizeof(double));
+	}
+
+	PG_RETURN_POINTER(gt);
+}
+
+/* Location of a point, with its Z when its schema has one */
+static void
+pcpoint_location(Datum d, FunctionCallInfo fcinfo, double *x, double *y, double *z, int *hasz)
+{
+	SERIALIZED_POINT *serpt = (SERIALIZED_POINT*)PG_DETOAST_DATUM(d);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpt->pcid, fcinfo);
+	PCPOINT *pt = pc_point_deserialize(serpt, schema);
+
+	if ( ! ( schema->xdim && schema->ydim ) )
+		elog(ERROR, "point schema has no X and Y dimensions");
+
+	pc_point_get_x(pt, x);
+	pc_point_get_y(pt, y);
+	*hasz = schema->zdim != NULL;
+	*z = 0;
+	if ( *hasz )
+		pc_point_get_z(pt, z);
+	pc_point_free(pt);
+}
+
+static PCKNN *
+pcpatch_knn_new(PCSCHEMA *schema, double x, double y, double z, int usez, int32 k)
+{
+	PCKNN *knn;
+
+	if ( k <= 0 )
+		elog(ERROR, "number of points must be positive");
+
+	knn = pc_knn_new(schema, x, y, z, usez, k);
+	if ( ! knn )
+		elog(ERROR, "%s: failed to start the search", __func__);
+	return knn;
+}
+
+/* Serialized patch of the points found, NULL when there are none */
+static Datum
+pcpatch_knn_result(FunctionCallInfo fcinfo, PCKNN *knn)
+{
+	PCPATCH_UNCOMPRESSED *pu = pc_knn_get_patch(knn);
+	SERIALIZED_PATCH *serpa;
+
+	pc_knn_free(knn);
+	if ( ! pu )
+		elog(ERROR, "%s: failed to gather the points found", __func__);
+
+	/* Always treat zero-point patches as SQL NULL */
+	if ( ! pu->npoints )
+	{
+		pc_patch_free((PCPATCH*)pu);
+		PG_RETURN_NULL();
+	}
+
+	serpa = pc_patch_serialize((PCPATCH*)pu, NULL);
+	pc_patch_free((PCPATCH*)pu);
+	PG_RETURN_POINTER(serpa);
+}
+
+static Datum
+pcpatch_knn_patch(FunctionCallInfo fcinfo, double x, double y, double z, int usez, int32 k)
+{
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	PCKNN *knn = pcpatch_knn_new(schema, x, y, z, usez, k);
+	PCPATCH *patch = pc_patch_deserialize(serpa, schema);
+
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	if ( PC_FAILURE == pc_knn_add_patch(knn, patch) )
+		elog(ERROR, "%s: failed to search patch", __func__);
+
+	pc_patch_free(patch);
+	return pcpatch_knn_result(fcinfo, knn);
+}
+
+/**
+* PC_KNN(p pcpatch, pt pcpoint, k int4) returns pcpatch
+* The k points of the patch nearest to pt, nearest first, in X/Y
+* and in Z too when both schemas have a Z dimension.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_knn);
+Datum pcpatch_knn(PG_FUNCTION_ARGS)
+{
+	double x, y, z;
+	int hasz;
+
+	pcpoint_location(PG_GETARG_DATUM(1), fcinfo, &x, &y, &z, &hasz);
+	return pcpatch_knn_patch(fcinfo, x, y, z, hasz, PG_GETARG_INT32(2));
+}
+
+/**
+* PC_KNN(p pcpatch, x float8, y float8, k int4) returns pcpatch
+* PC_KNN(p pcpatch, x float8, y float8, z float8, k int4) returns pcpatch
+*/
+PG_FUNCTION_INFO_V1(pcpatch_knn_xyz);
+Datum pcpatch_knn_xyz(PG_FUNCTION_ARGS)
+{
+	if ( PG_NARGS() > 4 )
+		return pcpatch_knn_patch(fcinfo, PG_GETARG_FLOAT8(1), PG_GETARG_FLOAT8(2),
+		                         PG_GETARG_FLOAT8(3), PC_TRUE, PG_GETARG_INT32(4));
+	return pcpatch_knn_patch(fcinfo, PG_GETARG_FLOAT8(1), PG_GETARG_FLOAT8(2),
+	                         0, PC_FALSE, PG_GETARG_INT32(3));
+}
+
+typedef struct
+{
+	double dist;
+	SERIALIZED_PATCH *serpa;
+} knn_candidate;
+
+static int
+knn_candidate_cmp(const void *a, const void *b)
+{
+	const knn_candidate *ca = a, *cb = b;
+	if ( ca->dist == cb->dist )
+		return 0;
+	return ca->dist < cb->dist ? -1 : 1;
+}
+
+/**
+* PC_KNN(pa pcpatch[], pt pcpoint, k int4) returns pcpatch
+* The k points nearest to pt over all the patches. Patches are
+* visited nearest bounds first, and the search stops at the first
+* one with bounds farther than the k points found.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_knn_array);
+Datum pcpatch_knn_array(PG_FUNCTION_ARGS)
+{
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(0);
+	int nelems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+	bits8 *bitmap = ARR_NULLBITMAP(array);
+	knn_candidate *cands;
+	PCSCHEMA *schema = NULL;
+	PCKNN *knn = NULL;
+	size_t offset = 0;
+	int i, ncands = 0, hasz;
+	double x, y, z;
+	int32 k = PG_GETARG_INT32(2);
+
+	pcpoint_location(PG_GETARG_DATUM(1), fcinfo, &x, &y, &z, &hasz);
+
+	cands = palloc(Max(nelems, 1) * sizeof(knn_candidate));
+	for ( i = 0; i < nelems; i++ )
+	{
+		SERIALIZED_PATCH *serpa;
+
+		if ( array_get_isnull(bitmap, i) )
+			continue;
+
+		serpa = (SERIALIZED_PATCH *)(ARR_DATA_PTR(array) + offset);
+		if ( ! schema )
+			schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+		else if ( serpa->pcid != schema->pcid )
+			elog(ERROR, "pcpatch_knn_array: pcid mismatch (%d != %d)", serpa->pcid, schema->pcid);
 
-	if (PG_ARGISNULL(0))
-		PG_RETURN_NULL();   /* returns null iff no input values */
+		if ( serpa->npoints )
+		{
+			cands[ncands].dist = pc_bounds_distance(&(serpa->bounds), x, y);
+			cands[ncands].serpa = serpa;
+			ncands++;
+		}
+		offset += INTALIGN(VARSIZE(serpa));
+	}
 
-	a = (abs_trans*) PG_GETARG_POINTER(0);
+	if ( ! ncands )
+		PG_RETURN_NULL();
 
-	result = pointcloud_agg_final(a, CurrentMemoryContext, fcinfo);
-	PG_RETURN_DATUM(result);
-}
+	qsort(cands, ncands, sizeof(knn_candidate), knn_candidate_cmp);
+	knn = pcpatch_knn_new(schema, x, y, z, hasz, k);
+	for ( i = 0; i < ncands; i++ )
+	{
+		PCPATCH *patch;
 
+		if ( cands[i].dist > pc_knn_max_distance(knn) )
+			break;
 
-PG_FUNCTION_INFO_V1(pcpoint_agg_final_pcpatch);
-Datum pcpoint_agg_final_pcpatch(PG_FUNCTION_ARGS)
-{
-	ArrayType *array;
-	abs_trans *a;
-	PCPATCH *pa;
-	SERIALIZED_PATCH *serpa;
+		patch = pc_patch_deserialize(cands[i].serpa, schema);
+		if ( ! patch )
+			elog(ERROR, "pcpatch_knn_array: patch deserialization failed");
+		if ( PC_FAILURE == pc_knn_add_patch(knn, patch) )
+			elog(ERROR, "pcpatch_knn_array: failed to search patch");
+		pc_patch_free(patch);
+	}
 
-	if (PG_ARGISNULL(0))
-		PG_RETURN_NULL();   /* returns null iff no input values */
+	pfree(cands);
+	return pcpatch_knn_result(fcinfo, knn);
+}
 
-	a = (abs_trans*) PG_GETARG_POINTER(0);
 
-	array = DatumGetArrayTypeP(pointcloud_agg_final(a, CurrentMemoryContext, fcinfo));
-	pa = pcpatch_from_point_array(array, fcinfo);
-	if ( ! pa )
-		PG_RETURN_NULL();
+/* Points decoded per step of the cursor behind PC_Explode */
+#define PCPATCH_UNNEST_BATCH 1024
 
-	serpa = pc_patch_serialize(pa, NULL);
-	pc_patch_free(pa);
-	PG_RETURN_POINTER(serpa);
+/**
+* Release the cursor of a set-returning call that is shut
+* down or fails before all its points were returned, lazperf
+* decoders live outside of the memory contexts
+*/
+static void
+pcpatch_unnest_cursor_free(void *arg)
+{
+	PCPATCH_CURSOR **cursor = (PCPATCH_CURSOR **) arg;
+	if ( *cursor )
+	{
+		pc_patch_cursor_free(*cursor);
+		*cursor = NULL;
+	}
 }
 
-
-PG_FUNCTION_INFO_V1(pcpatch_agg_final_pcpatch);
-Datum pcpatch_agg_final_pcpatch(PG_FUNCTION_ARGS)
+#if PG_VERSION_NUM < 90500
+static void
+pcpatch_unnest_shutdown(Datum arg)
 {
-	ArrayType *array;
-	abs_trans *a;
-	PCPATCH *pa;
-	SERIALIZED_PATCH *serpa;
+	pcpatch_unnest_cursor_free(DatumGetPointer(arg));
+}
+#endif
 
-	if (PG_ARGISNULL(0))
-		PG_RETURN_NULL();   /* returns null iff no input values */
+/**
+* Fill the tuplestore of a materializing call with every point
+* of the patch at once, the executor then no longer comes back
+* to us for each row
+*/
+static void
+pcpatch_unnest_materialize(FunctionCallInfo fcinfo, ReturnSetInfo *rsinfo)
+{
+	MemoryContext oldcontext;
+	Tuplestorestate *tupstore;
+	TupleDesc tupdesc;
+	SERIALIZED_PATCH *serpatch;
+	SERIALIZED_POINT *serpt;
+	PCPATCH *patch;
+	PCPATCH_CURSOR *cursor;
+	const uint8_t *points;
+	uint32_t i, n;
+	size_t size, serpt_size;
+	Datum value;
+	bool isnull = false;
 
-	a = (abs_trans*) PG_GETARG_POINTER(0);
+	serpatch = PG_GETARG_SERPATCH_P(0);
+	patch = pc_patch_deserialize_cached(serpatch, pc_schema_from_pcid(serpatch->pcid, fcinfo), false);
+	size = patch->schema->size;
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc = CreateTupleDescCopy(rsinfo->expectedDesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	/* The tuplestore copies each value, so one point buffer does for all */
+	serpt_size = sizeof(SERIALIZED_POINT) - 1 + size;
+	serpt = palloc(serpt_size);
+	serpt->pcid = patch->schema->pcid;
+	SET_VARSIZE(serpt, serpt_size);
+	value = PointerGetDatum(serpt);
+
+	cursor = pc_patch_cursor_new(patch, PCPATCH_UNNEST_BATCH);
+	PG_TRY();
+	{
+		while ( (n = pc_patch_cursor_next(cursor, &points)) )
+		{
+			for ( i = 0; i < n; i++ )
+			{
+				memcpy(serpt->data, points + i * size, size);
+				tuplestore_putvalues(tupstore, tupdesc, &value, &isnull);
+			}
+		}
+	}
+	PG_CATCH();
+	{
+		pc_patch_cursor_free(cursor);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+	pc_patch_cursor_free(cursor);
 
-	array = DatumGetArrayTypeP(pointcloud_agg_final(a, CurrentMemoryContext, fcinfo));
-	pa = pcpatch_from_patch_array(array, fcinfo);
-	if ( ! pa )
-		PG_RETURN_NULL();
+	pfree(serpt);
+	pc_patch_free(patch);
 
-	serpa = pc_patch_serialize(pa, NULL);
-	pc_patch_free(pa);
-	PG_RETURN_POINTER(serpa);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
 }
 
-
 PG_FUNCTION_INFO_V1(pcpatch_unnest);
 Datum pcpatch_unnest(PG_FUNCTION_ARGS)
 {
 	typedef struct
 	{
-		int nextelem;
-		int numelems;
-		PCPOINTLIST *pointlist;
+		PCPATCH_CURSOR *cursor;
+		const uint8_t *points;
+		uint32_t nextpoint;
+		uint32_t numpoints;
+#if PG_VERSION_NUM >= 90500
+		MemoryContextCallback cursor_cb;
+#else
+		ExprContext *econtext;
+#endif
 	} pcpatch_unnest_fctx;
 
 	FuncCallContext *funcctx;
 	pcpatch_unnest_fctx *fctx;
 	MemoryContext oldcontext;
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	bool has_rsinfo = rsinfo && IsA(rsinfo, ReturnSetInfo);
+
+	/* In FROM the whole set is wanted anyway, hand it over in one go */
+	if ( has_rsinfo && (rsinfo->allowedModes & SFRM_Materialize) && rsinfo->expectedDesc )
+	{
+		pcpatch_unnest_materialize(fcinfo, rsinfo);
+		return (Datum) 0;
+	}
 
 	/* stuff done only on the first call of the function */
 	if (SRF_IS_FIRSTCALL())
@@ -520,15 +1864,31 @@ Datum pcpatch_unnest(PG_FUNCTION_ARGS)
 		* passed array will stick around till then.)
 		*/
 		serpatch = PG_GETARG_SERPATCH_P(0);
-		patch = pc_patch_deserialize(serpatch, pc_schema_from_pcid_uncached(serpatch->pcid));
+		patch = pc_patch_deserialize(serpatch, pc_schema_from_pcid(serpatch->pcid, fcinfo));
 
 		/* allocate memory for user context */
-		fctx = (pcpatch_unnest_fctx *) palloc(sizeof(pcpatch_unnest_fctx));
+		fctx = (pcpatch_unnest_fctx *) palloc0(sizeof(pcpatch_unnest_fctx));
 
-		/* initialize state */
-		fctx->nextelem = 0;
-		fctx->numelems = patch->npoints;
-		fctx->pointlist = pc_pointlist_from_patch(patch);
+		/*
+		* Points are read a batch at a time, so a LIMIT or an early
+		* EXISTS on a lazperf patch only pays for the batches actually
+		* returned. A callback frees the cursor if we are not run to
+		* completion, on an early shutdown as on an error.
+		*/
+		fctx->cursor = pc_patch_cursor_new(patch, PCPATCH_UNNEST_BATCH);
+#if PG_VERSION_NUM >= 90500
+		fctx->cursor_cb.func = pcpatch_unnest_cursor_free;
+		fctx->cursor_cb.arg = &(fctx->cursor);
+		MemoryContextRegisterResetCallback(funcctx->multi_call_memory_ctx, &(fctx->cursor_cb));
+#else
+		if ( has_rsinfo )
+		{
+			fctx->econtext = rsinfo->econtext;
+			RegisterExprContextCallback(fctx->econtext,
+				pcpatch_unnest_shutdown,
+				PointerGetDatum(&(fctx->cursor)));
+		}
+#endif
 
 		/* save user context, switch back to function context */
 		funcctx->user_fctx = fctx;
@@ -539,18 +1899,36 @@ Datum pcpatch_unnest(PG_FUNCTION_ARGS)
 	funcctx = SRF_PERCALL_SETUP();
 	fctx = funcctx->user_fctx;
 
-	if (fctx->nextelem < fctx->numelems)
+	if ( fctx->nextpoint == fctx->numpoints && fctx->cursor )
+	{
+		fctx->nextpoint = 0;
+		fctx->numpoints = pc_patch_cursor_next(fctx->cursor, &(fctx->points));
+	}
+
+	if (fctx->nextpoint < fctx->numpoints)
 	{
-		Datum elem;
-		PCPOINT *pt = pc_pointlist_get_point(fctx->pointlist, fctx->nextelem);
-		SERIALIZED_POINT *serpt = pc_point_serialize(pt);
-		fctx->nextelem++;
-		elem = PointerGetDatum(serpt);
-		SRF_RETURN_NEXT(funcctx, elem);
+		const PCSCHEMA *schema = fctx->cursor->patch->schema;
+		size_t serpt_size = sizeof(SERIALIZED_POINT) - 1 + schema->size;
+		SERIALIZED_POINT *serpt = palloc(serpt_size);
+
+		serpt->pcid = schema->pcid;
+		memcpy(serpt->data, fctx->points + fctx->nextpoint * schema->size, schema->size);
+		SET_VARSIZE(serpt, serpt_size);
+		fctx->nextpoint++;
+		SRF_RETURN_NEXT(funcctx, PointerGetDatum(serpt));
 	}
 	else
 	{
 		/* do when there is no more left */
+#if PG_VERSION_NUM < 90500
+		if ( fctx->econtext )
+		{
+			UnregisterExprContextCallback(fctx->econtext,
+				pcpatch_unnest_shutdown,
+				PointerGetDatum(&(fctx->cursor)));
+		}
+#endif
+		pcpatch_unnest_cursor_free(&(fctx->cursor));
 		SRF_RETURN_DONE(funcctx);
 	}
 }
@@ -597,13 +1975,20 @@ Datum pcpatch_compress(PG_FUNCTION_ARGS)
 		PCPATCH_DIMENSIONAL *pdl = pc_patch_dimensional_from_uncompressed((PCPATCH_UNCOMPRESSED*)pa);
 		schema->compression = PC_DIMENSIONAL;
 		stats = pc_dimstats_make(schema);
+
+		/* Trial encode all dimensions, for size or for speed */
+		if ( strcmp(ptr, "adaptive") == 0 || strcmp(ptr, "adaptive:size") == 0 )
+			stats->objective = PC_TRIAL_SIZE;
+		else if ( strcmp(ptr, "adaptive:speed") == 0 )
+			stats->objective = PC_TRIAL_SPEED;
+
 		pc_dimstats_update(stats, pdl);
 		/* make sure to avoid stat updates (not sure if needed) */
 		stats->total_points = PCDIMSTATS_MIN_SAMPLE+1;
 
 
 		/* Fill in per-dimension compression */
-		if ( *ptr )
+		if ( *ptr && stats->objective == PC_TRIAL_NONE )
 		for (i=0; i<stats->ndims; ++i) {
 			PCDIMSTAT *stat = &(stats->stats[i]);
 			/*pcinfo("ptr: %s", ptr);*/
@@ -616,11 +2001,30 @@ Datum pcpatch_compress(PG_FUNCTION_ARGS)
 			else if ( strncmp(ptr, "sigbits", strlen("sigbits")) == 0 ) {
 				stat->recommended_compression = PC_DIM_SIGBITS;
 			}
+			else if ( strncmp(ptr, "zlib:indexed", strlen("zlib:indexed")) == 0 ) {
+				stat->recommended_compression = PC_DIM_ZLIB | PC_DIM_INDEXED;
+			}
 			else if ( strncmp(ptr, "zlib", strlen("zlib")) == 0 ) {
 				stat->recommended_compression = PC_DIM_ZLIB;
 			}
+			else if ( strncmp(ptr, "zstd", strlen("zstd")) == 0 ) {
+				if ( ! pc_bytes_compression_available(PC_DIM_ZSTD) )
+					elog(ERROR, "Dimensional compression 'zstd' is not supported by this build");
+				stat->recommended_compression = PC_DIM_ZSTD;
+			}
+			else if ( strncmp(ptr, "lz4", strlen("lz4")) == 0 ) {
+				if ( ! pc_bytes_compression_available(PC_DIM_LZ4) )
+					elog(ERROR, "Dimensional compression 'lz4' is not supported by this build");
+				stat->recommended_compression = PC_DIM_LZ4;
+			}
+			else if ( strncmp(ptr, "delta2", strlen("delta2")) == 0 ) {
+				stat->recommended_compression = PC_DIM_DELTA2;
+			}
+			else if ( strncmp(ptr, "delta", strlen("delta")) == 0 ) {
+				stat->recommended_compression = PC_DIM_DELTA;
+			}
 			else {
-				elog(ERROR, "Unrecognized dimensional compression '%s'. Please specify 'auto', 'rle', 'sigbits' or 'zlib'", ptr);
+				elog(ERROR, "Unrecognized dimensional compression '%s'. Please specify 'auto', 'rle', 'sigbits', 'zlib', 'zlib:indexed', 'zstd', 'lz4', 'delta' or 'delta2', or 'adaptive' for all dimensions", ptr);
 			}
 			while (*ptr && *ptr != ',') ++ptr;
 			if ( ! *ptr ) break;
@@ -666,7 +2070,7 @@ Datum pcpatch_pointn(PG_FUNCTION_ARGS)
 	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
 	int32 n = PG_GETARG_INT32(1);
 	PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
-	PCPATCH *patch = pc_patch_deserialize(serpa, schema);
+	PCPATCH *patch = pc_patch_deserialize_cached(serpa, schema, false);
 	PCPOINT *pt = NULL;
 	if(patch) {
 		pt = pc_patch_pointn(patch,n);
@@ -686,13 +2090,19 @@ Datum pcpatch_range(PG_FUNCTION_ARGS)
 	int32 first = PG_GETARG_INT32(1);
 	int32 count = PG_GETARG_INT32(2);
 	PCSCHEMA *schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
-	PCPATCH *patch = pc_patch_deserialize(serpa, schema);
+	PCPATCH *patch = pc_patch_deserialize_cached(serpa, schema, false);
 	PCPATCH *patchout = NULL;
 	if ( patch )
 	{
 		patchout = pc_patch_range(patch, first, count);
-		if ( patchout != patch )
+		/* The whole patch, hand back the input without copying it */
+		if ( patchout == patch )
+		{
 			pc_patch_free(patch);
+			PG_RETURN_POINTER(serpa);
+		}
+		/* An uncompressed range still reads its points from serpa */
+		pc_patch_free(patch);
 	}
 	if ( !patchout )
 		PG_RETURN_NULL();
@@ -701,6 +2111,73 @@ Datum pcpatch_range(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(serpaout);
 }
 
+/* Decimation of the patch of argument 0 to n points, by the method named in argument 2 */
+static Datum
+pcpatch_decimate_to(FunctionCallInfo fcinfo, SERIALIZED_PATCH *serpa, uint32 n)
+{
+	char *method_str = text_to_cstring(PG_GETARG_TEXT_P(2));
+	int method = pc_decimation_number(method_str);
+	PCSCHEMA *schema;
+	PCPATCH *patch, *patchout;
+	SERIALIZED_PATCH *serpaout;
+
+	if ( method < 0 )
+		elog(ERROR, "unknown decimation method \"%s\", use stride, random or grid", method_str);
+
+	/* Enough points, hand back the input without decoding it */
+	if ( n >= serpa->npoints )
+		PG_RETURN_POINTER(serpa);
+
+	schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
+	patch = pc_patch_deserialize(serpa, schema);
+	if ( ! patch )
+		elog(ERROR, "failed to deserialize patch");
+
+	patchout = pc_patch_decimate(patch, method, n);
+	if ( ! patchout )
+		elog(ERROR, "failed to decimate patch");
+
+	serpaout = pc_patch_serialize(patchout, NULL);
+	pc_patch_free(patchout);
+	pc_patch_free(patch);
+	PG_RETURN_POINTER(serpaout);
+}
+
+/**
+* PC_Decimate(p pcpatch, n int4, method text) returns pcpatch
+*/
+PG_FUNCTION_INFO_V1(pcpatch_decimate);
+Datum pcpatch_decimate(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	int32 n = PG_GETARG_INT32(1);
+
+	if ( n <= 0 )
+		elog(ERROR, "number of points must be positive");
+
+	return pcpatch_decimate_to(fcinfo, serpa, n);
+}
+
+/**
+* PC_Decimate(p pcpatch, ratio float8, method text) returns pcpatch
+* Keeps ratio of the points, rounded, and at least one.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_decimate_ratio);
+Datum pcpatch_decimate_ratio(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpa = PG_GETARG_SERPATCH_P(0);
+	float8 ratio = PG_GETARG_FLOAT8(1);
+	float8 n;
+
+	if ( ! ( ratio > 0 ) )
+		elog(ERROR, "ratio of points must be positive");
+
+	n = rint(ratio * serpa->npoints);
+	if ( n < 1 )
+		n = 1;
+	return pcpatch_decimate_to(fcinfo, serpa, n < serpa->npoints ? (uint32)n : serpa->npoints);
+}
+
 PG_FUNCTION_INFO_V1(pcpatch_pcid);
 Datum pcpatch_pcid(PG_FUNCTION_ARGS)
 {
@@ -723,7 +2200,7 @@ Datum pcpatch_summary(PG_FUNCTION_ARGS)
 
 	serpa = PG_GETHEADERX_SERPATCH_P(0, stats_size_guess);
 	schema = pc_schema_from_pcid(serpa->pcid, fcinfo);
-	if ( serpa->compression == PC_DIMENSIONAL )
+	if ( SERPATCH_COMPRESSION(serpa) == PC_DIMENSIONAL )
 	{
 		/* need full data to inspect per-dimension compression */
 		/* NOTE: memory usage could be optimized to only fetch slices
@@ -748,7 +2225,7 @@ Datum pcpatch_summary(PG_FUNCTION_ARGS)
 		"\"pcid\":%d, \"npts\":%d, \"srid\":%d, "
 		"\"compr\":\"%s\",\"dims\":[",
 		serpa->pcid, serpa->npoints, schema->srid,
-		pc_compression_name(serpa->compression));
+		pc_compression_name(SERPATCH_COMPRESSION(serpa)));
 
 	for (i=0; i<schema->ndims; ++i)
 	{
@@ -762,7 +2239,7 @@ Datum pcpatch_summary(PG_FUNCTION_ARGS)
 			pc_interpretation_string(dim->interpretation));
 
 		/* Print per-dimension compression (if dimensional) */
-		if ( serpa->compression == PC_DIMENSIONAL )
+		if ( SERPATCH_COMPRESSION(serpa) == PC_DIMENSIONAL )
 		{
 			bytes = ((PCPATCH_DIMENSIONAL*)patch)->bytes[i];
 			switch ( bytes.compression )
@@ -776,6 +2253,18 @@ Datum pcpatch_summary(PG_FUNCTION_ARGS)
 			case PC_DIM_ZLIB:
 				appendStringInfoString(&strdata,",\"compr\":\"zlib\"");
 				break;
+			case PC_DIM_ZSTD:
+				appendStringInfoString(&strdata,",\"compr\":\"zstd\"");
+				break;
+			case PC_DIM_LZ4:
+				appendStringInfoString(&strdata,",\"compr\":\"lz4\"");
+				break;
+			case PC_DIM_DELTA:
+				appendStringInfoString(&strdata,",\"compr\":\"delta\"");
+				break;
+			case PC_DIM_DELTA2:
+				appendStringInfoString(&strdata,",\"compr\":\"delta2\"");
+				break;
 			case PC_DIM_NONE:
 				appendStringInfoString(&strdata,",\"compr\":\"none\"");
 				break;
@@ -810,7 +2299,7 @@ PG_FUNCTION_INFO_V1(pcpatch_compression);
 Datum pcpatch_compression(PG_FUNCTION_ARGS)
 {
 	SERIALIZED_PATCH *serpa = PG_GETHEADER_SERPATCH_P(0);
-	PG_RETURN_INT32(serpa->compression);
+	PG_RETURN_INT32(SERPATCH_COMPRESSION(serpa));
 }
 
 PG_FUNCTION_INFO_V1(pcpatch_intersects);
@@ -860,6 +2349,64 @@ Datum pc_version(PG_FUNCTION_ARGS)
 	PG_RETURN_TEXT_P(version_text);
 }
 
+/**
+* PC_Stats() returns setof record
+* Calls, points, bytes and time of the library operations counted in
+* this backend while pointcloud.track_stats is on.
+*/
+PG_FUNCTION_INFO_V1(pc_op_stats);
+Datum pc_op_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	MemoryContext oldcontext;
+	Tuplestorestate *tupstore;
+	TupleDesc tupdesc;
+	int op;
+
+	if ( ! ( rsinfo && IsA(rsinfo, ReturnSetInfo) && (rsinfo->allowedModes & SFRM_Materialize) ) )
+		elog(ERROR, "%s: set-valued function called in context that cannot accept a set", __func__);
+
+	if ( get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE )
+		elog(ERROR, "%s: return type must be a row type", __func__);
+
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc = CreateTupleDescCopy(tupdesc);
+	tupstore = tuplestore_begin_heap(rsinfo->allowedModes & SFRM_Materialize_Random, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	for ( op = 0; op < PC_NUM_OPS; op++ )
+	{
+		PCCOUNTER c;
+		Datum values[6];
+		bool nulls[6] = { false, false, false, false, false, false };
+
+		pc_counter_get(op, &c);
+		values[0] = CStringGetTextDatum(pc_counter_name(op));
+		values[1] = Int64GetDatum((int64)c.calls);
+		values[2] = Int64GetDatum((int64)c.points);
+		values[3] = Int64GetDatum((int64)c.bytesin);
+		values[4] = Int64GetDatum((int64)c.bytesout);
+		values[5] = Float8GetDatum(c.nanos / 1000000.0);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult = tupstore;
+	rsinfo->setDesc = tupdesc;
+	return (Datum) 0;
+}
+
+/**
+* PC_StatsReset() returns void
+* Zero the counters of PC_Stats() in this backend.
+*/
+PG_FUNCTION_INFO_V1(pc_op_stats_reset);
+Datum pc_op_stats_reset(PG_FUNCTION_ARGS)
+{
+	pc_counters_reset();
+	PG_RETURN_VOID();
+}
+
 /**
 * Read a named dimension statistic from a PCPATCH
 * PC_PatchMax(patch pcpatch, dimname text) returns Numeric
@@ -948,17 +2495,32 @@ Datum pcpatch_filter(PG_FUNCTION_ARGS)
 	float8 value1 = PG_GETARG_FLOAT8(2);
 	float8 value2 = PG_GETARG_FLOAT8(3);
 	int32 mode = PG_GETARG_INT32(4);
+	static const PC_FILTERTYPE modefilters[] = { PC_LT, PC_GT, PC_EQUAL, PC_BETWEEN };
+	PCDIMENSION *dim = pc_schema_get_dimension_by_name(schema, dim_name);
 	PCPATCH *patch;
 	PCPATCH *patch_filtered = NULL;
 	SERIALIZED_PATCH *serpatch_filtered;
 
-	patch = pc_patch_deserialize(serpatch, schema);
+	patch = pc_patch_deserialize_cached(serpatch, schema, true);
 	if ( ! patch )
 	{
 		elog(ERROR, "failed to deserialize patch");
 		PG_RETURN_NULL();
 	}
 
+	/* Every point passes, hand back the input without copying it */
+	if ( dim && mode >= 0 && mode <= 3 && patch->npoints > 0 )
+	{
+		double lo = mode == 3 ? Min(value1, value2) : value1;
+		double hi = mode == 3 ? Max(value1, value2) : value1;
+		if ( pc_patch_filter_keeps_all(patch, dim->position, modefilters[mode], lo, hi) )
+		{
+			pc_patch_free(patch);
+			pfree(dim_name);
+			PG_RETURN_POINTER(serpatch);
+		}
+	}
+
 	switch ( mode )
 	{
 	case 0:
@@ -999,6 +2561,134 @@ Datum pcpatch_filter(PG_FUNCTION_ARGS)
 	PG_RETURN_POINTER(serpatch_filtered);
 }
 
+/**
+* PC_Filter(patch pcpatch, expr text) returns pcpatch
+* Subset a patch on an expression such as
+* 'classification = 2 AND z BETWEEN 10 AND 50 AND intensity > 100'
+* in a single pass over the patch.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_filter_expression);
+Datum pcpatch_filter_expression(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch = PG_GETARG_SERPATCH_P(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	char *expr = text_to_cstring(PG_GETARG_TEXT_P(1));
+	PCFILTEREXPR *filterexpr;
+	PCPATCH *patch;
+	PCPATCH *patch_filtered;
+	SERIALIZED_PATCH *serpatch_filtered;
+
+	filterexpr = pc_filterexpr_parse(schema, expr);
+	if ( ! filterexpr )
+	{
+		elog(ERROR, "invalid filter expression \"%s\"", expr);
+	}
+	pfree(expr);
+
+	patch = pc_patch_deserialize_cached(serpatch, schema, true);
+	if ( ! patch )
+	{
+		elog(ERROR, "failed to deserialize patch");
+		PG_RETURN_NULL();
+	}
+
+	/* Every point passes, hand back the input without copying it */
+	if ( patch->npoints > 0 && pc_patch_filter_expr_keeps_all(patch, filterexpr) )
+	{
+		pc_filterexpr_free(filterexpr);
+		pc_patch_free(patch);
+		PG_RETURN_POINTER(serpatch);
+	}
+
+	patch_filtered = pc_patch_filter_expr(patch, filterexpr);
+
+	pc_filterexpr_free(filterexpr);
+	pc_patch_free(patch);
+	PG_FREE_IF_COPY(serpatch, 0);
+
+	if ( ! patch_filtered )
+	{
+		elog(ERROR, "failed to filter patch");
+	}
+
+	/* Always treat zero-point patches as SQL NULL */
+	if ( patch_filtered->npoints <= 0 )
+	{
+		pc_patch_free(patch_filtered);
+		PG_RETURN_NULL();
+	}
+
+	serpatch_filtered = pc_patch_serialize(patch_filtered, NULL);
+	pc_patch_free(patch_filtered);
+
+	PG_RETURN_POINTER(serpatch_filtered);
+}
+
+/**
+* PC_FilterPolygon(patch pcpatch, wkb bytea) returns pcpatch
+* Subset a patch on the points inside a polygon or multipolygon,
+* given as WKB or EWKB in the coordinates of the patch.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_filter_polygon);
+Datum pcpatch_filter_polygon(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch = PG_GETARG_SERPATCH_P(0);
+	bytea *wkb = PG_GETARG_BYTEA_P(1);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	PCPOLYGON *poly;
+	PCPATCH *patch;
+	PCPATCH *patch_filtered;
+	SERIALIZED_PATCH *serpatch_filtered;
+
+	poly = pc_polygon_from_wkb((uint8_t*)VARDATA(wkb), VARSIZE(wkb) - VARHDRSZ);
+	if ( ! poly )
+	{
+		elog(ERROR, "geometry is not a polygon or multipolygon");
+	}
+
+	if ( poly->srid && schema->srid && poly->srid != schema->srid )
+	{
+		elog(ERROR, "geometry srid (%u) does not match patch srid (%u)", poly->srid, schema->srid);
+	}
+
+	patch = pc_patch_deserialize_cached(serpatch, schema, true);
+	if ( ! patch )
+	{
+		elog(ERROR, "failed to deserialize patch");
+		PG_RETURN_NULL();
+	}
+
+	patch_filtered = pc_patch_filter_polygon(patch, poly);
+	pc_polygon_free(poly);
+
+	if ( ! patch_filtered )
+	{
+		elog(ERROR, "failed to filter patch");
+	}
+
+	/* Every point passes, hand back the input without serializing a copy */
+	if ( patch_filtered->npoints == patch->npoints )
+	{
+		pc_patch_free(patch_filtered);
+		pc_patch_free(patch);
+		PG_RETURN_POINTER(serpatch);
+	}
+	pc_patch_free(patch);
+
+	/* Always treat zero-point patches as SQL NULL */
+	if ( patch_filtered->npoints <= 0 )
+	{
+		pc_patch_free(patch_filtered);
+		PG_RETURN_NULL();
+	}
+
+	serpatch_filtered = pc_patch_serialize(patch_filtered, NULL);
+	pc_patch_free(patch_filtered);
+	PG_FREE_IF_COPY(serpatch, 0);
+
+	PG_RETURN_POINTER(serpatch_filtered);
+}
+
 const char **array_to_cstring_array(ArrayType *array, int *size)
 {
 	int i, j, offset = 0;
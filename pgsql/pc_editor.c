@@ -50,7 +50,7 @@ pcpatch_set_schema(SERIALIZED_PATCH *serpa,
 		if ( ! patch )
 			return NULL;
 
-		paout = pc_patch_set_schema(patch, nschema, def);
+		paout = pc_remap_patch(pc_remap_from_schemas(oschema, nschema, def, PC_FALSE), patch);
 
 		if ( patch != paout )
 			pc_patch_free(patch);
@@ -111,7 +111,7 @@ Datum pcpatch_transform(PG_FUNCTION_ARGS)
 		if ( ! patch )
 			PG_RETURN_NULL();
 
-		paout = pc_patch_transform(patch, nschema, def);
+		paout = pc_remap_patch(pc_remap_from_schemas(oschema, nschema, def, PC_TRUE), patch);
 
 		pc_patch_free(patch);
 
@@ -0,0 +1,413 @@
+/***********************************************************************
+* pc_index.c
+*
+*  GiST and BRIN index support for patches. Both index the bounds
+*  found in the SERIALIZED_PATCH header, as a box, so neither index
+*  builds nor index scans ever read the points of a patch.
+*
+*  PgSQL Pointcloud is free and open source software provided
+*  by the Government of Canada
+*  Copyright (c) 2013 Natural Resources Canada
+*
+***********************************************************************/
+
+#include "pc_pgsql.h"      /* Common PgSQL support for our type */
+#include "pc_api_internal.h" /* for pc_bounds_merge */
+#include "access/gist.h"
+#include "access/skey.h"   /* for RTOverlapStrategyNumber */
+#include "utils/geo_decls.h" /* for BOX */
+#if PG_VERSION_NUM >= 90500
+#include "access/brin_internal.h"
+#include "access/brin_tuple.h"
+#include "utils/typcache.h"
+#endif
+
+/* Strategy of <-> in the GiST operator class, as for the built-in point_ops */
+#define PC_DISTANCE_STRATEGY 15
+
+Datum pcpatch_intersects_box(PG_FUNCTION_ARGS);
+Datum pcpatch_gist_compress(PG_FUNCTION_ARGS);
+Datum pcpatch_gist_decompress(PG_FUNCTION_ARGS);
+Datum pcpatch_gist_consistent(PG_FUNCTION_ARGS);
+Datum pcpatch_gist_distance(PG_FUNCTION_ARGS);
+Datum pcpatch_distance_pcpoint(PG_FUNCTION_ARGS);
+Datum pcpatch_distance_point(PG_FUNCTION_ARGS);
+#if PG_VERSION_NUM >= 90500
+Datum pcpatch_brin_opcinfo(PG_FUNCTION_ARGS);
+Datum pcpatch_brin_add_value(PG_FUNCTION_ARGS);
+Datum pcpatch_brin_consistent(PG_FUNCTION_ARGS);
+Datum pcpatch_brin_union(PG_FUNCTION_ARGS);
+#endif
+
+static void
+pc_bounds_from_box(PCBOUNDS *bounds, const BOX *box)
+{
+	bounds->xmin = box->low.x;
+	bounds->xmax = box->high.x;
+	bounds->ymin = box->low.y;
+	bounds->ymax = box->high.y;
+}
+
+static void
+pc_bounds_to_box(const PCBOUNDS *bounds, BOX *box)
+{
+	box->low.x = bounds->xmin;
+	box->high.x = bounds->xmax;
+	box->low.y = bounds->ymin;
+	box->high.y = bounds->ymax;
+}
+
+/**
+* Read the bounds of a patch datum, detoasting only its header
+*/
+static void
+pc_bounds_from_datum(PCBOUNDS *bounds, Datum d)
+{
+	SERIALIZED_PATCH *serpa = (SERIALIZED_PATCH*)PG_DETOAST_DATUM_SLICE(d, 0, sizeof(SERIALIZED_PATCH));
+	*bounds = serpa->bounds;
+	if ( (Pointer)serpa != DatumGetPointer(d) )
+		pfree(serpa);
+}
+
+/**
+* Bounds of an index query, which is either a patch or a box
+*/
+static void
+pc_bounds_from_query(PCBOUNDS *bounds, Datum query, Oid subtype)
+{
+	if ( subtype == BOXOID )
+		pc_bounds_from_box(bounds, DatumGetBoxP(query));
+	else
+		pc_bounds_from_datum(bounds, query);
+}
+
+/**
+* Location of a pcpoint distance query, decoded once and kept in
+* fn_extra for the rest of the scan. Index scans are restarted with
+* their FmgrInfo as is, so the serialized point is kept as well to
+* notice a new query point.
+*/
+typedef struct
+{
+	SERIALIZED_POINT *serpt;
+	uint32 pcid;
+	double x;
+	double y;
+} PcLocationCache;
+
+/**
+* X/Y of a distance query, which is either a pcpoint or a point,
+* and the pcid of the pcpoint, zero for a point
+*/
+static void
+pc_location_from_query(double *x, double *y, uint32 *pcid, Datum query, Oid subtype, FunctionCallInfo fcinfo)
+{
+	SERIALIZED_POINT *serpt;
+	PcLocationCache *cache = (PcLocationCache*) fcinfo->flinfo->fn_extra;
+	PCSCHEMA *schema;
+	PCPOINT *pt;
+	size_t size;
+
+	if ( subtype == POINTOID )
+	{
+		Point *p = DatumGetPointP(query);
+		*x = p->x;
+		*y = p->y;
+		*pcid = 0;
+		return;
+	}
+
+	serpt = (SERIALIZED_POINT*)PG_DETOAST_DATUM(query);
+	size = VARSIZE(serpt);
+
+	if ( ! ( cache && VARSIZE(cache->serpt) == size &&
+	         memcmp(cache->serpt, serpt, size) == 0 ) )
+	{
+		schema = pc_schema_from_pcid(serpt->pcid, fcinfo);
+		if ( ! ( schema->xdim && schema->ydim ) )
+			elog(ERROR, "point schema has no X and Y dimensions");
+
+		if ( ! cache )
+		{
+			cache = MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt, sizeof(PcLocationCache));
+			fcinfo->flinfo->fn_extra = cache;
+		}
+		if ( cache->serpt )
+			pfree(cache->serpt);
+		cache->serpt = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, size);
+		memcpy(cache->serpt, serpt, size);
+
+		pt = pc_point_deserialize(serpt, schema);
+		pc_point_get_x(pt, &(cache->x));
+		pc_point_get_y(pt, &(cache->y));
+		pc_point_free(pt);
+		cache->pcid = serpt->pcid;
+	}
+
+	if ( (Pointer)serpt != DatumGetPointer(query) )
+		pfree(serpt);
+
+	*x = cache->x;
+	*y = cache->y;
+	*pcid = cache->pcid;
+}
+
+/**
+* PC_Intersects(p pcpatch, b box) returns boolean
+*/
+PG_FUNCTION_INFO_V1(pcpatch_intersects_box);
+Datum pcpatch_intersects_box(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpa = PG_GETHEADER_SERPATCH_P(0);
+	BOX *box = PG_GETARG_BOX_P(1);
+	PCBOUNDS bounds;
+
+	pc_bounds_from_box(&bounds, box);
+	PG_RETURN_BOOL(pc_bounds_intersects(&(serpa->bounds), &bounds));
+}
+
+/**
+* p <-> pt returns float8
+* X/Y distance from the bounds of the patch to the point, 0 inside
+* of them, read from the patch header only.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_distance_pcpoint);
+Datum pcpatch_distance_pcpoint(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpa = PG_GETHEADER_SERPATCH_P(0);
+	double x, y;
+	uint32 pcid;
+
+	pc_location_from_query(&x, &y, &pcid, PG_GETARG_DATUM(1), InvalidOid, fcinfo);
+	if ( serpa->pcid != pcid )
+		elog(ERROR, "%s: pcid mismatch (%d != %d)", __func__, serpa->pcid, pcid);
+	PG_RETURN_FLOAT8(pc_bounds_distance(&(serpa->bounds), x, y));
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_distance_point);
+Datum pcpatch_distance_point(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpa = PG_GETHEADER_SERPATCH_P(0);
+	Point *p = PG_GETARG_POINT_P(1);
+
+	PG_RETURN_FLOAT8(pc_bounds_distance(&(serpa->bounds), p->x, p->y));
+}
+
+/***********************************************************************
+* GiST
+*
+* The keys are boxes, so union, penalty, picksplit and same are the
+* built-in gist_box_* functions, we only turn patches into boxes.
+*/
+
+PG_FUNCTION_INFO_V1(pcpatch_gist_compress);
+Datum pcpatch_gist_compress(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	GISTENTRY *retval;
+	PCBOUNDS bounds;
+	BOX *box;
+
+	/* Internal pages already hold boxes */
+	if ( ! entry->leafkey || DatumGetPointer(entry->key) == NULL )
+		PG_RETURN_POINTER(entry);
+
+	pc_bounds_from_datum(&bounds, entry->key);
+	box = palloc(sizeof(BOX));
+	pc_bounds_to_box(&bounds, box);
+
+	retval = palloc(sizeof(GISTENTRY));
+	gistentryinit(*retval, PointerGetDatum(box),
+		entry->rel, entry->page, entry->offset, false);
+	PG_RETURN_POINTER(retval);
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_gist_decompress);
+Datum pcpatch_gist_decompress(PG_FUNCTION_ARGS)
+{
+	PG_RETURN_POINTER(PG_GETARG_POINTER(0));
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_gist_consistent);
+Datum pcpatch_gist_consistent(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	Oid subtype = PG_GETARG_OID(3);
+	bool *recheck = (bool *) PG_GETARG_POINTER(4);
+	PCBOUNDS key, query;
+
+	if ( strategy != RTOverlapStrategyNumber )
+		elog(ERROR, "%s: unsupported strategy number %d", __func__, strategy);
+
+	/*
+	* The keys are the exact patch bounds, but carry no pcid, so leaves
+	* found for a patch are rechecked, which runs PC_Intersects and its
+	* pcid check on them as a sequential scan would. BRIN needs nothing
+	* of the kind, it rechecks every patch of the ranges it returns.
+	*/
+	*recheck = subtype != BOXOID && GIST_LEAF(entry);
+
+	if ( DatumGetPointer(entry->key) == NULL )
+		PG_RETURN_BOOL(false);
+
+	pc_bounds_from_box(&key, DatumGetBoxP(entry->key));
+	pc_bounds_from_query(&query, PG_GETARG_DATUM(1), subtype);
+	PG_RETURN_BOOL(pc_bounds_intersects(&key, &query));
+}
+
+/**
+* Distance for index scans ordered by <->. Keys of internal pages
+* cover those below them, and leaf keys are the exact patch bounds,
+* so the distance itself never needs a recheck. The keys carry no
+* pcid though, so leaves found for a pcpoint are rechecked, which
+* runs <-> on the patch and its pcid check.
+*/
+PG_FUNCTION_INFO_V1(pcpatch_gist_distance);
+Datum pcpatch_gist_distance(PG_FUNCTION_ARGS)
+{
+	GISTENTRY *entry = (GISTENTRY*) PG_GETARG_POINTER(0);
+	StrategyNumber strategy = (StrategyNumber) PG_GETARG_UINT16(2);
+	Oid subtype = PG_GETARG_OID(3);
+	PCBOUNDS key;
+	double x, y;
+	uint32 pcid;
+
+	if ( strategy != PC_DISTANCE_STRATEGY )
+		elog(ERROR, "%s: unsupported strategy number %d", __func__, strategy);
+
+	pc_bounds_from_box(&key, DatumGetBoxP(entry->key));
+	pc_location_from_query(&x, &y, &pcid, PG_GETARG_DATUM(1), subtype, fcinfo);
+
+	/* The recheck flag only comes from PostgreSQL 9.5 */
+	if ( PG_NARGS() > 4 )
+		*((bool *) PG_GETARG_POINTER(4)) = pcid && GIST_LEAF(entry);
+
+	PG_RETURN_FLOAT8(pc_bounds_distance(&key, x, y));
+}
+
+/***********************************************************************
+* BRIN
+*
+* Each block range stores the box covering the bounds of its patches.
+*/
+#if PG_VERSION_NUM >= 90500
+
+PG_FUNCTION_INFO_V1(pcpatch_brin_opcinfo);
+Datum pcpatch_brin_opcinfo(PG_FUNCTION_ARGS)
+{
+	BrinOpcInfo *result = palloc0(MAXALIGN(SizeofBrinOpcInfo(1)));
+	result->oi_nstored = 1;
+	result->oi_opaque = NULL;
+	result->oi_typcache[0] = lookup_type_cache(BOXOID, 0);
+	PG_RETURN_POINTER(result);
+}
+
+/*
+* Grow the stored box of a range to cover some more bounds,
+* returns false when it already did.
+*/
+static bool
+pcpatch_brin_extend(BrinDesc *bdesc, BrinValues *column, const PCBOUNDS *bounds)
+{
+	MemoryContext oldcontext;
+	PCBOUNDS stored;
+	BOX *box;
+
+	if ( ! column->bv_allnulls )
+	{
+		pc_bounds_from_box(&stored, DatumGetBoxP(column->bv_values[0]));
+		if ( stored.xmin <= bounds->xmin && stored.xmax >= bounds->xmax &&
+		     stored.ymin <= bounds->ymin && stored.ymax >= bounds->ymax )
+			return false;
+		pc_bounds_merge(&stored, bounds);
+	}
+	else
+	{
+		stored = *bounds;
+	}
+
+	oldcontext = MemoryContextSwitchTo(bdesc->bd_context);
+	box = palloc(sizeof(BOX));
+	MemoryContextSwitchTo(oldcontext);
+	pc_bounds_to_box(&stored, box);
+
+	column->bv_values[0] = PointerGetDatum(box);
+	column->bv_allnulls = false;
+	return true;
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_brin_add_value);
+Datum pcpatch_brin_add_value(PG_FUNCTION_ARGS)
+{
+	BrinDesc *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	Datum newval = PG_GETARG_DATUM(2);
+	bool isnull = PG_GETARG_BOOL(3);
+	PCBOUNDS bounds;
+
+	if ( isnull )
+	{
+		if ( column->bv_hasnulls )
+			PG_RETURN_BOOL(false);
+		column->bv_hasnulls = true;
+		PG_RETURN_BOOL(true);
+	}
+
+	pc_bounds_from_datum(&bounds, newval);
+	PG_RETURN_BOOL(pcpatch_brin_extend(bdesc, column, &bounds));
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_brin_consistent);
+Datum pcpatch_brin_consistent(PG_FUNCTION_ARGS)
+{
+	BrinValues *column = (BrinValues *) PG_GETARG_POINTER(1);
+	ScanKey key = (ScanKey) PG_GETARG_POINTER(2);
+	PCBOUNDS stored, query;
+
+	/*
+	* IS NULL and IS NOT NULL keys, which PostgreSQL before 14 hands
+	* to the operator class, && itself is strict
+	*/
+	if ( key->sk_flags & SK_ISNULL )
+	{
+		if ( key->sk_flags & SK_SEARCHNULL )
+			PG_RETURN_BOOL(column->bv_allnulls || column->bv_hasnulls);
+		if ( key->sk_flags & SK_SEARCHNOTNULL )
+			PG_RETURN_BOOL(! column->bv_allnulls);
+		PG_RETURN_BOOL(false);
+	}
+
+	if ( key->sk_strategy != RTOverlapStrategyNumber )
+		elog(ERROR, "%s: unsupported strategy number %d", __func__, key->sk_strategy);
+
+	/* Only NULLs in this range */
+	if ( column->bv_allnulls )
+		PG_RETURN_BOOL(false);
+
+	pc_bounds_from_box(&stored, DatumGetBoxP(column->bv_values[0]));
+	pc_bounds_from_query(&query, key->sk_argument, key->sk_subtype);
+	PG_RETURN_BOOL(pc_bounds_intersects(&stored, &query));
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_brin_union);
+Datum pcpatch_brin_union(PG_FUNCTION_ARGS)
+{
+	BrinDesc *bdesc = (BrinDesc *) PG_GETARG_POINTER(0);
+	BrinValues *col_a = (BrinValues *) PG_GETARG_POINTER(1);
+	BrinValues *col_b = (BrinValues *) PG_GETARG_POINTER(2);
+	PCBOUNDS bounds;
+
+	if ( col_b->bv_hasnulls )
+		col_a->bv_hasnulls = true;
+
+	if ( ! col_b->bv_allnulls )
+	{
+		pc_bounds_from_box(&bounds, DatumGetBoxP(col_b->bv_values[0]));
+		pcpatch_brin_extend(bdesc, col_a, &bounds);
+	}
+
+	PG_RETURN_VOID();
+}
+
+#endif /* PG_VERSION_NUM >= 90500 */
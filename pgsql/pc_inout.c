@@ -16,6 +16,10 @@ Datum pcpoint_in(PG_FUNCTION_ARGS);
 Datum pcpoint_out(PG_FUNCTION_ARGS);
 Datum pcpatch_in(PG_FUNCTION_ARGS);
 Datum pcpatch_out(PG_FUNCTION_ARGS);
+Datum pcpoint_recv(PG_FUNCTION_ARGS);
+Datum pcpoint_send(PG_FUNCTION_ARGS);
+Datum pcpatch_recv(PG_FUNCTION_ARGS);
+Datum pcpatch_send(PG_FUNCTION_ARGS);
 
 /* Typmod support */
 Datum pc_typmod_in(PG_FUNCTION_ARGS);
@@ -27,6 +31,8 @@ Datum pcpoint_enforce_typmod(PG_FUNCTION_ARGS);
 /* Other SQL functions */
 Datum pcschema_is_valid(PG_FUNCTION_ARGS);
 Datum pcschema_get_ndims(PG_FUNCTION_ARGS);
+Datum pcschema_get_dimstats(PG_FUNCTION_ARGS);
+Datum pcschema_reset_dimstats(PG_FUNCTION_ARGS);
 Datum pcpoint_from_double_array(PG_FUNCTION_ARGS);
 Datum pcpoint_as_text(PG_FUNCTION_ARGS);
 Datum pcpatch_as_text(PG_FUNCTION_ARGS);
@@ -160,6 +166,118 @@ Datum pcpatch_out(PG_FUNCTION_ARGS)
 	PG_RETURN_CSTRING(hexwkb);
 }
 
+/*
+* Binary I/O carries the WKB of points and patches as is, the
+* compressed payload of a patch goes over the wire untouched
+* instead of twice its size in hex.
+*/
+static PCSCHEMA *
+pc_schema_from_recv(StringInfo buf, size_t hdrsz, uint32 column_pcid, FunctionCallInfoData *fcinfo)
+{
+	PCSCHEMA *schema;
+	uint32 pcid;
+
+	if ( (size_t)(buf->len - buf->cursor) < hdrsz )
+		ereport(ERROR, (
+			errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+			errmsg("binary point/patch is too short (%d bytes)", buf->len - buf->cursor)
+		));
+
+	pcid = pc_wkb_get_pcid((uint8*)(buf->data + buf->cursor));
+	if ( ! pcid )
+		ereport(ERROR, (
+			errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+			errmsg("binary point/patch pcid is zero")
+		));
+	pcid_consistent(pcid, column_pcid);
+
+	schema = pc_schema_from_pcid(pcid, fcinfo);
+	if ( ! schema )
+		elog(ERROR, "unable to load schema for pcid = %d", pcid);
+	return schema;
+}
+
+static bytea *
+pc_wkb_to_bytea(uint8 *wkb, size_t wkbsize)
+{
+	bytea *result = palloc(VARHDRSZ + wkbsize);
+	memcpy(VARDATA(result), wkb, wkbsize);
+	SET_VARSIZE(result, VARHDRSZ + wkbsize);
+	pfree(wkb);
+	return result;
+}
+
+PG_FUNCTION_INFO_V1(pcpoint_recv);
+Datum pcpoint_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+	uint32 pcid = 0;
+	PCSCHEMA *schema;
+	PCPOINT *pt;
+	SERIALIZED_POINT *serpt;
+
+	if ( (PG_NARGS()>2) && (!PG_ARGISNULL(2)) )
+		pcid = pcid_from_typmod(PG_GETARG_INT32(2));
+
+	/* endian + pcid */
+	schema = pc_schema_from_recv(buf, 1+4, pcid, fcinfo);
+	pt = pc_point_from_wkb(schema, (uint8*)(buf->data + buf->cursor), buf->len - buf->cursor);
+	buf->cursor = buf->len;
+
+	serpt = pc_point_serialize(pt);
+	pc_point_free(pt);
+	PG_RETURN_POINTER(serpt);
+}
+
+PG_FUNCTION_INFO_V1(pcpoint_send);
+Datum pcpoint_send(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_POINT *serpt = PG_GETARG_SERPOINT_P(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpt->pcid, fcinfo);
+	PCPOINT *pt = pc_point_deserialize(serpt, schema);
+	size_t wkbsize;
+	uint8 *wkb = pc_point_to_wkb(pt, &wkbsize);
+
+	pc_point_free(pt);
+	PG_RETURN_BYTEA_P(pc_wkb_to_bytea(wkb, wkbsize));
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_recv);
+Datum pcpatch_recv(PG_FUNCTION_ARGS)
+{
+	StringInfo buf = (StringInfo) PG_GETARG_POINTER(0);
+	uint32 pcid = 0;
+	PCSCHEMA *schema;
+	PCPATCH *patch;
+	SERIALIZED_PATCH *serpatch;
+
+	if ( (PG_NARGS()>2) && (!PG_ARGISNULL(2)) )
+		pcid = pcid_from_typmod(PG_GETARG_INT32(2));
+
+	/* endian + pcid + compression + npoints */
+	schema = pc_schema_from_recv(buf, 1+4+4+4, pcid, fcinfo);
+	patch = pc_patch_from_wkb(schema, (uint8*)(buf->data + buf->cursor), buf->len - buf->cursor);
+	buf->cursor = buf->len;
+
+	/* Compressed like the text input, to the schema compression */
+	serpatch = pc_patch_serialize(patch, NULL);
+	pc_patch_free(patch);
+	PG_RETURN_POINTER(serpatch);
+}
+
+PG_FUNCTION_INFO_V1(pcpatch_send);
+Datum pcpatch_send(PG_FUNCTION_ARGS)
+{
+	SERIALIZED_PATCH *serpatch = PG_GETARG_SERPATCH_P(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
+	PCPATCH *patch = pc_patch_deserialize(serpatch, schema);
+	size_t wkbsize;
+	uint8 *wkb = pc_patch_to_wkb(patch, &wkbsize);
+
+	pc_patch_free(patch);
+	PG_RETURN_BYTEA_P(pc_wkb_to_bytea(wkb, wkbsize));
+}
+
 PG_FUNCTION_INFO_V1(pcschema_is_valid);
 Datum pcschema_is_valid(PG_FUNCTION_ARGS)
 {
@@ -193,6 +311,39 @@ Datum pcschema_get_ndims(PG_FUNCTION_ARGS)
 	PG_RETURN_INT32(ndims);
 }
 
+/**
+* PC_SchemaGetDimStats(pcid integer) returns text
+* The dimensional compression stats this backend gathered for a pcid
+*/
+PG_FUNCTION_INFO_V1(pcschema_get_dimstats);
+Datum pcschema_get_dimstats(PG_FUNCTION_ARGS)
+{
+	uint32 pcid = PG_GETARG_INT32(0);
+	PCSCHEMA *schema = pc_schema_from_pcid(pcid, fcinfo);
+	PCDIMSTATS *pds;
+
+	if ( ! schema )
+		elog(ERROR, "unable to load schema for pcid = %d", pcid);
+
+	pds = pc_dimstats_from_schema(schema);
+	if ( ! pds )
+		PG_RETURN_NULL();
+
+	PG_RETURN_TEXT_P(cstring_to_text(pc_dimstats_to_string(pds)));
+}
+
+/**
+* PC_SchemaResetDimStats(pcid integer default 0) returns integer
+* Start gathering the dimensional compression stats of a pcid,
+* or of all of them, afresh
+*/
+PG_FUNCTION_INFO_V1(pcschema_reset_dimstats);
+Datum pcschema_reset_dimstats(PG_FUNCTION_ARGS)
+{
+	uint32 pcid = PG_GETARG_INT32(0);
+	PG_RETURN_INT32(pc_dimstats_reset(pcid));
+}
+
 /**
 * pcpoint_from_double_array(integer pcid, float8[] returns PcPoint
 */
@@ -256,7 +407,7 @@ Datum pcpatch_as_text(PG_FUNCTION_ARGS)
 	text *txt;
 	char *str;
 	PCSCHEMA *schema = pc_schema_from_pcid(serpatch->pcid, fcinfo);
-	PCPATCH *patch = pc_patch_deserialize(serpatch, schema);
+	PCPATCH *patch = pc_patch_deserialize_cached(serpatch, schema, true);
 	if ( ! patch )
 		PG_RETURN_NULL();
 
@@ -12,9 +12,28 @@
 
 #include <assert.h>
 #include "pc_pgsql.h"
+#include "pc_api_internal.h" /* for pc_stats_clone */
 #include "executor/spi.h"
 #include "access/hash.h"
+#include "access/xact.h" /* for RegisterXactCallback */
 #include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/guc.h"
+#include "catalog/namespace.h" /* for RelnameGetRelid */
+#include "commands/extension.h" /* for get_extension_oid */
+#include "utils/lsyscache.h" /* for get_relname_relid */
+#include "commands/trigger.h"
+#if PG_VERSION_NUM >= 130000
+#include "access/detoast.h" /* for toast_raw_datum_size */
+#else
+#include "access/tuptoaster.h" /* for toast_raw_datum_size */
+#endif
+
+/* Before 9.4 every external datum was on disk */
+#ifndef VARATT_IS_EXTERNAL_ONDISK
+#define VARATT_IS_EXTERNAL_ONDISK(PTR) VARATT_IS_EXTERNAL(PTR)
+#endif
 
 PG_MODULE_MAGIC;
 
@@ -108,6 +127,16 @@ pgsql_info(const char *fmt, va_list ap)
 * functions of libpc to the PostgreSQL ones.
 * TODO: also hook the libxml2 hooks into PostgreSQL.
 */
+static void pc_schema_cache_callback(Datum arg, Oid relid);
+/* pointcloud.track_stats, counting of the library operations for PC_Stats() */
+static bool pc_track_stats = false;
+
+static void
+pc_track_stats_assign(bool newval, void *extra)
+{
+	pc_counters_enable(newval);
+}
+
 void _PG_init(void);
 void
 _PG_init(void)
@@ -119,6 +148,21 @@ _PG_init(void)
 		pgsql_info, pgsql_warn
 	);
 
+	/* Drop cached schemas when POINTCLOUD_FORMATS changes */
+	CacheRegisterRelcacheCallback(pc_schema_cache_callback, (Datum) 0);
+
+	DefineCustomBoolVariable(
+		"pointcloud.track_stats",
+		"Count calls, points, bytes and time of pointcloud operations.",
+		"The counts are read with PC_Stats() and zeroed with PC_StatsReset().",
+		&pc_track_stats,
+		false,
+		PGC_USERSET,
+		0,
+		NULL,
+		pc_track_stats_assign,
+		NULL
+	);
 }
 
 /* Module unload callback */
@@ -300,111 +344,123 @@ pc_schema_from_pcid_uncached(uint32 pcid)
 }
 
 
-typedef struct
-{
-	int type;
-	char data[1];
-} GenericCache;
-
 /**
-* Hold the schema references in a list.
-* We'll just search them linearly, because
-* usually we'll have only one per statement
+* Backend-wide cache of the schemas read from POINTCLOUD_FORMATS,
+* keyed by pcid. Schemas live in their own context under
+* TopMemoryContext, so every statement and every function of the
+* backend shares a single parse of each XML document.
+*
+* Next to each schema sit the PCDIMSTATS gathered while compressing
+* patches of that schema, so the compression of each dimension is
+* picked once per backend rather than once per patch, and the plans
+* to remap its patches to other schemas.
 */
-#define SchemaCacheSize 16
+typedef struct RemapCacheItem
+{
+	struct RemapCacheItem *next;
+	PCREMAP *remap;
+} RemapCacheItem;
 
 typedef struct
 {
-	int type;
-	int next_slot;
-	int pcids[SchemaCacheSize];
-	PCSCHEMA* schemas[SchemaCacheSize];
-} SchemaCache;
+	uint32 pcid; /* hash key, must be first */
+	PCSCHEMA *schema;
+	PCDIMSTATS *dimstats;
+	RemapCacheItem *remaps;
+} SchemaCacheEntry;
 
+static MemoryContext SchemaCacheContext = NULL;
+static HTAB *SchemaCacheHash = NULL;
+static Oid SchemaCacheFormatsOid = InvalidOid;
+static bool SchemaCacheStale = false;
 
 /**
-* PostGIS uses this kind of structure for its
-* cache objects, and we expect to be used in
-* concert with PostGIS, so here we not only ape
-* the container, but avoid the first 10 slots,
-* so as to miss any existing cached PostGIS objects.
+* Relcache invalidation callback. POINTCLOUD_FORMATS carries a
+* trigger that invalidates its relcache entry on every write, so
+* this fires in every backend once the write commits. Schemas
+* handed out earlier may still be in use, so we only flag the
+* cache here and let the next lookup rebuild it.
 */
-typedef struct
+static void
+pc_schema_cache_callback(Datum arg, Oid relid)
 {
-	GenericCache *entry[16];
-} GenericCacheCollection;
-
-#define PC_SCHEMA_CACHE 10
-#define PC_STATS_CACHE  11
+	/* Without the table OID, any relation may be the one we watch */
+	if ( relid == InvalidOid || relid == SchemaCacheFormatsOid ||
+	     SchemaCacheFormatsOid == InvalidOid )
+		SchemaCacheStale = true;
+}
 
 /**
-* Get the generic collection off the statement, allocate a
-* new one if we don't have one already.
+* OID of POINTCLOUD_FORMATS, looked up in the schema of the
+* extension so the answer does not depend on the search_path of
+* the first caller. Before PostgreSQL 16 the extension schema is
+* not exported, so we fall back on the search_path, and return
+* InvalidOid when the table is not on it.
 */
-static GenericCacheCollection *
-GetGenericCacheCollection(FunctionCallInfoData *fcinfo)
+static Oid
+pc_schema_cache_formats_oid(void)
 {
-	GenericCacheCollection *cache = fcinfo->flinfo->fn_extra;
-
-	if ( ! cache )
+#if PG_VERSION_NUM >= 160000
+	Oid extoid = get_extension_oid("pointcloud", true);
+	if ( extoid != InvalidOid )
 	{
-		cache = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(GenericCacheCollection));
-		memset(cache, 0, sizeof(GenericCacheCollection));
-		fcinfo->flinfo->fn_extra = cache;
+		Oid nspoid = get_extension_schema(extoid);
+		if ( nspoid != InvalidOid )
+			return get_relname_relid(POINTCLOUD_FORMATS, nspoid);
 	}
-	return cache;
+#endif
+	return RelnameGetRelid(POINTCLOUD_FORMATS);
 }
 
-/**
-* Get the Proj4 entry from the generic cache if one exists.
-* If it doesn't exist, make a new empty one and return it.
-*/
-static SchemaCache *
-GetSchemaCache(FunctionCallInfoData* fcinfo)
+static void
+pc_schema_cache_init(void)
 {
-	GenericCacheCollection *generic_cache = GetGenericCacheCollection(fcinfo);
-	SchemaCache* cache = (SchemaCache*)(generic_cache->entry[PC_SCHEMA_CACHE]);
-
-	if ( ! cache )
-	{
-		/* Allocate in the upper context */
-		cache = MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, sizeof(SchemaCache));
-		memset(cache, 0, sizeof(SchemaCache));
-		cache->type = PC_SCHEMA_CACHE;
-	}
+	HASHCTL ctl;
 
-	generic_cache->entry[PC_SCHEMA_CACHE] = (GenericCache*)cache;
-	return cache;
+	/*
+	* Hand a stale cache over to the current transaction, so it
+	* is freed only once the schemas it holds can no longer be
+	* referenced by the running statements.
+	*/
+	if ( SchemaCacheContext )
+		MemoryContextSetParent(SchemaCacheContext, TopTransactionContext);
+	SchemaCacheStale = false;
+
+	SchemaCacheContext = AllocSetContextCreate(TopMemoryContext,
+		"Pointcloud schema cache",
+		ALLOCSET_SMALL_MINSIZE,
+		ALLOCSET_SMALL_INITSIZE,
+		ALLOCSET_SMALL_MAXSIZE);
+
+	memset(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(uint32);
+	ctl.entrysize = sizeof(SchemaCacheEntry);
+	ctl.hash = tag_hash;
+	ctl.hcxt = SchemaCacheContext;
+	SchemaCacheHash = hash_create("Pointcloud schema cache", 16, &ctl,
+		HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT);
+
+	/* The table the invalidation callback listens for */
+	SchemaCacheFormatsOid = pc_schema_cache_formats_oid();
 }
 
-
 PCSCHEMA *
 pc_schema_from_pcid(uint32 pcid, FunctionCallInfoData *fcinfo)
 {
-	SchemaCache *schema_cache = GetSchemaCache(fcinfo);
-	int i;
+	SchemaCacheEntry *entry;
 	PCSCHEMA *schema;
 	MemoryContext oldcontext;
+	bool found;
 
-	/* Unable to find/make a schema cache? Odd. */
-	if ( ! schema_cache )
-	{
-		ereport(ERROR,
-			(errcode(ERRCODE_INTERNAL_ERROR),
-			errmsg("unable to create/load statement level schema cache")));
-	}
+	if ( ! SchemaCacheHash || SchemaCacheStale )
+		pc_schema_cache_init();
 
-	/* Find our PCID if it's in there (usually it will be first) */
-	for ( i = 0; i < SchemaCacheSize; i++ )
-	{
-		if ( schema_cache->pcids[i] == pcid )
-		{
-			return schema_cache->schemas[i];
-		}
-	}
+	entry = hash_search(SchemaCacheHash, &pcid, HASH_FIND, NULL);
+	if ( entry )
+		return entry->schema;
 
 	/* Not in there, load one the old-fashioned way. */
-	oldcontext = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+	oldcontext = MemoryContextSwitchTo(SchemaCacheContext);
 	schema = pc_schema_from_pcid_uncached(pcid);
 	MemoryContextSwitchTo(oldcontext);
 
@@ -416,13 +472,137 @@ pc_schema_from_pcid(uint32 pcid, FunctionCallInfoData *fcinfo)
 			errmsg("unable to load schema for pcid %u", pcid)));
 	}
 
-	/* Save the XML in the next unused slot */
-	schema_cache->schemas[schema_cache->next_slot] = schema;
-	schema_cache->pcids[schema_cache->next_slot] = pcid;
-	schema_cache->next_slot = (schema_cache->next_slot + 1) % SchemaCacheSize;
+	/*
+	* The lookup may have processed an invalidation, in which case
+	* the entry goes in the stale cache and is dropped with it.
+	*/
+	entry = hash_search(SchemaCacheHash, &pcid, HASH_ENTER, &found);
+	entry->schema = schema;
+	entry->dimstats = NULL;
+	entry->remaps = NULL;
 	return schema;
 }
 
+/**
+* The PCDIMSTATS of a cached schema, made on first use. Sampling
+* stops once PCDIMSTATS_MIN_SAMPLE points went through them, and
+* later patches reuse the recommended compressions as they are.
+* Schemas that are not the cached ones have none.
+*/
+PCDIMSTATS *
+pc_dimstats_from_schema(const PCSCHEMA *schema)
+{
+	SchemaCacheEntry *entry;
+	MemoryContext oldcontext;
+
+	if ( ! SchemaCacheHash || SchemaCacheStale )
+		return NULL;
+
+	entry = hash_search(SchemaCacheHash, &(schema->pcid), HASH_FIND, NULL);
+	if ( ! entry || entry->schema != schema )
+		return NULL;
+
+	if ( ! entry->dimstats )
+	{
+		oldcontext = MemoryContextSwitchTo(SchemaCacheContext);
+		entry->dimstats = pc_dimstats_make(schema);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	return entry->dimstats;
+}
+
+/**
+* The plan to remap patches of oschema to nschema, made on first use
+* and kept with oschema, so each pair of pcids is worked out once per
+* backend. Schemas that are not the cached ones get a plan of their
+* own, in the current memory context.
+*/
+PCREMAP *
+pc_remap_from_schemas(const PCSCHEMA *oschema, const PCSCHEMA *nschema, double def, int rescale)
+{
+	SchemaCacheEntry *entry = NULL;
+	SchemaCacheEntry *nentry;
+	RemapCacheItem *item;
+	MemoryContext oldcontext;
+	PCREMAP *remap;
+
+	if ( SchemaCacheHash && ! SchemaCacheStale )
+	{
+		entry = hash_search(SchemaCacheHash, &(oschema->pcid), HASH_FIND, NULL);
+		nentry = hash_search(SchemaCacheHash, &(nschema->pcid), HASH_FIND, NULL);
+		if ( entry && ( entry->schema != oschema || ! nentry || nentry->schema != nschema ) )
+			entry = NULL;
+	}
+
+	if ( ! entry )
+		return pc_remap_new(oschema, nschema, def, rescale);
+
+	/* Bitwise on the default, so a NaN one is found again too */
+	for ( item = entry->remaps; item; item = item->next )
+	{
+		remap = item->remap;
+		if ( remap->nschema == nschema && remap->rescale == rescale &&
+		     memcmp(&(remap->def), &def, sizeof(double)) == 0 )
+			return remap;
+	}
+
+	oldcontext = MemoryContextSwitchTo(SchemaCacheContext);
+	remap = pc_remap_new(oschema, nschema, def, rescale);
+	if ( remap )
+	{
+		item = palloc(sizeof(RemapCacheItem));
+		item->remap = remap;
+		item->next = entry->remaps;
+		entry->remaps = item;
+	}
+	MemoryContextSwitchTo(oldcontext);
+	return remap;
+}
+
+/**
+* Start sampling afresh for a pcid, or for all of them when pcid
+* is 0. Returns how many PCDIMSTATS were dropped.
+*/
+int
+pc_dimstats_reset(uint32 pcid)
+{
+	HASH_SEQ_STATUS status;
+	SchemaCacheEntry *entry;
+	int n = 0;
+
+	if ( ! SchemaCacheHash )
+		return 0;
+
+	hash_seq_init(&status, SchemaCacheHash);
+	while ( (entry = hash_seq_search(&status)) )
+	{
+		if ( entry->dimstats && ( pcid == 0 || entry->pcid == pcid ) )
+		{
+			pc_dimstats_free(entry->dimstats);
+			entry->dimstats = NULL;
+			n++;
+		}
+	}
+	return n;
+}
+
+/**
+* Trigger on POINTCLOUD_FORMATS, invalidates the schema caches
+* of all backends through the relcache of the table.
+*/
+Datum pc_schema_cache_invalidate(PG_FUNCTION_ARGS);
+PG_FUNCTION_INFO_V1(pc_schema_cache_invalidate);
+Datum pc_schema_cache_invalidate(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if ( ! CALLED_AS_TRIGGER(fcinfo) )
+		elog(ERROR, "%s: not called by trigger manager", __func__);
+
+	CacheInvalidateRelcache(trigdata->tg_relation);
+	PG_RETURN_POINTER(NULL);
+}
+
 
 
 /**********************************************************************************
@@ -479,7 +659,7 @@ pc_patch_serialized_size(const PCPATCH *patch)
 	}
 	case PC_DIMENSIONAL:
 	{
-		return common_size + stats_size + pc_patch_dimensional_serialized_size((PCPATCH_DIMENSIONAL*)patch);
+		return common_size + stats_size + pc_patch_dimensional_directory_serialized_size((PCPATCH_DIMENSIONAL*)patch);
 	}
 	case PC_LAZPERF:
 	{
@@ -498,15 +678,10 @@ pc_patch_serialized_size(const PCPATCH *patch)
 static size_t
 pc_patch_stats_serialize(uint8_t *buf, const PCSCHEMA *schema, const PCSTATS *stats)
 {
-	size_t sz = schema->size;
-	/* Copy min */
-	memcpy(buf, stats->min.data, sz);
-	/* Copy max */
-	memcpy(buf + sz, stats->max.data, sz);
-	/* Copy avg */
-	memcpy(buf + 2*sz, stats->avg.data, sz);
-
-	return sz*3;
+	size_t sz = pc_stats_size(schema);
+	/* Copy min, max and avg in one go */
+	memcpy(buf, stats->data, sz);
+	return sz;
 }
 
 /**
@@ -517,12 +692,7 @@ pc_patch_stats_serialize(uint8_t *buf, const PCSCHEMA *schema, const PCSTATS *st
 PCSTATS *
 pc_patch_stats_deserialize(const PCSCHEMA *schema, const uint8_t *buf)
 {
-	size_t sz = schema->size;
-	const uint8_t *buf_min = buf;
-	const uint8_t *buf_max = buf + sz;
-	const uint8_t *buf_avg = buf + 2*sz;
-
-	return pc_stats_new_from_data(schema, buf_min, buf_max, buf_avg);
+	return pc_stats_new_from_data(schema, buf);
 }
 
 static SERIALIZED_PATCH *
@@ -535,9 +705,10 @@ pc_patch_dimensional_serialize(const PCPATCH *patch_in)
 	//  double xmin, xmax, ymin, ymax;
 	//  data:
 	//    pcpoint[3] stats;
-	//    serialized_pcbytes[ndims] dimensions;
+	//    uint8_t marker;
+	//    pcdimentry[ndims] directory;
+	//    uint8_t[] dimensions;
 
-	int i;
 	uint8_t *buf;
 	size_t serpch_size = pc_patch_serialized_size(patch_in);
 	SERIALIZED_PATCH *serpch = pcalloc(serpch_size);
@@ -565,14 +736,8 @@ pc_patch_dimensional_serialize(const PCPATCH *patch_in)
 		pcerror("%s: stats missing!", __func__);
 	}
 
-	/* Write each dimension in after the stats */
-	for ( i = 0; i < patch->schema->ndims; i++ )
-	{
-		size_t bsize = 0;
-		PCBYTES *pcb = &(patch->bytes[i]);
-		pc_bytes_serialize(pcb, buf, &bsize);
-		buf += bsize;
-	}
+	/* Write the directory and each dimension in after the stats */
+	pc_patch_dimensional_directory_serialize(patch, buf);
 
 	SET_VARSIZE(serpch, serpch_size);
 	return serpch;
@@ -709,16 +874,34 @@ pc_patch_uncompressed_serialize(const PCPATCH *patch_in)
 }
 
 
+/* Record the sort order of the points next to the compression */
+static void
+pc_patch_sortdim_serialize(SERIALIZED_PATCH *serpatch, const PCPATCH *patch)
+{
+	if ( serpatch && patch->type != PC_GHT )
+		serpatch->compression |= patch->sortdim << SERPATCH_SORTDIM_SHIFT;
+}
+
+/* Sort order of a serialized patch, ignored when it does not fit the schema */
+static uint32_t
+pc_patch_sortdim_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema)
+{
+	uint32_t sortdim = SERPATCH_SORTDIM(serpatch);
+	return sortdim <= schema->ndims ? sortdim : 0;
+}
+
 /**
 * Convert struct to byte array.
 * Userdata is currently only PCDIMSTATS, hopefully updated across
-* a number of iterations and saved.
+* a number of iterations and saved. Without one, the PCDIMSTATS
+* cached with the schema are used.
 */
 SERIALIZED_PATCH *
 pc_patch_serialize(const PCPATCH *patch_in, void *userdata)
 {
 	PCPATCH *patch = (PCPATCH*)patch_in;
 	SERIALIZED_PATCH *serpatch = NULL;
+	PC_COUNTER_START(t0);
 	/*
 	* Ensure the patch has stats calculated before going on
 	*/
@@ -733,6 +916,8 @@ pc_patch_serialize(const PCPATCH *patch_in, void *userdata)
 	*/
 	if ( patch->type != patch->schema->compression )
 	{
+		if ( ! userdata && patch->schema->compression == PC_DIMENSIONAL )
+			userdata = pc_dimstats_from_schema(patch->schema);
 		patch = pc_patch_compress(patch_in, userdata);
 	}
 
@@ -764,9 +949,15 @@ pc_patch_serialize(const PCPATCH *patch_in, void *userdata)
 	}
 	}
 
+	pc_patch_sortdim_serialize(serpatch, patch);
+
 	if ( patch != patch_in )
 		pc_patch_free(patch);
 
+	/* The compression to the schema one is counted in too */
+	if ( serpatch )
+		PC_COUNTER_STOP(PC_OP_SERIALIZE, t0, patch_in->npoints, patch_in->npoints * patch_in->schema->size, VARSIZE(serpatch));
+
 	return serpatch;
 }
 
@@ -791,6 +982,7 @@ pc_patch_serialize_to_uncompressed(const PCPATCH *patch_in)
 	}
 
 	serpatch = pc_patch_uncompressed_serialize(patch);
+	pc_patch_sortdim_serialize(serpatch, patch);
 
 	/* An uncompressed input won't result in a copy */
 	if ( patch != patch_in )
@@ -820,7 +1012,8 @@ pc_patch_uncompressed_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHE
 	PCPATCH_UNCOMPRESSED *patch = pcalloc(sizeof(PCPATCH_UNCOMPRESSED));
 
 	/* Set up basic info */
-	patch->type = serpatch->compression;
+	patch->type = SERPATCH_COMPRESSION(serpatch);
+	patch->sortdim = pc_patch_sortdim_deserialize(serpatch, schema);
 	patch->schema = schema;
 	patch->readonly = true;
 	patch->npoints = serpatch->npoints;
@@ -843,8 +1036,24 @@ pc_patch_uncompressed_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHE
 	return (PCPATCH*)patch;
 }
 
+/*
+* A dimension skipped by a projected read: no bytes, so it can only
+* be told apart from the others by the caller that asked to skip it.
+*/
+static void
+pc_bytes_skipped(PCBYTES *pcb, const PCDIMENSION *dim, uint32_t npoints)
+{
+	pcb->size = 0;
+	pcb->npoints = npoints;
+	pcb->interpretation = dim->interpretation;
+	pcb->compression = PC_DIM_NONE;
+	pcb->readonly = true;
+	pcb->indexsize = 0;
+	pcb->bytes = NULL;
+}
+
 static PCPATCH *
-pc_patch_dimensional_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema)
+pc_patch_dimensional_deserialize_dims(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema, const uint8_t *dimmask)
 {
 	// typedef struct
 	// {
@@ -855,22 +1064,32 @@ pc_patch_dimensional_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEM
 	//  double xmin, xmax, ymin, ymax;
 	//  data:
 	//    pcpoint[3] pcstats(min, max, avg)
+	//    pcdimentry[ndims] directory, or nothing in the older layout
 	//    pcbytes[ndims];
 	// }
 	// SERIALIZED_PATCH;
 
 	PCPATCH_DIMENSIONAL *patch;
+	PCDIMENTRY *dir;
 	int i;
 	const uint8_t *buf;
+	size_t bufsize;
 	int ndims = schema->ndims;
 	int npoints = serpatch->npoints;
 	size_t stats_size = pc_stats_size(schema); // 3 pcpoints worth of stats
 
+	/* Locate the dimensions */
+	buf = serpatch->data + stats_size;
+	bufsize = VARSIZE(serpatch) - sizeof(SERIALIZED_PATCH) + 1 - stats_size;
+	dir = pcalloc(ndims * sizeof(PCDIMENTRY));
+	pc_patch_dimensional_directory_read(buf, bufsize, ndims, false /*flipendian*/, dir);
+
 	/* Reference the external data */
 	patch = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
 
 	/* Set up basic info */
-	patch->type = serpatch->compression;
+	patch->type = SERPATCH_COMPRESSION(serpatch);
+	patch->sortdim = pc_patch_sortdim_deserialize(serpatch, schema);
 	patch->schema = schema;
 	patch->readonly = true;
 	patch->npoints = npoints;
@@ -881,20 +1100,146 @@ pc_patch_dimensional_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEM
 
 	/* Set up dimensions */
 	patch->bytes = pcalloc(ndims * sizeof(PCBYTES));
-	buf = serpatch->data + stats_size;
 
 	for ( i = 0; i < ndims; i++ )
 	{
 		PCBYTES *pcb = &(patch->bytes[i]);
 		PCDIMENSION *dim = schema->dims[i];
-		pc_bytes_deserialize(buf, dim, pcb, true /*readonly*/, false /*flipendian*/);
-		pcb->npoints = npoints;
-		buf += pc_bytes_serialized_size(pcb);
+		if ( dimmask && ! dimmask[i] )
+			pc_bytes_skipped(pcb, dim, npoints);
+		else
+			pc_bytes_from_dimentry(buf, &(dir[i]), dim, npoints, pcb, true /*readonly*/, false /*flipendian*/);
 	}
 
+	pcfree(dir);
 	return (PCPATCH*)patch;
 }
 
+static PCPATCH *
+pc_patch_dimensional_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema)
+{
+	return pc_patch_dimensional_deserialize_dims(serpatch, schema, NULL);
+}
+
+/*
+* Read a dimensional patch stored out of line one slice at a time,
+* fetching the bytes of the flagged dimensions only. The directory
+* locates them all at once, in the older layout with no directory
+* only the headers of the skipped dimensions are read, to find the
+* next one.
+*/
+static PCPATCH *
+pc_patch_dimensional_deserialize_slices(Datum d, const PCSCHEMA *schema, const uint8_t *dimmask)
+{
+	SERIALIZED_PATCH *serhdr;
+	PCPATCH_DIMENSIONAL *patch;
+	PCDIMENTRY *dir;
+	struct varlena *slice;
+	size_t stats_size = pc_stats_size(schema);
+	size_t offset = offsetof(SERIALIZED_PATCH, data) - VARHDRSZ;
+	size_t dirsize = 1 + schema->ndims * PC_DIMENTRY_SIZE;
+	size_t bufsize;
+	int i;
+
+	serhdr = (SERIALIZED_PATCH*)PG_DETOAST_DATUM_SLICE(d, 0, offset + stats_size);
+
+	patch = pcalloc(sizeof(PCPATCH_DIMENSIONAL));
+	patch->type = SERPATCH_COMPRESSION(serhdr);
+	patch->sortdim = pc_patch_sortdim_deserialize(serhdr, schema);
+	patch->schema = schema;
+	patch->readonly = true;
+	patch->npoints = serhdr->npoints;
+	patch->bounds = serhdr->bounds;
+	/* Copied out, as deserialized stats would point into the header slice */
+	patch->stats = pc_stats_new(schema);
+	memcpy(patch->stats->data, serhdr->data, stats_size);
+	patch->bytes = pcalloc(schema->ndims * sizeof(PCBYTES));
+	offset += stats_size;
+	pfree(serhdr);
+
+	/* Directory, if any */
+	bufsize = toast_raw_datum_size(d) - sizeof(SERIALIZED_PATCH) + 1 - stats_size;
+	slice = PG_DETOAST_DATUM_SLICE(d, offset, dirsize);
+	if ( VARSIZE(slice) - VARHDRSZ == dirsize && *((uint8_t*)VARDATA(slice)) == PC_DIMENSIONAL_DIRECTORY )
+	{
+		dir = pcalloc(schema->ndims * sizeof(PCDIMENTRY));
+		pc_patch_dimensional_directory_read((uint8_t*)VARDATA(slice), bufsize, schema->ndims, false /*flipendian*/, dir);
+		pfree(slice);
+
+		for ( i = 0; i < schema->ndims; i++ )
+		{
+			PCBYTES *pcb = &(patch->bytes[i]);
+			pc_bytes_skipped(pcb, schema->dims[i], patch->npoints);
+			if ( dimmask[i] )
+			{
+				pcb->compression = dir[i].compression;
+				pcb->size = dir[i].size;
+				if ( dir[i].size > 0 )
+					pcb->bytes = (uint8_t*)VARDATA(PG_DETOAST_DATUM_SLICE(d, offset + dir[i].offset, dir[i].size));
+				pc_bytes_index_split(pcb, false /*flipendian*/);
+			}
+		}
+		pcfree(dir);
+		return (PCPATCH*)patch;
+	}
+	pfree(slice);
+
+	for ( i = 0; i < schema->ndims; i++ )
+	{
+		PCBYTES *pcb = &(patch->bytes[i]);
+		PCDIMENSION *dim = schema->dims[i];
+		uint8_t *hdr;
+		int32_t size;
+
+		/* Compression byte and int32 size */
+		slice = PG_DETOAST_DATUM_SLICE(d, offset, 5);
+		hdr = (uint8_t*)VARDATA(slice);
+		memcpy(&size, hdr + 1, 4);
+
+		pc_bytes_skipped(pcb, dim, patch->npoints);
+		if ( dimmask[i] )
+		{
+			pcb->compression = hdr[0];
+			pcb->size = size;
+			if ( size > 0 )
+				pcb->bytes = (uint8_t*)VARDATA(PG_DETOAST_DATUM_SLICE(d, offset + 5, size));
+			pc_bytes_index_split(pcb, false /*flipendian*/);
+		}
+		pfree(slice);
+		offset += 5 + size;
+	}
+
+	return (PCPATCH*)patch;
+}
+
+/**
+* Deserialize a patch to read the dimensions flagged in dimmask,
+* an array of schema->ndims flags. The other dimensions of a
+* dimensional patch are left empty, and are not even fetched when
+* the patch is stored out of line.
+*/
+PCPATCH *
+pc_patch_deserialize_dims(Datum d, const PCSCHEMA *schema, const uint8_t *dimmask)
+{
+	SERIALIZED_PATCH *serpatch;
+
+	if ( VARATT_IS_EXTERNAL_ONDISK(DatumGetPointer(d)) )
+	{
+		uint32_t compression;
+
+		serpatch = (SERIALIZED_PATCH*)PG_DETOAST_DATUM_SLICE(d, 0, sizeof(SERIALIZED_PATCH));
+		compression = SERPATCH_COMPRESSION(serpatch);
+		pfree(serpatch);
+		if ( compression == PC_DIMENSIONAL )
+			return pc_patch_dimensional_deserialize_slices(d, schema, dimmask);
+	}
+
+	serpatch = (SERIALIZED_PATCH*)PG_DETOAST_DATUM(d);
+	if ( SERPATCH_COMPRESSION(serpatch) == PC_DIMENSIONAL )
+		return pc_patch_dimensional_deserialize_dims(serpatch, schema, dimmask);
+	return pc_patch_deserialize(serpatch, schema);
+}
+
 /*
 * We don't do any radical deserialization here. Don't build out the tree, just
 * set up pointers to the start of the buffer, so we can build it out later
@@ -927,7 +1272,8 @@ pc_patch_ght_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schem
 	patch = pcalloc(sizeof(PCPATCH_GHT));
 
 	/* Set up basic info */
-	patch->type = serpatch->compression;
+	patch->type = SERPATCH_COMPRESSION(serpatch);
+	patch->sortdim = pc_patch_sortdim_deserialize(serpatch, schema);
 	patch->schema = schema;
 	patch->readonly = true;
 	patch->npoints = npoints;
@@ -958,7 +1304,8 @@ pc_patch_lazperf_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *s
 	patch = pcalloc(sizeof(PCPATCH_LAZPERF));
 
 	/* Set up basic info */
-	patch->type = serpatch->compression;
+	patch->type = SERPATCH_COMPRESSION(serpatch);
+	patch->sortdim = pc_patch_sortdim_deserialize(serpatch, schema);
 	patch->schema = schema;
 	patch->readonly = true;
 	patch->npoints = npoints;
@@ -972,8 +1319,8 @@ pc_patch_lazperf_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *s
 	patch->lazperfsize = lazperfsize;
 	buf += 4;
 
-	patch->lazperf = pcalloc( patch->lazperfsize );
-	memcpy(patch->lazperf, buf, patch->lazperfsize);
+	/* Point into the datum, the decoder reads it in place */
+	patch->lazperf = buf;
 
 	return (PCPATCH*)patch;
 }
@@ -981,19 +1328,193 @@ pc_patch_lazperf_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *s
 PCPATCH *
 pc_patch_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema)
 {
-	switch(serpatch->compression)
+	PCPATCH *patch;
+	PC_COUNTER_START(t0);
+
+	switch(SERPATCH_COMPRESSION(serpatch))
 	{
 	case PC_NONE:
-		return pc_patch_uncompressed_deserialize(serpatch, schema);
+		patch = pc_patch_uncompressed_deserialize(serpatch, schema);
+		break;
 	case PC_DIMENSIONAL:
-		return pc_patch_dimensional_deserialize(serpatch, schema);
+		patch = pc_patch_dimensional_deserialize(serpatch, schema);
+		break;
 	case PC_GHT:
-		return pc_patch_ght_deserialize(serpatch, schema);
+		patch = pc_patch_ght_deserialize(serpatch, schema);
+		break;
 	case PC_LAZPERF:
-		return pc_patch_lazperf_deserialize(serpatch, schema);
+		patch = pc_patch_lazperf_deserialize(serpatch, schema);
+		break;
+	default:
+		pcerror("%s: unsupported compression type", __func__);
+		return NULL;
 	}
-	pcerror("%s: unsupported compression type", __func__);
-	return NULL;
+
+	if ( patch )
+		PC_COUNTER_STOP(PC_OP_DESERIALIZE, t0, patch->npoints, VARSIZE(serpatch), 0);
+	return patch;
+}
+
+/***********************************************************************
+* Decoded patch cache
+*
+* LAZ and GHT patches only come apart whole, so functions called on
+* the same value in one row, as PC_PointN(pa, 1) and PC_FilterEquals(pa,
+* 'z', 10) are, decode it once each. The points of the patches decoded
+* last are kept until the end of the transaction, the least recently
+* used going first past PC_PATCH_CACHE_BYTES. Entries are found by the
+* size and hash of the serialized patch and checked against a copy of
+* it, as the detoasted values of different rows may share an address.
+*/
+
+#define PC_PATCH_CACHE_BYTES (16 * 1024 * 1024)
+#define PC_PATCH_CACHE_ENTRIES 8
+
+typedef struct
+{
+	uint32 hash;
+	size_t size;            /* of the serialized patch, 0 for free entries */
+	uint64 lastuse;
+	size_t bytes;           /* held for the entry */
+	SERIALIZED_PATCH *serpatch;
+	PCPATCH_UNCOMPRESSED *patch;
+} PatchCacheEntry;
+
+static MemoryContext PatchCacheContext = NULL;
+static PatchCacheEntry PatchCache[PC_PATCH_CACHE_ENTRIES];
+static size_t PatchCacheBytes = 0;
+static uint64 PatchCacheClock = 0;
+
+static void
+pc_patch_cache_entry_free(PatchCacheEntry *entry)
+{
+	PatchCacheBytes -= entry->bytes;
+	pc_patch_free((PCPATCH*)entry->patch);
+	pfree(entry->serpatch);
+	memset(entry, 0, sizeof(PatchCacheEntry));
+}
+
+static void
+pc_patch_cache_xact_callback(XactEvent event, void *arg)
+{
+	if ( PatchCacheContext )
+		MemoryContextReset(PatchCacheContext);
+	memset(PatchCache, 0, sizeof(PatchCache));
+	PatchCacheBytes = 0;
+}
+
+/* Readonly patch on the points of an entry, stats of its own */
+static PCPATCH *
+pc_patch_cache_view(PatchCacheEntry *entry)
+{
+	PCPATCH_UNCOMPRESSED *pu = palloc(sizeof(PCPATCH_UNCOMPRESSED));
+
+	memcpy(pu, entry->patch, sizeof(PCPATCH_UNCOMPRESSED));
+	pu->readonly = PC_TRUE;
+	pu->maxpoints = 0;
+	pu->stats = pc_stats_clone(entry->patch->stats);
+	entry->lastuse = ++PatchCacheClock;
+	return (PCPATCH*)pu;
+}
+
+/* Keep a copy of pu for the serialized patch, if it fits the budget */
+static void
+pc_patch_cache_add(const SERIALIZED_PATCH *serpatch, uint32 hash, const PCPATCH_UNCOMPRESSED *pu)
+{
+	size_t size = VARSIZE(serpatch);
+	size_t bytes = size + pu->datasize + sizeof(PCPATCH_UNCOMPRESSED);
+	PatchCacheEntry *entry;
+	MemoryContext oldcontext;
+	int i;
+
+	if ( bytes > PC_PATCH_CACHE_BYTES / 2 )
+		return;
+
+	if ( ! PatchCacheContext )
+	{
+		PatchCacheContext = AllocSetContextCreate(TopMemoryContext,
+			"Pointcloud patch cache",
+			ALLOCSET_DEFAULT_MINSIZE,
+			ALLOCSET_DEFAULT_INITSIZE,
+			ALLOCSET_DEFAULT_MAXSIZE);
+		RegisterXactCallback(pc_patch_cache_xact_callback, NULL);
+	}
+
+	/* Least recently used out, until there is a free entry and room */
+	for (;;)
+	{
+		PatchCacheEntry *lru = NULL;
+		entry = NULL;
+		for ( i = 0; i < PC_PATCH_CACHE_ENTRIES; i++ )
+		{
+			PatchCacheEntry *e = PatchCache + i;
+			if ( ! e->size )
+				entry = e;
+			else if ( ! lru || e->lastuse < lru->lastuse )
+				lru = e;
+		}
+		if ( entry && PatchCacheBytes + bytes <= PC_PATCH_CACHE_BYTES )
+			break;
+		pc_patch_cache_entry_free(lru);
+	}
+
+	oldcontext = MemoryContextSwitchTo(PatchCacheContext);
+	entry->serpatch = palloc(size);
+	memcpy(entry->serpatch, serpatch, size);
+	entry->patch = pc_patch_uncompressed_make(pu->schema, pu->npoints);
+	memcpy(entry->patch->data, pu->data, pu->datasize);
+	entry->patch->npoints = pu->npoints;
+	entry->patch->bounds = pu->bounds;
+	entry->patch->sortdim = pu->sortdim;
+	entry->patch->stats = pc_stats_clone(pu->stats);
+	MemoryContextSwitchTo(oldcontext);
+
+	entry->hash = hash;
+	entry->size = size;
+	entry->bytes = bytes;
+	entry->lastuse = ++PatchCacheClock;
+	PatchCacheBytes += bytes;
+}
+
+/**
+* Like pc_patch_deserialize, but LAZ and GHT patches found in the
+* decoded patch cache come back as readonly uncompressed patches on
+* the cached points, valid until the next call. Patches not found are
+* decoded and added to the cache when decode is set, and deserialized
+* as usual when it is not, for callers that only read part of them.
+*/
+PCPATCH *
+pc_patch_deserialize_cached(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema, bool decode)
+{
+	uint32 compression = SERPATCH_COMPRESSION(serpatch);
+	size_t size = VARSIZE(serpatch);
+	PCPATCH *patch;
+	PCPATCH_UNCOMPRESSED *pu;
+	uint32 hash;
+	int i;
+
+	if ( compression != PC_LAZPERF && compression != PC_GHT )
+		return pc_patch_deserialize(serpatch, schema);
+
+	hash = DatumGetUInt32(hash_any((const unsigned char*)serpatch, size));
+	for ( i = 0; i < PC_PATCH_CACHE_ENTRIES; i++ )
+	{
+		PatchCacheEntry *entry = PatchCache + i;
+		if ( entry->size == size && entry->hash == hash &&
+		     entry->patch->schema == schema &&
+		     memcmp(entry->serpatch, serpatch, size) == 0 )
+			return pc_patch_cache_view(entry);
+	}
+
+	patch = pc_patch_deserialize(serpatch, schema);
+	if ( ! ( decode && patch ) )
+		return patch;
+
+	pu = (PCPATCH_UNCOMPRESSED*)pc_patch_uncompress(patch);
+	pc_patch_free(patch);
+	if ( pu && pu->stats )
+		pc_patch_cache_add(serpatch, hash, pu);
+	return (PCPATCH*)pu;
 }
 
 
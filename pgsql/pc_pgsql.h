@@ -61,6 +61,8 @@ SERIALIZED_POINT;
 * the underlying structure of the data is described in XML,
 * the spatial reference system is indicated, and the data
 * packing scheme is indicated.
+* The upper half of the compression word holds the sortdim
+* of the patch, zero in patches written before it was kept.
 */
 typedef struct
 {
@@ -73,16 +75,29 @@ typedef struct
 }
 SERIALIZED_PATCH;
 
+#define SERPATCH_SORTDIM_SHIFT 16
+#define SERPATCH_COMPRESSION(serpatch) ((serpatch)->compression & ((1 << SERPATCH_SORTDIM_SHIFT) - 1))
+#define SERPATCH_SORTDIM(serpatch) ((serpatch)->compression >> SERPATCH_SORTDIM_SHIFT)
+
 
 /* PGSQL / POINTCLOUD UTILITY FUNCTIONS */
 uint32 pcid_from_typmod(const int32 typmod);
 
-/** Look-up the PCID in the POINTCLOUD_FORMATS table, and construct a PC_SCHEMA from the XML therein */
+/** Return the PC_SCHEMA of a PCID from the backend schema cache, loading it from POINTCLOUD_FORMATS on a miss */
 PCSCHEMA* pc_schema_from_pcid(uint32_t pcid, FunctionCallInfoData *fcinfo);
 
 /** Look-up the PCID in the POINTCLOUD_FORMATS table, and construct a PC_SCHEMA from the XML therein */
 PCSCHEMA* pc_schema_from_pcid_uncached(uint32 pcid);
 
+/** Return the PCDIMSTATS cached with a schema from the schema cache, NULL for other schemas */
+PCDIMSTATS* pc_dimstats_from_schema(const PCSCHEMA *schema);
+
+/** Drop the cached PCDIMSTATS of a pcid, or of all of them for pcid 0 */
+int pc_dimstats_reset(uint32 pcid);
+
+/** Return the PCREMAP from oschema to nschema from the schema cache, not to be freed */
+PCREMAP* pc_remap_from_schemas(const PCSCHEMA *oschema, const PCSCHEMA *nschema, double def, int rescale);
+
 /** Turn a PCPOINT into a byte buffer suitable for saving in PgSQL */
 SERIALIZED_POINT* pc_point_serialize(const PCPOINT *pcpt);
 
@@ -107,6 +122,12 @@ SERIALIZED_PATCH* pc_patch_serialize_to_uncompressed(const PCPATCH *patch);
 /** Turn a byte buffer into a PCPATCH for processing */
 PCPATCH* pc_patch_deserialize(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema);
 
+/** Like pc_patch_deserialize, reading LAZ and GHT patches decoded earlier in the transaction from a cache */
+PCPATCH* pc_patch_deserialize_cached(const SERIALIZED_PATCH *serpatch, const PCSCHEMA *schema, bool decode);
+
+/** Turn a patch datum into a PCPATCH to read the dimensions flagged in dimmask only */
+PCPATCH* pc_patch_deserialize_dims(Datum d, const PCSCHEMA *schema, const uint8_t *dimmask);
+
 /** Create a new readwrite PCPATCH from a hex string */
 PCPATCH* pc_patch_from_hexwkb(const char *hexwkb, size_t hexlen, FunctionCallInfoData *fcinfo);
 
@@ -88,6 +88,11 @@ SELECT pc_astext(PC_FilterLessThan(pa, 'z', 5)) FROM pa_test_laz;
 SELECT pc_astext(PC_FilterGreaterThan(pa, 'z', 1595)) FROM pa_test_laz;
 SELECT pc_astext(PC_FilterEquals(pa, 'z', 500)) FROM pa_test_laz;
 SELECT pc_astext(PC_FilterBetween(pa, 'z', 500, 505)) FROM pa_test_laz;
+-- Functions reading the same patch in one row decode it once
+SELECT coalesce(PC_NumPoints(PC_FilterLessThan(pa, 'z', 600)), 0) lt,
+       coalesce(PC_NumPoints(PC_FilterGreaterThan(pa, 'z', 600)), 0) gt,
+       coalesce(PC_NumPoints(PC_FilterEquals(pa, 'z', 500)), 0) eq
+FROM pa_test_laz ORDER BY PC_PatchMin(pa, 'z');
 
 DELETE FROM pa_test_laz;
 INSERT INTO pa_test_laz( pa ) VALUES ('01050000000300000004000000210000000000000000000000000000000a004417593a34c1c5f74f83179fc2448960000000');
@@ -242,6 +242,33 @@ VALUES (1, 0, -- XYZI, scaled, uncompressed
     <Metadata name="compression">dimensional</Metadata>
   </pc:metadata>
 </pc:PointCloudSchema>'
+),
+(21, 0, -- XYZ, unscaled, dimensionally compressed, zstd on Z
+'<?xml version="1.0" encoding="UTF-8"?>
+<pc:PointCloudSchema xmlns:pc="http://pointcloud.org/schemas/PC/1.1" xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance">
+  <pc:dimension>
+    <pc:position>1</pc:position>
+    <pc:size>4</pc:size>
+    <pc:name>X</pc:name>
+    <pc:interpretation>int32_t</pc:interpretation>
+  </pc:dimension>
+  <pc:dimension>
+    <pc:position>2</pc:position>
+    <pc:size>4</pc:size>
+    <pc:name>Y</pc:name>
+    <pc:interpretation>int32_t</pc:interpretation>
+  </pc:dimension>
+  <pc:dimension>
+    <pc:position>3</pc:position>
+    <pc:size>4</pc:size>
+    <pc:name>Z</pc:name>
+    <pc:interpretation>int32_t</pc:interpretation>
+    <pc:compression>zstd</pc:compression>
+  </pc:dimension>
+  <pc:metadata>
+    <Metadata name="compression">dimensional</Metadata>
+  </pc:metadata>
+</pc:PointCloudSchema>'
 )
 ;
 
@@ -263,6 +290,8 @@ SELECT Sum(PC_Get(pt, 'y')) FROM pt_test;
 SELECT PC_Get(pt) FROM pt_test;
 
 SELECT PC_AsText(pt) FROM pt_test;
+-- binary output is the WKB of the hex output
+SELECT upper(encode(pcpoint_send(pt), 'hex')) = pt::text FROM pt_test;
 
 SELECT PC_AsText(PC_Patch(pt)) FROM pt_test;
 SELECT PC_AsText(PC_Explode(PC_Patch(pt))) FROM pt_test;
@@ -289,6 +318,11 @@ SELECT PC_AsText(PC_Union(pa)) FROM pa_test;
 SELECT sum(PC_NumPoints(pa)) FROM pa_test;
 
 SELECT PC_AsText(PC_Range(pa, 1, 1)) FROM pa_test;
+SELECT PC_Get(pa, ARRAY['x', 'Intensity']) FROM pa_test LIMIT 1;
+SELECT PC_Get(pa, ARRAY['nope']) FROM pa_test LIMIT 1;
+SELECT PC_Get(pa, 'Intensity') FROM pa_test LIMIT 1;
+SELECT PC_Get(pa, 'nope') FROM pa_test LIMIT 1;
+SELECT upper(encode(pcpatch_send(pa), 'hex')) = pa::text FROM pa_test;
 
 CREATE TABLE IF NOT EXISTS pa_test_dim (
     pa PCPATCH(3)
@@ -333,6 +367,120 @@ SELECT PC_Get(PC_PatchAvg(pa)) FROM pa_test_dim order by 1 limit 1;
 
 SELECT PC_Summary(pa) summary FROM pa_test_dim order by 1 limit 1;
 
+-- Sorted patches keep their compression and filter by binary search
+SELECT DISTINCT PC_Compression(PC_Sort(pa, ARRAY['z'])) FROM pa_test_dim;
+SELECT Sum(PC_NumPoints(PC_FilterBetween(PC_Sort(pa, ARRAY['z']), 'z', 500, 600))) FROM pa_test_dim;
+-- Points of a 4x4 grid, numbered row by row, along the curves
+SELECT PC_Get(PC_Sort(PC_Patch(PC_MakePoint(20, ARRAY[a % 4, a / 4, a]::float8[])), ARRAY['morton']), 'z') FROM generate_series(0, 15) a;
+SELECT PC_Get(PC_Sort(PC_Patch(PC_MakePoint(20, ARRAY[a % 4, a / 4, a]::float8[])), ARRAY['hilbert']), 'z') FROM generate_series(0, 15) a;
+SELECT PC_Sort(PC_Patch(PC_MakePoint(20, ARRAY[a % 4, a / 4, a]::float8[])), ARRAY['zorder']) FROM generate_series(0, 15) a;
+-- Points inside POLYGON((-124.995 40,-121.995 40,-121.995 60,-124.995 60,-124.995 40))
+SELECT Sum(PC_NumPoints(PC_FilterPolygon(pa, '\x0103000000010000000500000048e17a14ae3f5fc0000000000000444048e17a14ae7f5ec0000000000000444048e17a14ae7f5ec00000000000004e4048e17a14ae3f5fc00000000000004e4048e17a14ae3f5fc00000000000004440'::bytea))) FROM pa_test_dim;
+-- The same with a hole from -123.995 to -122.995
+SELECT Sum(PC_NumPoints(PC_FilterPolygon(pa, '\x0103000000020000000500000048e17a14ae3f5fc0000000000000444048e17a14ae7f5ec0000000000000444048e17a14ae7f5ec00000000000004e4048e17a14ae3f5fc00000000000004e4048e17a14ae3f5fc000000000000044400500000048e17a14aeff5ec0000000000000444048e17a14aebf5ec0000000000000444048e17a14aebf5ec00000000000004e4048e17a14aeff5ec00000000000004e4048e17a14aeff5ec00000000000004440'::bytea))) FROM pa_test_dim;
+-- Points on the edges and vertices of POLYGON((1 1,2 1,2 2,1 2,1 1)) are in
+SELECT PC_NumPoints(PC_FilterPolygon(PC_Patch(PC_MakePoint(20, ARRAY[a % 4, a / 4, a]::float8[])), '\x01030000000100000005000000000000000000f03f000000000000f03f0000000000000040000000000000f03f00000000000000400000000000000040000000000000f03f0000000000000040000000000000f03f000000000000f03f'::bytea)) FROM generate_series(0, 15) a;
+-- And those of POLYGON((0 0,3 0,3 3,0 3,0 0)), with two on each edge
+SELECT PC_NumPoints(PC_FilterPolygon(PC_Patch(PC_MakePoint(20, ARRAY[a % 4, a / 4, a]::float8[])), '\x010300000001000000050000000000000000000000000000000000000000000000000008400000000000000000000000000000084000000000000008400000000000000000000000000000084000000000000000000000000000000000'::bytea)) FROM generate_series(0, 15) a;
+-- Points with 550 < z < 580, then the two points at either end
+SELECT Sum(PC_NumPoints(PC_Filter(pa, 'z > 550 AND NOT intensity > 57'))) FROM pa_test_dim;
+SELECT Sum(PC_NumPoints(PC_Filter(pa, 'Z < 3 OR (z > 1598)'))) FROM pa_test_dim;
+-- Malformed expressions
+SELECT PC_Filter(pa, 'z >= 5') FROM pa_test_dim;
+SELECT PC_Filter(pa, 'foo > 1') FROM pa_test_dim;
+-- Min, max and point-weighted average of the patch stats
+SELECT PC_Get(s[1], 'x') xmin, PC_Get(s[1], 'z') zmin, PC_Get(s[2], 'z') zmax, PC_Get(s[3], 'z') zavg, PC_Get(s[3], 'intensity') iavg
+FROM (SELECT PC_StatsAgg(pa) s FROM pa_test_dim) t;
+-- Values of one dimension, read from a dimensional patch
+SELECT PC_Get(pa, 'intensity') FROM pa_test_dim WHERE PC_NumPoints(pa) = 1;
+-- Max z of each patch, in a single cell of 100
+SELECT PC_Grid(pa, 100, 'z', 'max') FROM pa_test_dim ORDER BY 1;
+SELECT PC_GridAgg(pa, 100, 'z', 'avg') FROM pa_test_dim;
+SELECT array_dims(g), (SELECT sum(c) FROM unnest(g) c) FROM (SELECT PC_GridAgg(pa, 4, 'z', 'count') g FROM pa_test_dim) t;
+SELECT length(PC_GridRasterAgg(pa, 4, 'z', 'avg')) FROM pa_test_dim;
+SELECT PC_Grid(pa, 100, 'z', 'median') FROM pa_test_dim LIMIT 1;
+-- Nearest points across patches, in 3D as the point has a Z
+SELECT PC_AsText(PC_KNN(array_agg(pa), PC_MakePoint(3, ARRAY[-123, 49, 400.4, 0]), 3)) FROM pa_test_dim;
+SELECT Sum(PC_NumPoints(PC_KNN(pa, -123, 49, 5))) FROM pa_test_dim;
+SELECT PC_AsText(PC_KNN(pa, -123, 49, 0, 1)) FROM pa_test_dim ORDER BY pa <-> point(-123, 49) LIMIT 1;
+SELECT PC_NumPoints(pa), round((pa <-> point(-121, 51))::numeric, 4) FROM pa_test_dim ORDER BY pa <-> point(-121, 51) LIMIT 3;
+SELECT PC_KNN(pa, -123, 49, 0) FROM pa_test_dim LIMIT 1;
+-- Decimation, by stride unless told otherwise
+SELECT Sum(PC_NumPoints(PC_Decimate(pa, 10))) FROM pa_test_dim;
+SELECT Sum(PC_NumPoints(PC_Decimate(pa, 0.1, 'random'))) FROM pa_test_dim;
+SELECT Sum(PC_NumPoints(PC_Decimate(pa, 10, 'grid'))) FROM pa_test_dim;
+SELECT DISTINCT PC_Compression(PC_Decimate(pa, 10, 'random')) FROM pa_test_dim WHERE PC_NumPoints(pa) > 1;
+SELECT PC_AsText(PC_Decimate(PC_Sort(pa, ARRAY['z']), 4)) FROM pa_test_dim ORDER BY PC_PatchMin(pa, 'z') LIMIT 1;
+-- The first points of a progressive order are spread over the patch
+SELECT PC_AsText(PC_Range(PC_Sort(pa, ARRAY['progressive']), 1, 2)) FROM pa_test_dim ORDER BY PC_PatchMin(pa, 'z') LIMIT 1;
+SELECT PC_Decimate(pa, 10, 'median') FROM pa_test_dim LIMIT 1;
+-- Operation counters, left alone while tracking is off
+SET pointcloud.track_stats = on;
+SELECT PC_StatsReset();
+SELECT bool_and(PC_NumPoints(PC_FilterLessThan(pa, 'z', 0)) >= 0) FROM pa_test_dim;
+SELECT op, calls > 0 AS counted, points >= calls AS points, time_ms >= 0 AS timed
+FROM PC_Stats() WHERE op IN ('filter', 'deserialize') ORDER BY op;
+SET pointcloud.track_stats = off;
+SELECT PC_StatsReset();
+SELECT bool_and(PC_NumPoints(PC_FilterLessThan(pa, 'z', 0)) >= 0) FROM pa_test_dim;
+SELECT Sum(calls) FROM PC_Stats();
+RESET pointcloud.track_stats;
+-- Index scans on the bounds of the patches, IS NULL keys included
+INSERT INTO pa_test_dim (pa) VALUES (NULL);
+CREATE INDEX pa_test_dim_gist ON pa_test_dim USING gist (pa);
+SET enable_seqscan = off;
+SELECT count(*) FROM pa_test_dim WHERE pa && box(point(-120, 40), point(-116, 60));
+SELECT count(*) FROM pa_test_dim WHERE pa && PC_Patch(PC_MakePoint(3, ARRAY[-121, 51, 0, 0]));
+SELECT count(*) FROM pa_test_dim WHERE pa && PC_Patch(PC_MakePoint(1, ARRAY[-121, 51, 0, 0]));
+SELECT count(*) FROM pa_test_dim WHERE pa IS NULL;
+SELECT count(*) FROM pa_test_dim WHERE pa IS NOT NULL;
+SELECT PC_NumPoints(pa), round((pa <-> point(-121, 51))::numeric, 4) FROM pa_test_dim ORDER BY pa <-> point(-121, 51) LIMIT 3;
+SELECT PC_NumPoints(pa) FROM pa_test_dim ORDER BY pa <-> PC_MakePoint(3, ARRAY[-121, 51, 0, 0]) LIMIT 1;
+SELECT PC_NumPoints(pa) FROM pa_test_dim ORDER BY pa <-> PC_MakePoint(1, ARRAY[-121, 51, 0, 0]) LIMIT 1;
+DROP INDEX pa_test_dim_gist;
+CREATE INDEX pa_test_dim_brin ON pa_test_dim USING brin (pa);
+SELECT count(*) FROM pa_test_dim WHERE pa && box(point(-120, 40), point(-116, 60));
+SELECT count(*) FROM pa_test_dim WHERE pa && PC_Patch(PC_MakePoint(3, ARRAY[-121, 51, 0, 0]));
+SELECT count(*) FROM pa_test_dim WHERE pa && PC_Patch(PC_MakePoint(1, ARRAY[-121, 51, 0, 0]));
+SELECT count(*) FROM pa_test_dim WHERE pa IS NULL;
+SELECT count(*) FROM pa_test_dim WHERE pa IS NOT NULL;
+RESET enable_seqscan;
+-- Aggregates built in parallel workers, serialized and combined
+DO $$
+BEGIN
+	IF current_setting('server_version_num')::integer >= 100000 THEN
+		PERFORM set_config('parallel_setup_cost', '0', false);
+		PERFORM set_config('parallel_tuple_cost', '0', false);
+		PERFORM set_config('min_parallel_table_scan_size', '0', false);
+		PERFORM set_config('max_parallel_workers_per_gather', '2', false);
+		PERFORM set_config(CASE WHEN current_setting('server_version_num')::integer >= 160000
+			THEN 'debug_parallel_query' ELSE 'force_parallel_mode' END, 'on', false);
+	END IF;
+END
+$$;
+SELECT PC_NumPoints(u) npoints, PC_PatchMin(u, 'z') zmin, PC_PatchMax(u, 'z') zmax
+FROM (SELECT PC_Union(pa) u FROM pa_test_dim WHERE pa IS NOT NULL) t;
+SELECT array_length(a, 1) npatches, (SELECT sum(PC_NumPoints(p)) FROM unnest(a) p) npoints
+FROM (SELECT PC_Patch_Agg(pa) a FROM pa_test_dim WHERE pa IS NOT NULL) t;
+SELECT PC_Get(s[1], 'x') xmin, PC_Get(s[1], 'z') zmin, PC_Get(s[2], 'z') zmax, PC_Get(s[3], 'z') zavg, PC_Get(s[3], 'intensity') iavg
+FROM (SELECT PC_StatsAgg(pa) s FROM pa_test_dim) t;
+SELECT PC_NumPoints(PC_Patch(pt)) FROM (SELECT PC_Explode(pa) pt FROM pa_test_dim) t;
+DO $$
+DECLARE
+	guc text;
+BEGIN
+	IF current_setting('server_version_num')::integer >= 100000 THEN
+		FOREACH guc IN ARRAY ARRAY['parallel_setup_cost', 'parallel_tuple_cost',
+			'min_parallel_table_scan_size', 'max_parallel_workers_per_gather',
+			CASE WHEN current_setting('server_version_num')::integer >= 160000
+			THEN 'debug_parallel_query' ELSE 'force_parallel_mode' END]
+		LOOP
+			EXECUTE 'RESET ' || guc;
+		END LOOP;
+	END IF;
+END
+$$;
+
 
 --DROP TABLE pts_collection;
 DROP TABLE pt_test;
@@ -376,6 +524,8 @@ FROM p1, ( values
   ('dimensional','rle'),
   ('dimensional','zlib'),
   ('dimensional','sigbits'),
+  ('dimensional','delta'),
+  ('dimensional','delta2'),
   ('dimensional','auto'),
   ('laz','null')
   -- ,('ght',null) -- fails due to https://github.com/pgpointcloud/pointcloud/issues/35
@@ -396,6 +546,11 @@ FROM ( SELECT
     'y',0) p
 ) foo;
 
+-- Z is stored with zstd when the build has Zstandard, and the schema
+-- setting is ignored otherwise, so both builds read the same values
+SELECT PC_AsText(PC_Patch(PC_MakePoint(21, ARRAY[a, -a, a * 1000]::float8[]))) FROM generate_series(1, 3) a;
+SELECT PC_Get(PC_FilterGreaterThan(PC_Patch(PC_MakePoint(21, ARRAY[a, -a, a * 1000]::float8[])), 'z', 1500), 'z') FROM generate_series(1, 3) a;
+
 -- https://github.com/pgpointcloud/pointcloud/issues/78
 SELECT '#78' issue,
   PC_PatchMin(p,'x') x_min, PC_PatchMax(p,'x') x_max,
@@ -7,6 +7,8 @@ createdb $DB
 psql -d $DB -f pointcloud.sql > /dev/null 2>&1
 psql -d $DB -f pointcloud-laz.sql > /dev/null 2>&1
 psql -d $DB -f pointcloud-dim.sql > /dev/null 2>&1
+psql -d $DB -f pointcloud-dim-scattered.sql > /dev/null 2>&1
+psql -d $DB -f pointcloud-dim-hilbert.sql > /dev/null 2>&1
 psql -d $DB -f getsize.sql
 
 dropdb $DB
@@ -0,0 +1,68 @@
+create EXTENSION if not exists pointcloud;
+
+INSERT INTO pointcloud_formats (pcid, srid, schema)
+VALUES (5, 0,
+'<?xml version="1.0" encoding="UTF-8"?>
+<pc:PointCloudSchema xmlns:pc="http://pointcloud.org/schemas/PC/1.1" xmlns:xsi="http://www.w3.org/2001/XMLSchema-instance">
+  <pc:dimension>
+    <pc:position>1</pc:position>
+    <pc:size>4</pc:size>
+    <pc:description>X coordinate as a long integer. You must use the scale and offset information of the header to determine the double value.</pc:description>
+    <pc:name>X</pc:name>
+    <pc:interpretation>int32_t</pc:interpretation>
+    <pc:scale>0.01</pc:scale>
+  </pc:dimension>
+  <pc:dimension>
+    <pc:position>2</pc:position>
+    <pc:size>4</pc:size>
+    <pc:description>Y coordinate as a long integer. You must use the scale and offset information of the header to determine the double value.</pc:description>
+    <pc:name>Y</pc:name>
+    <pc:interpretation>int32_t</pc:interpretation>
+    <pc:scale>0.01</pc:scale>
+  </pc:dimension>
+  <pc:dimension>
+    <pc:position>3</pc:position>
+    <pc:size>4</pc:size>
+    <pc:description>Z coordinate as a long integer. You must use the scale and offset information of the header to determine the double value.</pc:description>
+    <pc:name>Z</pc:name>
+    <pc:interpretation>int32_t</pc:interpretation>
+    <pc:scale>0.01</pc:scale>
+  </pc:dimension>
+  <pc:dimension>
+    <pc:position>4</pc:position>
+    <pc:size>2</pc:size>
+    <pc:description>The intensity value is the integer representation of the pulse return magnitude. This value is optional and system specific. However, it should always be included if available.</pc:description>
+    <pc:name>Intensity</pc:name>
+    <pc:interpretation>uint16_t</pc:interpretation>
+    <pc:scale>1</pc:scale>
+  </pc:dimension>
+  <pc:metadata>
+    <Metadata name="compression">dimensional</Metadata>
+    <Metadata name="spatialsort">hilbert</Metadata>
+  </pc:metadata>
+</pc:PointCloudSchema>'
+);
+
+
+CREATE TABLE IF NOT EXISTS pa_compression_dimensional_hilbert (
+    pa PCPATCH(5)
+);
+\d pa_compression_dimensional_hilbert
+
+-- patches of 20x20 points visited in scattered order
+INSERT INTO pa_compression_dimensional_hilbert (pa)
+SELECT PC_Patch(PC_MakePoint(5, ARRAY[x,y,z,intensity]))
+FROM (
+ SELECT
+ -127+(gid%50)/5.0+(b%20)/100.0 AS x,
+   45+(gid/50)/5.0+(b/20)/100.0 AS y,
+        1.0*(b%20+b/20) AS z,
+         b/40 AS intensity,
+         gid
+  FROM (
+   SELECT a/400 AS gid, ((a%400)*7919)%400 AS b
+   FROM generate_series(1,100000) AS a
+  ) AS grid
+) AS values GROUP BY gid;
+
+TRUNCATE pointcloud_formats;
@@ -10,5 +10,6 @@ local $sql = <STDIN>;
 $sql =~ s/\nCREATE TYPE[^;]*;//gs;
 $sql =~ s/\nCREATE AGGREGATE[^;]*;//gs;
 $sql =~ s/\nCREATE CAST[^;]*;//gs;
+$sql =~ s/\nCREATE OPERATOR[^;]*;//gs;
 
 print $sql;